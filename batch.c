@@ -0,0 +1,190 @@
+/* Sprite batching.
+ * Sprites are sorted by layer, blend mode and texture with a radix sort,
+ * then written out as quads in sorted order so each run of the same blend
+ * mode and texture is one indexed draw. Nothing here touches the GPU, the
+ * vertices go wherever the caller points, e.g. a mapped buffer, and can be
+ * written in pieces on several threads.
+ */
+
+#include <stdlib.h>
+
+#include "batch.h"
+#include "util.h"
+
+/* Macros */
+#define RADIXBITS 8
+#define RADIXSIZE (1 << RADIXBITS)
+#define RADIXPASSES (32 / RADIXBITS)
+/* Sort key: layer, then blend mode, then texture */
+#define KEY(s) ((uint32_t) (s)->layer << 24 | \
+	(uint32_t) ((s)->blend & 1) << 23 | ((s)->texture & 0x7fffff))
+
+/* Function declarations */
+static void writevertex(SpriteVertex *v, float x, float y, float u,
+	float tv, uint32_t colour);
+
+/* Function implementations */
+
+void
+batch_initialise(SpriteList *l, uint32_t capacity)
+{
+    l->sprites = (Sprite *) malloc(capacity * sizeof(Sprite));
+    l->keys = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+    l->order = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+    /* Keys and order for the passes to ping-pong with */
+    l->scratch = (uint32_t *) malloc(2 * capacity * sizeof(uint32_t));
+    l->batches = (SpriteBatch *) malloc(capacity * sizeof(SpriteBatch));
+    if (l->sprites == NULL || l->keys == NULL || l->order == NULL ||
+	    l->scratch == NULL || l->batches == NULL)
+	terminate("Failed to allocate sprite list.");
+
+    l->sorted = l->order;
+    l->count = 0;
+    l->built = 0;
+    l->capacity = capacity;
+    l->dropped = 0;
+}
+
+void
+batch_terminate(SpriteList *l)
+{
+    free(l->sprites);
+    free(l->keys);
+    free(l->order);
+    free(l->scratch);
+    free(l->batches);
+}
+
+/* Never blocks or grows, sprites past the capacity are dropped */
+void
+batch_add(SpriteList *l, const Sprite *s)
+{
+    if (l->count == l->capacity) {
+	l->dropped++;
+	return;
+    }
+
+    l->sprites[l->count++] = *s;
+}
+
+/* Least significant digit first, stable so equal keys keep the order they
+ * were added in. The histograms for every pass come from one read of the
+ * keys, and a pass is skipped when every key has the same digit, as the
+ * layer and blend bits usually do. Returns whichever buffer holds the
+ * sorted order. */
+uint32_t *
+batch_sort(uint32_t *keys, uint32_t *order, uint32_t *scratch,
+	uint32_t count)
+{
+    uint32_t counts[RADIXPASSES][RADIXSIZE] = {{ 0 }};
+    uint32_t *tmpkeys = scratch, *tmporder = scratch + count, *t;
+    uint32_t i, p, shift, digit, sum, n;
+
+    if (count == 0)
+	return order;
+
+    for (i = 0; i < count; i++)
+	for (p = 0; p < RADIXPASSES; p++)
+	    counts[p][(keys[i] >> (p * RADIXBITS)) & (RADIXSIZE - 1)]++;
+
+    for (p = 0; p < RADIXPASSES; p++) {
+	shift = p * RADIXBITS;
+	if (counts[p][(keys[0] >> shift) & (RADIXSIZE - 1)] == count)
+	    continue;
+
+	/* Counts become each digit's first output index */
+	for (sum = 0, digit = 0; digit < RADIXSIZE; digit++) {
+	    n = counts[p][digit];
+	    counts[p][digit] = sum;
+	    sum += n;
+	}
+	for (i = 0; i < count; i++) {
+	    digit = (keys[i] >> shift) & (RADIXSIZE - 1);
+	    n = counts[p][digit]++;
+	    tmpkeys[n] = keys[i];
+	    tmporder[n] = order[i];
+	}
+
+	t = keys;
+	keys = tmpkeys;
+	tmpkeys = t;
+	t = order;
+	order = tmporder;
+	tmporder = t;
+    }
+
+    return order;
+}
+
+/* Every field, gaps would break up write combining */
+void
+writevertex(SpriteVertex *v, float x, float y, float u, float tv,
+	uint32_t colour)
+{
+    v->x = x;
+    v->y = y;
+    v->u = u;
+    v->v = tv;
+    v->colour = colour;
+    v->pad = 0;
+}
+
+/* Sorts and batches the sprites and empties the list. The sprites stay put
+ * for batch_write until the next one is added. Returns the number of
+ * batches. */
+uint32_t
+batch_build(SpriteList *l)
+{
+    const Sprite *s;
+    SpriteBatch *b = NULL;
+    uint32_t i, batchcount = 0;
+
+    for (i = 0; i < l->count; i++) {
+	l->keys[i] = KEY(&l->sprites[i]);
+	l->order[i] = i;
+    }
+    l->sorted = batch_sort(l->keys, l->order, l->scratch, l->count);
+
+    for (i = 0; i < l->count; i++) {
+	s = &l->sprites[l->sorted[i]];
+	if (b == NULL || s->blend != b->blend || s->texture != b->texture) {
+	    b = &l->batches[batchcount++];
+	    b->blend = s->blend;
+	    b->texture = s->texture;
+	    b->first = i;
+	    b->count = 0;
+	}
+	b->count++;
+    }
+
+    l->built = l->count;
+    l->count = 0;
+
+    return batchcount;
+}
+
+/* Writes four vertices a sprite for the built sprites from begin up to end
+ * in sorted order. Separate ranges can be written at the same time. */
+void
+batch_write(const SpriteList *l, SpriteVertex *vertices, uint32_t begin,
+	uint32_t end)
+{
+    const Sprite *s;
+    SpriteVertex *v;
+    uint32_t i;
+    float x0, y0, x1, y1;
+
+    for (i = begin; i < end; i++) {
+	s = &l->sprites[l->sorted[i]];
+	/* Written in order, the buffer may be write-combined */
+	x0 = s->x - 0.5f * s->width;
+	x1 = s->x + 0.5f * s->width;
+	y0 = s->y - 0.5f * s->height;
+	y1 = s->y + 0.5f * s->height;
+	v = vertices + 4 * (size_t) i;
+	writevertex(&v[0], x0, y0, s->u0, s->v0, s->colour);
+	writevertex(&v[1], x1, y0, s->u1, s->v0, s->colour);
+	writevertex(&v[2], x1, y1, s->u1, s->v1, s->colour);
+	writevertex(&v[3], x0, y1, s->u0, s->v1, s->colour);
+    }
+}
@@ -0,0 +1,58 @@
+#include <stdint.h>
+
+/* Blend modes, each has its own pipeline */
+enum { SPRITE_OPAQUE, SPRITE_ALPHA, SPRITE_BLENDCOUNT };
+
+/* Sprites in the same layer may be reordered to batch them, lower layers
+ * draw first */
+typedef struct {
+    float x, y;
+    float width, height;
+    float u0, v0, u1, v1;
+    /* RGBA, red in the low byte */
+    uint32_t colour;
+    /* Bindless handle */
+    uint32_t texture;
+    uint8_t layer;
+    uint8_t blend;
+} Sprite;
+
+/* Must match the Vertex struct in sprite.glsl */
+typedef struct {
+    float x, y;
+    float u, v;
+    uint32_t colour;
+    uint32_t pad;
+} SpriteVertex;
+
+/* A run of quads drawn with one indexed draw */
+typedef struct {
+    uint32_t blend;
+    uint32_t texture;
+    uint32_t first;
+    uint32_t count;
+} SpriteBatch;
+
+typedef struct {
+    Sprite *sprites;
+    uint32_t count;
+    uint32_t capacity;
+    /* Sprites that didn't fit, never reset */
+    uint32_t dropped;
+    /* Sprites in the last build, in sorted order */
+    uint32_t built;
+    const uint32_t *sorted;
+    uint32_t *keys;
+    uint32_t *order;
+    uint32_t *scratch;
+    SpriteBatch *batches;
+} SpriteList;
+
+void batch_initialise(SpriteList *l, uint32_t capacity);
+void batch_terminate(SpriteList *l);
+void batch_add(SpriteList *l, const Sprite *s);
+uint32_t *batch_sort(uint32_t *keys, uint32_t *order, uint32_t *scratch,
+	uint32_t count);
+uint32_t batch_build(SpriteList *l);
+void batch_write(const SpriteList *l, SpriteVertex *vertices, uint32_t begin,
+	uint32_t end);
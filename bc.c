@@ -0,0 +1,799 @@
+/* Block compression.
+ * Encodes RGBA8 images to BC1, BC3 and BC7 (mode 6 only) at load time. The
+ * scalar path searches the whole palette for each pixel and is the quality
+ * reference, the SSE2 and AVX2 paths project pixels onto the endpoint axis.
+ * Block rows are shared out between worker threads, a mip chain's levels
+ * are compressed together so the threads are only started once.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86
+#endif
+
+#include "bc.h"
+#include "util.h"
+
+/* Macros */
+#define BLOCKPIXELS 16
+#define TARGET(x) __attribute__((target(x)))
+
+/* Types */
+
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t pos;
+} Bits;
+
+typedef void (*BoundsFn)(const unsigned char *px, unsigned char *mn,
+	unsigned char *mx);
+typedef void (*ProjectFn)(const unsigned char *px, const int *e0,
+	const int *d, float scale, int maxt, unsigned char *t);
+
+typedef struct {
+    const BcImage *images;
+    uint32_t count;
+    /* Block rows of all the images, in order */
+    uint32_t blockstall;
+    BcFormat format;
+    BcPath path;
+    BoundsFn bounds;
+    ProjectFn project;
+    volatile LONG nextrow;
+} Job;
+
+/* Function declarations */
+static void putbits(Bits *b, uint32_t value, uint32_t count);
+static uint32_t getbits(Bits *b, uint32_t count);
+static void writebits(unsigned char *out, const Bits *b);
+static void readbits(Bits *b, const unsigned char *in);
+static uint32_t pack565(const unsigned char *rgb);
+static void unpack565(uint32_t c, int *rgb);
+static void boundsscalar(const unsigned char *px, unsigned char *mn,
+	unsigned char *mx);
+static void nearest(const unsigned char *px, int (*pal)[4], uint32_t n,
+	const int *mask, unsigned char *idx);
+static void project(const Job *job, const unsigned char *px, const int *e0,
+	const int *e1, const int *mask, uint32_t levels, unsigned char *t);
+#ifdef X86
+static void boundssse2(const unsigned char *px, unsigned char *mn,
+	unsigned char *mx);
+static void projectsse2(const unsigned char *px, const int *e0,
+	const int *d, float scale, int maxt, unsigned char *t);
+static void boundsavx2(const unsigned char *px, unsigned char *mn,
+	unsigned char *mx);
+static void projectavx2(const unsigned char *px, const int *e0,
+	const int *d, float scale, int maxt, unsigned char *t);
+#endif /* X86 */
+static void encodecolour(const Job *job, unsigned char *out,
+	const unsigned char *px, const unsigned char *mn,
+	const unsigned char *mx);
+static void encodealpha(const Job *job, unsigned char *out,
+	const unsigned char *px, const unsigned char *mn,
+	const unsigned char *mx);
+static uint32_t quantisebc7(const unsigned char *v, int *q, int *e);
+static void encodebc7(const Job *job, unsigned char *out,
+	const unsigned char *px, const unsigned char *mn,
+	const unsigned char *mx);
+static void encoderow(Job *job, uint32_t row);
+static DWORD WINAPI worker(LPVOID param);
+static void decodecolour(unsigned char *px, const unsigned char *in,
+	uint32_t fourcolour);
+static void decodealpha(unsigned char *px, const unsigned char *in);
+static void decodebc7(unsigned char *px, const unsigned char *in);
+
+/* Variables */
+static const uint32_t blockbytes[] = { 8, 16, 16 };
+/* BC7 4 bit index weights out of 64 */
+static const int weights4[] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+/* Function implementations */
+
+void
+putbits(Bits *b, uint32_t value, uint32_t count)
+{
+    if (b->pos < 64) {
+	b->lo |= (uint64_t) value << b->pos;
+	if (b->pos + count > 64)
+	    b->hi |= (uint64_t) value >> (64 - b->pos);
+    } else {
+	b->hi |= (uint64_t) value << (b->pos - 64);
+    }
+    b->pos += count;
+}
+
+uint32_t
+getbits(Bits *b, uint32_t count)
+{
+    uint64_t v;
+
+    if (b->pos >= 64)
+	v = b->hi >> (b->pos - 64);
+    else if (b->pos + count > 64)
+	v = b->lo >> b->pos | b->hi << (64 - b->pos);
+    else
+	v = b->lo >> b->pos;
+    b->pos += count;
+
+    return (uint32_t) (v & ((1u << count) - 1));
+}
+
+void
+writebits(unsigned char *out, const Bits *b)
+{
+    uint32_t i;
+
+    /* Blocks are little endian */
+    for (i = 0; i < 8; i++) {
+	out[i]     = (unsigned char) (b->lo >> (8 * i));
+	out[i + 8] = (unsigned char) (b->hi >> (8 * i));
+    }
+}
+
+void
+readbits(Bits *b, const unsigned char *in)
+{
+    uint32_t i;
+
+    b->lo = b->hi = 0;
+    b->pos = 0;
+    for (i = 0; i < 8; i++) {
+	b->lo |= (uint64_t) in[i]     << (8 * i);
+	b->hi |= (uint64_t) in[i + 8] << (8 * i);
+    }
+}
+
+uint32_t
+pack565(const unsigned char *rgb)
+{
+    return (uint32_t) ((rgb[0] * 31 + 127) / 255) << 11 |
+	(uint32_t) ((rgb[1] * 63 + 127) / 255) << 5 |
+	(uint32_t) ((rgb[2] * 31 + 127) / 255);
+}
+
+void
+unpack565(uint32_t c, int *rgb)
+{
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+
+    /* Replicate the high bits into the low ones, as the GPU does */
+    rgb[0] = r << 3 | r >> 2;
+    rgb[1] = g << 2 | g >> 4;
+    rgb[2] = b << 3 | b >> 2;
+    rgb[3] = 255;
+}
+
+void
+boundsscalar(const unsigned char *px, unsigned char *mn, unsigned char *mx)
+{
+    uint32_t i, c;
+
+    memcpy(mn, px, 4);
+    memcpy(mx, px, 4);
+    for (i = 1; i < BLOCKPIXELS; i++)
+	for (c = 0; c < 4; c++) {
+	    if (px[4 * i + c] < mn[c])
+		mn[c] = px[4 * i + c];
+	    if (px[4 * i + c] > mx[c])
+		mx[c] = px[4 * i + c];
+	}
+}
+
+void
+nearest(const unsigned char *px, int (*pal)[4], uint32_t n, const int *mask,
+	unsigned char *idx)
+{
+    uint32_t i, k, c;
+    int best, d, e;
+
+    for (i = 0; i < BLOCKPIXELS; i++) {
+	best = INT_MAX;
+	for (k = 0; k < n; k++) {
+	    d = 0;
+	    for (c = 0; c < 4; c++) {
+		e = (px[4 * i + c] - pal[k][c]) * mask[c];
+		d += e * e;
+	    }
+	    if (d < best) {
+		best = d;
+		idx[i] = (unsigned char) k;
+	    }
+	}
+    }
+}
+
+void
+project(const Job *job, const unsigned char *px, const int *e0,
+	const int *e1, const int *mask, uint32_t levels, unsigned char *t)
+{
+    int d[4], len2 = 0, c;
+
+    for (c = 0; c < 4; c++) {
+	d[c] = (e1[c] - e0[c]) * mask[c];
+	len2 += d[c] * d[c];
+    }
+
+    /* Position along the axis from e0 to e1, in palette steps */
+    if (len2 == 0)
+	memset(t, 0, BLOCKPIXELS);
+    else
+	job->project(px, e0, d, (float) (levels - 1) / (float) len2,
+		(int) levels - 1, t);
+}
+
+#ifdef X86
+
+TARGET("sse2") void
+boundssse2(const unsigned char *px, unsigned char *mn, unsigned char *mx)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *) px);
+    __m128i b = _mm_loadu_si128((const __m128i *) (px + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *) (px + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *) (px + 48));
+    __m128i lo = _mm_min_epu8(_mm_min_epu8(a, b), _mm_min_epu8(c, d));
+    __m128i hi = _mm_max_epu8(_mm_max_epu8(a, b), _mm_max_epu8(c, d));
+    int v;
+
+    /* Fold the four pixels down to one */
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+
+    v = _mm_cvtsi128_si32(lo);
+    memcpy(mn, &v, 4);
+    v = _mm_cvtsi128_si32(hi);
+    memcpy(mx, &v, 4);
+}
+
+TARGET("sse2") void
+projectsse2(const unsigned char *px, const int *e0, const int *d,
+	float scale, int maxt, unsigned char *t)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i base = _mm_set_epi16(e0[3], e0[2], e0[1], e0[0],
+	    e0[3], e0[2], e0[1], e0[0]);
+    __m128i axis = _mm_set_epi16(d[3], d[2], d[1], d[0],
+	    d[3], d[2], d[1], d[0]);
+    __m128 vscale = _mm_set1_ps(scale);
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 vmax = _mm_set1_ps((float) maxt);
+    __m128i p, lo, hi, dot;
+    __m128 even, odd, f;
+    int out[4];
+    uint32_t i, j;
+
+    for (i = 0; i < BLOCKPIXELS; i += 4) {
+	/* Two pixels per register as 16 bit, madd gives pairs of partial
+	 * dot products */
+	p = _mm_loadu_si128((const __m128i *) (px + 4 * i));
+	lo = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(p, zero), base),
+		axis);
+	hi = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(p, zero), base),
+		axis);
+	even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+		_MM_SHUFFLE(2, 0, 2, 0));
+	odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi),
+		_MM_SHUFFLE(3, 1, 3, 1));
+	dot = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+
+	f = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(dot), vscale), half);
+	f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), vmax);
+	_mm_storeu_si128((__m128i *) out, _mm_cvttps_epi32(f));
+
+	for (j = 0; j < 4; j++)
+	    t[i + j] = (unsigned char) out[j];
+    }
+}
+
+TARGET("avx2") void
+boundsavx2(const unsigned char *px, unsigned char *mn, unsigned char *mx)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *) px);
+    __m256i b = _mm256_loadu_si256((const __m256i *) (px + 32));
+    __m256i lo256 = _mm256_min_epu8(a, b);
+    __m256i hi256 = _mm256_max_epu8(a, b);
+    __m128i lo = _mm_min_epu8(_mm256_castsi256_si128(lo256),
+	    _mm256_extracti128_si256(lo256, 1));
+    __m128i hi = _mm_max_epu8(_mm256_castsi256_si128(hi256),
+	    _mm256_extracti128_si256(hi256, 1));
+    int v;
+
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+    lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+    hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+
+    v = _mm_cvtsi128_si32(lo);
+    memcpy(mn, &v, 4);
+    v = _mm_cvtsi128_si32(hi);
+    memcpy(mx, &v, 4);
+}
+
+TARGET("avx2") void
+projectavx2(const unsigned char *px, const int *e0, const int *d,
+	float scale, int maxt, unsigned char *t)
+{
+    __m256i base = _mm256_set_epi16(e0[3], e0[2], e0[1], e0[0],
+	    e0[3], e0[2], e0[1], e0[0], e0[3], e0[2], e0[1], e0[0],
+	    e0[3], e0[2], e0[1], e0[0]);
+    __m256i axis = _mm256_set_epi16(d[3], d[2], d[1], d[0],
+	    d[3], d[2], d[1], d[0], d[3], d[2], d[1], d[0],
+	    d[3], d[2], d[1], d[0]);
+    __m256 vscale = _mm256_set1_ps(scale);
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 vmax = _mm256_set1_ps((float) maxt);
+    __m256i lo, hi, dot;
+    __m256 even, odd, f;
+    int out[8];
+    uint32_t i, j;
+
+    for (i = 0; i < BLOCKPIXELS; i += 8) {
+	/* Four pixels per register as 16 bit */
+	lo = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *) (px + 4 * i))),
+		    base), axis);
+	hi = _mm256_madd_epi16(_mm256_sub_epi16(_mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *) (px + 4 * i + 16))),
+		    base), axis);
+	even = _mm256_shuffle_ps(_mm256_castsi256_ps(lo),
+		_mm256_castsi256_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+	odd = _mm256_shuffle_ps(_mm256_castsi256_ps(lo),
+		_mm256_castsi256_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+	/* Shuffles stay within 128 bit lanes, put the pixels back in order */
+	dot = _mm256_permute4x64_epi64(_mm256_add_epi32(
+		    _mm256_castps_si256(even), _mm256_castps_si256(odd)),
+		_MM_SHUFFLE(3, 1, 2, 0));
+
+	f = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(dot), vscale),
+		half);
+	f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), vmax);
+	_mm256_storeu_si256((__m256i *) out, _mm256_cvttps_epi32(f));
+
+	for (j = 0; j < 8; j++)
+	    t[i + j] = (unsigned char) out[j];
+    }
+}
+
+#endif /* X86 */
+
+void
+encodecolour(const Job *job, unsigned char *out, const unsigned char *px,
+	const unsigned char *mn, const unsigned char *mx)
+{
+    /* Palette entry for each step along the axis */
+    static const unsigned char order[] = { 0, 2, 3, 1 };
+    static const int rgb[] = { 1, 1, 1, 0 };
+    unsigned char lo[4], hi[4], t[BLOCKPIXELS];
+    int e0[4], e1[4], pal[4][4], inset, c;
+    uint32_t c0, c1, tmp, indices = 0, i;
+
+    /* Pull the endpoints in a little to reduce the error of the interior */
+    for (c = 0; c < 4; c++) {
+	inset = (mx[c] - mn[c]) >> 4;
+	hi[c] = (unsigned char) (mx[c] - inset);
+	lo[c] = (unsigned char) (mn[c] + inset);
+    }
+    c0 = pack565(hi);
+    c1 = pack565(lo);
+
+    /* c0 > c1 selects four colour mode */
+    if (c0 < c1) {
+	tmp = c0;
+	c0 = c1;
+	c1 = tmp;
+    }
+    unpack565(c0, e0);
+    unpack565(c1, e1);
+
+    if (c0 != c1) {
+	for (c = 0; c < 4; c++) {
+	    pal[0][c] = e0[c];
+	    pal[1][c] = e1[c];
+	    pal[2][c] = (2 * e0[c] + e1[c]) / 3;
+	    pal[3][c] = (e0[c] + 2 * e1[c]) / 3;
+	}
+
+	if (job->path == BC_SCALAR) {
+	    nearest(px, pal, 4, rgb, t);
+	} else {
+	    project(job, px, e0, e1, rgb, 4, t);
+	    for (i = 0; i < BLOCKPIXELS; i++)
+		t[i] = order[t[i]];
+	}
+
+	for (i = 0; i < BLOCKPIXELS; i++)
+	    indices |= (uint32_t) t[i] << (2 * i);
+    }
+
+    out[0] = (unsigned char) c0;
+    out[1] = (unsigned char) (c0 >> 8);
+    out[2] = (unsigned char) c1;
+    out[3] = (unsigned char) (c1 >> 8);
+    for (i = 0; i < 4; i++)
+	out[4 + i] = (unsigned char) (indices >> (8 * i));
+}
+
+void
+encodealpha(const Job *job, unsigned char *out, const unsigned char *px,
+	const unsigned char *mn, const unsigned char *mx)
+{
+    static const unsigned char order[] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+    static const int alpha[] = { 0, 0, 0, 1 };
+    unsigned char t[BLOCKPIXELS] = { 0 };
+    int e0[4] = { 0, 0, 0, mx[3] }, e1[4] = { 0, 0, 0, mn[3] };
+    int pal[8][4] = {{ 0 }};
+    uint64_t indices = 0;
+    uint32_t i;
+
+    /* a0 > a1 selects eight alpha mode */
+    if (e0[3] != e1[3]) {
+	pal[0][3] = e0[3];
+	pal[1][3] = e1[3];
+	for (i = 1; i < 7; i++)
+	    pal[i + 1][3] = ((7 - (int) i) * e0[3] + (int) i * e1[3]) / 7;
+
+	if (job->path == BC_SCALAR) {
+	    nearest(px, pal, 8, alpha, t);
+	} else {
+	    project(job, px, e0, e1, alpha, 8, t);
+	    for (i = 0; i < BLOCKPIXELS; i++)
+		t[i] = order[t[i]];
+	}
+    }
+
+    for (i = 0; i < BLOCKPIXELS; i++)
+	indices |= (uint64_t) t[i] << (3 * i);
+
+    out[0] = (unsigned char) e0[3];
+    out[1] = (unsigned char) e1[3];
+    for (i = 0; i < 6; i++)
+	out[2 + i] = (unsigned char) (indices >> (8 * i));
+}
+
+uint32_t
+quantisebc7(const unsigned char *v, int *q, int *e)
+{
+    int err[2] = { 0, 0 }, p, c, qc, d;
+    uint32_t best;
+
+    /* The p-bit is shared by all channels of an endpoint, pick the one with
+     * the least error */
+    for (p = 0; p < 2; p++)
+	for (c = 0; c < 4; c++) {
+	    qc = CLAMP((v[c] - p + 1) >> 1, 0, 127);
+	    d = (qc << 1 | p) - v[c];
+	    err[p] += d * d;
+	}
+    best = err[1] < err[0];
+
+    for (c = 0; c < 4; c++) {
+	q[c] = CLAMP((v[c] - (int) best + 1) >> 1, 0, 127);
+	e[c] = q[c] << 1 | (int) best;
+    }
+
+    return best;
+}
+
+void
+encodebc7(const Job *job, unsigned char *out, const unsigned char *px,
+	const unsigned char *mn, const unsigned char *mx)
+{
+    static const int rgba[] = { 1, 1, 1, 1 };
+    unsigned char lo[4], hi[4], t[BLOCKPIXELS];
+    int q0[4], q1[4], e0[4], e1[4], pal[16][4], inset, c, tmp;
+    uint32_t p0, p1, i;
+    Bits b = { 0, 0, 0 };
+
+    for (c = 0; c < 4; c++) {
+	inset = (mx[c] - mn[c]) >> 4;
+	hi[c] = (unsigned char) (mx[c] - inset);
+	lo[c] = (unsigned char) (mn[c] + inset);
+    }
+    p0 = quantisebc7(hi, q0, e0);
+    p1 = quantisebc7(lo, q1, e1);
+
+    for (i = 0; i < 16; i++)
+	for (c = 0; c < 4; c++)
+	    pal[i][c] = ((64 - weights4[i]) * e0[c] + weights4[i] * e1[c] +
+		    32) >> 6;
+
+    if (job->path == BC_SCALAR)
+	nearest(px, pal, 16, rgba, t);
+    else
+	project(job, px, e0, e1, rgba, 16, t);
+
+    /* The anchor index has an implied zero top bit, swap the endpoints if
+     * needed. The weights are symmetric so the palette just reverses. */
+    if (t[0] & 8) {
+	for (c = 0; c < 4; c++) {
+	    tmp = q0[c];
+	    q0[c] = q1[c];
+	    q1[c] = tmp;
+	}
+	tmp = (int) p0;
+	p0 = p1;
+	p1 = (uint32_t) tmp;
+	for (i = 0; i < BLOCKPIXELS; i++)
+	    t[i] = (unsigned char) (15 - t[i]);
+    }
+
+    /* Mode 6 is six zero bits then a one */
+    putbits(&b, 1 << 6, 7);
+    for (c = 0; c < 4; c++) {
+	putbits(&b, (uint32_t) q0[c], 7);
+	putbits(&b, (uint32_t) q1[c], 7);
+    }
+    putbits(&b, p0, 1);
+    putbits(&b, p1, 1);
+    putbits(&b, t[0], 3);
+    for (i = 1; i < BLOCKPIXELS; i++)
+	putbits(&b, t[i], 4);
+
+    writebits(out, &b);
+}
+
+void
+encoderow(Job *job, uint32_t row)
+{
+    const BcImage *im = job->images;
+    unsigned char px[4 * BLOCKPIXELS], mn[4], mx[4], *out;
+    uint32_t blockswide, bx, x, y, sx, sy;
+
+    /* Find the image the row is in */
+    for (; row >= (im->height + 3) / 4; im++)
+	row -= (im->height + 3) / 4;
+    blockswide = (im->width + 3) / 4;
+
+    for (bx = 0; bx < blockswide; bx++) {
+	/* Replicate the edge pixels into partial blocks */
+	for (y = 0; y < 4; y++)
+	    for (x = 0; x < 4; x++) {
+		sx = bx * 4 + x < im->width ? bx * 4 + x : im->width - 1;
+		sy = row * 4 + y < im->height ? row * 4 + y : im->height - 1;
+		memcpy(px + 4 * (4 * y + x),
+			im->rgba + 4 * ((size_t) sy * im->width + sx), 4);
+	    }
+
+	out = im->dst + ((size_t) row * blockswide + bx) *
+	    blockbytes[job->format];
+	job->bounds(px, mn, mx);
+
+	switch (job->format) {
+	case BC1:
+	    encodecolour(job, out, px, mn, mx);
+	    break;
+	case BC3:
+	    encodealpha(job, out, px, mn, mx);
+	    encodecolour(job, out + 8, px, mn, mx);
+	    break;
+	case BC7:
+	    encodebc7(job, out, px, mn, mx);
+	    break;
+	}
+    }
+}
+
+DWORD WINAPI
+worker(LPVOID param)
+{
+    Job *job = (Job *) param;
+    LONG row;
+
+    /* Take block rows until there are none left */
+    while ((row = InterlockedIncrement(&job->nextrow) - 1) <
+	    (LONG) job->blockstall)
+	encoderow(job, (uint32_t) row);
+
+    return 0;
+}
+
+uint32_t
+bc_supported(BcPath path)
+{
+    switch (path) {
+    case BC_AUTO:
+    case BC_SCALAR:
+	return 1;
+#ifdef X86
+    case BC_SSE2:
+	return __builtin_cpu_supports("sse2");
+    case BC_AVX2:
+	return __builtin_cpu_supports("avx2");
+#endif /* X86 */
+    default:
+	return 0;
+    }
+}
+
+size_t
+bc_size(uint32_t width, uint32_t height, BcFormat format)
+{
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) *
+	blockbytes[format];
+}
+
+/* Zero threads uses every processor */
+void
+bc_compress(const BcImage *images, uint32_t count, BcFormat format,
+	BcPath path, uint32_t threads)
+{
+    Job job;
+    HANDLE *handles;
+    SYSTEM_INFO si;
+    uint32_t i;
+
+    /* Fastest supported path, the scalar reference as a last resort */
+    if (path == BC_AUTO)
+	path = bc_supported(BC_AVX2) ? BC_AVX2 :
+	    bc_supported(BC_SSE2) ? BC_SSE2 : BC_SCALAR;
+    if (!bc_supported(path))
+	terminate("Block compression path not supported by the CPU.\n");
+
+    job.images = images;
+    job.count = count;
+    job.blockstall = 0;
+    for (i = 0; i < count; i++)
+	job.blockstall += (images[i].height + 3) / 4;
+    job.format = format;
+    job.path = path;
+    job.bounds = boundsscalar;
+    job.project = NULL;
+    job.nextrow = 0;
+#ifdef X86
+    if (path == BC_SSE2) {
+	job.bounds = boundssse2;
+	job.project = projectsse2;
+    } else if (path == BC_AVX2) {
+	job.bounds = boundsavx2;
+	job.project = projectavx2;
+    }
+#endif /* X86 */
+
+    if (threads == 0) {
+	GetSystemInfo(&si);
+	threads = si.dwNumberOfProcessors;
+    }
+    if (threads > job.blockstall)
+	threads = job.blockstall;
+    if (threads == 0)
+	return;
+
+    /* This thread is one of the workers */
+    if ((handles = (HANDLE *) malloc(threads * sizeof(HANDLE))) == NULL)
+	terminate("Failed to allocate block compression threads.\n");
+    for (i = 1; i < threads; i++)
+	if ((handles[i] = CreateThread(NULL, 0, worker, &job, 0, NULL)) ==
+		NULL)
+	    terminate("Failed to create block compression thread.\n");
+    worker(&job);
+    for (i = 1; i < threads; i++) {
+	WaitForSingleObject(handles[i], INFINITE);
+	CloseHandle(handles[i]);
+    }
+    free(handles);
+}
+
+void
+decodecolour(unsigned char *px, const unsigned char *in, uint32_t fourcolour)
+{
+    uint32_t c0 = in[0] | in[1] << 8, c1 = in[2] | in[3] << 8, indices, i;
+    int pal[4][4], c;
+
+    unpack565(c0, pal[0]);
+    unpack565(c1, pal[1]);
+    for (c = 0; c < 4; c++) {
+	if (fourcolour || c0 > c1) {
+	    pal[2][c] = (2 * pal[0][c] + pal[1][c]) / 3;
+	    pal[3][c] = (pal[0][c] + 2 * pal[1][c]) / 3;
+	} else {
+	    /* Three colours and transparent black */
+	    pal[2][c] = (pal[0][c] + pal[1][c]) / 2;
+	    pal[3][c] = 0;
+	}
+    }
+
+    indices = (uint32_t) in[4] | (uint32_t) in[5] << 8 |
+	(uint32_t) in[6] << 16 | (uint32_t) in[7] << 24;
+    for (i = 0; i < BLOCKPIXELS; i++)
+	for (c = 0; c < 4; c++)
+	    px[4 * i + c] = (unsigned char) pal[(indices >> (2 * i)) & 3][c];
+}
+
+void
+decodealpha(unsigned char *px, const unsigned char *in)
+{
+    int pal[8], i;
+    uint64_t indices = 0;
+
+    pal[0] = in[0];
+    pal[1] = in[1];
+    if (pal[0] > pal[1]) {
+	for (i = 1; i < 7; i++)
+	    pal[i + 1] = ((7 - i) * pal[0] + i * pal[1]) / 7;
+    } else {
+	/* Six alphas plus fully transparent and opaque */
+	for (i = 1; i < 5; i++)
+	    pal[i + 1] = ((5 - i) * pal[0] + i * pal[1]) / 5;
+	pal[6] = 0;
+	pal[7] = 255;
+    }
+
+    for (i = 0; i < 6; i++)
+	indices |= (uint64_t) in[2 + i] << (8 * i);
+    for (i = 0; i < BLOCKPIXELS; i++)
+	px[4 * i + 3] = (unsigned char) pal[(indices >> (3 * i)) & 7];
+}
+
+void
+decodebc7(unsigned char *px, const unsigned char *in)
+{
+    Bits b;
+    int e0[4], e1[4], q0[4], q1[4], c, w;
+    uint32_t p0, p1, i, t;
+
+    /* Only mode 6, the one bc_compress emits */
+    readbits(&b, in);
+    if (getbits(&b, 7) != 1 << 6) {
+	memset(px, 0, 4 * BLOCKPIXELS);
+	return;
+    }
+
+    for (c = 0; c < 4; c++) {
+	q0[c] = (int) getbits(&b, 7);
+	q1[c] = (int) getbits(&b, 7);
+    }
+    p0 = getbits(&b, 1);
+    p1 = getbits(&b, 1);
+    for (c = 0; c < 4; c++) {
+	e0[c] = q0[c] << 1 | (int) p0;
+	e1[c] = q1[c] << 1 | (int) p1;
+    }
+
+    for (i = 0; i < BLOCKPIXELS; i++) {
+	t = getbits(&b, i == 0 ? 3 : 4);
+	w = weights4[t];
+	for (c = 0; c < 4; c++)
+	    px[4 * i + c] = (unsigned char) (((64 - w) * e0[c] + w * e1[c] +
+			32) >> 6);
+    }
+}
+
+void
+bc_decompress(unsigned char *rgba, const unsigned char *src, uint32_t width,
+	uint32_t height, BcFormat format)
+{
+    unsigned char px[4 * BLOCKPIXELS];
+    uint32_t bx, by, x, y;
+    const unsigned char *in = src;
+
+    for (by = 0; by < (height + 3) / 4; by++)
+	for (bx = 0; bx < (width + 3) / 4; bx++) {
+	    switch (format) {
+	    case BC1:
+		decodecolour(px, in, 0);
+		break;
+	    case BC3:
+		decodecolour(px, in + 8, 1);
+		decodealpha(px, in);
+		break;
+	    case BC7:
+		decodebc7(px, in);
+		break;
+	    }
+	    in += blockbytes[format];
+
+	    /* Drop the pixels of partial blocks that are off the image */
+	    for (y = 0; y < 4 && by * 4 + y < height; y++)
+		for (x = 0; x < 4 && bx * 4 + x < width; x++)
+		    memcpy(rgba + 4 * ((size_t) (by * 4 + y) * width +
+				bx * 4 + x), px + 4 * (4 * y + x), 4);
+	}
+}
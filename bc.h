@@ -0,0 +1,20 @@
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum { BC1, BC3, BC7 } BcFormat;
+typedef enum { BC_AUTO, BC_SCALAR, BC_SSE2, BC_AVX2 } BcPath;
+
+/* RGBA8 in, blocks out */
+typedef struct {
+    unsigned char *dst;
+    const unsigned char *rgba;
+    uint32_t width;
+    uint32_t height;
+} BcImage;
+
+uint32_t bc_supported(BcPath path);
+size_t bc_size(uint32_t width, uint32_t height, BcFormat format);
+void bc_compress(const BcImage *images, uint32_t count, BcFormat format,
+	BcPath path, uint32_t threads);
+void bc_decompress(unsigned char *rgba, const unsigned char *src,
+	uint32_t width, uint32_t height, BcFormat format);
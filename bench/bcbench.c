@@ -0,0 +1,139 @@
+/* Block compression benchmark.
+ * Compresses a synthetic image with every supported path and reports
+ * throughput in MB/s of RGBA input, and PSNR against the source and against
+ * the scalar reference.
+ * Usage: bcbench [width height [runs]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "../bc.h"
+#include "../util.h"
+
+/* Function declarations */
+static double psnr(const unsigned char *a, const unsigned char *b,
+	size_t pixels, uint32_t channels);
+static void makeimage(unsigned char *rgba, uint32_t width, uint32_t height);
+
+/* Variables */
+static const char *formatnames[] = { "BC1", "BC3", "BC7" };
+static const char *pathnames[] = { "auto", "scalar", "sse2", "avx2" };
+
+/* Function implementations */
+
+double
+psnr(const unsigned char *a, const unsigned char *b, size_t pixels,
+	uint32_t channels)
+{
+    double sum = 0.0, d;
+    size_t i;
+    uint32_t c;
+
+    for (i = 0; i < pixels; i++)
+	for (c = 0; c < channels; c++) {
+	    d = (double) a[4 * i + c] - (double) b[4 * i + c];
+	    sum += d * d;
+	}
+    if (sum == 0.0)
+	return INFINITY;
+
+    return 10.0 * log10(255.0 * 255.0 * (double) (pixels * channels) / sum);
+}
+
+void
+makeimage(unsigned char *rgba, uint32_t width, uint32_t height)
+{
+    uint32_t x, y, noise = 1;
+    unsigned char *p;
+
+    /* Smooth gradients with some grain and hard edges, a bit like a photo */
+    for (y = 0; y < height; y++)
+	for (x = 0; x < width; x++) {
+	    noise = noise * 1664525 + 1013904223;
+	    p = rgba + 4 * ((size_t) y * width + x);
+	    p[0] = (unsigned char) (x * 255 / width);
+	    p[1] = (unsigned char) (y * 255 / height);
+	    p[2] = (unsigned char) (((x / 32 + y / 32) & 1) * 128 +
+		    (noise >> 28));
+	    p[3] = (unsigned char) (255 - (x + y) * 255 / (width + height));
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t width = 2048, height = 2048, runs = 5, f, p, r;
+    size_t pixels;
+    unsigned char *rgba, *ref, *out, *blocks;
+    double best, t, mb;
+    BcImage image;
+
+    if (argc >= 3) {
+	width = (uint32_t) atoi(argv[1]);
+	height = (uint32_t) atoi(argv[2]);
+    }
+    if (argc >= 4)
+	runs = (uint32_t) atoi(argv[3]);
+    if (width == 0 || height == 0 || runs == 0) {
+	fprintf(stderr, "Usage: %s [width height [runs]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    pixels = (size_t) width * height;
+    mb = (double) (pixels * 4) / (1024.0 * 1024.0);
+    rgba = (unsigned char *) malloc(pixels * 4);
+    ref = (unsigned char *) malloc(pixels * 4);
+    out = (unsigned char *) malloc(pixels * 4);
+    blocks = (unsigned char *) malloc(bc_size(width, height, BC7));
+    makeimage(rgba, width, height);
+    image.dst = blocks;
+    image.rgba = rgba;
+    image.width = width;
+    image.height = height;
+
+    printf("%ux%u, best of %u runs\n", width, height, runs);
+    printf("%-6s %-7s %10s %10s %10s %10s\n", "format", "path", "MB/s",
+	    "PSNR", "PSNR A", "vs scalar");
+    for (f = BC1; f <= BC7; f++) {
+	for (p = BC_SCALAR; p <= BC_AVX2; p++) {
+	    if (!bc_supported((BcPath) p)) {
+		printf("%-6s %-7s %10s\n", formatnames[f], pathnames[p],
+			"n/a");
+		continue;
+	    }
+
+	    best = INFINITY;
+	    for (r = 0; r < runs; r++) {
+		t = gettime();
+		bc_compress(&image, 1, (BcFormat) f, (BcPath) p, 0);
+		t = gettime() - t;
+		if (t < best)
+		    best = t;
+	    }
+
+	    bc_decompress(out, blocks, width, height, (BcFormat) f);
+	    if (p == BC_SCALAR)
+		memcpy(ref, out, pixels * 4);
+
+	    /* BC1 is opaque, its alpha isn't meaningful */
+	    printf("%-6s %-7s %10.1f %10.2f ", formatnames[f], pathnames[p],
+		    mb / best, psnr(rgba, out, pixels, 3));
+	    if (f == BC1)
+		printf("%10s ", "-");
+	    else
+		printf("%10.2f ", psnr(rgba + 3, out + 3, pixels, 1));
+	    printf("%10.2f\n", psnr(ref, out, pixels, f == BC1 ? 3 : 4));
+	}
+    }
+
+    free(rgba);
+    free(ref);
+    free(out);
+    free(blocks);
+
+    return EXIT_SUCCESS;
+}
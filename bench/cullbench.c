@@ -0,0 +1,121 @@
+/* Frustum culling benchmark.
+ * Culls random spheres scattered around the view, about a third of them
+ * visible, with every supported path on one thread and then shared out
+ * between the job workers, and reports objects culled a millisecond. The
+ * paths are checked against the scalar reference as they go.
+ * Usage: cullbench [objects [runs]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "../cull.h"
+#include "../job.h"
+#include "../util.h"
+
+/* Function declarations */
+static void makeobjects(ObjectStore *s, uint32_t count);
+
+/* Variables */
+static const char *pathnames[] = { "auto", "scalar", "sse2", "avx2" };
+/* The renderer's orthographic camera at a 4:3 aspect */
+static const float viewproj[16] = {
+    0.75f, 0.0f, 0.0f, 0.0f,
+    0.0f,  1.0f, 0.0f, 0.0f,
+    0.0f,  0.0f, 1.0f, 0.0f,
+    0.0f,  0.0f, 0.0f, 1.0f
+};
+
+/* Function implementations */
+
+void
+makeobjects(ObjectStore *s, uint32_t count)
+{
+    uint32_t i, noise = 1;
+    float x, y, z;
+
+    for (i = 0; i < count; i++) {
+	noise = noise * 1664525 + 1013904223;
+	x = (float) (noise >> 16) / 65536.0f * 4.0f - 2.0f;
+	y = (float) (noise & 0xffff) / 65536.0f * 4.0f - 2.0f;
+	noise = noise * 1664525 + 1013904223;
+	z = (float) (noise >> 16) / 65536.0f * 1.5f - 0.25f;
+	cull_add(s, x, y, z, 0.01f + (float) (noise & 0xff) / 2560.0f);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t count = 1000000, runs = 10, p, r, n = 0, ref = 0;
+    Frustum f;
+    ObjectStore s;
+    uint32_t *visible, *reference;
+    double best, t;
+
+    if (argc >= 2)
+	count = (uint32_t) atoi(argv[1]);
+    if (argc >= 3)
+	runs = (uint32_t) atoi(argv[2]);
+    if (count == 0 || runs == 0) {
+	fprintf(stderr, "Usage: %s [objects [runs]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    job_initialise(0);
+    cull_initialise(&s, count);
+    makeobjects(&s, count);
+    cull_planes(&f, viewproj);
+    visible = (uint32_t *) malloc(s.capacity * sizeof(uint32_t));
+    reference = (uint32_t *) malloc(s.capacity * sizeof(uint32_t));
+
+    printf("%u objects, best of %u runs\n", count, runs);
+    printf("%-7s %-8s %14s %10s %8s\n", "path", "threads", "objects/ms",
+	    "visible", "matches");
+    for (p = CULL_SCALAR; p <= CULL_AVX2; p++) {
+	if (!cull_supported((CullPath) p)) {
+	    printf("%-7s %-8s %14s\n", pathnames[p], "-", "n/a");
+	    continue;
+	}
+
+	best = INFINITY;
+	for (r = 0; r < runs; r++) {
+	    t = gettime();
+	    n = cull_range(&s, &f, (CullPath) p, 0, count, visible);
+	    t = gettime() - t;
+	    if (t < best)
+		best = t;
+	}
+	if (p == CULL_SCALAR) {
+	    memcpy(reference, visible, n * sizeof(uint32_t));
+	    ref = n;
+	}
+	printf("%-7s %-8s %14.0f %10u %8s\n", pathnames[p], "1",
+		count / (best * 1000.0), n, n == ref &&
+		memcmp(visible, reference, n * sizeof(uint32_t)) == 0 ?
+		"yes" : "NO");
+
+	best = INFINITY;
+	for (r = 0; r < runs; r++) {
+	    t = gettime();
+	    n = cull_frustum(&s, &f, (CullPath) p);
+	    t = gettime() - t;
+	    if (t < best)
+		best = t;
+	}
+	printf("%-7s %-8s %14.0f %10u %8s\n", pathnames[p], "jobs",
+		count / (best * 1000.0), n, n == ref &&
+		memcmp(s.visible, reference, n * sizeof(uint32_t)) == 0 ?
+		"yes" : "NO");
+    }
+
+    free(visible);
+    free(reference);
+    cull_terminate(&s);
+    job_terminate();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+/* Mesh pipeline benchmark.
+ * Builds a sphere, scrambles its triangle and vertex order as a careless
+ * exporter might, then runs each stage of the mesh pipeline and reports
+ * bytes a vertex, the post-transform cache's misses per triangle (ACMR) and
+ * per vertex (ATVR) and the vertex fetch overfetch after each, and what the
+ * whole pipeline costs at load. GPU time isn't measured here, pack a mesh
+ * with and without meshpack -u and compare the renderer's GPU frame time.
+ * Usage: meshbench [rings [runs]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "../mesh.h"
+#include "../util.h"
+
+/* Macros */
+#define PI 3.14159265f
+#define CACHE 16
+/* Vertex fetch modelled as a direct mapped cache of 64 byte lines */
+#define LINESIZE 64
+#define LINES 256
+
+/* Function declarations */
+static uint32_t makesphere(MeshSource *vertices, uint32_t *indices,
+	uint32_t rings);
+static void scramble(MeshSource *vertices, uint32_t vertexcount,
+	uint32_t *indices, uint32_t indexcount);
+static double overfetch(const uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount, uint32_t stride);
+static void report(const char *stage, const uint32_t *indices,
+	uint32_t indexcount, uint32_t vertexcount, uint32_t stride);
+
+/* Function implementations */
+
+/* Rings of latitude by twice as many of longitude, returns the index
+ * count. The seam's vertices are duplicated as an exporter would. */
+uint32_t
+makesphere(MeshSource *vertices, uint32_t *indices, uint32_t rings)
+{
+    uint32_t segments = 2 * rings, r, s, n = 0, a, b;
+    float theta, phi;
+    MeshSource *v;
+
+    for (r = 0; r <= rings; r++)
+	for (s = 0; s <= segments; s++) {
+	    theta = PI * (float) r / (float) rings;
+	    phi = 2.0f * PI * (float) s / (float) segments;
+	    v = &vertices[r * (segments + 1) + s];
+	    v->normal[0] = sinf(theta) * cosf(phi);
+	    v->normal[1] = cosf(theta);
+	    v->normal[2] = sinf(theta) * sinf(phi);
+	    memcpy(v->position, v->normal, sizeof v->position);
+	    v->colour[0] = (float) s / (float) segments;
+	    v->colour[1] = (float) r / (float) rings;
+	    v->colour[2] = 0.5f;
+	    v->colour[3] = 1.0f;
+	}
+
+    for (r = 0; r < rings; r++)
+	for (s = 0; s < segments; s++) {
+	    a = r * (segments + 1) + s;
+	    b = a + segments + 1;
+	    indices[n++] = a;
+	    indices[n++] = b;
+	    indices[n++] = a + 1;
+	    indices[n++] = a + 1;
+	    indices[n++] = b;
+	    indices[n++] = b + 1;
+	}
+
+    return n;
+}
+
+void
+scramble(MeshSource *vertices, uint32_t vertexcount, uint32_t *indices,
+	uint32_t indexcount)
+{
+    uint32_t *remap, noise = 1, i, j, k, t;
+    MeshSource tmp;
+
+    /* remap takes a vertex's old index to its new one */
+    remap = (uint32_t *) malloc(vertexcount * sizeof(uint32_t));
+    for (i = 0; i < vertexcount; i++)
+	remap[i] = i;
+    for (i = vertexcount - 1; i > 0; i--) {
+	noise = noise * 1664525 + 1013904223;
+	j = (noise >> 8) % (i + 1);
+	t = remap[i];
+	remap[i] = remap[j];
+	remap[j] = t;
+    }
+    for (i = 0; i < indexcount; i++)
+	indices[i] = remap[indices[i]];
+    /* Cycle each vertex into place */
+    for (i = 0; i < vertexcount; i++)
+	while (remap[i] != i) {
+	    j = remap[i];
+	    tmp = vertices[j];
+	    vertices[j] = vertices[i];
+	    vertices[i] = tmp;
+	    remap[i] = remap[j];
+	    remap[j] = j;
+	}
+
+    for (i = indexcount / 3 - 1; i > 0; i--) {
+	noise = noise * 1664525 + 1013904223;
+	j = (noise >> 8) % (i + 1);
+	for (k = 0; k < 3; k++) {
+	    t = indices[3 * i + k];
+	    indices[3 * i + k] = indices[3 * j + k];
+	    indices[3 * j + k] = t;
+	}
+    }
+
+    free(remap);
+}
+
+/* Bytes read from the vertex buffer over its size, only vertices missing
+ * the post-transform cache are fetched */
+double
+overfetch(const uint32_t *indices, uint32_t indexcount, uint32_t vertexcount,
+	uint32_t stride)
+{
+    uint32_t *stamps, lines[LINES], time = CACHE + 1, i, v, l, first, last;
+    uint64_t fetched = 0;
+
+    stamps = (uint32_t *) calloc(vertexcount, sizeof(uint32_t));
+    memset(lines, 0xff, sizeof lines);
+
+    for (i = 0; i < indexcount; i++) {
+	v = indices[i];
+	if (time - stamps[v] <= CACHE)
+	    continue;
+	stamps[v] = time++;
+
+	first = v * stride / LINESIZE;
+	last = ((v + 1) * stride - 1) / LINESIZE;
+	for (l = first; l <= last; l++)
+	    if (lines[l % LINES] != l) {
+		lines[l % LINES] = l;
+		fetched += LINESIZE;
+	    }
+    }
+
+    free(stamps);
+
+    return (double) fetched / ((double) vertexcount * stride);
+}
+
+void
+report(const char *stage, const uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount, uint32_t stride)
+{
+    uint32_t misses = mesh_cachemisses(indices, indexcount, vertexcount,
+	    CACHE);
+
+    printf("%-10s %12u %8.3f %8.3f %10.2f\n", stage, stride,
+	    3.0 * misses / indexcount, (double) misses / vertexcount,
+	    overfetch(indices, indexcount, vertexcount, stride));
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t rings = 128, runs = 5, vertexcount, indexcount, count, r;
+    MeshSource *source, *vertices;
+    uint32_t *sourceindices, *indices;
+    double best = INFINITY, t;
+    Mesh m;
+
+    if (argc >= 2)
+	rings = (uint32_t) atoi(argv[1]);
+    if (argc >= 3)
+	runs = (uint32_t) atoi(argv[2]);
+    if (rings < 2 || runs == 0) {
+	fprintf(stderr, "Usage: %s [rings [runs]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    vertexcount = (rings + 1) * (2 * rings + 1);
+    indexcount = 6 * rings * 2 * rings;
+    source = (MeshSource *) malloc(vertexcount * sizeof(MeshSource));
+    vertices = (MeshSource *) malloc(vertexcount * sizeof(MeshSource));
+    sourceindices = (uint32_t *) malloc(indexcount * sizeof(uint32_t));
+    indices = (uint32_t *) malloc(indexcount * sizeof(uint32_t));
+    makesphere(source, sourceindices, rings);
+    scramble(source, vertexcount, sourceindices, indexcount);
+
+    printf("%u vertices, %u triangles, %u entry FIFO, best of %u runs\n",
+	    vertexcount, indexcount / 3, CACHE, runs);
+    printf("%-10s %12s %8s %8s %10s\n", "stage", "bytes/vertex", "ACMR",
+	    "ATVR", "overfetch");
+
+    memcpy(vertices, source, vertexcount * sizeof(MeshSource));
+    memcpy(indices, sourceindices, indexcount * sizeof(uint32_t));
+    report("input", indices, indexcount, vertexcount, sizeof(MeshSource));
+    mesh_optimisecache(indices, indexcount, vertexcount);
+    report("cache", indices, indexcount, vertexcount, sizeof(MeshSource));
+    mesh_optimiseoverdraw(indices, indexcount, vertices, vertexcount, 1.05f);
+    report("overdraw", indices, indexcount, vertexcount, sizeof(MeshSource));
+    count = mesh_optimisefetch(vertices, vertexcount, indices, indexcount);
+    report("fetch", indices, indexcount, count, sizeof(MeshSource));
+    report("quantise", indices, indexcount, count, sizeof(MeshVertex));
+
+    /* The whole pipeline as run at load */
+    for (r = 0; r < runs; r++) {
+	memcpy(vertices, source, vertexcount * sizeof(MeshSource));
+	memcpy(indices, sourceindices, indexcount * sizeof(uint32_t));
+	t = gettime();
+	mesh_build(&m, vertices, vertexcount, indices, indexcount);
+	t = gettime() - t;
+	if (t < best)
+	    best = t;
+	mesh_free(&m);
+    }
+    printf("build %.3f ms, %.0f triangles/ms, %u -> %u bytes\n",
+	    best * 1000.0, indexcount / 3 / (best * 1000.0),
+	    (uint32_t) (vertexcount * sizeof(MeshSource)),
+	    (uint32_t) (count * sizeof(MeshVertex)));
+
+    free(source);
+    free(vertices);
+    free(sourceindices);
+    free(indices);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,240 @@
+/* Scene loading benchmark.
+ * Writes a large synthetic scene, then times loading it cold, evicted from
+ * the file cache, and warm, straight after. A mapped load is split into
+ * mapping and checking the file, paging in the blobs the check didn't touch
+ * and copying the mesh to what would be the staging buffer. It's compared
+ * against reading the whole file with fread(), which is where a parser
+ * would start. Eviction opens the file unbuffered, which drops its cached
+ * pages when nothing else has it open, so it's best effort.
+ * Usage: scenebench [megabytes [runs]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "../mesh.h"
+#include "../scene.h"
+#include "../util.h"
+
+/* Macros */
+#define FILENAME "scenebench.scene"
+#define INSTANCES 4096
+#define PAGESIZE 4096
+
+/* Function declarations */
+static void evict(const char *filename);
+static void writescene(uint32_t megabytes);
+static void loadmapped(unsigned char *staging, double *times);
+static double loadread(void);
+static void report(const char *name, const double *phases, double total);
+
+/* Variables */
+static size_t filesize;
+
+/* Function implementations */
+
+void
+evict(const char *filename)
+{
+    HANDLE file;
+
+    file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+	    OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+    if (file != INVALID_HANDLE_VALUE)
+	CloseHandle(file);
+}
+
+/* Mostly mesh, split evenly between vertices and indices. The contents
+ * don't matter to loading, only that the indices are in range. */
+void
+writescene(uint32_t megabytes)
+{
+    uint64_t bytes = (uint64_t) megabytes << 20;
+    SceneInstance *instances;
+    uint32_t noise = 1, i;
+    Mesh m;
+
+    m.vertexcount = (uint32_t) (bytes / 2 / sizeof(MeshVertex));
+    m.indexcount = (uint32_t) (bytes / 2 / sizeof(uint32_t)) / 3 * 3;
+    m.vertices = (MeshVertex *) malloc(m.vertexcount * sizeof(MeshVertex));
+    m.indices = (uint32_t *) malloc(m.indexcount * sizeof(uint32_t));
+    instances = (SceneInstance *) malloc(INSTANCES * sizeof(SceneInstance));
+    if (m.vertices == NULL || m.indices == NULL || instances == NULL) {
+	fprintf(stderr, "Failed to allocate a %u MB scene.\n", megabytes);
+	exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < m.vertexcount; i++) {
+	noise = noise * 1664525 + 1013904223;
+	m.vertices[i].position[0] = (int16_t) (noise >> 16);
+	m.vertices[i].position[1] = (int16_t) noise;
+	m.vertices[i].position[2] = (int16_t) (noise >> 8);
+	m.vertices[i].position[3] = 32767;
+	m.vertices[i].normal[0] = 0;
+	m.vertices[i].normal[1] = 0;
+	m.vertices[i].colour = noise;
+    }
+    for (i = 0; i < m.indexcount; i++)
+	m.indices[i] = (i / 3 + i % 3) % m.vertexcount;
+    for (i = 0; i < INSTANCES; i++) {
+	instances[i].x = (float) (i % 64);
+	instances[i].y = (float) (i / 64);
+	instances[i].z = 0.0f;
+	instances[i].radius = 1.0f;
+    }
+    m.centre[0] = m.centre[1] = m.centre[2] = 0.0f;
+    m.scale = 1.0f;
+    m.radius = sqrtf(3.0f);
+
+    scene_write(FILENAME, &m, instances, INSTANCES);
+
+    free(m.vertices);
+    free(m.indices);
+    free(instances);
+}
+
+/* Times mapping and checking, paging in and copying */
+void
+loadmapped(unsigned char *staging, double *times)
+{
+    const unsigned char *p;
+    volatile unsigned char sink = 0;
+    const void *data;
+    uint64_t offset;
+    size_t size;
+    Scene s;
+    double t;
+    uint32_t i;
+
+    t = gettime();
+    data = mapfile(FILENAME, &size);
+    scene_read(&s, data, size);
+    times[0] = gettime() - t;
+
+    /* The indices were paged in by the check */
+    t = gettime();
+    for (i = 0; i < SCENE_BLOBCOUNT; i++) {
+	if (i == SCENE_INDICES)
+	    continue;
+	p = (const unsigned char *) s.blobs[i].data;
+	for (offset = 0; offset < s.blobs[i].size; offset += PAGESIZE)
+	    sink += p[offset];
+    }
+    times[1] = gettime() - t;
+
+    t = gettime();
+    memcpy(staging, s.blobs[SCENE_VERTICES].data,
+	    s.blobs[SCENE_VERTICES].size);
+    memcpy(staging + s.blobs[SCENE_VERTICES].size,
+	    s.blobs[SCENE_INDICES].data, s.blobs[SCENE_INDICES].size);
+    times[2] = gettime() - t;
+
+    unmapfile(data);
+    (void) sink;
+}
+
+double
+loadread(void)
+{
+    unsigned char *data;
+    double t = gettime();
+    FILE *f;
+
+    if ((f = fopen(FILENAME, "rb")) == NULL ||
+	    (data = (unsigned char *) malloc(filesize)) == NULL ||
+	    fread(data, 1, filesize, f) != filesize) {
+	fprintf(stderr, "Could not read file %s.\n", FILENAME);
+	exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    t = gettime() - t;
+    free(data);
+
+    return t;
+}
+
+/* Phases may be NULL, a read isn't split */
+void
+report(const char *name, const double *phases, double total)
+{
+    uint32_t i;
+
+    printf("%-12s", name);
+    for (i = 0; i < 3; i++)
+	if (phases != NULL)
+	    printf(" %10.2f", phases[i] * 1000.0);
+	else
+	    printf(" %10s", "-");
+    printf(" %10.2f %10.0f\n", total * 1000.0,
+	    (double) filesize / (1 << 20) / total);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t megabytes = 512, runs = 3, r, i;
+    double mapped[2][3], mappedtotal[2], readtotal[2], times[3];
+    unsigned char *staging;
+    const void *data;
+    size_t size;
+    Scene s;
+
+    if (argc >= 2)
+	megabytes = (uint32_t) atoi(argv[1]);
+    if (argc >= 3)
+	runs = (uint32_t) atoi(argv[2]);
+    if (megabytes == 0 || megabytes > 4095 || runs == 0) {
+	fprintf(stderr, "Usage: %s [megabytes [runs]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    writescene(megabytes);
+    data = mapfile(FILENAME, &filesize);
+    scene_read(&s, data, filesize);
+    size = s.blobs[SCENE_VERTICES].size + s.blobs[SCENE_INDICES].size;
+    unmapfile(data);
+    /* Touched so its page faults aren't counted, as a staging buffer's
+     * memory is resident */
+    if ((staging = (unsigned char *) malloc(size)) == NULL) {
+	fprintf(stderr, "Failed to allocate staging.\n");
+	return EXIT_FAILURE;
+    }
+    memset(staging, 0, size);
+
+    /* The best run of each, cold then warm */
+    for (i = 0; i < 2; i++)
+	mappedtotal[i] = readtotal[i] = INFINITY;
+    for (r = 0; r < runs; r++) {
+	for (i = 0; i < 2; i++) {
+	    if (i == 0)
+		evict(FILENAME);
+	    loadmapped(staging, times);
+	    if (times[0] + times[1] + times[2] < mappedtotal[i]) {
+		mappedtotal[i] = times[0] + times[1] + times[2];
+		memcpy(mapped[i], times, sizeof times);
+	    }
+	}
+	for (i = 0; i < 2; i++) {
+	    if (i == 0)
+		evict(FILENAME);
+	    readtotal[i] = fmin(readtotal[i], loadread());
+	}
+    }
+
+    printf("%zu MB scene, %zu MB of mesh, best of %u runs, ms\n",
+	    filesize >> 20, size >> 20, runs);
+    printf("%-12s %10s %10s %10s %10s %10s\n", "load", "map+check",
+	    "page in", "copy", "total", "MB/s");
+    report("mapped cold", mapped[0], mappedtotal[0]);
+    report("mapped warm", mapped[1], mappedtotal[1]);
+    report("fread cold", NULL, readtotal[0]);
+    report("fread warm", NULL, readtotal[1]);
+
+    free(staging);
+    remove(FILENAME);
+
+    return EXIT_SUCCESS;
+}
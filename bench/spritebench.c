@@ -0,0 +1,144 @@
+/* Sprite batching benchmark.
+ * Builds batches from random sprites spread over four layers, both blend
+ * modes and a number of textures, and reports the CPU cost a frame, the
+ * draws it makes and how many sprites fit in a 60 Hz frame. The radix sort
+ * is timed against qsort on the same keys. GPU time isn't measured.
+ * Usage: spritebench [sprites [textures [runs]]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "../batch.h"
+#include "../util.h"
+
+/* Macros */
+#define LAYERS 4
+#define FRAMEMS (1000.0 / 60.0)
+
+/* Function declarations */
+static int comparekeys(const void *a, const void *b);
+static void makesprites(Sprite *sprites, uint32_t count, uint32_t textures);
+
+/* Function implementations */
+
+int
+comparekeys(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+void
+makesprites(Sprite *sprites, uint32_t count, uint32_t textures)
+{
+    uint32_t i, noise = 1;
+    Sprite *s;
+
+    for (i = 0; i < count; i++) {
+	noise = noise * 1664525 + 1013904223;
+	s = &sprites[i];
+	s->x = (float) (noise >> 16) / 65536.0f * 2.0f - 1.0f;
+	s->y = (float) (noise & 0xffff) / 65536.0f * 2.0f - 1.0f;
+	s->width = s->height = 0.02f;
+	s->u0 = s->v0 = 0.0f;
+	s->u1 = s->v1 = 1.0f;
+	s->colour = noise | 0xff000000;
+	s->texture = (noise >> 8) % textures;
+	s->layer = (uint8_t) ((noise >> 4) % LAYERS);
+	s->blend = (uint8_t) (noise >> 30 & 1);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t counts[] = { 1000, 10000, 100000 }, ncounts = 3;
+    uint32_t textures = 16, runs = 5, count, batches = 0, c, i, r;
+    Sprite *sprites;
+    SpriteList list;
+    SpriteVertex *vertices;
+    uint32_t *keys, *order, *scratch;
+    double best, bestsort, bestqsort, t, ms;
+
+    if (argc >= 2) {
+	counts[0] = (uint32_t) atoi(argv[1]);
+	ncounts = 1;
+    }
+    if (argc >= 3)
+	textures = (uint32_t) atoi(argv[2]);
+    if (argc >= 4)
+	runs = (uint32_t) atoi(argv[3]);
+    if (counts[0] == 0 || textures == 0 || runs == 0) {
+	fprintf(stderr, "Usage: %s [sprites [textures [runs]]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    printf("%u textures, %u layers, best of %u runs\n", textures, LAYERS,
+	    runs);
+    printf("%8s %10s %10s %8s %12s %10s %10s\n", "sprites", "ms/frame",
+	    "ns/sprite", "draws", "60 Hz", "radix ms", "qsort ms");
+    for (c = 0; c < ncounts; c++) {
+	count = counts[c];
+	sprites = (Sprite *) malloc(count * sizeof(Sprite));
+	vertices = (SpriteVertex *) malloc(4 * (size_t) count *
+		sizeof(SpriteVertex));
+	keys = (uint32_t *) malloc(count * sizeof(uint32_t));
+	order = (uint32_t *) malloc(count * sizeof(uint32_t));
+	scratch = (uint32_t *) malloc(2 * (size_t) count * sizeof(uint32_t));
+	makesprites(sprites, count, textures);
+	batch_initialise(&list, count);
+
+	/* Adding is part of the frame, as it is in the renderer */
+	best = bestsort = bestqsort = INFINITY;
+	for (r = 0; r < runs; r++) {
+	    t = gettime();
+	    for (i = 0; i < count; i++)
+		batch_add(&list, &sprites[i]);
+	    batches = batch_build(&list);
+	    batch_write(&list, vertices, 0, list.built);
+	    t = gettime() - t;
+	    if (t < best)
+		best = t;
+
+	    /* The same keys batch_build makes */
+	    for (i = 0; i < count; i++) {
+		keys[i] = (uint32_t) sprites[i].layer << 24 |
+		    (uint32_t) sprites[i].blend << 23 | sprites[i].texture;
+		order[i] = i;
+	    }
+	    t = gettime();
+	    batch_sort(keys, order, scratch, count);
+	    t = gettime() - t;
+	    if (t < bestsort)
+		bestsort = t;
+
+	    for (i = 0; i < count; i++)
+		keys[i] = (uint32_t) sprites[i].layer << 24 |
+		    (uint32_t) sprites[i].blend << 23 | sprites[i].texture;
+	    t = gettime();
+	    qsort(keys, count, sizeof(uint32_t), comparekeys);
+	    t = gettime() - t;
+	    if (t < bestqsort)
+		bestqsort = t;
+	}
+
+	ms = best * 1000.0;
+	printf("%8u %10.3f %10.1f %8u %12.0f %10.3f %10.3f\n", count, ms,
+		best * 1e9 / (double) count, batches,
+		FRAMEMS / ms * (double) count, bestsort * 1000.0,
+		bestqsort * 1000.0);
+
+	batch_terminate(&list);
+	free(sprites);
+	free(vertices);
+	free(keys);
+	free(order);
+	free(scratch);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1267 @@
+/* Vulkan API benchmark.
+ * Times the fixed costs of the calls the renderer makes, on whichever device
+ * comes first, lavapipe included: creating a shader module, creating the
+ * scene pipeline cold and from a warm pipeline cache, recreating a swap
+ * chain on a headless surface, recording a frame of N draws, submitting
+ * batches of command buffers and fence and semaphore round trips. Each is
+ * warmed up and its iteration count doubled until a run takes long enough
+ * to time, then timed over the runs. Results go to stdout as CSV in
+ * microseconds an iteration with a 95% confidence interval for the mean.
+ * Mesa keeps its own shader cache on disk, set MESA_SHADER_CACHE_DISABLE=true
+ * for cold pipelines that are cold. The swap chain is skipped without
+ * VK_EXT_headless_surface.
+ * Usage: vkbench [runs]
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "../mesh.h"
+#include "../pipeline.h"
+#include "../util.h"
+#include "../vulkan.h"
+
+/* Macros */
+#define MAXRUNS 1000
+/* Seconds a run takes at least, unless it's at the most iterations */
+#define MINRUNTIME 0.01
+#define MAXITERATIONS (1 << 20)
+#define MAXBATCH 64
+#define MAXDRAWS 10000
+#define TARGETSIZE 256
+#define BINDLESSCOUNT 256
+#define UNIFORMSIZE 256
+#define VERTEXOFFSET 256
+#define INDEXOFFSET 512
+#define BUFFERSIZE 1024
+
+/* Types */
+typedef void (*BenchFunction)(uint32_t param, uint32_t iterations);
+
+/* Function declarations */
+static void fail(const char *what);
+static uint32_t *loadspirv(const char *filename, size_t *size);
+static uint32_t hasinstanceext(const char *name);
+static uint32_t hasdeviceext(const char *name);
+static uint32_t findmemorytype(uint32_t typefilter,
+	VkMemoryPropertyFlags properties);
+static void createinstance(void);
+static void createdevice(void);
+static void createtarget(void);
+static void createlayouts(void);
+static VkPipeline createpipeline(VkPipelineCache cache);
+static void createbuffer(void);
+static void createcommands(void);
+static void createswapchain(void);
+static void destroyswapchain(void);
+static void destroyall(void);
+static double tquantile(uint32_t df);
+static int comparedoubles(const void *a, const void *b);
+static void bench(const char *name, BenchFunction f, uint32_t param);
+static void benchshadermodule(uint32_t param, uint32_t iterations);
+static void benchpipeline(uint32_t param, uint32_t iterations);
+static void benchswapchain(uint32_t param, uint32_t iterations);
+static void benchrecord(uint32_t draws, uint32_t iterations);
+static void benchsubmitbatched(uint32_t batch, uint32_t iterations);
+static void benchsubmitcalls(uint32_t batch, uint32_t iterations);
+static void benchfence(uint32_t param, uint32_t iterations);
+static void benchsemaphore(uint32_t param, uint32_t iterations);
+
+/* Variables */
+/* 95% two sided, by degrees of freedom from one */
+static const double tquantiles[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+static const char * const shaderfiles[] = {
+    "shaders/vertex.spv", "shaders/fragment.spv"
+};
+static uint32_t runs = 20;
+static VkInstance instance;
+VkPhysicalDevice physicaldevice;
+VkDevice device;
+static uint32_t queuefamily;
+static VkQueue queue;
+static uint32_t hasheadless;
+static uint32_t *spirv[2];
+static size_t spirvsize[2];
+static VkShaderModule modules[2];
+static VkRenderPass renderpass;
+static VkImage targetimage;
+static VkDeviceMemory targetmemory;
+static VkImageView targetview;
+static VkFramebuffer framebuffer;
+static VkSampler sampler;
+static VkDescriptorSetLayout setlayouts[2];
+static VkPipelineLayout pipelinelayout;
+static VkDescriptorPool descriptorpools[2];
+static VkDescriptorSet sets[2];
+static VkPipelineCache pipelinecache;
+static VkPipeline pipeline;
+static VkBuffer buffer;
+static VkDeviceMemory buffermemory;
+static VkCommandPool commandpool;
+static VkCommandBuffer recordcb;
+static VkCommandBuffer emptycbs[MAXBATCH];
+static VkFence fence;
+static VkSemaphore semaphore;
+static VkSurfaceKHR surface;
+static VkSwapchainKHR swapchain;
+static VkImageView *swapchainviews;
+static uint32_t swapchaincount;
+
+/* Function implementations */
+
+void
+fail(const char *what)
+{
+    fprintf(stderr, "Failed to %s.\n", what);
+    exit(EXIT_FAILURE);
+}
+
+/* Built by the Makefile's shaders, run from the repository */
+uint32_t *
+loadspirv(const char *filename, size_t *size)
+{
+    uint32_t *code;
+    long end;
+    FILE *f;
+
+    if ((f = fopen(filename, "rb")) == NULL || fseek(f, 0, SEEK_END) != 0 ||
+	    (end = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+	fprintf(stderr, "Could not read file %s.\n", filename);
+	exit(EXIT_FAILURE);
+    }
+    *size = (size_t) end;
+    if ((code = (uint32_t *) malloc(*size)) == NULL ||
+	    fread(code, 1, *size, f) != *size) {
+	fprintf(stderr, "Could not read file %s.\n", filename);
+	exit(EXIT_FAILURE);
+    }
+    fclose(f);
+
+    return code;
+}
+
+uint32_t
+hasinstanceext(const char *name)
+{
+    VkExtensionProperties *props;
+    uint32_t count, found = 0, i;
+
+    vkEnumerateInstanceExtensionProperties(NULL, &count, NULL);
+    if ((props = (VkExtensionProperties *) malloc(count *
+		    sizeof(VkExtensionProperties))) == NULL)
+	fail("allocate extension properties");
+    vkEnumerateInstanceExtensionProperties(NULL, &count, props);
+    for (i = 0; i < count && !found; i++)
+	found = strcmp(props[i].extensionName, name) == 0;
+    free(props);
+
+    return found;
+}
+
+uint32_t
+hasdeviceext(const char *name)
+{
+    VkExtensionProperties *props;
+    uint32_t count, found = 0, i;
+
+    vkEnumerateDeviceExtensionProperties(physicaldevice, NULL, &count, NULL);
+    if ((props = (VkExtensionProperties *) malloc(count *
+		    sizeof(VkExtensionProperties))) == NULL)
+	fail("allocate extension properties");
+    vkEnumerateDeviceExtensionProperties(physicaldevice, NULL, &count, props);
+    for (i = 0; i < count && !found; i++)
+	found = strcmp(props[i].extensionName, name) == 0;
+    free(props);
+
+    return found;
+}
+
+uint32_t
+findmemorytype(uint32_t typefilter, VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties mp;
+    uint32_t i;
+
+    vkGetPhysicalDeviceMemoryProperties(physicaldevice, &mp);
+    for (i = 0; i < mp.memoryTypeCount; i++)
+	if ((typefilter & (1 << i)) &&
+		(mp.memoryTypes[i].propertyFlags & properties) == properties)
+	    return i;
+    fail("find a memory type");
+
+    return 0;
+}
+
+/* The headless surface only if there is one */
+void
+createinstance(void)
+{
+    const char *exts[] = {
+	VK_KHR_SURFACE_EXTENSION_NAME,
+	VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME
+    };
+    VkApplicationInfo ai = {
+	.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+	.pNext = NULL,
+	.pApplicationName = "vkbench",
+	.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+	.pEngineName = "No Engine",
+	.engineVersion = VK_MAKE_VERSION(1, 0, 0),
+	.apiVersion = VK_API_VERSION_1_1
+    };
+    VkInstanceCreateInfo ci = {
+	.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.pApplicationInfo = &ai,
+	.enabledLayerCount = 0,
+	.ppEnabledLayerNames = NULL,
+	.enabledExtensionCount = 0,
+	.ppEnabledExtensionNames = exts
+    };
+    uint32_t count = 1;
+    VkPhysicalDeviceProperties pdp;
+
+    hasheadless = hasinstanceext(VK_KHR_SURFACE_EXTENSION_NAME) &&
+	hasinstanceext(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+    if (hasheadless)
+	ci.enabledExtensionCount = COUNT(exts);
+    if (vkCreateInstance(&ci, NULL, &instance) != VK_SUCCESS)
+	fail("create instance");
+
+    /* VK_INCOMPLETE with more than one */
+    vkEnumeratePhysicalDevices(instance, &count, &physicaldevice);
+    if (count == 0 || physicaldevice == VK_NULL_HANDLE)
+	fail("find a device");
+    vkGetPhysicalDeviceProperties(physicaldevice, &pdp);
+    fprintf(stderr, "Device: %s\n", pdp.deviceName);
+}
+
+/* With what the bindless table needs, as the renderer does */
+void
+createdevice(void)
+{
+    const char *exts[] = {
+	VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+	VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+    };
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT difs = {
+	.sType =
+	    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+	.pNext = NULL,
+	.runtimeDescriptorArray = VK_TRUE,
+	.descriptorBindingPartiallyBound = VK_TRUE,
+	.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+	.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+	.descriptorBindingUpdateUnusedWhilePending = VK_TRUE
+    };
+    VkPhysicalDeviceFeatures pdf = { 0 };
+    float prio = 1.0f;
+    VkDeviceQueueCreateInfo dqci = {
+	.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.queueFamilyIndex = 0,
+	.queueCount = 1,
+	.pQueuePriorities = &prio
+    };
+    VkDeviceCreateInfo dci = {
+	.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+	.pNext = &difs,
+	.flags = 0,
+	.queueCreateInfoCount = 1,
+	.pQueueCreateInfos = &dqci,
+	.enabledLayerCount = 0,
+	.ppEnabledLayerNames = NULL,
+	.enabledExtensionCount = COUNT(exts) - 1,
+	.ppEnabledExtensionNames = exts,
+	.pEnabledFeatures = &pdf
+    };
+    VkQueueFamilyProperties *qfps;
+    uint32_t count, i;
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &count, NULL);
+    if ((qfps = (VkQueueFamilyProperties *) malloc(count *
+		    sizeof(VkQueueFamilyProperties))) == NULL)
+	fail("allocate queue families");
+    vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &count, qfps);
+    for (i = 0; i < count; i++)
+	if (qfps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+	    break;
+    free(qfps);
+    if (i == count)
+	fail("find a graphics queue");
+    queuefamily = dqci.queueFamilyIndex = i;
+
+    if (hasheadless && (hasheadless =
+		hasdeviceext(VK_KHR_SWAPCHAIN_EXTENSION_NAME)))
+	dci.enabledExtensionCount++;
+    if (vkCreateDevice(physicaldevice, &dci, NULL, &device) != VK_SUCCESS)
+	fail("create device");
+    vkGetDeviceQueue(device, queuefamily, 0, &queue);
+}
+
+/* What the scene pass draws into, only recorded against */
+void
+createtarget(void)
+{
+    VkAttachmentDescription ad = {
+	.flags = 0,
+	.format = VK_FORMAT_R8G8B8A8_UNORM,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+    VkAttachmentReference ar = {
+	.attachment = 0,
+	.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+    VkSubpassDescription sd = {
+	.flags = 0,
+	.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+	.inputAttachmentCount = 0,
+	.pInputAttachments = NULL,
+	.colorAttachmentCount = 1,
+	.pColorAttachments = &ar,
+	.pResolveAttachments = NULL,
+	.pDepthStencilAttachment = NULL,
+	.preserveAttachmentCount = 0,
+	.pPreserveAttachments = NULL
+    };
+    VkRenderPassCreateInfo rpci = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.attachmentCount = 1,
+	.pAttachments = &ad,
+	.subpassCount = 1,
+	.pSubpasses = &sd,
+	.dependencyCount = 0,
+	.pDependencies = NULL
+    };
+    VkImageCreateInfo ici = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.imageType = VK_IMAGE_TYPE_2D,
+	.format = VK_FORMAT_R8G8B8A8_UNORM,
+	.extent = { TARGETSIZE, TARGETSIZE, 1 },
+	.mipLevels = 1,
+	.arrayLayers = 1,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.tiling = VK_IMAGE_TILING_OPTIMAL,
+	.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    VkImageViewCreateInfo ivci = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.image = VK_NULL_HANDLE,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = VK_FORMAT_R8G8B8A8_UNORM,
+	.components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    VkFramebufferCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.renderPass = VK_NULL_HANDLE,
+	.attachmentCount = 1,
+	.pAttachments = &targetview,
+	.width = TARGETSIZE,
+	.height = TARGETSIZE,
+	.layers = 1
+    };
+    VkMemoryRequirements mr;
+
+    if (vkCreateRenderPass(device, &rpci, NULL, &renderpass) != VK_SUCCESS)
+	fail("create render pass");
+    if (vkCreateImage(device, &ici, NULL, &targetimage) != VK_SUCCESS)
+	fail("create target image");
+    vkGetImageMemoryRequirements(device, targetimage, &mr);
+    mai.allocationSize = mr.size;
+    mai.memoryTypeIndex = findmemorytype(mr.memoryTypeBits,
+	    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (vkAllocateMemory(device, &mai, NULL, &targetmemory) != VK_SUCCESS ||
+	    vkBindImageMemory(device, targetimage, targetmemory, 0) !=
+	    VK_SUCCESS)
+	fail("allocate target memory");
+    ivci.image = targetimage;
+    if (vkCreateImageView(device, &ivci, NULL, &targetview) != VK_SUCCESS)
+	fail("create target view");
+    fci.renderPass = renderpass;
+    if (vkCreateFramebuffer(device, &fci, NULL, &framebuffer) != VK_SUCCESS)
+	fail("create framebuffer");
+}
+
+/* The per-frame uniforms and the bindless table, in the renderer's sets */
+void
+createlayouts(void)
+{
+    VkSamplerCreateInfo sci = {
+	.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.magFilter = VK_FILTER_LINEAR,
+	.minFilter = VK_FILTER_LINEAR,
+	.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+	.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.mipLodBias = 0.0f,
+	.anisotropyEnable = VK_FALSE,
+	.maxAnisotropy = 1.0f,
+	.compareEnable = VK_FALSE,
+	.compareOp = VK_COMPARE_OP_ALWAYS,
+	.minLod = 0.0f,
+	.maxLod = 1000.0f,
+	.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+	.unnormalizedCoordinates = VK_FALSE
+    };
+    VkDescriptorSetLayoutBinding uniformbinding = {
+	.binding = 0,
+	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.descriptorCount = 1,
+	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+	.pImmutableSamplers = NULL
+    };
+    VkDescriptorSetLayoutBinding bindlessbindings[] = {
+	{
+	    .binding = 0,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+	    .descriptorCount = BINDLESSCOUNT,
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = NULL
+	},
+	{
+	    .binding = 1,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+	    .descriptorCount = 1,
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = &sampler
+	},
+	{
+	    .binding = 2,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+	    .descriptorCount = BINDLESSCOUNT,
+	    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+		VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = NULL
+	}
+    };
+    VkDescriptorBindingFlags bindingflags[] = {
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+	0,
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT dslbfci = {
+	.sType =
+	   VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+	.pNext = NULL,
+	.bindingCount = COUNT(bindingflags),
+	.pBindingFlags = bindingflags
+    };
+    VkDescriptorSetLayoutCreateInfo dslcis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .bindingCount = 1,
+	    .pBindings = &uniformbinding
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	    .pNext = &dslbfci,
+	    .flags =
+		VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+	    .bindingCount = COUNT(bindlessbindings),
+	    .pBindings = bindlessbindings
+	}
+    };
+    VkPushConstantRange pcr = {
+	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+	.offset = 0,
+	.size = sizeof(DrawConstants)
+    };
+    VkPipelineLayoutCreateInfo plci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.setLayoutCount = COUNT(setlayouts),
+	.pSetLayouts = setlayouts,
+	.pushConstantRangeCount = 1,
+	.pPushConstantRanges = &pcr
+    };
+    VkDescriptorPoolSize uniformsize = {
+	VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1
+    };
+    VkDescriptorPoolSize bindlesssizes[] = {
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,  BINDLESSCOUNT },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER,        1 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, BINDLESSCOUNT }
+    };
+    VkDescriptorPoolCreateInfo dpcis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .maxSets = 1,
+	    .poolSizeCount = 1,
+	    .pPoolSizes = &uniformsize
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+	    .maxSets = 1,
+	    .poolSizeCount = COUNT(bindlesssizes),
+	    .pPoolSizes = bindlesssizes
+	}
+    };
+    VkDescriptorSetAllocateInfo dsai = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+	.pNext = NULL,
+	.descriptorPool = VK_NULL_HANDLE,
+	.descriptorSetCount = 1,
+	.pSetLayouts = NULL
+    };
+    uint32_t i;
+
+    if (vkCreateSampler(device, &sci, NULL, &sampler) != VK_SUCCESS)
+	fail("create sampler");
+    for (i = 0; i < COUNT(setlayouts); i++) {
+	if (vkCreateDescriptorSetLayout(device, &dslcis[i], NULL,
+		    &setlayouts[i]) != VK_SUCCESS)
+	    fail("create descriptor set layout");
+	if (vkCreateDescriptorPool(device, &dpcis[i], NULL,
+		    &descriptorpools[i]) != VK_SUCCESS)
+	    fail("create descriptor pool");
+	dsai.descriptorPool = descriptorpools[i];
+	dsai.pSetLayouts = &setlayouts[i];
+	if (vkAllocateDescriptorSets(device, &dsai, &sets[i]) != VK_SUCCESS)
+	    fail("allocate descriptor set");
+    }
+    if (vkCreatePipelineLayout(device, &plci, NULL, &pipelinelayout) !=
+	    VK_SUCCESS)
+	fail("create pipeline layout");
+}
+
+/* The renderer's textured vertex colour variant, in one piece, from the
+ * scene pipeline state in pipeline.h */
+VkPipeline
+createpipeline(VkPipelineCache cache)
+{
+    PipelineKey key = {
+	.colourmode = COLOUR_VERTEX,
+	.textured = VK_TRUE
+    };
+    VkSpecializationInfo si = {
+	.mapEntryCount = COUNT(pipespecentries),
+	.pMapEntries = pipespecentries,
+	.dataSize = sizeof key,
+	.pData = &key
+    };
+    VkPipelineShaderStageCreateInfo psscis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .stage = VK_SHADER_STAGE_VERTEX_BIT,
+	    .module = modules[0],
+	    .pName = "main",
+	    .pSpecializationInfo = NULL
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .module = modules[1],
+	    .pName = "main",
+	    .pSpecializationInfo = &si
+	}
+    };
+    VkGraphicsPipelineCreateInfo gpci = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.stageCount = COUNT(psscis),
+	.pStages = psscis,
+	.pVertexInputState = &pipevertexinput,
+	.pInputAssemblyState = &pipeinputassembly,
+	.pTessellationState = NULL,
+	.pViewportState = &pipeviewport,
+	.pRasterizationState = &piperasterisation,
+	.pMultisampleState = &pipemultisample,
+	.pDepthStencilState = NULL,
+	.pColorBlendState = &pipeblend,
+	.pDynamicState = &pipedynamic,
+	.layout = pipelinelayout,
+	.renderPass = renderpass,
+	.subpass = 0,
+	.basePipelineHandle = VK_NULL_HANDLE,
+	.basePipelineIndex = -1
+    };
+    VkPipeline p;
+
+    if (vkCreateGraphicsPipelines(device, cache, 1, &gpci, NULL, &p) !=
+	    VK_SUCCESS)
+	fail("create graphics pipeline");
+
+    return p;
+}
+
+/* Uniforms, then a triangle's vertices and indices, in one mapped buffer */
+void
+createbuffer(void)
+{
+    static const MeshVertex vertices[] = {
+	{ {      0, -16384, 0, 32767 }, { 0, 0 }, 0xff0000ff },
+	{ {  16384,  16384, 0, 32767 }, { 0, 0 }, 0xff00ff00 },
+	{ { -16384,  16384, 0, 32767 }, { 0, 0 }, 0xffff0000 }
+    };
+    static const uint32_t indices[] = { 0, 1, 2 };
+    VkBufferCreateInfo bci = {
+	.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.size = BUFFERSIZE,
+	.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+	    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+	    VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    VkDescriptorBufferInfo dbi = {
+	.buffer = VK_NULL_HANDLE,
+	.offset = 0,
+	.range = UNIFORMSIZE
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = VK_NULL_HANDLE,
+	.dstBinding = 0,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.pImageInfo = NULL,
+	.pBufferInfo = &dbi,
+	.pTexelBufferView = NULL
+    };
+    VkMemoryRequirements mr;
+    unsigned char *data;
+
+    if (vkCreateBuffer(device, &bci, NULL, &buffer) != VK_SUCCESS)
+	fail("create buffer");
+    vkGetBufferMemoryRequirements(device, buffer, &mr);
+    mai.allocationSize = mr.size;
+    mai.memoryTypeIndex = findmemorytype(mr.memoryTypeBits,
+	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (vkAllocateMemory(device, &mai, NULL, &buffermemory) != VK_SUCCESS ||
+	    vkBindBufferMemory(device, buffer, buffermemory, 0) != VK_SUCCESS ||
+	    vkMapMemory(device, buffermemory, 0, BUFFERSIZE, 0,
+		(void **) &data) != VK_SUCCESS)
+	fail("allocate buffer memory");
+
+    memset(data, 0, BUFFERSIZE);
+    memcpy(data + VERTEXOFFSET, vertices, sizeof vertices);
+    memcpy(data + INDEXOFFSET, indices, sizeof indices);
+    vkUnmapMemory(device, buffermemory);
+
+    dbi.buffer = buffer;
+    wds.dstSet = sets[0];
+    vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
+}
+
+/* Empty command buffers for the submits, recorded once */
+void
+createcommands(void)
+{
+    VkCommandPoolCreateInfo cpci = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+	.queueFamilyIndex = queuefamily
+    };
+    VkCommandBufferAllocateInfo cbai = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+	.pNext = NULL,
+	.commandPool = VK_NULL_HANDLE,
+	.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+	.commandBufferCount = 1
+    };
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.pInheritanceInfo = NULL
+    };
+    VkFenceCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0
+    };
+    VkSemaphoreCreateInfo sci = {
+	.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0
+    };
+    uint32_t i;
+
+    if (vkCreateCommandPool(device, &cpci, NULL, &commandpool) != VK_SUCCESS)
+	fail("create command pool");
+    cbai.commandPool = commandpool;
+    if (vkAllocateCommandBuffers(device, &cbai, &recordcb) != VK_SUCCESS)
+	fail("allocate command buffer");
+    cbai.commandBufferCount = MAXBATCH;
+    if (vkAllocateCommandBuffers(device, &cbai, emptycbs) != VK_SUCCESS)
+	fail("allocate command buffers");
+    for (i = 0; i < MAXBATCH; i++)
+	if (vkBeginCommandBuffer(emptycbs[i], &cbbi) != VK_SUCCESS ||
+		vkEndCommandBuffer(emptycbs[i]) != VK_SUCCESS)
+	    fail("record command buffer");
+
+    if (vkCreateFence(device, &fci, NULL, &fence) != VK_SUCCESS ||
+	    vkCreateSemaphore(device, &sci, NULL, &semaphore) != VK_SUCCESS)
+	fail("create sync objects");
+}
+
+/* As the renderer recreates its swap chain, less the render target */
+void
+createswapchain(void)
+{
+    VkSwapchainCreateInfoKHR ci = {
+	.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+	.pNext = NULL,
+	.flags = 0,
+	.surface = surface,
+	.minImageCount = 0,
+	.imageFormat = VK_FORMAT_UNDEFINED,
+	.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+	.imageExtent = { 1280, 720 },
+	.imageArrayLayers = 1,
+	.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+	.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL,
+	.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
+	.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+	.presentMode = VK_PRESENT_MODE_FIFO_KHR,
+	.clipped = VK_TRUE,
+	.oldSwapchain = VK_NULL_HANDLE
+    };
+    VkImageViewCreateInfo ivci = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.image = VK_NULL_HANDLE,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = VK_FORMAT_UNDEFINED,
+	.components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    VkSurfaceCapabilitiesKHR caps;
+    VkSurfaceFormatKHR format;
+    VkImage *images;
+    uint32_t count = 1, i;
+
+    /* VK_INCOMPLETE with more than one, the first format will do */
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicaldevice, surface,
+	    &caps);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physicaldevice, surface, &count,
+	    &format);
+    if (count == 0)
+	fail("find a surface format");
+    ci.minImageCount = caps.minImageCount + 1;
+    if (caps.maxImageCount > 0 && ci.minImageCount > caps.maxImageCount)
+	ci.minImageCount = caps.maxImageCount;
+    ci.imageFormat = ivci.format = format.format;
+    ci.imageColorSpace = format.colorSpace;
+    if (caps.currentExtent.width != UINT32_MAX)
+	ci.imageExtent = caps.currentExtent;
+    if (caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+	ci.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    ci.preTransform = caps.currentTransform;
+
+    if (vkCreateSwapchainKHR(device, &ci, NULL, &swapchain) != VK_SUCCESS)
+	fail("create swap chain");
+    vkGetSwapchainImagesKHR(device, swapchain, &swapchaincount, NULL);
+    images = (VkImage *) malloc(swapchaincount * sizeof(VkImage));
+    swapchainviews = (VkImageView *) malloc(swapchaincount *
+	    sizeof(VkImageView));
+    if (images == NULL || swapchainviews == NULL)
+	fail("allocate swap chain images");
+    vkGetSwapchainImagesKHR(device, swapchain, &swapchaincount, images);
+    for (i = 0; i < swapchaincount; i++) {
+	ivci.image = images[i];
+	if (vkCreateImageView(device, &ivci, NULL, &swapchainviews[i]) !=
+		VK_SUCCESS)
+	    fail("create swap chain image view");
+    }
+    free(images);
+}
+
+void
+destroyswapchain(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < swapchaincount; i++)
+	vkDestroyImageView(device, swapchainviews[i], NULL);
+    free(swapchainviews);
+    vkDestroySwapchainKHR(device, swapchain, NULL);
+}
+
+void
+destroyall(void)
+{
+    uint32_t i;
+
+    vkDeviceWaitIdle(device);
+    vkDestroySemaphore(device, semaphore, NULL);
+    vkDestroyFence(device, fence, NULL);
+    vkDestroyCommandPool(device, commandpool, NULL);
+    vkDestroyBuffer(device, buffer, NULL);
+    vkFreeMemory(device, buffermemory, NULL);
+    vkDestroyPipeline(device, pipeline, NULL);
+    vkDestroyPipelineCache(device, pipelinecache, NULL);
+    vkDestroyPipelineLayout(device, pipelinelayout, NULL);
+    for (i = 0; i < COUNT(setlayouts); i++) {
+	vkDestroyDescriptorPool(device, descriptorpools[i], NULL);
+	vkDestroyDescriptorSetLayout(device, setlayouts[i], NULL);
+    }
+    vkDestroySampler(device, sampler, NULL);
+    for (i = 0; i < COUNT(modules); i++) {
+	vkDestroyShaderModule(device, modules[i], NULL);
+	free(spirv[i]);
+    }
+    vkDestroyFramebuffer(device, framebuffer, NULL);
+    vkDestroyImageView(device, targetview, NULL);
+    vkDestroyImage(device, targetimage, NULL);
+    vkFreeMemory(device, targetmemory, NULL);
+    vkDestroyRenderPass(device, renderpass, NULL);
+    if (hasheadless) {
+	destroyswapchain();
+	vkDestroySurfaceKHR(instance, surface, NULL);
+    }
+    vkDestroyDevice(device, NULL);
+    vkDestroyInstance(instance, NULL);
+}
+
+/* Student's t, close enough past the table */
+double
+tquantile(uint32_t df)
+{
+    if (df == 0)
+	return 0.0;
+    if (df <= COUNT(tquantiles))
+	return tquantiles[df - 1];
+
+    return 1.96 + 2.4 / df;
+}
+
+int
+comparedoubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Warms up while finding the iterations for a run, then times the runs */
+void
+bench(const char *name, BenchFunction f, uint32_t param)
+{
+    static double samples[MAXRUNS];
+    double t, mean = 0.0, var = 0.0;
+    uint32_t iterations = 1, r;
+
+    for (;;) {
+	t = gettime();
+	f(param, iterations);
+	if (gettime() - t >= MINRUNTIME || iterations >= MAXITERATIONS)
+	    break;
+	iterations *= 2;
+    }
+
+    for (r = 0; r < runs; r++) {
+	t = gettime();
+	f(param, iterations);
+	samples[r] = (gettime() - t) / iterations * 1e6;
+	mean += samples[r];
+    }
+    mean /= runs;
+    for (r = 0; r < runs; r++)
+	var += (samples[r] - mean) * (samples[r] - mean);
+    var = runs > 1 ? var / (runs - 1) : 0.0;
+    qsort(samples, runs, sizeof samples[0], comparedoubles);
+
+    printf("%s,%u,%u,%u,%.3f,%.3f,%.3f,%.3f\n", name, param, runs,
+	    iterations, mean, tquantile(runs - 1) * sqrt(var / runs),
+	    samples[runs / 2], samples[0]);
+    fflush(stdout);
+}
+
+/* 0 is the vertex shader, 1 the fragment */
+void
+benchshadermodule(uint32_t param, uint32_t iterations)
+{
+    VkShaderModuleCreateInfo ci = {
+	.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.codeSize = spirvsize[param],
+	.pCode = spirv[param]
+    };
+    VkShaderModule sm;
+    uint32_t i;
+
+    for (i = 0; i < iterations; i++) {
+	if (vkCreateShaderModule(device, &ci, NULL, &sm) != VK_SUCCESS)
+	    fail("create shader module");
+	vkDestroyShaderModule(device, sm, NULL);
+    }
+}
+
+/* 0 without a pipeline cache, 1 from one that already has it */
+void
+benchpipeline(uint32_t param, uint32_t iterations)
+{
+    uint32_t i;
+
+    for (i = 0; i < iterations; i++)
+	vkDestroyPipeline(device, createpipeline(param ? pipelinecache :
+		    VK_NULL_HANDLE), NULL);
+}
+
+void
+benchswapchain(uint32_t param, uint32_t iterations)
+{
+    uint32_t i;
+
+    (void) param;
+    for (i = 0; i < iterations; i++) {
+	vkDeviceWaitIdle(device);
+	destroyswapchain();
+	createswapchain();
+    }
+}
+
+/* The scene pass as drawscene() records it, a triangle a draw */
+void
+benchrecord(uint32_t draws, uint32_t iterations)
+{
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.pInheritanceInfo = NULL
+    };
+    VkClearValue clear = { .color.float32 = { 0.0f, 0.0f, 0.0f, 1.0f } };
+    VkRenderPassBeginInfo rpbi = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+	.pNext = NULL,
+	.renderPass = renderpass,
+	.framebuffer = framebuffer,
+	.renderArea.offset = { 0, 0 },
+	.renderArea.extent = { TARGETSIZE, TARGETSIZE },
+	.clearValueCount = 1,
+	.pClearValues = &clear
+    };
+    VkViewport viewport = {
+	.x = 0.0f,
+	.y = 0.0f,
+	.width = (float) TARGETSIZE,
+	.height = (float) TARGETSIZE,
+	.minDepth = 0.0f,
+	.maxDepth = 1.0f
+    };
+    VkRect2D scissor = {
+	.offset = { 0, 0 },
+	.extent = { TARGETSIZE, TARGETSIZE }
+    };
+    DrawConstants dc = {
+	.offset = { 0.0f, 0.0f },
+	.scale = 0.01f,
+	.rotation = 0.0f,
+	.texture = NOHANDLE,
+	.buffer = NOHANDLE,
+	.minlod = 0.0f
+    };
+    VkDeviceSize vertexoffset = VERTEXOFFSET;
+    uint32_t dynamicoffset = 0, i, d;
+
+    for (i = 0; i < iterations; i++) {
+	vkResetCommandBuffer(recordcb, 0);
+	if (vkBeginCommandBuffer(recordcb, &cbbi) != VK_SUCCESS)
+	    fail("begin command buffer");
+	vkCmdBeginRenderPass(recordcb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(recordcb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		pipeline);
+	vkCmdSetViewport(recordcb, 0, 1, &viewport);
+	vkCmdSetScissor(recordcb, 0, 1, &scissor);
+	vkCmdBindDescriptorSets(recordcb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		pipelinelayout, 0, COUNT(sets), sets, 1, &dynamicoffset);
+	vkCmdBindVertexBuffers(recordcb, 0, 1, &buffer, &vertexoffset);
+	vkCmdBindIndexBuffer(recordcb, buffer, INDEXOFFSET,
+		VK_INDEX_TYPE_UINT32);
+	for (d = 0; d < draws; d++) {
+	    dc.offset[0] = (float) (d % 100) * 0.02f - 1.0f;
+	    dc.offset[1] = (float) (d / 100 % 100) * 0.02f - 1.0f;
+	    vkCmdPushConstants(recordcb, pipelinelayout,
+		    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+		    0, sizeof dc, &dc);
+	    vkCmdDrawIndexed(recordcb, 3, 1, 0, 0, 0);
+	}
+	vkCmdEndRenderPass(recordcb);
+	if (vkEndCommandBuffer(recordcb) != VK_SUCCESS)
+	    fail("record command buffer");
+    }
+}
+
+/* One submit of a batch of command buffers, waited for */
+void
+benchsubmitbatched(uint32_t batch, uint32_t iterations)
+{
+    VkSubmitInfo si = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.pNext = NULL,
+	.waitSemaphoreCount = 0,
+	.pWaitSemaphores = NULL,
+	.pWaitDstStageMask = NULL,
+	.commandBufferCount = batch,
+	.pCommandBuffers = emptycbs,
+	.signalSemaphoreCount = 0,
+	.pSignalSemaphores = NULL
+    };
+    uint32_t i;
+
+    for (i = 0; i < iterations; i++) {
+	if (vkQueueSubmit(queue, 1, &si, fence) != VK_SUCCESS)
+	    fail("submit");
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device, 1, &fence);
+    }
+}
+
+/* The same command buffers a submit each, the last one waited for */
+void
+benchsubmitcalls(uint32_t batch, uint32_t iterations)
+{
+    VkSubmitInfo si = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.pNext = NULL,
+	.waitSemaphoreCount = 0,
+	.pWaitSemaphores = NULL,
+	.pWaitDstStageMask = NULL,
+	.commandBufferCount = 1,
+	.pCommandBuffers = NULL,
+	.signalSemaphoreCount = 0,
+	.pSignalSemaphores = NULL
+    };
+    uint32_t i, b;
+
+    for (i = 0; i < iterations; i++) {
+	for (b = 0; b < batch; b++) {
+	    si.pCommandBuffers = &emptycbs[b];
+	    if (vkQueueSubmit(queue, 1, &si, b + 1 == batch ? fence :
+			VK_NULL_HANDLE) != VK_SUCCESS)
+		fail("submit");
+	}
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device, 1, &fence);
+    }
+}
+
+/* A submit of nothing, signalling the fence the CPU waits on */
+void
+benchfence(uint32_t param, uint32_t iterations)
+{
+    uint32_t i;
+
+    (void) param;
+    for (i = 0; i < iterations; i++) {
+	if (vkQueueSubmit(queue, 0, NULL, fence) != VK_SUCCESS)
+	    fail("submit");
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device, 1, &fence);
+    }
+}
+
+/* The fence round trip with a semaphore between two batches, as acquire
+ * to render to present chains them */
+void
+benchsemaphore(uint32_t param, uint32_t iterations)
+{
+    VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo sis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	    .pNext = NULL,
+	    .waitSemaphoreCount = 0,
+	    .pWaitSemaphores = NULL,
+	    .pWaitDstStageMask = NULL,
+	    .commandBufferCount = 0,
+	    .pCommandBuffers = NULL,
+	    .signalSemaphoreCount = 1,
+	    .pSignalSemaphores = &semaphore
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	    .pNext = NULL,
+	    .waitSemaphoreCount = 1,
+	    .pWaitSemaphores = &semaphore,
+	    .pWaitDstStageMask = &stage,
+	    .commandBufferCount = 0,
+	    .pCommandBuffers = NULL,
+	    .signalSemaphoreCount = 0,
+	    .pSignalSemaphores = NULL
+	}
+    };
+    uint32_t i;
+
+    (void) param;
+    for (i = 0; i < iterations; i++) {
+	if (vkQueueSubmit(queue, COUNT(sis), sis, fence) != VK_SUCCESS)
+	    fail("submit");
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkResetFences(device, 1, &fence);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const uint32_t drawcounts[] = { 1, 100, 1000, MAXDRAWS };
+    static const uint32_t batches[] = { 1, 4, 16, MAXBATCH };
+    VkHeadlessSurfaceCreateInfoEXT hsci = {
+	.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+	.pNext = NULL,
+	.flags = 0
+    };
+    VkPipelineCacheCreateInfo pcci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.initialDataSize = 0,
+	.pInitialData = NULL
+    };
+    VkShaderModuleCreateInfo smci = {
+	.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.codeSize = 0,
+	.pCode = NULL
+    };
+    PFN_vkCreateHeadlessSurfaceEXT createheadlesssurface;
+    uint32_t i;
+
+    if (argc >= 2)
+	runs = (uint32_t) atoi(argv[1]);
+    if (argc > 2 || runs < 2 || runs > MAXRUNS) {
+	fprintf(stderr, "Usage: %s [runs]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    createinstance();
+    createdevice();
+    for (i = 0; i < COUNT(modules); i++) {
+	spirv[i] = loadspirv(shaderfiles[i], &spirvsize[i]);
+	smci.codeSize = spirvsize[i];
+	smci.pCode = spirv[i];
+	if (vkCreateShaderModule(device, &smci, NULL, &modules[i]) !=
+		VK_SUCCESS)
+	    fail("create shader module");
+    }
+    createtarget();
+    createlayouts();
+    if (vkCreatePipelineCache(device, &pcci, NULL, &pipelinecache) !=
+	    VK_SUCCESS)
+	fail("create pipeline cache");
+    pipeline = createpipeline(pipelinecache);
+    createbuffer();
+    createcommands();
+    if (hasheadless) {
+	createheadlesssurface = (PFN_vkCreateHeadlessSurfaceEXT)
+	    vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+	if (createheadlesssurface == NULL || createheadlesssurface(instance,
+		    &hsci, NULL, &surface) != VK_SUCCESS)
+	    fail("create headless surface");
+	createswapchain();
+    } else {
+	fprintf(stderr, "No headless surface, skipping the swap chain.\n");
+    }
+
+    printf("benchmark,param,runs,iterations,mean_us,ci95_us,median_us,"
+	    "min_us\n");
+    bench("createshadermodule_vertex", benchshadermodule, 0);
+    bench("createshadermodule_fragment", benchshadermodule, 1);
+    bench("creategraphicspipeline_cold", benchpipeline, 0);
+    bench("creategraphicspipeline_cached", benchpipeline, 1);
+    if (hasheadless)
+	bench("recreateswapchain", benchswapchain, 0);
+    for (i = 0; i < COUNT(drawcounts); i++)
+	bench("recordcommandbuffer", benchrecord, drawcounts[i]);
+    for (i = 0; i < COUNT(batches); i++)
+	bench("queuesubmit_batched", benchsubmitbatched, batches[i]);
+    for (i = 0; i < COUNT(batches); i++)
+	bench("queuesubmit_calls", benchsubmitcalls, batches[i]);
+    bench("fence_roundtrip", benchfence, 0);
+    bench("semaphore_roundtrip", benchsemaphore, 0);
+
+    destroyall();
+
+    return EXIT_SUCCESS;
+}
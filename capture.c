@@ -0,0 +1,371 @@
+/* Frame capture.
+ * Presented images are copied into a ring of host-visible buffers and read
+ * back MAXFRAMES later, once the frame's fence has signalled, so the GPU is
+ * never waited on. A writer thread streams them to a file or stdout as raw
+ * RGBA or Y4M. If the writer falls behind frames are dropped, not waited for.
+ */
+
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "capture.h"
+#include "config.h"
+#include "trace.h"
+#include "mem.h"
+#include "util.h"
+#include "vulkan.h"
+
+/* Macros */
+#define NOSLOT UINT32_MAX
+/* Frames in flight plus slack for the writer */
+#define SLOTCOUNT (MAXFRAMES + 2)
+
+/* Types */
+
+enum { SLOT_FREE, SLOT_GPU, SLOT_QUEUED };
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    unsigned char *data;
+    uint32_t state;
+} Slot;
+
+/* Function declarations */
+static VkMemoryPropertyFlags readbackproperties(void);
+static void writeraw(const unsigned char *data);
+static void writey4m(const unsigned char *data);
+static DWORD WINAPI writerthread(LPVOID param);
+
+/* Variables */
+static uint32_t active;
+static FILE *out;
+static VkExtent2D capextent;
+/* Swap chain is BGRA, swap to RGBA on output */
+static uint32_t swizzle;
+static Slot slots[SLOTCOUNT];
+static uint32_t pending[MAXFRAMES];
+/* Queued slots in frame order, guarded by caplock */
+static uint32_t queue[SLOTCOUNT];
+static uint32_t queuehead, queuecount;
+static SRWLOCK caplock = SRWLOCK_INIT;
+static CONDITION_VARIABLE capcond = CONDITION_VARIABLE_INIT;
+static uint32_t stopping;
+static HANDLE thread;
+static unsigned char *scratch;
+static uint64_t written, dropped, resized;
+/* Swap chain is a different size to the stream */
+static uint32_t paused;
+static uint32_t failed;
+
+/* Function implementations */
+
+VkMemoryPropertyFlags
+readbackproperties(void)
+{
+    VkPhysicalDeviceMemoryProperties pdmp;
+    VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    uint32_t i;
+
+    /* CPU reads from uncached memory are very slow, prefer cached */
+    vkGetPhysicalDeviceMemoryProperties(physicaldevice, &pdmp);
+    for (i = 0; i < pdmp.memoryTypeCount; i++)
+	if ((pdmp.memoryTypes[i].propertyFlags & cached) == cached)
+	    return cached;
+
+    return VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+}
+
+void
+writeraw(const unsigned char *data)
+{
+    size_t rowsize = (size_t) capextent.width * 4;
+    uint32_t x, y;
+
+    if (!swizzle) {
+	if (fwrite(data, rowsize, capextent.height, out) < capextent.height)
+	    failed = 1;
+	return;
+    }
+
+    for (y = 0; y < capextent.height; y++, data += rowsize) {
+	for (x = 0; x < capextent.width; x++) {
+	    scratch[4 * x + 0] = data[4 * x + 2];
+	    scratch[4 * x + 1] = data[4 * x + 1];
+	    scratch[4 * x + 2] = data[4 * x + 0];
+	    scratch[4 * x + 3] = data[4 * x + 3];
+	}
+	if (fwrite(scratch, rowsize, 1, out) < 1)
+	    failed = 1;
+    }
+}
+
+void
+writey4m(const unsigned char *data)
+{
+    size_t n = (size_t) capextent.width * capextent.height, i;
+    unsigned char *yp = scratch, *up = scratch + n, *vp = scratch + 2 * n;
+    int r, g, b;
+
+    /* BT.601 studio range, alpha is dropped */
+    for (i = 0; i < n; i++, data += 4) {
+	r = data[swizzle ? 2 : 0];
+	g = data[1];
+	b = data[swizzle ? 0 : 2];
+	yp[i] = (unsigned char) (((66 * r + 129 * g + 25 * b + 128) >> 8) +
+		16);
+	up[i] = (unsigned char) ((-38 * r - 74 * g + 112 * b + 128 + 32768) >>
+		8);
+	vp[i] = (unsigned char) ((112 * r - 94 * g - 18 * b + 128 + 32768) >>
+		8);
+    }
+
+    if (fputs("FRAME\n", out) == EOF || fwrite(scratch, n, 3, out) < 3)
+	failed = 1;
+}
+
+DWORD WINAPI
+writerthread(LPVOID param)
+{
+    uint32_t slot;
+
+    UNUSED(param);
+    TRACE_THREAD("capture writer");
+
+    AcquireSRWLockExclusive(&caplock);
+    for (;;) {
+	while (queuecount == 0 && !stopping)
+	    SleepConditionVariableSRW(&capcond, &caplock, INFINITE, 0);
+	if (queuecount == 0)
+	    break;
+
+	slot = queue[queuehead];
+	queuehead = (queuehead + 1) % SLOTCOUNT;
+	queuecount--;
+	ReleaseSRWLockExclusive(&caplock);
+
+	/* A broken pipe stops the output but not the renderer */
+	if (!failed) {
+	    TRACE_BEGIN("write frame");
+	    if (capturey4m)
+		writey4m(slots[slot].data);
+	    else
+		writeraw(slots[slot].data);
+	    fflush(out);
+	    TRACE_END();
+	}
+
+	AcquireSRWLockExclusive(&caplock);
+	if (failed)
+	    dropped++;
+	else
+	    written++;
+	slots[slot].state = SLOT_FREE;
+    }
+    ReleaseSRWLockExclusive(&caplock);
+
+    return 0;
+}
+
+/* An empty capturefile disables capture, "-" writes to stdout */
+void
+cap_initialise(VkFormat format, VkExtent2D extent)
+{
+    VkDeviceSize size = (VkDeviceSize) extent.width * extent.height * 4;
+    VkMemoryPropertyFlags properties;
+    uint32_t i;
+
+    if (capturefile[0] == '\0')
+	return;
+
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+	swizzle = 0;
+	break;
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+	swizzle = 1;
+	break;
+    default:
+	terminate("Capture needs an 8 bit RGBA or BGRA swap chain.");
+    }
+
+    if (strcmp(capturefile, "-") == 0) {
+	out = stdout;
+	_setmode(_fileno(stdout), _O_BINARY);
+    } else if ((out = fopen(capturefile, "wb")) == NULL) {
+	terminate("Could not open capture file %s.\n", capturefile);
+    }
+    if (capturey4m)
+	fprintf(out, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", extent.width,
+		extent.height, capturefps);
+
+    /* The stream is a fixed size, frames of any other size are dropped
+     * until the window is back to it */
+    capextent = extent;
+    paused = 0;
+    scratch = (unsigned char *) malloc(capturey4m ? (size_t) size / 4 * 3 :
+	    (size_t) extent.width * 4);
+
+    properties = readbackproperties();
+    for (i = 0; i < SLOTCOUNT; i++) {
+	vk_createbuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties,
+		&slots[i].buffer, &slots[i].memory);
+	if (vkMapMemory(device, slots[i].memory, 0, VK_WHOLE_SIZE, 0,
+		    (void **) &slots[i].data) != VK_SUCCESS)
+	    terminate("Failed to map capture buffer.");
+	slots[i].state = SLOT_FREE;
+    }
+    for (i = 0; i < MAXFRAMES; i++)
+	pending[i] = NOSLOT;
+
+    stopping = 0;
+    if ((thread = CreateThread(NULL, 0, writerthread, NULL, 0, NULL)) ==
+	    NULL)
+	terminate("Failed to create capture writer thread.");
+    active = 1;
+}
+
+/* The GPU must be idle */
+void
+cap_terminate(void)
+{
+    uint32_t i;
+
+    if (!active)
+	return;
+
+    for (i = 0; i < MAXFRAMES; i++)
+	cap_collect(i);
+
+    AcquireSRWLockExclusive(&caplock);
+    stopping = 1;
+    WakeAllConditionVariable(&capcond);
+    ReleaseSRWLockExclusive(&caplock);
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    fprintf(stderr, "Captured %llu frames, dropped %llu behind the writer, "
+	    "%llu on resize.%s\n", (unsigned long long) written,
+	    (unsigned long long) dropped, (unsigned long long) resized,
+	    failed ? " Output failed." : "");
+
+    for (i = 0; i < SLOTCOUNT; i++) {
+	vkUnmapMemory(device, slots[i].memory);
+	vkDestroyBuffer(device, slots[i].buffer, &allocator);
+	vkFreeMemory(device, slots[i].memory, &allocator);
+    }
+    free(scratch);
+    if (out != stdout)
+	fclose(out);
+    active = 0;
+}
+
+/* Image must be in the transfer source layout, the render graph puts it
+ * there */
+void
+cap_record(VkCommandBuffer cb, uint32_t frame, VkImage image,
+	VkExtent2D extent)
+{
+    VkBufferMemoryBarrier bmb = {
+	.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+	.pNext = NULL,
+	/* Visible to the host once the frame's fence signals */
+	.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+	.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.buffer = VK_NULL_HANDLE,
+	.offset = 0,
+	.size = VK_WHOLE_SIZE
+    };
+    VkBufferImageCopy region = {
+	.bufferOffset = 0,
+	.bufferRowLength = 0,
+	.bufferImageHeight = 0,
+	.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+	.imageSubresource.mipLevel = 0,
+	.imageSubresource.baseArrayLayer = 0,
+	.imageSubresource.layerCount = 1,
+	.imageOffset = { 0, 0, 0 },
+	.imageExtent = { extent.width, extent.height, 1 }
+    };
+    uint32_t slot = NOSLOT, i;
+
+    if (!active)
+	return;
+
+    AcquireSRWLockExclusive(&caplock);
+    if (extent.width != capextent.width ||
+	    extent.height != capextent.height) {
+	/* The stream can't change size, say so rather than stop silently */
+	if (!paused)
+	    fprintf(stderr, "Capture paused, the window is %ux%u and the "
+		    "stream %ux%u.\n", extent.width, extent.height,
+		    capextent.width, capextent.height);
+	paused = 1;
+	resized++;
+    } else {
+	if (paused)
+	    fprintf(stderr, "Capture resumed.\n");
+	paused = 0;
+	for (i = 0; i < SLOTCOUNT; i++)
+	    if (slots[i].state == SLOT_FREE) {
+		slot = i;
+		slots[i].state = SLOT_GPU;
+		break;
+	    }
+	/* Never wait for the writer */
+	if (slot == NOSLOT)
+	    dropped++;
+    }
+    ReleaseSRWLockExclusive(&caplock);
+
+    if (slot == NOSLOT)
+	return;
+
+    vkCmdCopyImageToBuffer(cb, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	    slots[slot].buffer, 1, &region);
+    bmb.buffer = slots[slot].buffer;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &bmb, 0, NULL);
+    pending[frame] = slot;
+}
+
+/* Call once the frame's fence has signalled */
+void
+cap_collect(uint32_t frame)
+{
+    uint32_t slot = active ? pending[frame] : NOSLOT;
+    VkMappedMemoryRange mmr = {
+	.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+	.pNext = NULL,
+	.memory = VK_NULL_HANDLE,
+	.offset = 0,
+	.size = VK_WHOLE_SIZE
+    };
+
+    if (slot == NOSLOT)
+	return;
+    pending[frame] = NOSLOT;
+
+    /* Cached memory isn't coherent */
+    mmr.memory = slots[slot].memory;
+    vkInvalidateMappedMemoryRanges(device, 1, &mmr);
+
+    AcquireSRWLockExclusive(&caplock);
+    slots[slot].state = SLOT_QUEUED;
+    queue[(queuehead + queuecount) % SLOTCOUNT] = slot;
+    queuecount++;
+    WakeAllConditionVariable(&capcond);
+    ReleaseSRWLockExclusive(&caplock);
+}
@@ -0,0 +1,7 @@
+#include <vulkan/vulkan.h>
+
+void cap_initialise(VkFormat format, VkExtent2D extent);
+void cap_terminate(void);
+void cap_record(VkCommandBuffer cb, uint32_t frame, VkImage image,
+	VkExtent2D extent);
+void cap_collect(uint32_t frame);
@@ -0,0 +1,226 @@
+/* Command stream capture.
+ * Writes the scene pass of a run of frames as the commands recorded, with
+ * the shaders, mesh, textures and uniforms they use, for tools/replay to
+ * execute headless and time. The sprites and the post-processing aren't
+ * captured. While not capturing, each draw only tests a flag. A frame is
+ * begun and ended on the main thread around the job recording it, so only
+ * one thread writes at a time and no lock is taken. Writes go through a
+ * large stdio buffer so capturing a draw is a copy.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#include "cmdstream.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "util.h"
+#include "vulkan.h"
+
+/* Macros */
+#define BUFFERSIZE (1 << 20)
+
+/* Function declarations */
+static void put(const void *data, size_t size);
+static void finish(void);
+
+/* Variables */
+static FILE *out;
+static const char *outname;
+static uint64_t firstframe;
+static uint32_t framestodo;
+static uint32_t framecount;
+static uint32_t capturing;
+
+/* Function implementations */
+
+void
+put(const void *data, size_t size)
+{
+    if (fwrite(data, 1, size, out) != size)
+	terminate("Error on writing file %s.\n", outname);
+}
+
+/* The header's frame count is written last so a file cut short by a crash
+ * reads as empty rather than truncated */
+void
+finish(void)
+{
+    if (fseek(out, offsetof(CsHeader, framecount), SEEK_SET) != 0 ||
+	    fwrite(&framecount, sizeof framecount, 1, out) != 1 ||
+	    fclose(out) != 0)
+	terminate("Error on writing file %s.\n", outname);
+    out = NULL;
+    fprintf(stderr, "Captured the commands of %u frames to %s.\n",
+	    framecount, outname);
+}
+
+/* An empty filename leaves capture off */
+void
+cs_initialise(const char *filename, uint64_t first, uint32_t count)
+{
+    CsHeader h = {
+	.magic = { 'C', 'M', 'D', 'S' },
+	.version = CS_VERSION,
+	.vertexsize = sizeof(MeshVertex),
+	.constantsize = sizeof(DrawConstants),
+	.keysize = sizeof(PipelineKey),
+	.framecount = 0
+    };
+
+    if (filename[0] == '\0' || count == 0)
+	return;
+
+    if ((out = fopen(filename, "wb")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+    if (setvbuf(out, NULL, _IOFBF, BUFFERSIZE) != 0)
+	terminate("Failed to buffer file %s.\n", filename);
+    outname = filename;
+    firstframe = first;
+    framestodo = count;
+    put(&h, sizeof h);
+}
+
+/* Keeps what was captured if the run ends first */
+void
+cs_terminate(void)
+{
+    if (out != NULL)
+	finish();
+}
+
+/* The SPIR-V as loaded at startup, a reload while capturing isn't seen */
+void
+cs_shader(VkShaderStageFlagBits stage, const char *filename)
+{
+    uint32_t s = (uint32_t) stage;
+    CsCommand c = {
+	.op = CS_SHADER,
+	.size = 0
+    };
+    char *code;
+    long size;
+    FILE *fp;
+
+    if (out == NULL)
+	return;
+
+    if ((fp = fopen(filename, "rb")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+    if (fseek(fp, 0L, SEEK_END) != 0 || (size = ftell(fp)) < 0)
+	terminate("Error on seeking file %s.\n", filename);
+    rewind(fp);
+    if (size % 4 != 0)
+	terminate("File %s is not SPIR-V.\n", filename);
+    if ((code = (char *) malloc(size)) == NULL)
+	terminate("Failed to allocate shader code.\n");
+    if (fread(code, 1, size, fp) != (size_t) size)
+	terminate("Error reading file %s.\n", filename);
+    if (fclose(fp) == EOF)
+	terminate("Error on closing file %s.\n", filename);
+
+    c.size = sizeof s + (uint32_t) size;
+    put(&c, sizeof c);
+    put(&s, sizeof s);
+    put(code, size);
+    free(code);
+}
+
+/* Before the host copy of the mesh is freed */
+void
+cs_mesh(const void *vertices, uint32_t vertexcount, const uint32_t *indices,
+	uint32_t indexcount)
+{
+    CsMesh m = {
+	.vertexcount = vertexcount,
+	.indexcount = indexcount
+    };
+    uint64_t size = sizeof m + (uint64_t) vertexcount * sizeof(MeshVertex) +
+	(uint64_t) indexcount * sizeof(uint32_t);
+    CsCommand c = {
+	.op = CS_MESH,
+	.size = (uint32_t) size
+    };
+
+    if (out == NULL)
+	return;
+
+    if (size > UINT32_MAX)
+	terminate("Mesh is too large to capture.\n");
+    put(&c, sizeof c);
+    put(&m, sizeof m);
+    put(vertices, vertexcount * sizeof(MeshVertex));
+    put(indices, indexcount * sizeof(uint32_t));
+}
+
+/* While capturing, by the thread recording the frame */
+void
+cs_texture(const CsTexture *t, const unsigned char *const *levels,
+	const uint64_t *lengths)
+{
+    uint64_t size = sizeof *t;
+    CsCommand c = {
+	.op = CS_TEXTURE,
+	.size = 0
+    };
+    uint32_t i;
+
+    for (i = 0; i < t->levelcount; i++)
+	size += lengths[i];
+    if (size > UINT32_MAX)
+	terminate("Texture is too large to capture.\n");
+    c.size = (uint32_t) size;
+    put(&c, sizeof c);
+    put(t, sizeof *t);
+    for (i = 0; i < t->levelcount; i++)
+	put(levels[i], (size_t) lengths[i]);
+}
+
+/* Main thread, before the frame is recorded. Frames presented again
+ * without drawing aren't begun. */
+void
+cs_beginframe(uint64_t frame)
+{
+    if (out == NULL || frame < firstframe)
+	return;
+
+    capturing = 1;
+    cs_command(CS_BEGINFRAME, &frame, sizeof frame);
+}
+
+/* Main thread, once the frame is recorded and its uniforms written */
+void
+cs_endframe(const void *uniforms, uint32_t size)
+{
+    if (!capturing)
+	return;
+
+    cs_command(CS_UNIFORMS, uniforms, size);
+    cs_command(CS_ENDFRAME, NULL, 0);
+    capturing = 0;
+    if (++framecount == framestodo)
+	finish();
+}
+
+uint32_t
+cs_capturing(void)
+{
+    return capturing;
+}
+
+/* Only while capturing, from whichever thread is recording the frame */
+void
+cs_command(uint32_t op, const void *args, uint32_t size)
+{
+    CsCommand c = {
+	.op = op,
+	.size = size
+    };
+
+    put(&c, sizeof c);
+    if (size > 0)
+	put(args, size);
+}
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+/* File layout, little endian. A CsHeader then commands, each a CsCommand
+ * followed by its size bytes of arguments, always a multiple of four. The
+ * shaders and the mesh come first, then each frame is CS_BEGINFRAME, the
+ * scene pass and CS_ENDFRAME. A texture is written before the pass of the
+ * first frame that draws with it. The frame's uniforms come last as they're
+ * written alongside recording, they only have to be in place by the submit.
+ * Only the scene pass is captured, not the sprites or post-processing. */
+#define CS_VERSION 2
+
+enum {
+    CS_SHADER,          /* uint32_t VkShaderStageFlagBits, then SPIR-V */
+    CS_MESH,            /* CsMesh, its vertices, then its uint32_t indices */
+    CS_TEXTURE,         /* CsTexture, then each level's blocks, largest first */
+    CS_BEGINFRAME,      /* uint64_t frame number */
+    CS_BEGINPASS,       /* CsPass */
+    CS_BINDPIPELINE,    /* PipelineKey */
+    CS_PUSHCONSTANTS,   /* DrawConstants */
+    CS_DRAWINDEXED,     /* CsDraw */
+    CS_ENDPASS,         /* None */
+    CS_UNIFORMS,        /* The frame's uniform block */
+    CS_ENDFRAME,        /* None */
+    CS_OPCOUNT
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    /* Of MeshVertex, DrawConstants and PipelineKey, to catch a mismatch */
+    uint32_t vertexsize;
+    uint32_t constantsize;
+    uint32_t keysize;
+    /* Patched when the capture ends */
+    uint32_t framecount;
+} CsHeader;
+
+typedef struct {
+    uint32_t op;
+    uint32_t size;
+} CsCommand;
+
+typedef struct {
+    uint32_t vertexcount;
+    uint32_t indexcount;
+} CsMesh;
+
+/* Every level, whether or not it was resident. The draws' minimum LOD keeps
+ * sampling to the levels the renderer had. */
+typedef struct {
+    uint32_t handle;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelcount;
+    /* Texels per block and bytes per block, levels are tightly packed rows
+     * of blocks */
+    uint32_t blockwidth;
+    uint32_t blockheight;
+    uint32_t blockbytes;
+} CsTexture;
+
+/* The whole render target and the sub-rect drawn at the render scale */
+typedef struct {
+    VkFormat format;
+    VkExtent2D target;
+    VkExtent2D extent;
+    float clear[4];
+} CsPass;
+
+typedef struct {
+    uint32_t indexcount;
+    uint32_t instancecount;
+    uint32_t firstindex;
+    int32_t vertexoffset;
+    uint32_t firstinstance;
+} CsDraw;
+
+void cs_initialise(const char *filename, uint64_t first, uint32_t count);
+void cs_terminate(void);
+void cs_shader(VkShaderStageFlagBits stage, const char *filename);
+void cs_mesh(const void *vertices, uint32_t vertexcount,
+	const uint32_t *indices, uint32_t indexcount);
+void cs_texture(const CsTexture *t, const unsigned char *const *levels,
+	const uint64_t *lengths);
+void cs_beginframe(uint64_t frame);
+void cs_endframe(const void *uniforms, uint32_t size);
+uint32_t cs_capturing(void);
+void cs_command(uint32_t op, const void *args, uint32_t size);
@@ -4,8 +4,115 @@ static const char         appname[] = "Vulkan Triangle";
 static const unsigned int appver    = VK_MAKE_VERSION(1, 0, 0);
 static const unsigned int appwidth  = 800;
 static const unsigned int appheight = 600;
+/* Extra windows showing the frame, up to 3. Their swap chains are written
+ * in the frame's submission and presented in the same call as the main
+ * window's. */
+static const uint32_t viewwindows = 0;
 
 static const char vertexshader[]   = "shaders/vertex.spv";
 static const char fragmentshader[] = "shaders/fragment.spv";
 static const char shaderentry[]    = "main";
-static const uint32_t vertexcount  = 3;
+
+/* Mesh drawn for every object, packed offline by meshpack. An empty
+ * filename draws the triangle. */
+static const char meshfile[] = "";
+/* Mesh and its instances, packed offline by scenepack and used instead of
+ * the mesh file if given */
+static const char scenefile[] = "";
+
+/* Tonemap and colour grade: 0 off, 1 as subpasses of the scene's render pass
+ * so intermediates can stay in tile memory, 2 as separate render passes to
+ * compare against */
+static const uint32_t postprocess  = 0;
+static const char fullscreenshader[] = "shaders/fullscreen.spv";
+static const char tonemapshader[]    = "shaders/tonemap.spv";
+static const char gradeshader[]      = "shaders/grade.spv";
+
+/* Debug builds recompile and reload shaders when these change */
+static const char shaderdir[]      = "shaders";
+static const char vertexsource[]   = "shaders/vertex.glsl";
+static const char fragmentsource[] = "shaders/fragment.glsl";
+static const char shadercompiler[] = "glslc";
+/* Milliseconds to let an editor finish saving */
+static const uint32_t reloaddelay  = 100;
+
+/* Link pipeline variants from precompiled parts when the device has
+ * VK_EXT_graphics_pipeline_library, then relink them optimised */
+static const uint32_t pipelinelibraries = 1;
+static const uint32_t optimisedlink     = 1;
+
+/* Sprites drawn in a frame, more are dropped. The test sprites are drawn
+ * every frame, 0 draws none. */
+static const uint32_t maxsprites  = 65536;
+static const uint32_t demosprites = 0;
+static const char spriteshader[]  = "shaders/sprite.spv";
+
+/* Objects culled against the view each frame. The test objects are
+ * scattered around the triangle, mostly out of view, 0 adds none. */
+static const uint32_t maxobjects  = 65536;
+static const uint32_t demoobjects = 0;
+
+/* Size of the bindless descriptor table */
+static const uint32_t maxtextures = 4096;
+static const uint32_t maxbuffers  = 1024;
+
+/* Texture streaming, an empty filename loads no texture */
+static const char texturefile[]         = "";
+static const VkDeviceSize texturebudget = 4 * 1024 * 1024;
+/* RGBA textures are block compressed to BC7 on load, 0 keeps them as is */
+static const uint32_t texturecompress   = 1;
+
+/* Dynamic resolution, scales the render target to hold the GPU frame time
+ * under budget in milliseconds */
+static const double framebudget    = 1000.0 / 60.0;
+static const double framesmoothing = 0.1;
+static const float minrenderscale  = 0.5f;
+static const float maxrenderscale  = 1.0f;
+
+/* Frame capture, an empty filename disables it and "-" writes to stdout.
+ * Frames are raw RGBA unless Y4M is selected. */
+static const char capturefile[]  = "";
+static const uint32_t capturey4m = 0;
+static const uint32_t capturefps = 60;
+
+/* Command stream capture for tools/replay, an empty filename disables it.
+ * The scene pass of streamframes frames drawn from frame streamfirst is
+ * written with the shaders, mesh and uniforms it uses. */
+static const char streamfile[]      = "";
+static const uint64_t streamfirst   = 60;
+static const uint32_t streamframes  = 60;
+
+/* Frames are timed from their start to the display. Low latency mode holds
+ * back each frame start until its work only just fits before the next
+ * refresh, with a margin in milliseconds for misjudging it. */
+static const uint32_t lowlatency   = 0;
+static const double latencymargin  = 2.0;
+
+/* Per frame telemetry in named shared memory for tools/telread, an empty
+ * name disables it, e.g. "Local\\TriangleTelemetry". Device memory is
+ * queried every telemetryperiod frames as it's a driver call. */
+static const char telemetryname[]     = "";
+static const uint32_t telemetryperiod = 60;
+
+/* Render on demand: 0 draws continuously, 1 only draws when something has
+ * changed and otherwise sleeps until a message or a wake. With
+ * repeatexposed an expose alone presents the last frame again rather than
+ * drawing it. Animated sprites and capture draw every frame regardless. */
+static const uint32_t ondemand      = 0;
+static const uint32_t repeatexposed = 1;
+
+/* Host memory arenas for transient arrays and for each swap chain's image
+ * and view handles */
+static const size_t initarenasize      = 4 * 1024 * 1024;
+static const size_t swapchainarenasize = 4096;
+
+/* Trace output in builds with TRACE, written on exit and on F9 */
+static const char tracefile[] = "trace.json";
+
+/* Threads running the per frame jobs, 0 uses every processor and 1 runs
+ * them all on the main thread */
+static const uint32_t jobthreads = 0;
+
+/* Threads running the initialisation task graph, 0 uses every processor and
+ * 1 initialises serially */
+static const uint32_t initthreads = 0;
@@ -0,0 +1,335 @@
+/* Frustum culling.
+ * Tests bounding spheres against the six frustum planes, four or eight
+ * objects at a time with SSE2 or AVX2 and one at a time in the scalar
+ * reference. The store is cut into blocks that cull as jobs, each block
+ * packs its visible indices into its own part of the list and the parts
+ * are closed up afterwards, so the list stays in index order.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86
+#endif
+
+#include "cull.h"
+#include "job.h"
+#include "util.h"
+
+/* Macros */
+/* Objects a job culls at least, a multiple of eight */
+#define CULLBLOCK 1024
+#define ALIGNMENT 32
+#define PADDED(n) (((n) + 7) & ~(uint32_t) 7)
+#define TARGET(x) __attribute__((target(x)))
+
+/* Types */
+typedef struct {
+    ObjectStore *s;
+    const Frustum *f;
+    CullPath path;
+} CullJob;
+
+/* Function declarations */
+static uint32_t visiblescalar(const ObjectStore *s, const Frustum *f,
+	uint32_t i);
+#ifdef X86
+static uint32_t rangesse2(const ObjectStore *s, const Frustum *f,
+	uint32_t begin, uint32_t end, uint32_t *visible);
+static uint32_t rangeavx2(const ObjectStore *s, const Frustum *f,
+	uint32_t begin, uint32_t end, uint32_t *visible);
+#endif /* X86 */
+static void cullblocks(void *data, uint32_t begin, uint32_t end);
+
+/* Function implementations */
+
+uint32_t
+cull_supported(CullPath path)
+{
+    switch (path) {
+    case CULL_AUTO:
+    case CULL_SCALAR:
+	return 1;
+#ifdef X86
+    case CULL_SSE2:
+	return __builtin_cpu_supports("sse2");
+    case CULL_AVX2:
+	return __builtin_cpu_supports("avx2");
+#endif /* X86 */
+    default:
+	return 0;
+    }
+}
+
+/* The capacity is rounded up to whole SIMD groups */
+void
+cull_initialise(ObjectStore *s, uint32_t capacity)
+{
+    uint32_t padded = PADDED(capacity);
+    uintptr_t p;
+
+    s->base = malloc(4 * (size_t) padded * sizeof(float) + ALIGNMENT);
+    s->visible = (uint32_t *) malloc(padded * sizeof(uint32_t));
+    s->blockcounts = (uint32_t *) malloc((padded + CULLBLOCK - 1) /
+	    CULLBLOCK * sizeof(uint32_t));
+    if (s->base == NULL || s->visible == NULL || s->blockcounts == NULL)
+	terminate("Failed to allocate object store.");
+
+    p = ((uintptr_t) s->base + ALIGNMENT - 1) & ~(uintptr_t) (ALIGNMENT - 1);
+    s->x = (float *) p;
+    s->y = s->x + padded;
+    s->z = s->y + padded;
+    s->radius = s->z + padded;
+    s->count = s->visiblecount = 0;
+    s->capacity = padded;
+    s->culls = s->tested = s->passed = 0;
+    s->seconds = 0.0;
+}
+
+void
+cull_terminate(ObjectStore *s)
+{
+    if (s->culls > 0)
+	fprintf(stderr, "Culling: %.0f objects a cull, %.1f%% visible, "
+		"%.3f ms mean.\n", (double) s->tested / (double) s->culls,
+		100.0 * (double) s->passed / (double) s->tested,
+		s->seconds * 1000.0 / (double) s->culls);
+
+    free(s->base);
+    free(s->visible);
+    free(s->blockcounts);
+}
+
+/* Returns the object's index */
+uint32_t
+cull_add(ObjectStore *s, float x, float y, float z, float radius)
+{
+    if (s->count == s->capacity)
+	terminate("Object store is full.");
+
+    s->x[s->count] = x;
+    s->y[s->count] = y;
+    s->z[s->count] = z;
+    s->radius[s->count] = radius;
+
+    return s->count++;
+}
+
+/* Planes face inwards and are normalised so a sphere's distance can be
+ * compared with its radius. Column major, depth from zero to one. */
+void
+cull_planes(Frustum *f, const float *viewproj)
+{
+    float (*planes)[4] = f->planes;
+    const float *m = viewproj;
+    float len;
+    uint32_t p, c;
+
+    for (c = 0; c < 4; c++) {
+	planes[0][c] = m[4 * c + 3] + m[4 * c + 0];
+	planes[1][c] = m[4 * c + 3] - m[4 * c + 0];
+	planes[2][c] = m[4 * c + 3] + m[4 * c + 1];
+	planes[3][c] = m[4 * c + 3] - m[4 * c + 1];
+	planes[4][c] = m[4 * c + 2];
+	planes[5][c] = m[4 * c + 3] - m[4 * c + 2];
+    }
+    for (p = 0; p < 6; p++) {
+	len = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1]
+		+ planes[p][2] * planes[p][2]);
+	if (len > 0.0f)
+	    for (c = 0; c < 4; c++)
+		planes[p][c] /= len;
+    }
+}
+
+/* A sphere is culled once it's wholly outside any plane */
+uint32_t
+visiblescalar(const ObjectStore *s, const Frustum *f, uint32_t i)
+{
+    uint32_t p;
+
+    for (p = 0; p < 6; p++)
+	if (f->planes[p][0] * s->x[i] + f->planes[p][1] * s->y[i] +
+		f->planes[p][2] * s->z[i] + f->planes[p][3] < -s->radius[i])
+	    return 0;
+
+    return 1;
+}
+
+#ifdef X86
+
+/* Every lane's index is stored and the count only moves past the visible
+ * ones, so nothing branches on the result */
+TARGET("sse2") uint32_t
+rangesse2(const ObjectStore *s, const Frustum *f, uint32_t begin,
+	uint32_t end, uint32_t *visible)
+{
+    __m128 px[6], py[6], pz[6], pw[6], x, y, z, r, d, in;
+    __m128 zero = _mm_setzero_ps();
+    uint32_t i = begin, n = 0, p, mask;
+
+    for (p = 0; p < 6; p++) {
+	px[p] = _mm_set1_ps(f->planes[p][0]);
+	py[p] = _mm_set1_ps(f->planes[p][1]);
+	pz[p] = _mm_set1_ps(f->planes[p][2]);
+	pw[p] = _mm_set1_ps(f->planes[p][3]);
+    }
+
+    /* Aligned loads from here */
+    for (; i < end && i % 4 != 0; i++)
+	if (visiblescalar(s, f, i))
+	    visible[n++] = i;
+    for (; i + 4 <= end; i += 4) {
+	x = _mm_load_ps(s->x + i);
+	y = _mm_load_ps(s->y + i);
+	z = _mm_load_ps(s->z + i);
+	r = _mm_sub_ps(zero, _mm_load_ps(s->radius + i));
+	in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (p = 0; p < 6; p++) {
+	    d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x),
+			_mm_mul_ps(py[p], y)),
+		    _mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+	    in = _mm_and_ps(in, _mm_cmpge_ps(d, r));
+	}
+	mask = (uint32_t) _mm_movemask_ps(in);
+	visible[n] = i;
+	n += mask & 1;
+	visible[n] = i + 1;
+	n += mask >> 1 & 1;
+	visible[n] = i + 2;
+	n += mask >> 2 & 1;
+	visible[n] = i + 3;
+	n += mask >> 3 & 1;
+    }
+    for (; i < end; i++)
+	if (visiblescalar(s, f, i))
+	    visible[n++] = i;
+
+    return n;
+}
+
+TARGET("avx2") uint32_t
+rangeavx2(const ObjectStore *s, const Frustum *f, uint32_t begin,
+	uint32_t end, uint32_t *visible)
+{
+    __m256 px[6], py[6], pz[6], pw[6], x, y, z, r, d, in;
+    __m256 zero = _mm256_setzero_ps();
+    uint32_t i = begin, n = 0, p, l, mask;
+
+    for (p = 0; p < 6; p++) {
+	px[p] = _mm256_set1_ps(f->planes[p][0]);
+	py[p] = _mm256_set1_ps(f->planes[p][1]);
+	pz[p] = _mm256_set1_ps(f->planes[p][2]);
+	pw[p] = _mm256_set1_ps(f->planes[p][3]);
+    }
+
+    for (; i < end && i % 8 != 0; i++)
+	if (visiblescalar(s, f, i))
+	    visible[n++] = i;
+    for (; i + 8 <= end; i += 8) {
+	x = _mm256_load_ps(s->x + i);
+	y = _mm256_load_ps(s->y + i);
+	z = _mm256_load_ps(s->z + i);
+	r = _mm256_sub_ps(zero, _mm256_load_ps(s->radius + i));
+	in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	for (p = 0; p < 6; p++) {
+	    d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], x),
+			_mm256_mul_ps(py[p], y)),
+		    _mm256_add_ps(_mm256_mul_ps(pz[p], z), pw[p]));
+	    in = _mm256_and_ps(in, _mm256_cmp_ps(d, r, _CMP_GE_OQ));
+	}
+	mask = (uint32_t) _mm256_movemask_ps(in);
+	for (l = 0; l < 8; l++) {
+	    visible[n] = i + l;
+	    n += mask >> l & 1;
+	}
+    }
+    for (; i < end; i++)
+	if (visiblescalar(s, f, i))
+	    visible[n++] = i;
+
+    return n;
+}
+
+#endif /* X86 */
+
+/* Writes the visible indices from begin up to end and returns how many.
+ * The SIMD paths may write up to seven entries past those, but never past
+ * visible + (end - begin). */
+uint32_t
+cull_range(const ObjectStore *s, const Frustum *f, CullPath path,
+	uint32_t begin, uint32_t end, uint32_t *visible)
+{
+    uint32_t i, n = 0;
+
+#ifdef X86
+    if (path == CULL_SSE2)
+	return rangesse2(s, f, begin, end, visible);
+    if (path == CULL_AVX2)
+	return rangeavx2(s, f, begin, end, visible);
+#endif /* X86 */
+    UNUSED(path);
+    for (i = begin; i < end; i++)
+	if (visiblescalar(s, f, i))
+	    visible[n++] = i;
+
+    return n;
+}
+
+void
+cullblocks(void *data, uint32_t begin, uint32_t end)
+{
+    CullJob *job = (CullJob *) data;
+    ObjectStore *s = job->s;
+    uint32_t b, first, last;
+
+    for (b = begin; b < end; b++) {
+	first = b * CULLBLOCK;
+	last = first + CULLBLOCK < s->count ? first + CULLBLOCK : s->count;
+	s->blockcounts[b] = cull_range(s, job->f, job->path, first, last,
+		s->visible + first);
+    }
+}
+
+/* Fills the visible list, blocks are shared out between the job workers.
+ * Returns the number visible. */
+uint32_t
+cull_frustum(ObjectStore *s, const Frustum *f, CullPath path)
+{
+    CullJob job = {
+	.s = s,
+	.f = f,
+	.path = path
+    };
+    JobCounter counter = { 0 };
+    uint32_t blocks = (s->count + CULLBLOCK - 1) / CULLBLOCK, b, n;
+    double t = gettime();
+
+    /* Fastest supported path, the scalar reference as a last resort */
+    if (job.path == CULL_AUTO)
+	job.path = cull_supported(CULL_AVX2) ? CULL_AVX2 :
+	    cull_supported(CULL_SSE2) ? CULL_SSE2 : CULL_SCALAR;
+    if (!cull_supported(job.path))
+	terminate("Culling path not supported by the CPU.");
+
+    job_parallelfor("cullblocks", cullblocks, &job, blocks, 1, &counter);
+    job_wait(&counter);
+
+    n = blocks > 0 ? s->blockcounts[0] : 0;
+    for (b = 1; b < blocks; b++) {
+	memmove(s->visible + n, s->visible + b * CULLBLOCK,
+		s->blockcounts[b] * sizeof(uint32_t));
+	n += s->blockcounts[b];
+    }
+    s->visiblecount = n;
+
+    s->culls++;
+    s->tested += s->count;
+    s->passed += n;
+    s->seconds += gettime() - t;
+
+    return n;
+}
@@ -0,0 +1,39 @@
+#include <stdint.h>
+
+typedef enum { CULL_AUTO, CULL_SCALAR, CULL_SSE2, CULL_AVX2 } CullPath;
+
+/* Inward facing planes, a point is inside when ax + by + cz + d >= 0 */
+typedef struct {
+    float planes[6][4];
+} Frustum;
+
+/* Bounding spheres as separate arrays so a SIMD load takes one field of
+ * eight objects. The arrays are 32 byte aligned. */
+typedef struct {
+    float *x;
+    float *y;
+    float *z;
+    float *radius;
+    uint32_t count;
+    uint32_t capacity;
+    /* Indices that passed the last cull, in index order */
+    uint32_t *visible;
+    uint32_t visiblecount;
+    /* Visible objects found by each block before they're packed */
+    uint32_t *blockcounts;
+    /* Totals over every cull for the report */
+    uint64_t culls;
+    uint64_t tested;
+    uint64_t passed;
+    double seconds;
+    void *base;
+} ObjectStore;
+
+uint32_t cull_supported(CullPath path);
+void cull_initialise(ObjectStore *s, uint32_t capacity);
+void cull_terminate(ObjectStore *s);
+uint32_t cull_add(ObjectStore *s, float x, float y, float z, float radius);
+void cull_planes(Frustum *f, const float *viewproj);
+uint32_t cull_range(const ObjectStore *s, const Frustum *f, CullPath path,
+	uint32_t begin, uint32_t end, uint32_t *visible);
+uint32_t cull_frustum(ObjectStore *s, const Frustum *f, CullPath path);
@@ -0,0 +1,717 @@
+/* Render graph.
+ * Passes declare the images they read and write, in the order they run. The
+ * graph drops passes nothing needs, places every layout transition and
+ * barrier, and lets transient images whose uses don't overlap share memory.
+ * Images that stay within one render pass get lazily allocated memory when
+ * the device has it, which tilers need never back.
+ * Compiling is redone only when the extent of the images changes.
+ */
+
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+
+#include "graph.h"
+#include "mem.h"
+#include "util.h"
+#include "vulkan.h"
+
+/* Macros */
+#define MAXRESOURCES 16
+#define MAXPASSES 16
+#define MAXUSES 8
+#define ATTACHMENTUSAGE (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | \
+	VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | \
+	VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+
+/* Types */
+
+typedef struct {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    VkImageUsageFlags usage;
+    /* Whether it needs earlier contents, and whether it changes them */
+    uint32_t read;
+    uint32_t write;
+} AccessInfo;
+
+/* What an image was last used for, its layout is known only in the graph */
+typedef struct {
+    VkImageLayout layout;
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    uint32_t write;
+} State;
+
+typedef struct {
+    const char *name;
+    VkFormat format;
+    uint32_t imported;
+    VkImageLayout finallayout;
+    /* Imported, set each frame */
+    VkImage bound;
+    /* Transient, one per frame in flight */
+    VkImage images[MAXFRAMES];
+    VkImageView views[MAXFRAMES];
+    VkImageUsageFlags usage;
+    uint32_t slot;
+    /* Live passes that use it, first > last when there are none */
+    uint32_t first;
+    uint32_t last;
+    VkPipelineStageFlags waitstage;
+    /* Transient, read by submissions after the frame's */
+    VkPipelineStageFlags laterstages;
+} Resource;
+
+typedef struct {
+    uint32_t resource;
+    RgAccess access;
+} Use;
+
+typedef struct {
+    uint32_t resource;
+    State from;
+    State to;
+} Transition;
+
+typedef struct {
+    const char *name;
+    RgExecute execute;
+    uint32_t keep;
+    uint32_t live;
+    Use uses[MAXUSES];
+    uint32_t usecount;
+    Transition transitions[MAXUSES];
+    uint32_t transitioncount;
+    VkPipelineStageFlags srcstages;
+    VkPipelineStageFlags dststages;
+} Pass;
+
+/* Memory shared by transient images, occupied by one at a time */
+typedef struct {
+    VkDeviceSize size;
+    uint32_t typebits;
+    uint32_t lazy;
+    uint32_t last;
+    /* Last use by the previous occupant */
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkDeviceMemory memory[MAXFRAMES];
+} Slot;
+
+/* Function declarations */
+static void cull(void);
+static void findlifetimes(void);
+static void createimages(VkExtent2D extent);
+static void assignslots(void);
+static uint32_t findmemorytype(const Slot *s);
+static void allocateslots(void);
+static void createviews(void);
+static void addtransition(Pass *p, uint32_t resource, State *s, State to);
+static void computebarriers(void);
+static void destroyimages(void);
+static void fillbarrier(VkImageMemoryBarrier *imb, const Transition *t,
+	uint32_t frame);
+
+/* Variables */
+
+static const AccessInfo accessinfo[RG_ACCESSCOUNT] = {
+    [RG_COLOUR_WRITE] = {
+	VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+	    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+	VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, 0, 1
+    },
+    [RG_ATTACHMENT] = {
+	VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+	    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+	    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	    VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+	VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, ATTACHMENTUSAGE, 0, 1
+    },
+    /* Read in the shader, but the attachment's load and store ops touch it
+     * too */
+    [RG_INPUT] = {
+	VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+	    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+	    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+	    VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+	VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, 1, 1
+    },
+    [RG_SAMPLED] = {
+	VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+	VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT,
+	1, 0
+    },
+    [RG_TRANSFER_READ] = {
+	VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+	1, 0
+    },
+    [RG_TRANSFER_WRITE] = {
+	VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+	0, 1
+    }
+};
+
+static Resource resources[MAXRESOURCES];
+static uint32_t resourcecount;
+static Pass passes[MAXPASSES];
+static uint32_t passcount;
+static Slot slots[MAXRESOURCES];
+static uint32_t slotcount;
+/* Imported images leaving the frame in their final layout */
+static Transition finals[MAXRESOURCES];
+static uint32_t finalcount;
+static VkPipelineStageFlags finalstages;
+static VkExtent2D compiledextent;
+static uint32_t compiled;
+
+/* Function implementations */
+
+/* Transient, contents last only for the frame */
+uint32_t
+rg_image(const char *name, VkFormat format)
+{
+    Resource *r;
+
+    if (resourcecount == MAXRESOURCES)
+	terminate("Too many render graph resources.");
+
+    r = &resources[resourcecount];
+    r->name = name;
+    r->format = format;
+    r->imported = 0;
+    r->laterstages = 0;
+
+    return resourcecount++;
+}
+
+/* Owned elsewhere, bound each frame, e.g. the swap chain image */
+uint32_t
+rg_import(const char *name, VkImageLayout finallayout)
+{
+    Resource *r;
+
+    if (resourcecount == MAXRESOURCES)
+	terminate("Too many render graph resources.");
+
+    r = &resources[resourcecount];
+    r->name = name;
+    r->imported = 1;
+    r->finallayout = finallayout;
+    r->bound = VK_NULL_HANDLE;
+
+    return resourcecount++;
+}
+
+/* Passes run in the order they are added, keep ones with side effects */
+uint32_t
+rg_pass(const char *name, RgExecute execute, uint32_t keep)
+{
+    Pass *p;
+
+    if (passcount == MAXPASSES)
+	terminate("Too many render graph passes.");
+
+    p = &passes[passcount];
+    p->name = name;
+    p->execute = execute;
+    p->keep = keep;
+    p->usecount = 0;
+
+    return passcount++;
+}
+
+void
+rg_use(uint32_t pass, uint32_t resource, RgAccess access)
+{
+    Pass *p = &passes[pass];
+
+    if (p->usecount == MAXUSES)
+	terminate("Too many images used by a render graph pass.");
+
+    p->uses[p->usecount].resource = resource;
+    p->uses[p->usecount].access = access;
+    p->usecount++;
+}
+
+/* The image is read outside the graph by a later submission, e.g. to
+ * present the frame again. The next frame in its slot waits for that read
+ * before reusing the memory. */
+void
+rg_readlater(uint32_t resource, RgAccess access)
+{
+    resources[resource].laterstages |= accessinfo[access].stage;
+}
+
+/* A pass is needed if it is kept, writes an imported image or writes an
+ * image a later needed pass reads */
+void
+cull(void)
+{
+    uint32_t needed[MAXRESOURCES] = { 0 };
+    uint32_t j;
+#ifdef DEBUG
+    uint32_t i;
+#endif /* DEBUG */
+    int p;
+
+    for (p = (int) passcount - 1; p >= 0; p--) {
+	Pass *ps = &passes[p];
+
+	ps->live = ps->keep;
+	for (j = 0; j < ps->usecount && !ps->live; j++) {
+	    const Use *u = &ps->uses[j];
+
+	    if (accessinfo[u->access].write &&
+		    (resources[u->resource].imported || needed[u->resource]))
+		ps->live = 1;
+	}
+	if (!ps->live)
+	    continue;
+
+	for (j = 0; j < ps->usecount; j++)
+	    if (accessinfo[ps->uses[j].access].read)
+		needed[ps->uses[j].resource] = 1;
+    }
+
+#ifdef DEBUG
+    /* Runs on every compile, only worth saying while developing */
+    for (i = 0; i < passcount; i++)
+	if (!passes[i].live)
+	    fprintf(stderr, "Render graph pass %s is unused.\n",
+		    passes[i].name);
+#endif /* DEBUG */
+}
+
+void
+findlifetimes(void)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < resourcecount; i++) {
+	resources[i].first = passcount;
+	resources[i].last = 0;
+	resources[i].usage = 0;
+	resources[i].waitstage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+
+    for (i = 0; i < passcount; i++) {
+	if (!passes[i].live)
+	    continue;
+
+	for (j = 0; j < passes[i].usecount; j++) {
+	    const Use *u = &passes[i].uses[j];
+	    Resource *r = &resources[u->resource];
+
+	    if (r->first == passcount) {
+		r->first = i;
+		r->waitstage = accessinfo[u->access].stage;
+	    }
+	    r->last = i;
+	    r->usage |= accessinfo[u->access].usage;
+	}
+    }
+
+    /* Transient only if it is never anything but an attachment */
+    for (i = 0; i < resourcecount; i++)
+	if (resources[i].usage & ~ATTACHMENTUSAGE)
+	    resources[i].usage &= ~VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+}
+
+void
+createimages(VkExtent2D extent)
+{
+    VkImageCreateInfo ici = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.imageType = VK_IMAGE_TYPE_2D,
+	.format = VK_FORMAT_UNDEFINED,
+	.extent = { extent.width, extent.height, 1 },
+	.mipLevels = 1,
+	.arrayLayers = 1,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.tiling = VK_IMAGE_TILING_OPTIMAL,
+	.usage = 0,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    uint32_t i, f;
+
+    for (i = 0; i < resourcecount; i++) {
+	Resource *r = &resources[i];
+
+	if (r->imported || r->first > r->last)
+	    continue;
+
+	ici.format = r->format;
+	ici.usage = r->usage;
+	for (f = 0; f < MAXFRAMES; f++)
+	    if (vkCreateImage(device, &ici, &allocator, &r->images[f]) !=
+		    VK_SUCCESS)
+		terminate("Failed to create render graph image.");
+    }
+}
+
+/* Greedy in order of first use, an image takes the first slot whose
+ * occupant's last use is before its own first */
+void
+assignslots(void)
+{
+    VkMemoryRequirements mr;
+    uint32_t i, j, s, lazy;
+
+    slotcount = 0;
+    for (i = 0; i < passcount; i++) {
+	for (j = 0; j < resourcecount; j++) {
+	    Resource *r = &resources[j];
+
+	    if (r->imported || r->first != i)
+		continue;
+
+	    vkGetImageMemoryRequirements(device, r->images[0], &mr);
+	    lazy = (r->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+	    for (s = 0; s < slotcount; s++)
+		if (slots[s].last < r->first && slots[s].lazy == lazy &&
+			(slots[s].typebits & mr.memoryTypeBits))
+		    break;
+
+	    if (s == slotcount) {
+		slots[s].size = 0;
+		slots[s].typebits = mr.memoryTypeBits;
+		slots[s].lazy = lazy;
+		slotcount++;
+	    }
+	    if (mr.size > slots[s].size)
+		slots[s].size = mr.size;
+	    slots[s].typebits &= mr.memoryTypeBits;
+	    slots[s].last = r->last;
+	    r->slot = s;
+	}
+    }
+}
+
+/* Lazily allocated memory is only for images that are all transient */
+uint32_t
+findmemorytype(const Slot *s)
+{
+    VkPhysicalDeviceMemoryProperties pdmp;
+    uint32_t i;
+
+    if (s->lazy) {
+	vkGetPhysicalDeviceMemoryProperties(physicaldevice, &pdmp);
+	for (i = 0; i < pdmp.memoryTypeCount; i++)
+	    if ((s->typebits & (1 << i)) && (pdmp.memoryTypes[i].propertyFlags &
+			VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+		return i;
+    }
+
+    return vk_findmemorytype(s->typebits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void
+allocateslots(void)
+{
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    uint32_t i, f;
+
+    for (i = 0; i < slotcount; i++) {
+	mai.allocationSize = slots[i].size;
+	mai.memoryTypeIndex = findmemorytype(&slots[i]);
+	for (f = 0; f < MAXFRAMES; f++)
+	    if (vkAllocateMemory(device, &mai, &allocator,
+			&slots[i].memory[f]) != VK_SUCCESS)
+		terminate("Failed to allocate render graph memory.");
+    }
+
+    for (i = 0; i < resourcecount; i++) {
+	const Resource *r = &resources[i];
+
+	if (r->imported || r->first > r->last)
+	    continue;
+
+	for (f = 0; f < MAXFRAMES; f++)
+	    if (vkBindImageMemory(device, r->images[f],
+			slots[r->slot].memory[f], 0) != VK_SUCCESS)
+		terminate("Failed to bind render graph memory.");
+    }
+}
+
+void
+createviews(void)
+{
+    VkImageViewCreateInfo ivci = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.image = VK_NULL_HANDLE,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = VK_FORMAT_UNDEFINED,
+	.components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    uint32_t i, f;
+
+    for (i = 0; i < resourcecount; i++) {
+	Resource *r = &resources[i];
+
+	if (r->imported || r->first > r->last)
+	    continue;
+
+	ivci.format = r->format;
+	for (f = 0; f < MAXFRAMES; f++) {
+	    ivci.image = r->images[f];
+	    if (vkCreateImageView(device, &ivci, &allocator, &r->views[f]) !=
+		    VK_SUCCESS)
+		terminate("Failed to create render graph image view.");
+	}
+    }
+}
+
+void
+addtransition(Pass *p, uint32_t resource, State *s, State to)
+{
+    Transition *t = &p->transitions[p->transitioncount++];
+
+    t->resource = resource;
+    t->from = *s;
+    t->to = to;
+    p->srcstages |= s->stage;
+    p->dststages |= to.stage;
+    *s = to;
+}
+
+/* Walks the live passes tracking each image's state. Reads after reads in
+ * the same layout need nothing, only their stages are gathered so the next
+ * write waits on all of them. */
+void
+computebarriers(void)
+{
+    State states[MAXRESOURCES];
+    uint32_t i, j;
+
+    for (i = 0; i < resourcecount; i++) {
+	states[i].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	/* The swap chain semaphore wait covers the first use's stage */
+	states[i].stage = resources[i].imported ? resources[i].waitstage :
+	    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	states[i].access = 0;
+	states[i].write = 0;
+    }
+    for (i = 0; i < slotcount; i++) {
+	slots[i].stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	slots[i].access = 0;
+    }
+    /* Those reads were submitted before the frame, so its first use of the
+     * memory only has to wait for their stages. A read has nothing to make
+     * available. */
+    for (i = 0; i < resourcecount; i++)
+	if (!resources[i].imported && resources[i].first <= resources[i].last)
+	    slots[resources[i].slot].stage |= resources[i].laterstages;
+
+    for (i = 0; i < passcount; i++) {
+	Pass *p = &passes[i];
+
+	p->transitioncount = 0;
+	p->srcstages = p->dststages = 0;
+	if (!p->live)
+	    continue;
+
+	for (j = 0; j < p->usecount; j++) {
+	    const Use *u = &p->uses[j];
+	    const AccessInfo *a = &accessinfo[u->access];
+	    const Resource *r = &resources[u->resource];
+	    State *s = &states[u->resource];
+	    State to = { a->layout, a->stage, a->access, a->write };
+
+	    /* Wait for the image that had the memory before */
+	    if (!r->imported && r->first == i) {
+		s->stage = slots[r->slot].stage;
+		s->access = slots[r->slot].access;
+		s->write = s->access != 0;
+	    }
+
+	    if (s->layout != a->layout || s->write || a->write)
+		addtransition(p, u->resource, s, to);
+	    else
+		s->stage |= a->stage;
+
+	    if (!r->imported && r->last == i) {
+		slots[r->slot].stage = s->stage;
+		slots[r->slot].access = s->write ? s->access : 0;
+	    }
+	}
+    }
+
+    finalcount = 0;
+    finalstages = 0;
+    for (i = 0; i < resourcecount; i++) {
+	const Resource *r = &resources[i];
+	Transition *t;
+
+	if (!r->imported || r->first > r->last)
+	    continue;
+
+	t = &finals[finalcount++];
+	t->resource = i;
+	t->from = states[i];
+	t->to.layout = r->finallayout;
+	t->to.stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	t->to.access = 0;
+	t->to.write = 0;
+	finalstages |= states[i].stage;
+    }
+}
+
+void
+destroyimages(void)
+{
+    uint32_t i, f;
+
+    for (i = 0; i < resourcecount; i++) {
+	const Resource *r = &resources[i];
+
+	if (r->imported || r->first > r->last)
+	    continue;
+
+	for (f = 0; f < MAXFRAMES; f++) {
+	    vkDestroyImageView(device, r->views[f], &allocator);
+	    vkDestroyImage(device, r->images[f], &allocator);
+	}
+    }
+
+    for (i = 0; i < slotcount; i++)
+	for (f = 0; f < MAXFRAMES; f++)
+	    vkFreeMemory(device, slots[i].memory[f], &allocator);
+    slotcount = 0;
+}
+
+/* The GPU must be idle when the extent changes */
+void
+rg_compile(VkExtent2D extent)
+{
+    if (compiled && extent.width == compiledextent.width &&
+	    extent.height == compiledextent.height)
+	return;
+
+    if (compiled)
+	destroyimages();
+
+    cull();
+    findlifetimes();
+    createimages(extent);
+    assignslots();
+    allocateslots();
+    createviews();
+    computebarriers();
+
+    compiledextent = extent;
+    compiled = 1;
+}
+
+void
+rg_terminate(void)
+{
+    if (compiled)
+	destroyimages();
+    compiled = 0;
+}
+
+void
+rg_bind(uint32_t resource, VkImage image)
+{
+    resources[resource].bound = image;
+}
+
+void
+fillbarrier(VkImageMemoryBarrier *imb, const Transition *t, uint32_t frame)
+{
+    imb->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imb->pNext = NULL;
+    /* Only writes have anything to make available */
+    imb->srcAccessMask = t->from.write ? t->from.access : 0;
+    imb->dstAccessMask = t->to.access;
+    imb->oldLayout = t->from.layout;
+    imb->newLayout = t->to.layout;
+    imb->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imb->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imb->image = rg_getimage(t->resource, frame);
+    imb->subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imb->subresourceRange.baseMipLevel = 0;
+    imb->subresourceRange.levelCount = 1;
+    imb->subresourceRange.baseArrayLayer = 0;
+    imb->subresourceRange.layerCount = 1;
+}
+
+/* One barrier call before each pass that needs one */
+void
+rg_execute(VkCommandBuffer cb, uint32_t frame)
+{
+    VkImageMemoryBarrier imbs[MAXRESOURCES];
+    uint32_t i, j;
+
+    for (i = 0; i < passcount; i++) {
+	const Pass *p = &passes[i];
+
+	if (!p->live)
+	    continue;
+
+	if (p->transitioncount > 0) {
+	    for (j = 0; j < p->transitioncount; j++)
+		fillbarrier(&imbs[j], &p->transitions[j], frame);
+	    vkCmdPipelineBarrier(cb, p->srcstages, p->dststages, 0, 0, NULL,
+		    0, NULL, p->transitioncount, imbs);
+	}
+	p->execute(cb, frame);
+    }
+
+    if (finalcount > 0) {
+	for (j = 0; j < finalcount; j++)
+	    fillbarrier(&imbs[j], &finals[j], frame);
+	vkCmdPipelineBarrier(cb, finalstages,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL,
+		finalcount, imbs);
+    }
+}
+
+VkImage
+rg_getimage(uint32_t resource, uint32_t frame)
+{
+    const Resource *r = &resources[resource];
+
+    return r->imported ? r->bound : r->images[frame];
+}
+
+VkImageView
+rg_getview(uint32_t resource, uint32_t frame)
+{
+    return resources[resource].views[frame];
+}
+
+/* Stage to wait on an imported image's semaphore at, its first use */
+VkPipelineStageFlags
+rg_waitstage(uint32_t resource)
+{
+    return resources[resource].waitstage;
+}
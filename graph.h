@@ -0,0 +1,28 @@
+#include <vulkan/vulkan.h>
+
+/* How a pass uses an image. An attachment is written and read back by later
+ * subpasses of the same render pass, so it never needs to leave the tile. */
+typedef enum {
+    RG_COLOUR_WRITE,
+    RG_ATTACHMENT,
+    RG_INPUT,
+    RG_SAMPLED,
+    RG_TRANSFER_READ,
+    RG_TRANSFER_WRITE,
+    RG_ACCESSCOUNT
+} RgAccess;
+
+typedef void (*RgExecute)(VkCommandBuffer cb, uint32_t frame);
+
+uint32_t rg_image(const char *name, VkFormat format);
+uint32_t rg_import(const char *name, VkImageLayout finallayout);
+uint32_t rg_pass(const char *name, RgExecute execute, uint32_t keep);
+void rg_use(uint32_t pass, uint32_t resource, RgAccess access);
+void rg_readlater(uint32_t resource, RgAccess access);
+void rg_compile(VkExtent2D extent);
+void rg_terminate(void);
+void rg_bind(uint32_t resource, VkImage image);
+void rg_execute(VkCommandBuffer cb, uint32_t frame);
+VkImage rg_getimage(uint32_t resource, uint32_t frame);
+VkImageView rg_getview(uint32_t resource, uint32_t frame);
+VkPipelineStageFlags rg_waitstage(uint32_t resource);
@@ -0,0 +1,396 @@
+/* Job system.
+ * Each worker owns a Chase-Lev deque: it pushes and pops jobs at the
+ * bottom, and idle workers steal from the top of someone else's. The
+ * calling thread is worker 0 and only runs jobs while it waits on a
+ * counter. A parallel for starts as one job that halves its range, keeping
+ * one half and pushing the other, so thieves take the biggest pieces
+ * first. Workers with nothing to run or steal sleep until a job is pushed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "job.h"
+#include "trace.h"
+#include "util.h"
+#include "win32.h"
+
+/* Macros */
+#define MAXWORKERS 16
+/* Jobs a deque holds, a power of two. A push to a full deque runs the job
+ * there and then. */
+#define DEQUESIZE 4096
+/* Rounds of stealing before a worker sleeps */
+#define SPINS 64
+/* Parallel for pieces per worker when no grain is given */
+#define PIECES 4
+
+/* Types */
+
+typedef struct {
+    const char *name;
+    JobFunc func;
+    JobRange range;
+    void *data;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t grain;
+    JobCounter *counter;
+} Job;
+
+typedef struct {
+    /* Stolen from the top, pushed and popped at the bottom by the owner */
+    volatile LONG64 top;
+    char pad0[64 - sizeof(LONG64)];
+    volatile LONG64 bottom;
+    char pad1[64 - sizeof(LONG64)];
+    Job jobs[DEQUESIZE];
+    /* Owner only, read unlocked by the stats */
+    uint32_t depth;
+    uint32_t random;
+    uint64_t ran;
+    uint64_t steals;
+    double busy;
+    HANDLE thread;
+} Worker;
+
+/* Function declarations */
+static int push(Worker *w, const Job *job);
+static int pop(Worker *w, Job *job);
+static int steal(Worker *w, Job *job);
+static void run(Worker *w, Job *job);
+static int runnext(Worker *w);
+static void idle(void);
+static void start(Worker *w, const Job *job);
+static DWORD WINAPI work(LPVOID param);
+
+/* Variables */
+static Worker *workers;
+static uint32_t workercount;
+static DWORD tlsindex = TLS_OUT_OF_INDEXES;
+static double starttime;
+/* Jobs in any deque, wakes sleepers when it goes up */
+static volatile LONG queued;
+static volatile LONG sleepers;
+static volatile LONG stopping;
+static SRWLOCK lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE cond = CONDITION_VARIABLE_INIT;
+
+/* Function implementations */
+
+/* Zero threads uses every processor, one runs every job on the caller */
+void
+job_initialise(uint32_t threads)
+{
+    SYSTEM_INFO si;
+    uint32_t i;
+
+    if (threads == 0) {
+	GetSystemInfo(&si);
+	threads = si.dwNumberOfProcessors;
+    }
+    workercount = CLAMP(threads, 1, MAXWORKERS);
+
+    if ((tlsindex = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+	terminate("Failed to allocate job thread storage.");
+    if ((workers = (Worker *) calloc(workercount, sizeof(Worker))) == NULL)
+	terminate("Failed to allocate job workers.");
+    starttime = gettime();
+
+    for (i = 0; i < workercount; i++)
+	workers[i].random = 2654435761u * (i + 1);
+    TlsSetValue(tlsindex, &workers[0]);
+    for (i = 1; i < workercount; i++)
+	if ((workers[i].thread = CreateThread(NULL, 0, work, &workers[i], 0,
+			NULL)) == NULL)
+	    terminate("Failed to create job thread.");
+}
+
+/* Jobs still queued are run first */
+void
+job_terminate(void)
+{
+    JobStats s;
+    uint32_t i;
+
+    while (runnext(&workers[0]))
+	;
+    AcquireSRWLockExclusive(&lock);
+    InterlockedExchange(&stopping, 1);
+    WakeAllConditionVariable(&cond);
+    ReleaseSRWLockExclusive(&lock);
+    for (i = 1; i < workercount; i++) {
+	WaitForSingleObject(workers[i].thread, INFINITE);
+	CloseHandle(workers[i].thread);
+    }
+
+    job_stats(&s);
+    if (s.jobs > 0)
+	fprintf(stderr, "Jobs: %llu run on %u threads, %llu stolen, %.1f%% "
+		"utilisation.\n", (unsigned long long) s.jobs, s.threads,
+		(unsigned long long) s.steals,
+		100.0 * s.busy / (s.elapsed * (double) s.threads));
+
+    free(workers);
+    TlsFree(tlsindex);
+}
+
+/* Owner only. Fails when full. */
+int
+push(Worker *w, const Job *job)
+{
+    LONG64 b = w->bottom, t = w->top;
+
+    if (b - t >= DEQUESIZE)
+	return 0;
+
+    w->jobs[b & (DEQUESIZE - 1)] = *job;
+    /* The job must be visible before the bottom that covers it */
+    MemoryBarrier();
+    w->bottom = b + 1;
+    InterlockedIncrement(&queued);
+    if (sleepers > 0) {
+	AcquireSRWLockExclusive(&lock);
+	WakeConditionVariable(&cond);
+	ReleaseSRWLockExclusive(&lock);
+    }
+
+    return 1;
+}
+
+/* Owner only, takes the newest job. The last job left may be raced for by
+ * a thief, the top decides who gets it. */
+int
+pop(Worker *w, Job *job)
+{
+    LONG64 b = w->bottom - 1, t;
+    int got = 1;
+
+    InterlockedExchange64(&w->bottom, b);
+    t = w->top;
+    if (t > b) {
+	w->bottom = b + 1;
+	return 0;
+    }
+
+    *job = w->jobs[b & (DEQUESIZE - 1)];
+    if (t == b) {
+	got = InterlockedCompareExchange64(&w->top, t + 1, t) == t;
+	w->bottom = b + 1;
+    }
+    if (got)
+	InterlockedDecrement(&queued);
+
+    return got;
+}
+
+/* Any thread, takes the oldest job of a random victim */
+int
+steal(Worker *w, Job *job)
+{
+    Worker *v;
+    LONG64 t, b;
+    uint32_t i;
+
+    for (i = 0; i < workercount; i++) {
+	w->random ^= w->random << 13;
+	w->random ^= w->random >> 17;
+	w->random ^= w->random << 5;
+	v = &workers[(w->random + i) % workercount];
+	if (v == w)
+	    continue;
+
+	t = v->top;
+	MemoryBarrier();
+	b = v->bottom;
+	if (t >= b)
+	    continue;
+	/* May be overwritten once the top moves on, then the swap fails */
+	*job = v->jobs[t & (DEQUESIZE - 1)];
+	if (InterlockedCompareExchange64(&v->top, t + 1, t) != t)
+	    continue;
+
+	InterlockedDecrement(&queued);
+	w->steals++;
+	return 1;
+    }
+
+    return 0;
+}
+
+/* A range job splits off halves for others till it's down to its grain */
+void
+run(Worker *w, Job *job)
+{
+    Job half;
+    double t = 0.0;
+
+    if (w->depth++ == 0)
+	t = gettime();
+    TRACE_BEGIN(job->name);
+    if (job->range == NULL) {
+	job->func(job->data);
+    } else {
+	while (job->end - job->begin > job->grain) {
+	    half = *job;
+	    half.begin = job->begin + (job->end - job->begin) / 2;
+	    InterlockedIncrement(&job->counter->pending);
+	    if (!push(w, &half)) {
+		InterlockedDecrement(&job->counter->pending);
+		break;
+	    }
+	    job->end = half.begin;
+	}
+	job->range(job->data, job->begin, job->end);
+    }
+    TRACE_END();
+    if (--w->depth == 0)
+	w->busy += gettime() - t;
+    w->ran++;
+
+    /* Everything the job wrote is visible once its count is */
+    InterlockedDecrement(&job->counter->pending);
+}
+
+int
+runnext(Worker *w)
+{
+    Job job;
+
+    if (!pop(w, &job) && !steal(w, &job))
+	return 0;
+
+    run(w, &job);
+
+    return 1;
+}
+
+/* A push counts itself before looking for sleepers and a sleeper counts
+ * itself before looking for jobs, so one always sees the other */
+void
+idle(void)
+{
+    AcquireSRWLockExclusive(&lock);
+    InterlockedIncrement(&sleepers);
+    while (queued == 0 && !stopping)
+	SleepConditionVariableSRW(&cond, &lock, INFINITE, 0);
+    InterlockedDecrement(&sleepers);
+    ReleaseSRWLockExclusive(&lock);
+}
+
+/* Threads that aren't workers can't push, they run the job themselves */
+void
+start(Worker *w, const Job *job)
+{
+    Job j = *job;
+
+    InterlockedIncrement(&j.counter->pending);
+    if (w == NULL) {
+	TRACE_BEGIN(j.name);
+	if (j.range == NULL)
+	    j.func(j.data);
+	else
+	    j.range(j.data, j.begin, j.end);
+	TRACE_END();
+	InterlockedDecrement(&j.counter->pending);
+    } else if (!push(w, &j)) {
+	run(w, &j);
+    }
+}
+
+DWORD WINAPI
+work(LPVOID param)
+{
+    Worker *w = (Worker *) param;
+    uint32_t spins = 0;
+
+    TlsSetValue(tlsindex, w);
+    TRACE_THREAD("job worker");
+    while (!stopping) {
+	if (runnext(w)) {
+	    spins = 0;
+	} else if (++spins < SPINS) {
+	    YieldProcessor();
+	} else {
+	    idle();
+	    spins = 0;
+	}
+    }
+
+    return 0;
+}
+
+void
+job_run(const char *name, JobFunc func, void *data, JobCounter *counter)
+{
+    Job job = {
+	.name = name,
+	.func = func,
+	.range = NULL,
+	.data = data,
+	.begin = 0,
+	.end = 0,
+	.grain = 0,
+	.counter = counter
+    };
+
+    start((Worker *) TlsGetValue(tlsindex), &job);
+}
+
+/* Items are handed out in pieces of at least the grain, zero picks one
+ * that gives each worker a few pieces */
+void
+job_parallelfor(const char *name, JobRange func, void *data, uint32_t count,
+	uint32_t grain, JobCounter *counter)
+{
+    Job job = {
+	.name = name,
+	.func = NULL,
+	.range = func,
+	.data = data,
+	.begin = 0,
+	.end = count,
+	.grain = grain,
+	.counter = counter
+    };
+
+    if (count == 0)
+	return;
+    if (job.grain == 0)
+	job.grain = count / (workercount * PIECES);
+    if (job.grain == 0)
+	job.grain = 1;
+
+    start((Worker *) TlsGetValue(tlsindex), &job);
+}
+
+/* Workers run other jobs while they wait */
+void
+job_wait(JobCounter *counter)
+{
+    Worker *w = (Worker *) TlsGetValue(tlsindex);
+
+    while (counter->pending > 0)
+	if (w == NULL || !runnext(w))
+	    YieldProcessor();
+    /* Reads after this see what the jobs wrote */
+    MemoryBarrier();
+}
+
+/* Counts are read without locking, they may lag while jobs run */
+void
+job_stats(JobStats *s)
+{
+    uint32_t i;
+
+    s->threads = workercount;
+    s->jobs = s->steals = 0;
+    s->busy = 0.0;
+    for (i = 0; i < workercount; i++) {
+	s->jobs += workers[i].ran;
+	s->steals += workers[i].steals;
+	s->busy += workers[i].busy;
+    }
+    s->elapsed = gettime() - starttime;
+}
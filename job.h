@@ -0,0 +1,28 @@
+#include <stdint.h>
+
+/* Jobs waited on together share a counter, it reaches zero once they have
+ * all run. Zero it before the first job. */
+typedef struct {
+    volatile long pending;
+} JobCounter;
+
+typedef void (*JobFunc)(void *data);
+/* Runs the items from begin up to end of a parallel for */
+typedef void (*JobRange)(void *data, uint32_t begin, uint32_t end);
+
+typedef struct {
+    uint32_t threads;
+    uint64_t jobs;
+    uint64_t steals;
+    /* Seconds running jobs summed over workers, and since initialising */
+    double busy;
+    double elapsed;
+} JobStats;
+
+void job_initialise(uint32_t threads);
+void job_terminate(void);
+void job_run(const char *name, JobFunc func, void *data, JobCounter *counter);
+void job_parallelfor(const char *name, JobRange func, void *data,
+	uint32_t count, uint32_t grain, JobCounter *counter);
+void job_wait(JobCounter *counter);
+void job_stats(JobStats *s);
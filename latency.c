@@ -0,0 +1,321 @@
+/* Present timing.
+ * Each frame is timed from its start to when its image reaches the display.
+ * With VK_KHR_present_wait a thread waits on each present id in turn and
+ * stamps it as it completes. Without it the frame is timed to the present
+ * call instead, which leaves out the time spent queued for the display.
+ * Low latency mode predicts the next refresh from the last ones and holds
+ * back the frame start until its work only just fits before it, so input
+ * and animation are sampled as late as possible.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "config.h"
+#include "latency.h"
+#include "trace.h"
+#include "util.h"
+#include "vulkan.h"
+#include "win32.h"
+
+/* Macros */
+/* Presents waiting for the display */
+#define MAXPENDING 16
+/* Latencies kept for the percentiles */
+#define MAXSAMPLES 4096
+/* Nanoseconds the waiter blocks on one present before giving up on it */
+#define PRESENTTIMEOUT 100000000
+/* Sleep can overshoot by a scheduler tick, so the last of a wait spins */
+#define SPINTIME 0.002
+
+/* Types */
+typedef struct {
+    VkSwapchainKHR swapchain;
+    uint64_t id;
+    double start;
+} Pending;
+
+/* Function declarations */
+static void addsample(double start, double end);
+static void addrefresh(double t);
+static void waituntil(double t);
+static DWORD WINAPI waiter(LPVOID param);
+static int comparedoubles(const void *a, const void *b);
+static double percentile(const double *sorted, uint32_t count, double p);
+
+/* Variables */
+static PFN_vkWaitForPresentKHR waitforpresent;
+static HANDLE thread;
+static SRWLOCK lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE cond = CONDITION_VARIABLE_INIT;
+/* Guarded by the lock */
+static Pending pending[MAXPENDING];
+static uint32_t head, tail;
+static uint32_t stopping;
+static double samples[MAXSAMPLES];
+static uint64_t samplecount, failed, dropped;
+/* Last refresh seen and the smoothed time between them, in seconds */
+static double lastrefresh, refreshperiod;
+/* Main thread only */
+static uint64_t presentid;
+/* Only the main window's present is timed, the views' have no id */
+static uint64_t ids[MAXWINDOWS];
+static VkPresentIdKHR presentids;
+static double framestart, acquiretime;
+/* Smoothed seconds from acquiring to presenting */
+static double cputime;
+static double totalwait;
+static uint64_t waits;
+
+/* Function implementations */
+
+/* Starts the waiter if the device can wait on presents */
+void
+lat_initialise(uint32_t presentwait)
+{
+    if (!presentwait)
+	return;
+
+    waitforpresent = (PFN_vkWaitForPresentKHR) vkGetDeviceProcAddr(device,
+	    "vkWaitForPresentKHR");
+    if (waitforpresent == NULL)
+	return;
+    if ((thread = CreateThread(NULL, 0, waiter, NULL, 0, NULL)) == NULL)
+	terminate("Failed to create present wait thread.");
+}
+
+/* After the last swap chain is flushed */
+void
+lat_terminate(void)
+{
+    double *sorted;
+    uint32_t count;
+
+    if (thread != NULL) {
+	AcquireSRWLockExclusive(&lock);
+	stopping = 1;
+	WakeAllConditionVariable(&cond);
+	ReleaseSRWLockExclusive(&lock);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+    }
+
+    if (samplecount == 0)
+	return;
+    count = samplecount < MAXSAMPLES ? (uint32_t) samplecount : MAXSAMPLES;
+    if ((sorted = (double *) malloc(count * sizeof(double))) == NULL)
+	return;
+    memcpy(sorted, samples, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), comparedoubles);
+
+    fprintf(stderr, "Latency from frame start to %s over the last %u "
+	    "frames: %.2f p50, %.2f p90, %.2f p99, %.2f max ms.\n",
+	    waitforpresent != NULL ? "display" : "present", count,
+	    percentile(sorted, count, 0.5), percentile(sorted, count, 0.9),
+	    percentile(sorted, count, 0.99), sorted[count - 1]);
+    if (failed > 0 || dropped > 0)
+	fprintf(stderr, "Latency: %llu presents failed to complete, %llu "
+		"untimed.\n",
+		(unsigned long long) failed, (unsigned long long) dropped);
+    if (waits > 0)
+	fprintf(stderr, "Low latency mode held frames back %.2f ms on "
+		"average.\n", totalwait * 1000.0 / (double) waits);
+    free(sorted);
+}
+
+/* Latencies go round a ring, the report covers the most recent */
+void
+addsample(double start, double end)
+{
+    samples[samplecount++ % MAXSAMPLES] = (end - start) * 1000.0;
+}
+
+/* Frames that miss a refresh show up as a gap of two or more periods, those
+ * aren't counted towards the period */
+void
+addrefresh(double t)
+{
+    double d = t - lastrefresh;
+
+    if (lastrefresh > 0.0 && d > 0.0) {
+	if (refreshperiod == 0.0)
+	    refreshperiod = d;
+	else if (d < 1.5 * refreshperiod)
+	    refreshperiod += (d - refreshperiod) * framesmoothing;
+    }
+    lastrefresh = t;
+}
+
+void
+waituntil(double t)
+{
+    double left;
+
+    while ((left = t - gettime()) > SPINTIME)
+	Sleep((DWORD) ((left - SPINTIME) * 1000.0));
+    while (gettime() < t)
+	YieldProcessor();
+}
+
+/* Waits on presents in the order they were queued. A later present showing
+ * completes an earlier one too, as happens when mailbox replaces it. */
+DWORD WINAPI
+waiter(LPVOID param)
+{
+    Pending p;
+    VkResult result;
+    double now;
+
+    UNUSED(param);
+    TRACE_THREAD("present wait");
+
+    AcquireSRWLockExclusive(&lock);
+    for (;;) {
+	while (head == tail && !stopping)
+	    SleepConditionVariableSRW(&cond, &lock, INFINITE, 0);
+	if (head == tail)
+	    break;
+	p = pending[head % MAXPENDING];
+	ReleaseSRWLockExclusive(&lock);
+
+	result = waitforpresent(device, p.swapchain, p.id, PRESENTTIMEOUT);
+	now = gettime();
+
+	AcquireSRWLockExclusive(&lock);
+	head++;
+	if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+	    addsample(p.start, now);
+	    addrefresh(now);
+	} else {
+	    failed++;
+	}
+	WakeAllConditionVariable(&cond);
+    }
+    ReleaseSRWLockExclusive(&lock);
+
+    return 0;
+}
+
+int
+comparedoubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank */
+double
+percentile(const double *sorted, uint32_t count, double p)
+{
+    uint32_t i = (uint32_t) ceil(p * (double) count);
+
+    return sorted[i > 0 ? i - 1 : 0];
+}
+
+/* Before the frame reads any input. In low latency mode this sleeps until
+ * the frame has to start to make the first refresh it still can, given how
+ * long the last frames took on the CPU and the GPU. */
+void
+lat_wait(double gpums)
+{
+    double now, last, period, work, next;
+
+    if (!lowlatency)
+	return;
+
+    TRACE_BEGIN("latency wait");
+    AcquireSRWLockExclusive(&lock);
+    /* Every present queued for the display adds a refresh of latency */
+    while (tail - head > 1)
+	SleepConditionVariableSRW(&cond, &lock, INFINITE, 0);
+    last = lastrefresh;
+    period = refreshperiod;
+    ReleaseSRWLockExclusive(&lock);
+
+    if (period > 0.0) {
+	now = gettime();
+	work = cputime + (gpums + latencymargin) / 1000.0;
+	next = last + period * ceil((now + work - last) / period);
+	if (next - work > now) {
+	    waituntil(next - work);
+	    totalwait += next - work - now;
+	}
+	waits++;
+    }
+    TRACE_END();
+}
+
+void
+lat_beginframe(void)
+{
+    framestart = gettime();
+}
+
+/* Without present wait the acquires mark the refreshes, it's only rough as
+ * an acquire returns when an image is free and not at the refresh itself */
+void
+lat_acquired(void)
+{
+    acquiretime = gettime();
+    if (waitforpresent == NULL) {
+	AcquireSRWLockExclusive(&lock);
+	addrefresh(acquiretime);
+	ReleaseSRWLockExclusive(&lock);
+    }
+}
+
+/* Tags the present with an id to wait on, the info must be presented
+ * before this is called again */
+void
+lat_present(VkPresentInfoKHR *info)
+{
+    if (waitforpresent == NULL)
+	return;
+
+    ids[0] = ++presentid;
+    presentids.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    presentids.pNext = info->pNext;
+    presentids.swapchainCount = info->swapchainCount;
+    presentids.pPresentIds = ids;
+    info->pNext = &presentids;
+}
+
+void
+lat_presented(VkSwapchainKHR swapchain, VkResult result)
+{
+    double now = gettime(), d = now - acquiretime;
+
+    cputime = cputime == 0.0 ? d : cputime + (d - cputime) * framesmoothing;
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	return;
+
+    AcquireSRWLockExclusive(&lock);
+    if (waitforpresent == NULL) {
+	addsample(framestart, now);
+    } else if (tail - head == MAXPENDING) {
+	dropped++;
+    } else {
+	pending[tail % MAXPENDING].swapchain = swapchain;
+	pending[tail % MAXPENDING].id = presentid;
+	pending[tail % MAXPENDING].start = framestart;
+	tail++;
+	WakeAllConditionVariable(&cond);
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+/* Before a swap chain is destroyed, presents to it can't be waited on after.
+ * Ids carry on across swap chains, waits on the next one complete in turn. */
+void
+lat_flush(void)
+{
+    AcquireSRWLockExclusive(&lock);
+    while (head != tail)
+	SleepConditionVariableSRW(&cond, &lock, INFINITE, 0);
+    ReleaseSRWLockExclusive(&lock);
+}
@@ -0,0 +1,11 @@
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+void lat_initialise(uint32_t presentwait);
+void lat_terminate(void);
+void lat_wait(double gpums);
+void lat_beginframe(void);
+void lat_acquired(void);
+void lat_present(VkPresentInfoKHR *info);
+void lat_presented(VkSwapchainKHR swapchain, VkResult result);
+void lat_flush(void);
@@ -0,0 +1,280 @@
+/* Host memory.
+ * Linear arenas for transient arrays, and allocation callbacks that give the
+ * driver a private heap per allocation scope and keep statistics on each, to
+ * find allocation churn and leaks.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "config.h"
+#include "mem.h"
+#include "util.h"
+
+/* Macros */
+#define ARENAALIGN 16
+/* Of the header, so it can sit in front of a block of any alignment */
+#define HEADERALIGN offsetof(struct { char c; Header h; }, h)
+/* Command, object, cache, device and instance */
+#define SCOPECOUNT 5
+
+/* Types */
+
+/* Sits just before every block handed to the driver */
+typedef struct {
+    void *base;
+    size_t size;
+    VkSystemAllocationScope scope;
+} Header;
+
+typedef struct {
+    volatile LONG64 bytes;
+    volatile LONG64 peak;
+    volatile LONG64 count;
+    volatile LONG64 total;
+    volatile LONG64 internal;
+} ScopeStats;
+
+/* Function declarations */
+static void track(VkSystemAllocationScope scope, LONG64 bytes);
+static VKAPI_ATTR void *VKAPI_CALL allocation(void *userdata, size_t size,
+	size_t alignment, VkSystemAllocationScope scope);
+static VKAPI_ATTR void *VKAPI_CALL reallocation(void *userdata,
+	void *original, size_t size, size_t alignment,
+	VkSystemAllocationScope scope);
+static VKAPI_ATTR void VKAPI_CALL freefunction(void *userdata, void *memory);
+static VKAPI_ATTR void VKAPI_CALL internalallocation(void *userdata,
+	size_t size, VkInternalAllocationType type,
+	VkSystemAllocationScope scope);
+static VKAPI_ATTR void VKAPI_CALL internalfree(void *userdata, size_t size,
+	VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+/* Variables */
+static const char * const scopenames[] = {
+    "command", "object", "cache", "device", "instance"
+};
+static HANDLE heaps[SCOPECOUNT];
+static ScopeStats stats[SCOPECOUNT];
+Arena initarena;
+const VkAllocationCallbacks allocator = {
+    .pUserData = NULL,
+    .pfnAllocation = allocation,
+    .pfnReallocation = reallocation,
+    .pfnFree = freefunction,
+    .pfnInternalAllocation = internalallocation,
+    .pfnInternalFree = internalfree
+};
+
+/* Function implementations */
+
+void
+track(VkSystemAllocationScope scope, LONG64 bytes)
+{
+    ScopeStats *s = &stats[scope];
+    LONG64 now, peak;
+
+    now = InterlockedExchangeAdd64(&s->bytes, bytes) + bytes;
+    if (bytes > 0) {
+	InterlockedIncrement64(&s->count);
+	InterlockedIncrement64(&s->total);
+    } else {
+	InterlockedExchangeAdd64(&s->count, -1);
+    }
+
+    /* Lock-free maximum */
+    while (now > (peak = s->peak))
+	if (InterlockedCompareExchange64(&s->peak, now, peak) == peak)
+	    break;
+}
+
+VKAPI_ATTR void *VKAPI_CALL
+allocation(void *userdata, size_t size, size_t alignment,
+	VkSystemAllocationScope scope)
+{
+    unsigned char *base, *p;
+    Header *h;
+
+    UNUSED(userdata);
+
+    if (size == 0)
+	return NULL;
+    if (alignment < HEADERALIGN)
+	alignment = HEADERALIGN;
+
+    /* Room to align and to put the header in front */
+    if ((base = (unsigned char *) HeapAlloc(heaps[scope], 0, size +
+		    alignment + sizeof(Header))) == NULL)
+	return NULL;
+    p = (unsigned char *) (((uintptr_t) base + sizeof(Header) + alignment -
+		1) & ~((uintptr_t) alignment - 1));
+
+    h = (Header *) p - 1;
+    h->base = base;
+    h->size = size;
+    h->scope = scope;
+    track(scope, (LONG64) size);
+
+    return p;
+}
+
+VKAPI_ATTR void *VKAPI_CALL
+reallocation(void *userdata, void *original, size_t size, size_t alignment,
+	VkSystemAllocationScope scope)
+{
+    void *p;
+    const Header *h;
+
+    if (original == NULL)
+	return allocation(userdata, size, alignment, scope);
+    if (size == 0) {
+	freefunction(userdata, original);
+	return NULL;
+    }
+
+    /* Alignment has to be kept, so always move */
+    h = (const Header *) original - 1;
+    if ((p = allocation(userdata, size, alignment, scope)) == NULL)
+	return NULL;
+    memcpy(p, original, h->size < size ? h->size : size);
+    freefunction(userdata, original);
+
+    return p;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+freefunction(void *userdata, void *memory)
+{
+    const Header *h;
+
+    UNUSED(userdata);
+
+    if (memory == NULL)
+	return;
+
+    h = (const Header *) memory - 1;
+    track(h->scope, -(LONG64) h->size);
+    HeapFree(heaps[h->scope], 0, h->base);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+internalallocation(void *userdata, size_t size, VkInternalAllocationType type,
+	VkSystemAllocationScope scope)
+{
+    UNUSED(userdata);
+    UNUSED(type);
+
+    InterlockedExchangeAdd64(&stats[scope].internal, (LONG64) size);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+internalfree(void *userdata, size_t size, VkInternalAllocationType type,
+	VkSystemAllocationScope scope)
+{
+    UNUSED(userdata);
+    UNUSED(type);
+
+    InterlockedExchangeAdd64(&stats[scope].internal, -(LONG64) size);
+}
+
+void
+mem_initialise(void)
+{
+    uint32_t i;
+
+    /* Growable and serialised, the driver may allocate from any thread */
+    for (i = 0; i < SCOPECOUNT; i++)
+	if ((heaps[i] = HeapCreate(0, 0, 0)) == NULL)
+	    terminate("Failed to create heap.");
+
+    mem_createarena(&initarena, initarenasize);
+}
+
+/* Anything still allocated by the driver is leaked */
+void
+mem_terminate(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < SCOPECOUNT; i++)
+	HeapDestroy(heaps[i]);
+
+    mem_destroyarena(&initarena);
+}
+
+void
+mem_createarena(Arena *a, size_t size)
+{
+    if ((a->base = (unsigned char *) malloc(size)) == NULL)
+	terminate("Failed to allocate arena.");
+    a->size = size;
+    a->used = a->peak = 0;
+}
+
+void
+mem_destroyarena(Arena *a)
+{
+    free(a->base);
+    a->base = NULL;
+}
+
+/* Lock-free, so initialisation tasks can share an arena across threads */
+void *
+mem_alloc(Arena *a, size_t size)
+{
+    LONG64 used, start, end, peak;
+
+    do {
+	used = a->used;
+	start = (used + ARENAALIGN - 1) & ~((LONG64) ARENAALIGN - 1);
+	if ((LONG64) size > (LONG64) a->size - start)
+	    terminate("Arena out of memory.");
+	end = start + (LONG64) size;
+    } while (InterlockedCompareExchange64(&a->used, end, used) != used);
+
+    while (end > (peak = a->peak))
+	if (InterlockedCompareExchange64(&a->peak, end, peak) == peak)
+	    break;
+
+    return a->base + start;
+}
+
+/* Only when nothing else is allocating from the arena */
+void
+mem_reset(Arena *a, size_t mark)
+{
+    a->used = (LONG64) mark;
+}
+
+/* Driver allocations live now, cheap enough to sample every frame */
+size_t
+mem_hostbytes(void)
+{
+    LONG64 bytes = 0;
+    uint32_t i;
+
+    for (i = 0; i < SCOPECOUNT; i++)
+	bytes += stats[i].bytes;
+
+    return (size_t) bytes;
+}
+
+void
+mem_report(void)
+{
+    uint32_t i;
+
+    fprintf(stderr, "%-9s %12s %8s %12s %8s %12s\n", "scope", "bytes",
+	    "count", "peak", "allocs", "internal");
+    for (i = 0; i < SCOPECOUNT; i++)
+	fprintf(stderr, "%-9s %12lld %8lld %12lld %8lld %12lld\n",
+		scopenames[i], (long long) stats[i].bytes,
+		(long long) stats[i].count, (long long) stats[i].peak,
+		(long long) stats[i].total, (long long) stats[i].internal);
+    fprintf(stderr, "init arena peak %zu of %zu\n",
+	    (size_t) initarena.peak, initarena.size);
+}
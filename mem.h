@@ -0,0 +1,25 @@
+#include <stddef.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+/* Linear allocator, everything is freed at once by resetting to a mark */
+typedef struct {
+    unsigned char *base;
+    size_t size;
+    volatile LONG64 used;
+    volatile LONG64 peak;
+} Arena;
+
+/* Transient arrays during initialisation and swap chain recreation */
+extern Arena initarena;
+/* Tracks driver host allocations by scope */
+extern const VkAllocationCallbacks allocator;
+
+void mem_initialise(void);
+void mem_terminate(void);
+void mem_createarena(Arena *a, size_t size);
+void mem_destroyarena(Arena *a);
+void *mem_alloc(Arena *a, size_t size);
+void mem_reset(Arena *a, size_t mark);
+size_t mem_hostbytes(void);
+void mem_report(void);
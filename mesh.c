@@ -0,0 +1,589 @@
+/* Mesh pipeline.
+ * Triangles are reordered for the post-transform vertex cache with Tom
+ * Forsyth's linear-speed optimiser, then cut into clusters at the points
+ * where the cache would start cold anyway and the clusters sorted so those
+ * facing out from the centre draw first, which cuts overdraw. Vertices are
+ * then renumbered in the order the triangles first use them so fetches walk
+ * the buffer forwards, and finally quantised from 40 to 16 bytes. Runs
+ * offline in meshpack, which saves the result, or at load.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh.h"
+#include "util.h"
+
+/* Macros */
+#define MESHVERSION 1
+/* Forsyth's scoring, the cache is modelled as LRU */
+#define CACHESIZE 32
+#define CACHEDECAY 1.5f
+#define LASTTRISCORE 0.75f
+#define VALENCESCALE 2.0f
+#define VALENCEPOWER 0.5f
+/* FIFO cache used to find cluster boundaries, as on most hardware */
+#define CLUSTERCACHE 16
+/* Clusters may cost this much more ACMR than the whole mesh */
+#define OVERDRAWTHRESHOLD 1.05f
+#define NOTRIANGLE UINT32_MAX
+
+/* Types */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexcount;
+    uint32_t indexcount;
+    float centre[3];
+    float scale;
+    float radius;
+    /* Keeps the vertices 16 byte aligned */
+    uint32_t pad[3];
+} MeshHeader;
+
+typedef struct {
+    float key;
+    uint32_t first;
+    uint32_t count;
+} Cluster;
+
+/* Function declarations */
+static float vertexscore(int32_t cachepos, uint32_t remaining);
+static float trianglescore(const uint32_t *tri, const float *scores);
+static void trianglegeometry(const uint32_t *tri, const MeshSource *vertices,
+	float *centroid, float *normal);
+static int compareclusters(const void *a, const void *b);
+static int16_t snorm16(float x);
+static uint32_t unorm8(float x);
+static void octahedral(const float *n, int16_t *out);
+static void checkindices(const uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount);
+
+/* Function implementations */
+
+/* Vertices recently used score higher, the three just used a fixed amount
+ * so the next triangle doesn't only reuse them. Vertices with few
+ * triangles left are boosted so they get finished off. */
+float
+vertexscore(int32_t cachepos, uint32_t remaining)
+{
+    float score = 0.0f;
+
+    if (remaining == 0)
+	return -1.0f;
+
+    if (cachepos >= 3)
+	score = powf(1.0f - (float) (cachepos - 3) / (CACHESIZE - 3),
+		CACHEDECAY);
+    else if (cachepos >= 0)
+	score = LASTTRISCORE;
+
+    return score + VALENCESCALE * powf((float) remaining, -VALENCEPOWER);
+}
+
+float
+trianglescore(const uint32_t *tri, const float *scores)
+{
+    return scores[tri[0]] + scores[tri[1]] + scores[tri[2]];
+}
+
+void
+mesh_optimisecache(uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount)
+{
+    uint32_t tricount = indexcount / 3, cache[CACHESIZE + 3];
+    uint32_t newcache[CACHESIZE + 3], cachecount = 0, newcount, cursor = 0;
+    uint32_t best = NOTRIANGLE, out, t, i, j, k, v, a, last;
+    uint32_t *offsets, *remaining, *adjacency, *output;
+    int32_t *cachepos;
+    float *vscores, *tscores, score, bestscore = -1.0f;
+    unsigned char *emitted;
+
+    if (tricount == 0)
+	return;
+
+    offsets = (uint32_t *) malloc((vertexcount + 1) * sizeof(uint32_t));
+    remaining = (uint32_t *) calloc(vertexcount, sizeof(uint32_t));
+    adjacency = (uint32_t *) malloc(3 * (size_t) tricount * sizeof(uint32_t));
+    output = (uint32_t *) malloc(3 * (size_t) tricount * sizeof(uint32_t));
+    cachepos = (int32_t *) malloc(vertexcount * sizeof(int32_t));
+    vscores = (float *) malloc(vertexcount * sizeof(float));
+    tscores = (float *) malloc(tricount * sizeof(float));
+    emitted = (unsigned char *) calloc(tricount, 1);
+    if (offsets == NULL || remaining == NULL || adjacency == NULL ||
+	    output == NULL || cachepos == NULL || vscores == NULL ||
+	    tscores == NULL || emitted == NULL)
+	terminate("Failed to allocate mesh optimiser.");
+
+    /* Each vertex's triangles, the ones not yet emitted kept first */
+    for (i = 0; i < 3 * tricount; i++)
+	remaining[indices[i]]++;
+    offsets[0] = 0;
+    for (v = 0; v < vertexcount; v++) {
+	offsets[v + 1] = offsets[v] + remaining[v];
+	remaining[v] = 0;
+    }
+    for (i = 0; i < 3 * tricount; i++) {
+	v = indices[i];
+	adjacency[offsets[v] + remaining[v]++] = i / 3;
+    }
+
+    for (v = 0; v < vertexcount; v++) {
+	cachepos[v] = -1;
+	vscores[v] = vertexscore(-1, remaining[v]);
+    }
+    for (t = 0; t < tricount; t++) {
+	tscores[t] = trianglescore(indices + 3 * t, vscores);
+	if (tscores[t] > bestscore) {
+	    bestscore = tscores[t];
+	    best = t;
+	}
+    }
+
+    for (out = 0; out < tricount; out++) {
+	/* Nothing in the cache has triangles left, start somewhere new */
+	if (best == NOTRIANGLE) {
+	    while (emitted[cursor])
+		cursor++;
+	    best = cursor;
+	}
+	t = best;
+	emitted[t] = 1;
+
+	/* The triangle's vertices go to the front of the cache */
+	newcount = 0;
+	for (k = 0; k < 3; k++) {
+	    v = output[3 * out + k] = indices[3 * t + k];
+	    newcache[newcount++] = v;
+	    last = offsets[v] + --remaining[v];
+	    for (j = offsets[v]; adjacency[j] != t; j++)
+		;
+	    adjacency[j] = adjacency[last];
+	    adjacency[last] = t;
+	}
+	for (i = 0; i < cachecount; i++) {
+	    v = cache[i];
+	    if (v != newcache[0] && v != newcache[1] && v != newcache[2])
+		newcache[newcount++] = v;
+	}
+
+	/* Vertices pushed out of the cache are rescored too */
+	for (i = 0; i < newcount; i++) {
+	    v = newcache[i];
+	    cachepos[v] = i < CACHESIZE ? (int32_t) i : -1;
+	    vscores[v] = vertexscore(cachepos[v], remaining[v]);
+	}
+
+	/* Only triangles touching the cache can have changed */
+	best = NOTRIANGLE;
+	bestscore = -1.0f;
+	for (i = 0; i < newcount; i++) {
+	    v = newcache[i];
+	    for (j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+		a = adjacency[j];
+		score = tscores[a] = trianglescore(indices + 3 * a, vscores);
+		if (score > bestscore) {
+		    bestscore = score;
+		    best = a;
+		}
+	    }
+	}
+
+	cachecount = newcount < CACHESIZE ? newcount : CACHESIZE;
+	memcpy(cache, newcache, cachecount * sizeof(uint32_t));
+    }
+
+    memcpy(indices, output, 3 * (size_t) tricount * sizeof(uint32_t));
+
+    free(offsets);
+    free(remaining);
+    free(adjacency);
+    free(output);
+    free(cachepos);
+    free(vscores);
+    free(tscores);
+    free(emitted);
+}
+
+/* Centroid and the normal scaled by twice the area */
+void
+trianglegeometry(const uint32_t *tri, const MeshSource *vertices,
+	float *centroid, float *normal)
+{
+    const float *p0 = vertices[tri[0]].position;
+    const float *p1 = vertices[tri[1]].position;
+    const float *p2 = vertices[tri[2]].position;
+    float e1[3], e2[3];
+    uint32_t c;
+
+    for (c = 0; c < 3; c++) {
+	centroid[c] = (p0[c] + p1[c] + p2[c]) / 3.0f;
+	e1[c] = p1[c] - p0[c];
+	e2[c] = p2[c] - p0[c];
+    }
+    normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/* Most outward facing first, then in cache order */
+int
+compareclusters(const void *a, const void *b)
+{
+    const Cluster *x = (const Cluster *) a, *y = (const Cluster *) b;
+
+    if (x->key != y->key)
+	return x->key < y->key ? 1 : -1;
+
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+/* Run after mesh_optimisecache(). A cluster ends where a triangle misses
+ * all three vertices, so reordering there costs nothing, or once its own
+ * ACMR is within the threshold of the mesh's. */
+void
+mesh_optimiseoverdraw(uint32_t *indices, uint32_t indexcount,
+	const MeshSource *vertices, uint32_t vertexcount, float threshold)
+{
+    uint32_t tricount = indexcount / 3, clustercount = 0, time, misses;
+    uint32_t clustermisses = 0, t, k, c, v, i;
+    uint32_t *stamps, *output;
+    Cluster *clusters, *cl;
+    float meshacmr, centre[3] = { 0.0f, 0.0f, 0.0f }, area = 0.0f;
+    float centroid[3], normal[3], sum[3], nsum[3], a, len, key;
+
+    if (tricount == 0)
+	return;
+
+    stamps = (uint32_t *) calloc(vertexcount, sizeof(uint32_t));
+    output = (uint32_t *) malloc(3 * (size_t) tricount * sizeof(uint32_t));
+    clusters = (Cluster *) malloc(tricount * sizeof(Cluster));
+    if (stamps == NULL || output == NULL || clusters == NULL)
+	terminate("Failed to allocate mesh optimiser.");
+
+    meshacmr = (float) mesh_cachemisses(indices, indexcount, vertexcount,
+	    CLUSTERCACHE) / (float) tricount;
+
+    /* Area weighted centre of the mesh */
+    for (t = 0; t < tricount; t++) {
+	trianglegeometry(indices + 3 * t, vertices, centroid, normal);
+	a = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] +
+		normal[2] * normal[2]);
+	for (c = 0; c < 3; c++)
+	    centre[c] += centroid[c] * a;
+	area += a;
+    }
+    for (c = 0; c < 3; c++)
+	centre[c] = area > 0.0f ? centre[c] / area : 0.0f;
+
+    /* FIFO cache by time stamp, a vertex is cached if it went in less than
+     * the cache size misses ago */
+    time = CLUSTERCACHE + 1;
+    for (t = 0; t < tricount; t++) {
+	misses = 0;
+	for (k = 0; k < 3; k++)
+	    misses += time - stamps[indices[3 * t + k]] > CLUSTERCACHE;
+
+	if (clustercount == 0 || misses == 3 ||
+		(float) clustermisses <= threshold * meshacmr *
+		(float) clusters[clustercount - 1].count) {
+	    cl = &clusters[clustercount++];
+	    cl->first = t;
+	    cl->count = 0;
+	    clustermisses = 0;
+	    /* Once sorted a cluster may start with a cold cache */
+	    time += CLUSTERCACHE;
+	}
+
+	for (k = 0; k < 3; k++) {
+	    v = indices[3 * t + k];
+	    if (time - stamps[v] > CLUSTERCACHE) {
+		stamps[v] = time++;
+		clustermisses++;
+	    }
+	}
+	clusters[clustercount - 1].count++;
+    }
+
+    /* How far the cluster's centroid is out along its normal */
+    for (i = 0; i < clustercount; i++) {
+	cl = &clusters[i];
+	sum[0] = sum[1] = sum[2] = nsum[0] = nsum[1] = nsum[2] = 0.0f;
+	area = 0.0f;
+	for (t = cl->first; t < cl->first + cl->count; t++) {
+	    trianglegeometry(indices + 3 * t, vertices, centroid, normal);
+	    a = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] +
+		    normal[2] * normal[2]);
+	    for (c = 0; c < 3; c++) {
+		sum[c] += centroid[c] * a;
+		nsum[c] += normal[c];
+	    }
+	    area += a;
+	}
+	len = sqrtf(nsum[0] * nsum[0] + nsum[1] * nsum[1] + nsum[2] * nsum[2]);
+	key = 0.0f;
+	if (area > 0.0f && len > 0.0f)
+	    for (c = 0; c < 3; c++)
+		key += (sum[c] / area - centre[c]) * nsum[c] / len;
+	cl->key = key;
+    }
+
+    qsort(clusters, clustercount, sizeof(Cluster), compareclusters);
+
+    for (i = 0, t = 0; i < clustercount; i++) {
+	memcpy(output + 3 * t, indices + 3 * clusters[i].first,
+		3 * (size_t) clusters[i].count * sizeof(uint32_t));
+	t += clusters[i].count;
+    }
+    memcpy(indices, output, 3 * (size_t) tricount * sizeof(uint32_t));
+
+    free(stamps);
+    free(output);
+    free(clusters);
+}
+
+/* Renumbers vertices in the order the indices first use them, dropping
+ * any unused. Returns the new vertex count. */
+uint32_t
+mesh_optimisefetch(MeshSource *vertices, uint32_t vertexcount,
+	uint32_t *indices, uint32_t indexcount)
+{
+    uint32_t *remap, next = 0, i, v;
+    MeshSource *copy;
+
+    remap = (uint32_t *) malloc(vertexcount * sizeof(uint32_t));
+    copy = (MeshSource *) malloc(vertexcount * sizeof(MeshSource));
+    if (remap == NULL || copy == NULL)
+	terminate("Failed to allocate mesh optimiser.");
+
+    for (v = 0; v < vertexcount; v++)
+	remap[v] = UINT32_MAX;
+    for (i = 0; i < indexcount; i++) {
+	v = indices[i];
+	if (remap[v] == UINT32_MAX) {
+	    copy[next] = vertices[v];
+	    remap[v] = next++;
+	}
+	indices[i] = remap[v];
+    }
+    memcpy(vertices, copy, next * sizeof(MeshSource));
+
+    free(remap);
+    free(copy);
+
+    return next;
+}
+
+int16_t
+snorm16(float x)
+{
+    return (int16_t) lrintf(CLAMP(x, -1.0f, 1.0f) * 32767.0f);
+}
+
+uint32_t
+unorm8(float x)
+{
+    return (uint32_t) lrintf(CLAMP(x, 0.0f, 1.0f) * 255.0f);
+}
+
+/* Projects the unit normal onto an octahedron and unfolds the lower half
+ * over the corners of the square */
+void
+octahedral(const float *n, int16_t *out)
+{
+    float l = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]), x, y, ox;
+
+    if (l == 0.0f) {
+	out[0] = out[1] = 0;
+	return;
+    }
+
+    x = n[0] / l;
+    y = n[1] / l;
+    if (n[2] < 0.0f) {
+	ox = x;
+	x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+	y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+    out[0] = snorm16(x);
+    out[1] = snorm16(y);
+}
+
+/* Fills m's vertices, which must have room, and its bounds. The scale is
+ * the same on every axis so a draw can scale the mesh uniformly. */
+void
+mesh_quantise(Mesh *m, const MeshSource *vertices, uint32_t vertexcount)
+{
+    float lo[3] = { INFINITY, INFINITY, INFINITY };
+    float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+    float r2 = 0.0f, d, inv;
+    const MeshSource *s;
+    MeshVertex *q;
+    uint32_t i, c;
+
+    for (i = 0; i < vertexcount; i++) {
+	s = &vertices[i];
+	d = 0.0f;
+	for (c = 0; c < 3; c++) {
+	    lo[c] = s->position[c] < lo[c] ? s->position[c] : lo[c];
+	    hi[c] = s->position[c] > hi[c] ? s->position[c] : hi[c];
+	    d += s->position[c] * s->position[c];
+	}
+	r2 = d > r2 ? d : r2;
+    }
+
+    m->scale = 0.0f;
+    for (c = 0; c < 3; c++) {
+	m->centre[c] = vertexcount > 0 ? (lo[c] + hi[c]) / 2.0f : 0.0f;
+	d = vertexcount > 0 ? (hi[c] - lo[c]) / 2.0f : 0.0f;
+	m->scale = d > m->scale ? d : m->scale;
+    }
+    if (m->scale == 0.0f)
+	m->scale = 1.0f;
+    m->radius = sqrtf(r2);
+    inv = 1.0f / m->scale;
+
+    for (i = 0; i < vertexcount; i++) {
+	s = &vertices[i];
+	q = &m->vertices[i];
+	for (c = 0; c < 3; c++)
+	    q->position[c] = snorm16((s->position[c] - m->centre[c]) * inv);
+	q->position[3] = 32767;
+	octahedral(s->normal, q->normal);
+	q->colour = unorm8(s->colour[0]) | unorm8(s->colour[1]) << 8 |
+	    unorm8(s->colour[2]) << 16 | unorm8(s->colour[3]) << 24;
+    }
+    m->vertexcount = vertexcount;
+}
+
+void
+checkindices(const uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount)
+{
+    uint32_t i;
+
+    if (indexcount == 0 || indexcount % 3 != 0)
+	terminate("Mesh index count %u is not whole triangles.", indexcount);
+    for (i = 0; i < indexcount; i++)
+	if (indices[i] >= vertexcount)
+	    terminate("Mesh index %u out of range.", indices[i]);
+}
+
+/* The whole pipeline. The source arrays are reordered in place and m gets
+ * its own quantised copies, free them with mesh_free(). */
+void
+mesh_build(Mesh *m, MeshSource *vertices, uint32_t vertexcount,
+	uint32_t *indices, uint32_t indexcount)
+{
+    checkindices(indices, indexcount, vertexcount);
+
+    mesh_optimisecache(indices, indexcount, vertexcount);
+    mesh_optimiseoverdraw(indices, indexcount, vertices, vertexcount,
+	    OVERDRAWTHRESHOLD);
+    vertexcount = mesh_optimisefetch(vertices, vertexcount, indices,
+	    indexcount);
+
+    m->base = malloc(vertexcount * sizeof(MeshVertex) +
+	    indexcount * sizeof(uint32_t));
+    if (m->base == NULL)
+	terminate("Failed to allocate mesh.");
+    m->vertices = (MeshVertex *) m->base;
+    m->indices = (uint32_t *) (m->vertices + vertexcount);
+
+    mesh_quantise(m, vertices, vertexcount);
+    memcpy(m->indices, indices, indexcount * sizeof(uint32_t));
+    m->indexcount = indexcount;
+}
+
+/* Only frees what the mesh owns, the counts and bounds stay */
+void
+mesh_free(Mesh *m)
+{
+    free(m->base);
+    m->base = NULL;
+    m->vertices = NULL;
+    m->indices = NULL;
+}
+
+/* Little endian, laid out as it's uploaded */
+void
+mesh_save(const Mesh *m, const char *filename)
+{
+    MeshHeader h = {
+	.magic = { 'M', 'E', 'S', 'H' },
+	.version = MESHVERSION,
+	.vertexcount = m->vertexcount,
+	.indexcount = m->indexcount,
+	.centre = { m->centre[0], m->centre[1], m->centre[2] },
+	.scale = m->scale,
+	.radius = m->radius,
+	.pad = { 0, 0, 0 }
+    };
+    FILE *f;
+
+    if ((f = fopen(filename, "wb")) == NULL)
+	terminate("Could not open file %s.", filename);
+    if (fwrite(&h, sizeof h, 1, f) != 1 ||
+	    fwrite(m->vertices, sizeof(MeshVertex), m->vertexcount, f) !=
+	    m->vertexcount ||
+	    fwrite(m->indices, sizeof(uint32_t), m->indexcount, f) !=
+	    m->indexcount)
+	terminate("Error on writing file %s.", filename);
+    if (fclose(f) != 0)
+	terminate("Error on writing file %s.", filename);
+}
+
+/* Points the mesh into a file's data, e.g. a mapped view, which must stay
+ * alive and be 16 byte aligned. Nothing is copied or reordered. */
+void
+mesh_read(Mesh *m, const void *data, size_t size)
+{
+    const MeshHeader *h = (const MeshHeader *) data;
+    uint64_t expected;
+
+    if (size < sizeof(MeshHeader) || memcmp(h->magic, "MESH", 4) != 0 ||
+	    h->version != MESHVERSION)
+	terminate("Not a version %u mesh file.", MESHVERSION);
+    expected = sizeof(MeshHeader) + (uint64_t) h->vertexcount *
+	sizeof(MeshVertex) + (uint64_t) h->indexcount * sizeof(uint32_t);
+    if (expected != size)
+	terminate("Mesh file is %zu bytes, expected %llu.", size,
+		(unsigned long long) expected);
+
+    m->vertices = (MeshVertex *) (h + 1);
+    m->indices = (uint32_t *) (m->vertices + h->vertexcount);
+    m->vertexcount = h->vertexcount;
+    m->indexcount = h->indexcount;
+    memcpy(m->centre, h->centre, sizeof m->centre);
+    m->scale = h->scale;
+    m->radius = h->radius;
+    m->base = NULL;
+
+    /* Drawn straight from the file, so a bad index mustn't reach the GPU */
+    checkindices(m->indices, m->indexcount, m->vertexcount);
+}
+
+/* Misses in a FIFO cache of the given size, divided by the triangle count
+ * this is the ACMR and by the vertex count the ATVR */
+uint32_t
+mesh_cachemisses(const uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount, uint32_t cachesize)
+{
+    uint32_t *stamps, time = cachesize + 1, misses = 0, i;
+
+    if ((stamps = (uint32_t *) calloc(vertexcount, sizeof(uint32_t))) ==
+	    NULL)
+	terminate("Failed to allocate cache model.");
+
+    for (i = 0; i < indexcount; i++)
+	if (time - stamps[indices[i]] > cachesize) {
+	    stamps[indices[i]] = time++;
+	    misses++;
+	}
+
+    free(stamps);
+
+    return misses;
+}
@@ -0,0 +1,50 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/* Full precision vertex as authored, the input to the mesh pipeline */
+typedef struct {
+    float position[3];
+    float normal[3];
+    float colour[4];
+} MeshSource;
+
+/* Quantised vertex, must match the vertex input descriptions built in
+ * creategraphicspipeline(). The position is 16 bit snorm within the mesh's
+ * bounds with w of one, the normal is octahedral encoded in two 16 bit
+ * snorms and the colour is RGBA8, red in the low byte. */
+typedef struct {
+    int16_t position[4];
+    int16_t normal[2];
+    uint32_t colour;
+} MeshVertex;
+
+/* Vertices and indices ready to upload. A position is centre plus scale
+ * times the snorm value. */
+typedef struct {
+    MeshVertex *vertices;
+    uint32_t *indices;
+    uint32_t vertexcount;
+    uint32_t indexcount;
+    float centre[3];
+    float scale;
+    /* Bounding radius about the mesh's origin, not the centre */
+    float radius;
+    /* Allocation holding the arrays, NULL when they point into a file */
+    void *base;
+} Mesh;
+
+void mesh_optimisecache(uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount);
+void mesh_optimiseoverdraw(uint32_t *indices, uint32_t indexcount,
+	const MeshSource *vertices, uint32_t vertexcount, float threshold);
+uint32_t mesh_optimisefetch(MeshSource *vertices, uint32_t vertexcount,
+	uint32_t *indices, uint32_t indexcount);
+void mesh_quantise(Mesh *m, const MeshSource *vertices,
+	uint32_t vertexcount);
+void mesh_build(Mesh *m, MeshSource *vertices, uint32_t vertexcount,
+	uint32_t *indices, uint32_t indexcount);
+void mesh_free(Mesh *m);
+void mesh_save(const Mesh *m, const char *filename);
+void mesh_read(Mesh *m, const void *data, size_t size);
+uint32_t mesh_cachemisses(const uint32_t *indices, uint32_t indexcount,
+	uint32_t vertexcount, uint32_t cachesize);
@@ -0,0 +1,1016 @@
+/* Graphics pipelines.
+ * Variants are specialized from the same shader modules and built on a
+ * background thread. Until a variant is ready draws use the fallback, built
+ * at start up from the shaders' default constants. Finished variants are
+ * only swapped in between frames.
+ * With graphics pipeline libraries the vertex input, pre-rasterisation and
+ * fragment output parts are compiled once. A variant then only compiles its
+ * fragment shader part and is linked without optimisation, then relinked
+ * with link time optimisation when the builder is otherwise idle.
+ * Debug builds watch the shader directory, recompile sources that change and
+ * rebuild every pipeline in the background. Replaced pipelines are destroyed
+ * once the frames that used them have completed.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "config.h"
+#include "mem.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "util.h"
+#include "vulkan.h"
+#include "win32.h"
+
+/* Macros */
+#define MAXVARIANTS 64
+/* Each swap retires at most every variant and the fallback, and a retired
+ * pipeline lives for MAXFRAMES more swaps */
+#define RETIREDSIZE ((MAXVARIANTS + 1) * (MAXFRAMES + 1))
+/* Parts of a pipeline library */
+#define LIB_INPUT \
+    VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT
+#define LIB_RASTER \
+    VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT
+#define LIB_FRAGMENT \
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT
+#define LIB_OUTPUT \
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT
+
+/* Types */
+
+/* Linked variants are waiting on an optimised link */
+typedef enum {
+    VARIANT_QUEUED, VARIANT_BUILDING, VARIANT_LINKED, VARIANT_BUILT
+} VariantState;
+
+typedef struct {
+    PipelineKey key;
+    /* Guarded by the lock */
+    VariantState state;
+    VkPipeline built;
+    /* Only the frame thread reads and writes this */
+    VkPipeline current;
+    /* Fragment shader part, only the builder uses it */
+    VkPipeline library;
+} Variant;
+
+typedef struct {
+    uint32_t count;
+    /* Milliseconds */
+    double time;
+} BuildStats;
+
+typedef struct {
+    uint64_t frame;
+    VkPipeline pipeline;
+} RetiredPipeline;
+
+#ifdef DEBUG
+typedef struct {
+    const char *source;
+    const char *spirv;
+    /* Last write of the SPIR-V that was loaded */
+    FILETIME loaded;
+} ShaderFile;
+#endif /* DEBUG */
+
+/* Function declarations */
+static uint32_t readmodule(const char *filename, VkShaderModule *sm);
+static VkPipeline createpipeline(const PipelineKey *key,
+	VkGraphicsPipelineLibraryFlagsEXT parts);
+static VkPipeline linkpipeline(VkPipeline fragment,
+	VkPipelineCreateFlags flags);
+static void measure(BuildStats *s, double start);
+static void report(const char *name, const BuildStats *s);
+static VkPipeline buildvariant(Variant *v, const PipelineKey *key);
+static VkPipeline optimisevariant(Variant *v);
+static void replace(VkPipeline *built, VkPipeline current, VkPipeline p);
+static void rebuild(void);
+static DWORD WINAPI builder(LPVOID param);
+static void retire(VkPipeline pipeline, uint64_t frame);
+#ifdef DEBUG
+static uint32_t lastwrite(const char *filename, FILETIME *time);
+static uint32_t compileshader(const ShaderFile *s);
+static DWORD WINAPI watcher(LPVOID param);
+#endif /* DEBUG */
+
+/* Variables */
+static const char readonlybinary[] = "rb";
+static VkShaderModule vertexmodule;
+static VkShaderModule fragmentmodule;
+static VkRenderPass pipelinerenderpass;
+static VkPipelineLayout pipelinelayout;
+static uint32_t librarymode;
+static VkPipeline vertexinput;
+static VkPipeline prerasterisation;
+static VkPipeline fragmentoutput;
+/* Only written before the builder starts or by the builder */
+static BuildStats fullstats, librarystats, fastlinkstats, optimisedstats;
+/* Built is guarded by the lock, the frame thread draws with current */
+static VkPipeline fallbackbuilt;
+static VkPipeline fallback;
+static Variant variants[MAXVARIANTS];
+static uint32_t variantcount;
+static SRWLOCK lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE cond = CONDITION_VARIABLE_INIT;
+static HANDLE thread;
+static uint32_t stopping;
+static uint32_t reloading;
+/* Set when a pipeline has been built but not swapped in */
+static volatile LONG pending;
+static RetiredPipeline retired[RETIREDSIZE];
+static uint32_t retiredhead, retiredcount;
+#ifdef DEBUG
+static ShaderFile shaderfiles[] = {
+    { vertexsource, vertexshader, { 0, 0 } },
+    { fragmentsource, fragmentshader, { 0, 0 } }
+};
+static HANDLE watchthread;
+static HANDLE stopevent;
+#endif /* DEBUG */
+
+/* Function implementations */
+
+/* Read with malloc, reloads can happen while the init arena is in use.
+ * Zero with the reason on stderr if the file isn't usable SPIR-V. */
+uint32_t
+readmodule(const char *filename, VkShaderModule *sm)
+{
+    FILE *fp;
+    char *code;
+    long size;
+    uint32_t magic = 0;
+    VkShaderModuleCreateInfo ci = {
+	.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.codeSize = 0,
+	.pCode = NULL
+    };
+    VkResult result;
+
+    if ((fp = fopen(filename, readonlybinary)) == NULL) {
+	fprintf(stderr, "Could not open file %s.\n", filename);
+	return 0;
+    }
+    if (fseek(fp, 0L, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+	fprintf(stderr, "Error on seeking file %s.\n", filename);
+	fclose(fp);
+	return 0;
+    }
+    rewind(fp);
+    /* Caught here rather than left to the driver */
+    if (size == 0 || size % 4 != 0) {
+	fprintf(stderr, "File %s is not SPIR-V.\n", filename);
+	fclose(fp);
+	return 0;
+    }
+    if ((code = (char *) malloc(size * sizeof(char))) == NULL)
+	terminate("Failed to allocate shader code.");
+    if (fread(code, sizeof(char), size, fp) < (size_t) size) {
+	fprintf(stderr, "Error reading file %s.\n", filename);
+	fclose(fp);
+	free(code);
+	return 0;
+    }
+    if (fclose(fp) == EOF)
+	terminate("Error on closing file %s.\n", filename);
+
+    memcpy(&magic, code, sizeof magic);
+    if (magic != 0x07230203) {
+	fprintf(stderr, "File %s is not SPIR-V.\n", filename);
+	free(code);
+	return 0;
+    }
+    ci.codeSize = size;
+    ci.pCode = (const uint32_t *) code;
+    result = vkCreateShaderModule(device, &ci, &allocator, sm);
+    free(code);
+    if (result != VK_SUCCESS) {
+	fprintf(stderr, "Failed to create shader module from %s.\n",
+		filename);
+	return 0;
+    }
+
+    return 1;
+}
+
+VkShaderModule
+pipe_loadmodule(const char *filename)
+{
+    VkShaderModule sm;
+
+    if (!readmodule(filename, &sm))
+	terminate("Failed to load shader %s.\n", filename);
+
+    return sm;
+}
+
+/* A single pipeline without variants, built straight away */
+VkPipeline
+pipe_create(VkShaderModule vertex, VkShaderModule fragment,
+	VkPipelineLayout layout, VkRenderPass renderpass, uint32_t subpass,
+	VkBool32 blend)
+{
+    VkPipelineShaderStageCreateInfo psscis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .stage = VK_SHADER_STAGE_VERTEX_BIT,
+	    .module = vertex,
+	    .pName = shaderentry,
+	    .pSpecializationInfo = NULL
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .module = fragment,
+	    .pName = shaderentry,
+	    .pSpecializationInfo = NULL
+	}
+    };
+    /* Vertices come from the vertex index */
+    VkPipelineVertexInputStateCreateInfo pvisci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.vertexBindingDescriptionCount = 0,
+	.pVertexBindingDescriptions = NULL,
+	.vertexAttributeDescriptionCount = 0,
+	.pVertexAttributeDescriptions = NULL
+    };
+    VkPipelineInputAssemblyStateCreateInfo piasci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	.primitiveRestartEnable = VK_FALSE
+    };
+    /* Follows the render scale */
+    VkDynamicState dynamicstates[] = {
+	VK_DYNAMIC_STATE_VIEWPORT,
+	VK_DYNAMIC_STATE_SCISSOR
+    };
+    VkPipelineDynamicStateCreateInfo pdsci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.dynamicStateCount = COUNT(dynamicstates),
+	.pDynamicStates = dynamicstates
+    };
+    VkPipelineViewportStateCreateInfo pvsci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.viewportCount = 1,
+	.pViewports = NULL,
+	.scissorCount = 1,
+	.pScissors = NULL
+    };
+    VkPipelineRasterizationStateCreateInfo prsci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.depthClampEnable = VK_FALSE,
+	.rasterizerDiscardEnable = VK_FALSE,
+	.polygonMode = VK_POLYGON_MODE_FILL,
+	.cullMode = VK_CULL_MODE_NONE,
+	.frontFace = VK_FRONT_FACE_CLOCKWISE,
+	.depthBiasEnable = VK_FALSE,
+	.depthBiasConstantFactor = 0.0f,
+	.depthBiasClamp = 0.0f,
+	.depthBiasSlopeFactor = 0.0f,
+	.lineWidth = 1.0f
+    };
+    VkPipelineMultisampleStateCreateInfo pmsci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	.sampleShadingEnable = VK_FALSE,
+	.minSampleShading = 0.0f,
+	.pSampleMask = NULL,
+	.alphaToCoverageEnable = VK_FALSE,
+	.alphaToOneEnable = VK_FALSE
+    };
+    /* Straight alpha when blending */
+    VkPipelineColorBlendAttachmentState pcbas = {
+	.blendEnable = blend,
+	.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+	.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+	.colorBlendOp = VK_BLEND_OP_ADD,
+	.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+	.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+	.alphaBlendOp = VK_BLEND_OP_ADD,
+	.colorWriteMask =
+	    VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+	    VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+    };
+    VkPipelineColorBlendStateCreateInfo pcbsci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.logicOpEnable = VK_FALSE,
+	.logicOp = VK_LOGIC_OP_COPY,
+	.attachmentCount = 1,
+	.pAttachments = &pcbas,
+	.blendConstants[0] = 0.0f,
+	.blendConstants[1] = 0.0f,
+	.blendConstants[2] = 0.0f,
+	.blendConstants[3] = 0.0f
+    };
+    VkGraphicsPipelineCreateInfo gpci = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.stageCount = COUNT(psscis),
+	.pStages = psscis,
+	.pVertexInputState = &pvisci,
+	.pInputAssemblyState = &piasci,
+	.pTessellationState = NULL,
+	.pViewportState = &pvsci,
+	.pRasterizationState = &prsci,
+	.pMultisampleState = &pmsci,
+	.pDepthStencilState = NULL,
+	.pColorBlendState = &pcbsci,
+	.pDynamicState = &pdsci,
+	.layout = layout,
+	.renderPass = renderpass,
+	.subpass = subpass,
+	.basePipelineHandle = VK_NULL_HANDLE,
+	.basePipelineIndex = -1
+    };
+    VkPipeline pipeline;
+
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci,
+		&allocator, &pipeline) != VK_SUCCESS)
+	terminate("Failed to create pipeline.");
+
+    return pipeline;
+}
+
+/* No key builds with the constants the shaders default to, no parts builds a
+ * whole pipeline rather than a library */
+VkPipeline
+createpipeline(const PipelineKey *key, VkGraphicsPipelineLibraryFlagsEXT parts)
+{
+    VkSpecializationInfo si = {
+	.mapEntryCount = COUNT(pipespecentries),
+	.pMapEntries = pipespecentries,
+	.dataSize = sizeof(PipelineKey),
+	.pData = key
+    };
+    VkPipelineShaderStageCreateInfo vertexpssci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.stage = VK_SHADER_STAGE_VERTEX_BIT,
+	.module = vertexmodule,
+	.pName = shaderentry,
+	.pSpecializationInfo = NULL
+    };
+    /* Only the fragment shader has constants */
+    VkPipelineShaderStageCreateInfo fragmentpssci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+	.module = fragmentmodule,
+	.pName = shaderentry,
+	.pSpecializationInfo = key != NULL ? &si : NULL
+    };
+    VkPipelineShaderStageCreateInfo psscis[] = {
+	vertexpssci,
+	fragmentpssci
+    };
+    VkGraphicsPipelineLibraryCreateInfoEXT gplci = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+	.pNext = NULL,
+	.flags = parts
+    };
+    VkGraphicsPipelineCreateInfo gpci = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.stageCount = COUNT(psscis),
+	.pStages = psscis,
+	.pVertexInputState = &pipevertexinput,
+	.pInputAssemblyState = &pipeinputassembly,
+	.pTessellationState = NULL,
+	.pViewportState = &pipeviewport,
+	.pRasterizationState = &piperasterisation,
+	.pMultisampleState = &pipemultisample,
+	.pColorBlendState = &pipeblend,
+	.pDynamicState = &pipedynamic,
+	.layout = pipelinelayout,
+	.renderPass = pipelinerenderpass,
+	.subpass = 0,
+	.basePipelineHandle = VK_NULL_HANDLE,
+	.basePipelineIndex = -1
+    };
+    VkPipeline pipeline;
+
+    /* Each part only takes its own state */
+    if (parts != 0) {
+	gpci.pNext = &gplci;
+	gpci.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+	    VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+	if (!(parts & LIB_INPUT)) {
+	    gpci.pVertexInputState = NULL;
+	    gpci.pInputAssemblyState = NULL;
+	}
+	if (!(parts & LIB_RASTER)) {
+	    /* Drop the vertex stage */
+	    gpci.stageCount--;
+	    gpci.pStages++;
+	    gpci.pViewportState = NULL;
+	    gpci.pRasterizationState = NULL;
+	    gpci.pDynamicState = NULL;
+	}
+	if (!(parts & LIB_FRAGMENT))
+	    gpci.stageCount--;
+	if (!(parts & (LIB_FRAGMENT | LIB_OUTPUT)))
+	    gpci.pMultisampleState = NULL;
+	if (!(parts & LIB_OUTPUT))
+	    gpci.pColorBlendState = NULL;
+	if (!(parts & (LIB_RASTER | LIB_FRAGMENT)))
+	    gpci.layout = VK_NULL_HANDLE;
+    }
+
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci, &allocator,
+		&pipeline) != VK_SUCCESS)
+	terminate("Failed to create graphics pipeline.");
+
+    return pipeline;
+}
+
+/* Links the shared parts with a variant's fragment shader */
+VkPipeline
+linkpipeline(VkPipeline fragment, VkPipelineCreateFlags flags)
+{
+    VkPipeline libraries[] = {
+	vertexinput,
+	prerasterisation,
+	fragment,
+	fragmentoutput
+    };
+    VkPipelineLibraryCreateInfoKHR plci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+	.pNext = NULL,
+	.libraryCount = COUNT(libraries),
+	.pLibraries = libraries
+    };
+    VkGraphicsPipelineCreateInfo gpci = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	.pNext = &plci,
+	.flags = flags,
+	.stageCount = 0,
+	.pStages = NULL,
+	.pVertexInputState = NULL,
+	.pInputAssemblyState = NULL,
+	.pTessellationState = NULL,
+	.pViewportState = NULL,
+	.pRasterizationState = NULL,
+	.pMultisampleState = NULL,
+	.pColorBlendState = NULL,
+	.pDynamicState = NULL,
+	.layout = pipelinelayout,
+	.renderPass = pipelinerenderpass,
+	.subpass = 0,
+	.basePipelineHandle = VK_NULL_HANDLE,
+	.basePipelineIndex = -1
+    };
+    VkPipeline pipeline;
+
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci, &allocator,
+		&pipeline) != VK_SUCCESS)
+	terminate("Failed to link graphics pipeline.");
+
+    return pipeline;
+}
+
+void
+measure(BuildStats *s, double start)
+{
+    s->count++;
+    s->time += (gettime() - start) * 1000.0;
+}
+
+void
+report(const char *name, const BuildStats *s)
+{
+    fprintf(stderr, "%-16s %4u %9.2f ms mean\n", name, s->count,
+	    s->count > 0 ? s->time / s->count : 0.0);
+}
+
+/* Full compile without libraries, otherwise compile only the fragment
+ * shader part and link it fast */
+VkPipeline
+buildvariant(Variant *v, const PipelineKey *key)
+{
+    double start = gettime();
+    VkPipeline p;
+
+    if (!librarymode) {
+	p = createpipeline(key, 0);
+	measure(&fullstats, start);
+	return p;
+    }
+
+    /* Linked pipelines don't need their libraries to stay alive */
+    vkDestroyPipeline(device, v->library, &allocator);
+    v->library = createpipeline(key, LIB_FRAGMENT);
+    measure(&librarystats, start);
+
+    start = gettime();
+    p = linkpipeline(v->library, 0);
+    measure(&fastlinkstats, start);
+
+    return p;
+}
+
+VkPipeline
+optimisevariant(Variant *v)
+{
+    double start = gettime();
+    VkPipeline p;
+
+    p = linkpipeline(v->library,
+	    VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT);
+    measure(&optimisedstats, start);
+
+    return p;
+}
+
+/* Under the lock. Built but never swapped in means no frame has used it. */
+void
+replace(VkPipeline *built, VkPipeline current, VkPipeline p)
+{
+    if (*built != VK_NULL_HANDLE && *built != current)
+	vkDestroyPipeline(device, *built, &allocator);
+    *built = p;
+    InterlockedExchange(&pending, 1);
+    /* Swapped in by the next frame */
+    vk_invalidate();
+}
+
+/* Only the builder thread uses the shader modules after start up. A
+ * shader that won't load keeps the last good pipelines. */
+void
+rebuild(void)
+{
+    double start = gettime(), partstart;
+    VkShaderModule oldvertex = vertexmodule, oldfragment = fragmentmodule;
+    VkShaderModule vertex, fragment;
+    VkPipeline oldraster = prerasterisation, p;
+    PipelineKey key;
+    uint32_t i, count;
+
+    if (!readmodule(vertexshader, &vertex))
+	goto failed;
+    if (!readmodule(fragmentshader, &fragment)) {
+	vkDestroyShaderModule(device, vertex, &allocator);
+	goto failed;
+    }
+    vertexmodule = vertex;
+    fragmentmodule = fragment;
+    if (librarymode) {
+	partstart = gettime();
+	prerasterisation = createpipeline(NULL, LIB_RASTER);
+	measure(&librarystats, partstart);
+    }
+
+    partstart = gettime();
+    p = createpipeline(NULL, 0);
+    measure(&fullstats, partstart);
+    AcquireSRWLockExclusive(&lock);
+    replace(&fallbackbuilt, fallback, p);
+    count = variantcount;
+    ReleaseSRWLockExclusive(&lock);
+
+    /* Queued variants will be built from the new modules anyway */
+    for (i = 0; i < count; i++) {
+	AcquireSRWLockExclusive(&lock);
+	key = variants[i].key;
+	if (variants[i].state != VARIANT_LINKED &&
+		variants[i].state != VARIANT_BUILT) {
+	    ReleaseSRWLockExclusive(&lock);
+	    continue;
+	}
+	ReleaseSRWLockExclusive(&lock);
+
+	p = buildvariant(&variants[i], &key);
+	AcquireSRWLockExclusive(&lock);
+	replace(&variants[i].built, variants[i].current, p);
+	variants[i].state = librarymode && optimisedlink ? VARIANT_LINKED :
+	    VARIANT_BUILT;
+	ReleaseSRWLockExclusive(&lock);
+    }
+
+    vkDestroyPipeline(device, oldraster, &allocator);
+    vkDestroyShaderModule(device, oldvertex,   &allocator);
+    vkDestroyShaderModule(device, oldfragment, &allocator);
+    fprintf(stderr, "Rebuilt %u pipelines in %.1f ms.\n", count + 1,
+	    (gettime() - start) * 1000.0);
+    return;
+
+failed:
+    fprintf(stderr, "Shader reload failed, keeping the current "
+	    "pipelines.\n");
+}
+
+DWORD WINAPI
+builder(LPVOID param)
+{
+    PipelineKey key;
+    VkPipeline pipeline;
+    uint32_t i, optimise;
+
+    UNUSED(param);
+    TRACE_THREAD("pipeline builder");
+
+    AcquireSRWLockExclusive(&lock);
+    while (!stopping) {
+	if (reloading) {
+	    reloading = 0;
+	    ReleaseSRWLockExclusive(&lock);
+	    TRACE_CALL(rebuild());
+	    AcquireSRWLockExclusive(&lock);
+	    continue;
+	}
+
+	for (i = 0; i < variantcount; i++)
+	    if (variants[i].state == VARIANT_QUEUED)
+		break;
+	/* Optimise only once nothing is drawing with the fallback */
+	if (i == variantcount)
+	    for (i = 0; i < variantcount; i++)
+		if (variants[i].state == VARIANT_LINKED)
+		    break;
+
+	if (i == variantcount) {
+	    SleepConditionVariableSRW(&cond, &lock, INFINITE, 0);
+	    continue;
+	}
+
+	key = variants[i].key;
+	optimise = variants[i].state == VARIANT_LINKED;
+	variants[i].state = VARIANT_BUILDING;
+	ReleaseSRWLockExclusive(&lock);
+
+	if (optimise) {
+	    TRACE_BEGIN("optimise pipeline variant");
+	    pipeline = optimisevariant(&variants[i]);
+	} else {
+	    TRACE_BEGIN("build pipeline variant");
+	    pipeline = buildvariant(&variants[i], &key);
+	}
+	TRACE_END();
+
+	AcquireSRWLockExclusive(&lock);
+	replace(&variants[i].built, variants[i].current, pipeline);
+	variants[i].state = librarymode && optimisedlink && !optimise ?
+	    VARIANT_LINKED : VARIANT_BUILT;
+    }
+    ReleaseSRWLockExclusive(&lock);
+
+    return 0;
+}
+
+/* Frame thread only, frames already submitted may still use the pipeline */
+void
+retire(VkPipeline pipeline, uint64_t frame)
+{
+    RetiredPipeline *rp = &retired[(retiredhead + retiredcount++) %
+	RETIREDSIZE];
+
+    rp->frame = frame;
+    rp->pipeline = pipeline;
+}
+
+#ifdef DEBUG
+
+/* Zero if the file can't be opened */
+uint32_t
+lastwrite(const char *filename, FILETIME *time)
+{
+    HANDLE file;
+    BOOL ok;
+
+    if ((file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ |
+		    FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		    FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+	return 0;
+    ok = GetFileTime(file, NULL, NULL, time);
+    CloseHandle(file);
+
+    return ok;
+}
+
+/* Nonzero if the source compiled. Without a console glslc's messages would
+ * be lost, so its output is read through a pipe and shown on failure. */
+uint32_t
+compileshader(const ShaderFile *s)
+{
+    char command[512], output[4096], chunk[256];
+    SECURITY_ATTRIBUTES sa = { sizeof sa, NULL, TRUE };
+    STARTUPINFO si = { 0 };
+    PROCESS_INFORMATION pi;
+    HANDLE readpipe, writepipe;
+    DWORD code = 1, length = 0, n;
+
+    if (snprintf(command, sizeof command, "%s %s -o %s", shadercompiler,
+		s->source, s->spirv) >= (int) sizeof command)
+	terminate("Shader compile command too long.");
+
+    /* Only the child's end is inherited */
+    if (!CreatePipe(&readpipe, &writepipe, &sa, 0) ||
+	    !SetHandleInformation(readpipe, HANDLE_FLAG_INHERIT, 0))
+	terminate("Failed to create shader compiler pipe.");
+    si.cb = sizeof si;
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = NULL;
+    si.hStdOutput = writepipe;
+    si.hStdError = writepipe;
+    if (!CreateProcess(NULL, command, NULL, NULL, TRUE, CREATE_NO_WINDOW,
+		NULL, NULL, &si, &pi)) {
+	fprintf(stderr, "Could not run %s.\n", shadercompiler);
+	CloseHandle(readpipe);
+	CloseHandle(writepipe);
+	return 0;
+    }
+    /* So the read ends when glslc exits */
+    CloseHandle(writepipe);
+
+    /* Drained to the end, past what fits, so glslc never blocks */
+    while (ReadFile(readpipe, chunk, sizeof chunk, &n, NULL) && n > 0) {
+	if (n > sizeof output - 1 - length)
+	    n = sizeof output - 1 - length;
+	memcpy(output + length, chunk, n);
+	length += n;
+    }
+    output[length] = '\0';
+    CloseHandle(readpipe);
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &code);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+
+    if (code != 0)
+	fprintf(stderr, "%s failed on %s:\n%s", shadercompiler, s->source,
+		output);
+
+    return code == 0;
+}
+
+DWORD WINAPI
+watcher(LPVOID param)
+{
+    HANDLE handles[2];
+    FILETIME source, spirv[COUNT(shaderfiles)];
+    uint32_t i, changed, failed;
+
+    UNUSED(param);
+    TRACE_THREAD("shader watcher");
+
+    if ((handles[1] = FindFirstChangeNotification(shaderdir, FALSE,
+		    FILE_NOTIFY_CHANGE_LAST_WRITE |
+		    FILE_NOTIFY_CHANGE_FILE_NAME)) == INVALID_HANDLE_VALUE)
+	terminate("Could not watch %s.\n", shaderdir);
+    handles[0] = stopevent;
+
+    while (WaitForMultipleObjects(COUNT(handles), handles, FALSE, INFINITE)
+	    == WAIT_OBJECT_0 + 1) {
+	/* Editors often save in several writes */
+	Sleep(reloaddelay);
+	FindNextChangeNotification(handles[1]);
+
+	changed = failed = 0;
+	for (i = 0; i < COUNT(shaderfiles); i++) {
+	    spirv[i] = shaderfiles[i].loaded;
+	    if (!lastwrite(shaderfiles[i].spirv, &spirv[i]) ||
+		    (lastwrite(shaderfiles[i].source, &source) &&
+		     CompareFileTime(&source, &spirv[i]) > 0)) {
+		TRACE_BEGIN("compile shader");
+		if (!compileshader(&shaderfiles[i]))
+		    failed = 1;
+		TRACE_END();
+	    }
+
+	    /* Also picks up SPIR-V built outside, by make */
+	    if (lastwrite(shaderfiles[i].spirv, &spirv[i]) &&
+		    CompareFileTime(&spirv[i], &shaderfiles[i].loaded) != 0)
+		changed = 1;
+	}
+
+	/* A shader that doesn't compile keeps the last good pipelines */
+	if (failed) {
+	    fprintf(stderr, "Shader compile failed, keeping the current "
+		    "pipelines.\n");
+	} else if (changed) {
+	    for (i = 0; i < COUNT(shaderfiles); i++)
+		shaderfiles[i].loaded = spirv[i];
+	    AcquireSRWLockExclusive(&lock);
+	    reloading = 1;
+	    WakeAllConditionVariable(&cond);
+	    ReleaseSRWLockExclusive(&lock);
+	}
+    }
+
+    FindCloseChangeNotification(handles[1]);
+
+    return 0;
+}
+
+#endif /* DEBUG */
+
+/* Safe on any thread, needs the device */
+void
+pipe_loadshaders(void)
+{
+#ifdef DEBUG
+    uint32_t i;
+
+    /* Before loading, so a save from now on triggers a reload */
+    for (i = 0; i < COUNT(shaderfiles); i++)
+	lastwrite(shaderfiles[i].spirv, &shaderfiles[i].loaded);
+#endif /* DEBUG */
+
+    vertexmodule = pipe_loadmodule(vertexshader);
+    fragmentmodule = pipe_loadmodule(fragmentshader);
+}
+
+/* Libraries only if the device has VK_EXT_graphics_pipeline_library */
+void
+pipe_initialise(VkRenderPass renderpass, VkPipelineLayout layout,
+	uint32_t libraries)
+{
+    double start;
+
+    pipelinerenderpass = renderpass;
+    pipelinelayout = layout;
+    librarymode = libraries;
+
+    /* Always a full compile, a baseline for the library timings */
+    start = gettime();
+    fallback = fallbackbuilt = createpipeline(NULL, 0);
+    measure(&fullstats, start);
+
+    /* Shared by every variant */
+    if (librarymode) {
+	start = gettime();
+	vertexinput = createpipeline(NULL, LIB_INPUT);
+	measure(&librarystats, start);
+	start = gettime();
+	prerasterisation = createpipeline(NULL, LIB_RASTER);
+	measure(&librarystats, start);
+	start = gettime();
+	fragmentoutput = createpipeline(NULL, LIB_OUTPUT);
+	measure(&librarystats, start);
+    }
+
+    stopping = reloading = 0;
+    if ((thread = CreateThread(NULL, 0, builder, NULL, 0, NULL)) == NULL)
+	terminate("Failed to create pipeline builder thread.");
+    /* Builds are never waited on, so keep clear of the frame thread */
+    SetThreadPriority(thread, THREAD_PRIORITY_BELOW_NORMAL);
+
+#ifdef DEBUG
+    if ((stopevent = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL)
+	terminate("Failed to create shader watcher event.");
+    if ((watchthread = CreateThread(NULL, 0, watcher, NULL, 0, NULL)) ==
+	    NULL)
+	terminate("Failed to create shader watcher thread.");
+#endif /* DEBUG */
+}
+
+/* Only once the device is idle */
+void
+pipe_terminate(void)
+{
+    uint32_t i;
+
+#ifdef DEBUG
+    SetEvent(stopevent);
+    WaitForSingleObject(watchthread, INFINITE);
+    CloseHandle(watchthread);
+    CloseHandle(stopevent);
+#endif /* DEBUG */
+
+    AcquireSRWLockExclusive(&lock);
+    stopping = 1;
+    WakeAllConditionVariable(&cond);
+    ReleaseSRWLockExclusive(&lock);
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    for (i = 0; i < variantcount; i++) {
+	if (variants[i].built != variants[i].current)
+	    vkDestroyPipeline(device, variants[i].built, &allocator);
+	vkDestroyPipeline(device, variants[i].current, &allocator);
+	vkDestroyPipeline(device, variants[i].library, &allocator);
+    }
+    variantcount = 0;
+    vkDestroyPipeline(device, vertexinput, &allocator);
+    vkDestroyPipeline(device, prerasterisation, &allocator);
+    vkDestroyPipeline(device, fragmentoutput, &allocator);
+
+    for (; retiredcount > 0; retiredcount--) {
+	vkDestroyPipeline(device, retired[retiredhead].pipeline, &allocator);
+	retiredhead = (retiredhead + 1) % RETIREDSIZE;
+    }
+
+    if (fallbackbuilt != fallback)
+	vkDestroyPipeline(device, fallbackbuilt, &allocator);
+    vkDestroyPipeline(device, fallback, &allocator);
+    vkDestroyShaderModule(device, vertexmodule,   &allocator);
+    vkDestroyShaderModule(device, fragmentmodule, &allocator);
+
+    report("full compile", &fullstats);
+    report("library part", &librarystats);
+    report("fast link", &fastlinkstats);
+    report("optimised link", &optimisedstats);
+}
+
+/* Queues a build the first time a key is seen */
+uint32_t
+pipe_request(PipelineKey key)
+{
+    uint32_t i;
+
+    AcquireSRWLockExclusive(&lock);
+    for (i = 0; i < variantcount; i++)
+	if (memcmp(&variants[i].key, &key, sizeof key) == 0)
+	    break;
+
+    if (i == variantcount) {
+	if (variantcount == MAXVARIANTS)
+	    terminate("Too many pipeline variants.");
+	variants[i].key = key;
+	variants[i].state = VARIANT_QUEUED;
+	variants[i].built = VK_NULL_HANDLE;
+	variants[i].current = VK_NULL_HANDLE;
+	variants[i].library = VK_NULL_HANDLE;
+	variantcount++;
+	WakeAllConditionVariable(&cond);
+    }
+    ReleaseSRWLockExclusive(&lock);
+
+    return i;
+}
+
+/* Call between frames, after waiting on the frame MAXFRAMES ago and before
+ * any recording. Frame counts submissions so far. */
+void
+pipe_update(uint64_t frame)
+{
+    RetiredPipeline *rp;
+    uint32_t i;
+
+    while (retiredcount > 0) {
+	rp = &retired[retiredhead];
+	if (rp->frame + MAXFRAMES > frame)
+	    break;
+
+	vkDestroyPipeline(device, rp->pipeline, &allocator);
+	retiredhead = (retiredhead + 1) % RETIREDSIZE;
+	retiredcount--;
+    }
+
+    if (!InterlockedExchange(&pending, 0))
+	return;
+
+    AcquireSRWLockExclusive(&lock);
+    if (fallbackbuilt != fallback) {
+	retire(fallback, frame);
+	fallback = fallbackbuilt;
+    }
+    for (i = 0; i < variantcount; i++) {
+	if (variants[i].built == variants[i].current)
+	    continue;
+	if (variants[i].current != VK_NULL_HANDLE)
+	    retire(variants[i].current, frame);
+	variants[i].current = variants[i].built;
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+/* The fallback until the variant has been swapped in */
+VkPipeline
+pipe_get(uint32_t variant)
+{
+    return variants[variant].current != VK_NULL_HANDLE ?
+	variants[variant].current : fallback;
+}
@@ -0,0 +1,154 @@
+#include <stddef.h>
+#include <vulkan/vulkan.h>
+
+/* Colour modes of the fragment shader */
+enum { COLOUR_VERTEX, COLOUR_GREY, COLOUR_UV, COLOUR_COUNT };
+
+/* Specialization constants, must match the constant_ids in fragment.glsl */
+typedef struct {
+    uint32_t colourmode;
+    VkBool32 textured;
+} PipelineKey;
+
+/* The scene pipeline's fixed state. The benchmark and the replay tool build
+ * their pipelines from it too, so they can't drift from the renderer.
+ * Include mesh.h first. */
+static const VkSpecializationMapEntry pipespecentries[] = {
+    {
+	.constantID = 0,
+	.offset = offsetof(PipelineKey, colourmode),
+	.size = sizeof(uint32_t)
+    },
+    {
+	.constantID = 1,
+	.offset = offsetof(PipelineKey, textured),
+	.size = sizeof(VkBool32)
+    }
+};
+/* Quantised mesh vertices, the normal isn't read yet */
+static const VkVertexInputBindingDescription pipevertexbinding = {
+    .binding = 0,
+    .stride = sizeof(MeshVertex),
+    .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+};
+static const VkVertexInputAttributeDescription pipevertexattributes[] = {
+    {
+	.location = 0,
+	.binding = 0,
+	.format = VK_FORMAT_R16G16B16A16_SNORM,
+	.offset = offsetof(MeshVertex, position)
+    },
+    {
+	.location = 1,
+	.binding = 0,
+	.format = VK_FORMAT_R8G8B8A8_UNORM,
+	.offset = offsetof(MeshVertex, colour)
+    }
+};
+static const VkPipelineVertexInputStateCreateInfo pipevertexinput = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    .vertexBindingDescriptionCount = 1,
+    .pVertexBindingDescriptions = &pipevertexbinding,
+    .vertexAttributeDescriptionCount = sizeof pipevertexattributes /
+	sizeof pipevertexattributes[0],
+    .pVertexAttributeDescriptions = pipevertexattributes
+};
+static const VkPipelineInputAssemblyStateCreateInfo pipeinputassembly = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    .primitiveRestartEnable = VK_FALSE
+};
+/* Viewport and scissor state will be specified at drawing time */
+static const VkDynamicState pipedynamicstates[] = {
+    VK_DYNAMIC_STATE_VIEWPORT,
+    VK_DYNAMIC_STATE_SCISSOR
+};
+static const VkPipelineDynamicStateCreateInfo pipedynamic = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    .dynamicStateCount = sizeof pipedynamicstates /
+	sizeof pipedynamicstates[0],
+    .pDynamicStates = pipedynamicstates
+};
+static const VkPipelineViewportStateCreateInfo pipeviewport = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    .viewportCount = 1,
+    .pViewports = NULL,
+    .scissorCount = 1,
+    .pScissors = NULL
+};
+static const VkPipelineRasterizationStateCreateInfo piperasterisation = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    /* Discard fragments that are not visibile */
+    .depthClampEnable = VK_FALSE,
+    /* Don't disable rastersizer */
+    .rasterizerDiscardEnable = VK_FALSE,
+    .polygonMode = VK_POLYGON_MODE_FILL,
+    .cullMode = VK_CULL_MODE_BACK_BIT,
+    /* Clockwise vertex order for faces to be considered front-facing */
+    .frontFace = VK_FRONT_FACE_CLOCKWISE,
+    .depthBiasEnable = VK_FALSE,
+    .depthBiasConstantFactor = 0.0f,
+    .depthBiasClamp = 0.0f,
+    .depthBiasSlopeFactor = 0.0f,
+    .lineWidth = 1.0f
+};
+/* Disable multisampling */
+static const VkPipelineMultisampleStateCreateInfo pipemultisample = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    .sampleShadingEnable = VK_FALSE,
+    .minSampleShading = 0.0f,
+    .pSampleMask = NULL,
+    .alphaToCoverageEnable = VK_FALSE,
+    .alphaToOneEnable = VK_FALSE
+};
+/* Disable colour blending */
+static const VkPipelineColorBlendAttachmentState pipeblendattachment = {
+    .blendEnable = VK_FALSE,
+    .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+    .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+    .colorBlendOp = VK_BLEND_OP_ADD,
+    .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+    .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+    .alphaBlendOp = VK_BLEND_OP_ADD,
+    .colorWriteMask =
+	VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+	VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+};
+static const VkPipelineColorBlendStateCreateInfo pipeblend = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+    .pNext = NULL,
+    .flags = 0,
+    .logicOpEnable = VK_FALSE,
+    .logicOp = VK_LOGIC_OP_COPY,
+    .attachmentCount = 1,
+    .pAttachments = &pipeblendattachment,
+    .blendConstants[0] = 0.0f,
+    .blendConstants[1] = 0.0f,
+    .blendConstants[2] = 0.0f,
+    .blendConstants[3] = 0.0f
+};
+
+VkShaderModule pipe_loadmodule(const char *filename);
+VkPipeline pipe_create(VkShaderModule vertex, VkShaderModule fragment,
+	VkPipelineLayout layout, VkRenderPass renderpass, uint32_t subpass,
+	VkBool32 blend);
+void pipe_loadshaders(void);
+void pipe_initialise(VkRenderPass renderpass, VkPipelineLayout layout,
+	uint32_t libraries);
+void pipe_terminate(void);
+uint32_t pipe_request(PipelineKey key);
+void pipe_update(uint64_t frame);
+VkPipeline pipe_get(uint32_t variant);
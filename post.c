@@ -0,0 +1,550 @@
+/* Post-processing.
+ * The scene renders in HDR, then a tonemap and a colour grade each draw a
+ * full-screen triangle that reads the step before through an input
+ * attachment. As subpasses of the scene's render pass a pixel only reads what
+ * its own earlier subpass wrote, so on tilers the intermediates never leave
+ * tile memory. The same steps can run as separate render passes, which store
+ * every intermediate and load it back, to measure the difference.
+ */
+
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+
+#include "config.h"
+#include "graph.h"
+#include "mem.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "post.h"
+#include "util.h"
+#include "vulkan.h"
+
+/* Macros */
+#define LDRFORMAT VK_FORMAT_R8G8B8A8_UNORM
+/* Bytes per pixel of the intermediates */
+#define HDRBYTES 8
+#define LDRBYTES 4
+
+/* Types */
+
+enum { STEP_TONEMAP, STEP_GRADE, STEP_COUNT };
+
+typedef struct {
+    const char *shader;
+    /* Render graph images */
+    uint32_t input;
+    uint32_t output;
+    VkFormat inputformat;
+    VkFormat outputformat;
+    VkPipeline pipeline;
+    VkDescriptorSet sets[MAXFRAMES];
+    /* Separate passes only */
+    VkRenderPass renderpass;
+    VkFramebuffer framebuffers[MAXFRAMES];
+} Step;
+
+/* Function declarations */
+static VkRenderPass createsteppass(const Step *s);
+static void draw(VkCommandBuffer cb, const Step *s, uint32_t frame);
+static void record(VkCommandBuffer cb, const Step *s, uint32_t frame);
+static void tonemap(VkCommandBuffer cb, uint32_t frame);
+static void grade(VkCommandBuffer cb, uint32_t frame);
+
+/* Variables */
+static Step steps[STEP_COUNT] = {
+    [STEP_TONEMAP] = { .shader = tonemapshader },
+    [STEP_GRADE]   = { .shader = gradeshader }
+};
+static VkDescriptorSetLayout setlayout;
+static VkDescriptorPool descriptorpool;
+static VkPipelineLayout pipelinelayout;
+/* GPU frame times while post-processing */
+static uint64_t frames;
+static double totalms, totalpixels;
+
+/* Function implementations */
+
+/* The scene pass writes HDR, the steps write output last */
+void
+post_declare(uint32_t scenepass, uint32_t output)
+{
+    uint32_t hdr, ldr, pass;
+
+    hdr = rg_image("hdr colour", POST_HDRFORMAT);
+    ldr = rg_image("ldr colour", LDRFORMAT);
+    steps[STEP_TONEMAP].input = hdr;
+    steps[STEP_TONEMAP].output = ldr;
+    steps[STEP_GRADE].input = ldr;
+    steps[STEP_GRADE].output = output;
+
+    if (postprocess == POST_SUBPASSES) {
+	rg_use(scenepass, hdr, RG_ATTACHMENT);
+	rg_use(scenepass, ldr, RG_ATTACHMENT);
+	rg_use(scenepass, output, RG_COLOUR_WRITE);
+	return;
+    }
+
+    rg_use(scenepass, hdr, RG_COLOUR_WRITE);
+    pass = rg_pass("tonemap", tonemap, 0);
+    rg_use(pass, hdr, RG_INPUT);
+    rg_use(pass, ldr, RG_COLOUR_WRITE);
+    pass = rg_pass("grade", grade, 0);
+    rg_use(pass, ldr, RG_INPUT);
+    rg_use(pass, output, RG_COLOUR_WRITE);
+}
+
+/* Scene, tonemap and grade as subpasses. Only the output is stored, the
+ * render graph transitions the attachments around the pass. */
+VkRenderPass
+post_createrenderpass(VkFormat format)
+{
+    VkAttachmentDescription attachments[] = {
+	{
+	    .flags = 0,
+	    .format = POST_HDRFORMAT,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	    .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	},
+	{
+	    .flags = 0,
+	    .format = LDRFORMAT,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	    .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	},
+	{
+	    .flags = 0,
+	    .format = format,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	    .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	}
+    };
+    VkAttachmentReference colourrefs[] = {
+	{ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+	{ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+	{ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL }
+    };
+    VkAttachmentReference inputrefs[] = {
+	{ 0, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+	{ 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+    };
+    VkSubpassDescription subpasses[3];
+    /* Each step reads the pixel the subpass before wrote */
+    VkSubpassDependency dependency = {
+	.srcSubpass = 0,
+	.dstSubpass = 1,
+	.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+	.dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+	.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT
+    };
+    VkSubpassDependency dependencies[2];
+    VkRenderPassCreateInfo rpci = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.attachmentCount = COUNT(attachments),
+	.pAttachments = attachments,
+	.subpassCount = COUNT(subpasses),
+	.pSubpasses = subpasses,
+	.dependencyCount = COUNT(dependencies),
+	.pDependencies = dependencies
+    };
+    VkRenderPass renderpass;
+    uint32_t i;
+
+    for (i = 0; i < COUNT(subpasses); i++) {
+	subpasses[i].flags = 0;
+	subpasses[i].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	/* The scene has no input */
+	subpasses[i].inputAttachmentCount = i > 0;
+	subpasses[i].pInputAttachments = i > 0 ? &inputrefs[i - 1] : NULL;
+	subpasses[i].colorAttachmentCount = 1;
+	subpasses[i].pColorAttachments = &colourrefs[i];
+	subpasses[i].pResolveAttachments = NULL;
+	subpasses[i].pDepthStencilAttachment = NULL;
+	subpasses[i].preserveAttachmentCount = 0;
+	subpasses[i].pPreserveAttachments = NULL;
+    }
+    for (i = 0; i < COUNT(dependencies); i++) {
+	dependencies[i] = dependency;
+	dependencies[i].srcSubpass = i;
+	dependencies[i].dstSubpass = i + 1;
+    }
+
+    if (vkCreateRenderPass(device, &rpci, &allocator, &renderpass) !=
+	    VK_SUCCESS)
+	terminate("Failed to create post-processing render pass.");
+
+    return renderpass;
+}
+
+/* One step on its own, loads the input from memory and stores the output */
+VkRenderPass
+createsteppass(const Step *s)
+{
+    VkAttachmentDescription attachments[] = {
+	{
+	    .flags = 0,
+	    .format = s->inputformat,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+	    /* Nothing reads it after this step */
+	    .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	    .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	},
+	{
+	    .flags = 0,
+	    .format = s->outputformat,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	    .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	}
+    };
+    VkAttachmentReference inputref = {
+	.attachment = 0,
+	.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    VkAttachmentReference colourref = {
+	.attachment = 1,
+	.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+    VkSubpassDescription subpass = {
+	.flags = 0,
+	.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+	.inputAttachmentCount = 1,
+	.pInputAttachments = &inputref,
+	.colorAttachmentCount = 1,
+	.pColorAttachments = &colourref,
+	.pResolveAttachments = NULL,
+	.pDepthStencilAttachment = NULL,
+	.preserveAttachmentCount = 0,
+	.pPreserveAttachments = NULL
+    };
+    /* Barriers come from the render graph */
+    VkRenderPassCreateInfo rpci = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.attachmentCount = COUNT(attachments),
+	.pAttachments = attachments,
+	.subpassCount = 1,
+	.pSubpasses = &subpass,
+	.dependencyCount = 0,
+	.pDependencies = NULL
+    };
+    VkRenderPass renderpass;
+
+    if (vkCreateRenderPass(device, &rpci, &allocator, &renderpass) !=
+	    VK_SUCCESS)
+	terminate("Failed to create post-processing render pass.");
+
+    return renderpass;
+}
+
+/* The scene's render pass has to come from post_createrenderpass when
+ * running as subpasses */
+void
+post_initialise(VkRenderPass scenepass, VkFormat format)
+{
+    VkDescriptorSetLayoutBinding binding = {
+	.binding = 0,
+	.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+	.descriptorCount = 1,
+	.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	.pImmutableSamplers = NULL
+    };
+    VkDescriptorSetLayoutCreateInfo dslci = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.bindingCount = 1,
+	.pBindings = &binding
+    };
+    VkPipelineLayoutCreateInfo plci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.setLayoutCount = 1,
+	.pSetLayouts = &setlayout,
+	.pushConstantRangeCount = 0,
+	.pPushConstantRanges = NULL
+    };
+    VkDescriptorPoolSize dps = {
+	.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+	.descriptorCount = STEP_COUNT * MAXFRAMES
+    };
+    VkDescriptorPoolCreateInfo dpci = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.maxSets = STEP_COUNT * MAXFRAMES,
+	.poolSizeCount = 1,
+	.pPoolSizes = &dps
+    };
+    VkDescriptorSetLayout layouts[MAXFRAMES];
+    VkDescriptorSetAllocateInfo dsai = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+	.pNext = NULL,
+	.descriptorPool = VK_NULL_HANDLE,
+	.descriptorSetCount = MAXFRAMES,
+	.pSetLayouts = layouts
+    };
+    VkShaderModule vertex, fragment;
+    uint32_t i;
+
+    steps[STEP_TONEMAP].inputformat = POST_HDRFORMAT;
+    steps[STEP_TONEMAP].outputformat = LDRFORMAT;
+    steps[STEP_GRADE].inputformat = LDRFORMAT;
+    steps[STEP_GRADE].outputformat = format;
+
+    if (vkCreateDescriptorSetLayout(device, &dslci, &allocator, &setlayout) !=
+	    VK_SUCCESS)
+	terminate("Failed to create post-processing descriptor set layout.");
+    if (vkCreatePipelineLayout(device, &plci, &allocator, &pipelinelayout) !=
+	    VK_SUCCESS)
+	terminate("Failed to create post-processing pipeline layout.");
+    if (vkCreateDescriptorPool(device, &dpci, &allocator, &descriptorpool) !=
+	    VK_SUCCESS)
+	terminate("Failed to create post-processing descriptor pool.");
+
+    for (i = 0; i < MAXFRAMES; i++)
+	layouts[i] = setlayout;
+    dsai.descriptorPool = descriptorpool;
+
+    vertex = pipe_loadmodule(fullscreenshader);
+    for (i = 0; i < STEP_COUNT; i++) {
+	Step *s = &steps[i];
+
+	if (vkAllocateDescriptorSets(device, &dsai, s->sets) != VK_SUCCESS)
+	    terminate("Failed to allocate post-processing descriptor sets.");
+
+	fragment = pipe_loadmodule(s->shader);
+	if (postprocess == POST_SUBPASSES) {
+	    /* Subpass 0 is the scene */
+	    s->pipeline = pipe_create(vertex, fragment, pipelinelayout,
+		    scenepass, i + 1, VK_FALSE);
+	} else {
+	    s->renderpass = createsteppass(s);
+	    s->pipeline = pipe_create(vertex, fragment, pipelinelayout,
+		    s->renderpass, 0, VK_FALSE);
+	}
+	vkDestroyShaderModule(device, fragment, &allocator);
+    }
+    vkDestroyShaderModule(device, vertex, &allocator);
+}
+
+void
+post_terminate(void)
+{
+    double pixels;
+    uint32_t i;
+
+    if (frames > 0) {
+	pixels = totalpixels / (double) frames;
+	fprintf(stderr, "Post-processing as %s: %.3f ms mean GPU frame over "
+		"%llu frames, %.2f ns per pixel.\n",
+		postprocess == POST_SUBPASSES ? "subpasses" : "separate passes",
+		totalms / (double) frames, (unsigned long long) frames,
+		totalms * 1e6 / totalpixels);
+	/* Separate passes store every intermediate and load it back, subpasses
+	 * keep them on chip if the GPU is a tiler */
+	if (postprocess == POST_PASSES)
+	    fprintf(stderr, "Intermediates through memory: %.1f MB per "
+		    "frame.\n", pixels * 2.0 * (HDRBYTES + LDRBYTES) / 1e6);
+	else
+	    fprintf(stderr, "Intermediates through memory: none on tilers, "
+		    "%.1f MB per frame at most.\n",
+		    pixels * 2.0 * (HDRBYTES + LDRBYTES) / 1e6);
+    }
+
+    for (i = 0; i < STEP_COUNT; i++) {
+	vkDestroyPipeline(device, steps[i].pipeline, &allocator);
+	if (steps[i].renderpass != VK_NULL_HANDLE)
+	    vkDestroyRenderPass(device, steps[i].renderpass, &allocator);
+    }
+    vkDestroyDescriptorPool(device, descriptorpool, &allocator);
+    vkDestroyPipelineLayout(device, pipelinelayout, &allocator);
+    vkDestroyDescriptorSetLayout(device, setlayout, &allocator);
+}
+
+/* Attachments of the scene's framebuffer, returns how many */
+uint32_t
+post_attachments(uint32_t frame, VkImageView *views)
+{
+    views[0] = rg_getview(steps[STEP_TONEMAP].input, frame);
+    if (postprocess != POST_SUBPASSES)
+	return 1;
+
+    views[1] = rg_getview(steps[STEP_GRADE].input, frame);
+    views[2] = rg_getview(steps[STEP_GRADE].output, frame);
+    return 3;
+}
+
+/* Call once the render graph has compiled, its views change with the
+ * extent */
+void
+post_createframebuffers(VkExtent2D extent)
+{
+    VkDescriptorImageInfo dii = {
+	.sampler = VK_NULL_HANDLE,
+	.imageView = VK_NULL_HANDLE,
+	.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = VK_NULL_HANDLE,
+	.dstBinding = 0,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+	.pImageInfo = &dii,
+	.pBufferInfo = NULL,
+	.pTexelBufferView = NULL
+    };
+    VkImageView views[2];
+    VkFramebufferCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.renderPass = VK_NULL_HANDLE,
+	.attachmentCount = COUNT(views),
+	.pAttachments = views,
+	.width = extent.width,
+	.height = extent.height,
+	.layers = 1
+    };
+    uint32_t i, j;
+
+    for (i = 0; i < STEP_COUNT; i++) {
+	Step *s = &steps[i];
+
+	for (j = 0; j < MAXFRAMES; j++) {
+	    dii.imageView = rg_getview(s->input, j);
+	    wds.dstSet = s->sets[j];
+	    vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
+
+	    if (postprocess != POST_PASSES)
+		continue;
+	    views[0] = dii.imageView;
+	    views[1] = rg_getview(s->output, j);
+	    fci.renderPass = s->renderpass;
+	    if (vkCreateFramebuffer(device, &fci, &allocator,
+			&s->framebuffers[j]) != VK_SUCCESS)
+		terminate("Failed to create post-processing framebuffer.");
+	}
+    }
+}
+
+void
+post_destroyframebuffers(void)
+{
+    uint32_t i, j;
+
+    if (postprocess != POST_PASSES)
+	return;
+
+    for (i = 0; i < STEP_COUNT; i++)
+	for (j = 0; j < MAXFRAMES; j++)
+	    vkDestroyFramebuffer(device, steps[i].framebuffers[j], &allocator);
+}
+
+void
+draw(VkCommandBuffer cb, const Step *s, uint32_t frame)
+{
+    VkExtent2D extent = vk_renderextent();
+    VkViewport viewport = {
+	.x = 0.0f,
+	.y = 0.0f,
+	.width = (float) extent.width,
+	.height = (float) extent.height,
+	.minDepth = 0.0f,
+	.maxDepth = 1.0f
+    };
+    VkRect2D scissor = {
+	.offset = { 0, 0 },
+	.extent = extent
+    };
+
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, s->pipeline);
+    vkCmdSetViewport(cb, 0, 1, &viewport);
+    vkCmdSetScissor(cb, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	    pipelinelayout, 0, 1, &s->sets[frame], 0, NULL);
+    vkCmdDraw(cb, 3, 1, 0, 0);
+}
+
+/* Inside the scene's render pass, after the scene has drawn */
+void
+post_subpasses(VkCommandBuffer cb, uint32_t frame)
+{
+    uint32_t i;
+
+    for (i = 0; i < STEP_COUNT; i++) {
+	vkCmdNextSubpass(cb, VK_SUBPASS_CONTENTS_INLINE);
+	draw(cb, &steps[i], frame);
+    }
+}
+
+void
+record(VkCommandBuffer cb, const Step *s, uint32_t frame)
+{
+    VkRenderPassBeginInfo rpbi = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+	.pNext = NULL,
+	.renderPass = s->renderpass,
+	.framebuffer = s->framebuffers[frame],
+	.renderArea.offset = { 0, 0 },
+	.renderArea.extent = vk_renderextent(),
+	.clearValueCount = 0,
+	.pClearValues = NULL
+    };
+
+    vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+    draw(cb, s, frame);
+    vkCmdEndRenderPass(cb);
+}
+
+void
+tonemap(VkCommandBuffer cb, uint32_t frame)
+{
+    record(cb, &steps[STEP_TONEMAP], frame);
+}
+
+void
+grade(VkCommandBuffer cb, uint32_t frame)
+{
+    record(cb, &steps[STEP_GRADE], frame);
+}
+
+/* GPU time of a whole frame and the pixels it rendered */
+void
+post_account(double ms, VkExtent2D extent)
+{
+    frames++;
+    totalms += ms;
+    totalpixels += (double) extent.width * extent.height;
+}
@@ -0,0 +1,17 @@
+#include <vulkan/vulkan.h>
+
+/* Ways to run the tonemap and grade, see postprocess in config.h */
+enum { POST_OFF, POST_SUBPASSES, POST_PASSES };
+
+/* Format the scene renders in when post-processing */
+#define POST_HDRFORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+
+void post_declare(uint32_t scenepass, uint32_t output);
+VkRenderPass post_createrenderpass(VkFormat format);
+void post_initialise(VkRenderPass scenepass, VkFormat format);
+void post_terminate(void);
+uint32_t post_attachments(uint32_t frame, VkImageView *views);
+void post_createframebuffers(VkExtent2D extent);
+void post_destroyframebuffers(void);
+void post_subpasses(VkCommandBuffer cb, uint32_t frame);
+void post_account(double ms, VkExtent2D extent);
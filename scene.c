@@ -0,0 +1,168 @@
+/* Scene files.
+ * A versioned container of blobs laid out to be used where they lie. The
+ * file is memory-mapped, a table after the header gives each blob's type,
+ * element size, count and offset, and each blob starts on a page and is
+ * padded to whole pages. Reading only checks the table and the indices, so
+ * loading costs what paging the blobs in costs: the GPU copy can read them
+ * straight from the mapping as imported host memory, or they're copied to
+ * staging with one memcpy each.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "mesh.h"
+#include "scene.h"
+#include "util.h"
+
+/* Macros */
+#define SCENEVERSION 1
+#define ALIGN(x) (((x) + SCENEALIGN - 1) & ~(uint64_t) (SCENEALIGN - 1))
+
+/* Types */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t blobcount;
+    uint32_t pad;
+} SceneHeader;
+
+typedef struct {
+    uint32_t type;
+    /* Bytes an element, checked against what the reader expects */
+    uint32_t stride;
+    uint32_t count;
+    uint32_t pad;
+    uint64_t offset;
+    uint64_t size;
+} SceneEntry;
+
+/* Function declarations */
+static void writeblob(FILE *f, const char *filename, uint64_t *offset,
+	SceneEntry *e, uint32_t type, uint32_t stride, uint32_t count,
+	const void *data);
+
+/* Variables */
+static const uint32_t strides[SCENE_BLOBCOUNT] = {
+    [SCENE_BOUNDS]    = sizeof(SceneBounds),
+    [SCENE_VERTICES]  = sizeof(MeshVertex),
+    [SCENE_INDICES]   = sizeof(uint32_t),
+    [SCENE_INSTANCES] = sizeof(SceneInstance)
+};
+static const unsigned char zeros[SCENEALIGN];
+
+/* Function implementations */
+
+/* The data must be page aligned, as a mapped view is, and stay alive */
+void
+scene_read(Scene *s, const void *data, size_t size)
+{
+    const SceneHeader *h = (const SceneHeader *) data;
+    const SceneEntry *e = (const SceneEntry *) (h + 1);
+    const unsigned char *base = (const unsigned char *) data;
+    const uint32_t *indices;
+    uint32_t vertexcount, i;
+
+    memset(s, 0, sizeof *s);
+    if (size < sizeof(SceneHeader) || memcmp(h->magic, "SCNE", 4) != 0 ||
+	    h->version != SCENEVERSION)
+	terminate("Not a version %u scene file.\n", SCENEVERSION);
+    if (sizeof(SceneHeader) + (uint64_t) h->blobcount * sizeof(SceneEntry) >
+	    size)
+	terminate("Scene blob table is truncated.\n");
+
+    for (i = 0; i < h->blobcount; i++, e++) {
+	if (e->type >= SCENE_BLOBCOUNT)
+	    continue;
+	if (e->stride != strides[e->type] ||
+		e->size != (uint64_t) e->stride * e->count ||
+		e->offset % SCENEALIGN != 0 || e->offset > size ||
+		ALIGN(e->size) > size - e->offset)
+	    terminate("Scene blob %u is malformed.\n", i);
+	s->blobs[e->type].data = base + e->offset;
+	s->blobs[e->type].size = e->size;
+	s->blobs[e->type].count = e->count;
+    }
+
+    if (s->blobs[SCENE_BOUNDS].count != 1 ||
+	    s->blobs[SCENE_INDICES].count == 0 ||
+	    s->blobs[SCENE_INDICES].count % 3 != 0)
+	terminate("Scene has no mesh.\n");
+
+    /* Drawn straight from the file, so a bad index mustn't reach the GPU.
+     * The pages are needed anyway, this only brings them in sooner. */
+    indices = (const uint32_t *) s->blobs[SCENE_INDICES].data;
+    vertexcount = s->blobs[SCENE_VERTICES].count;
+    for (i = 0; i < s->blobs[SCENE_INDICES].count; i++)
+	if (indices[i] >= vertexcount)
+	    terminate("Scene index %u out of range.\n", indices[i]);
+}
+
+/* Appends a blob and its padding at the offset, which is aligned. The
+ * offset is kept here as ftell() is 32 bit on Windows. */
+void
+writeblob(FILE *f, const char *filename, uint64_t *offset, SceneEntry *e,
+	uint32_t type, uint32_t stride, uint32_t count, const void *data)
+{
+    uint64_t padding;
+
+    e->type = type;
+    e->stride = stride;
+    e->count = count;
+    e->pad = 0;
+    e->offset = *offset;
+    e->size = (uint64_t) stride * count;
+    padding = ALIGN(e->size) - e->size;
+    *offset += e->size + padding;
+
+    if ((count > 0 && fwrite(data, stride, count, f) != count) ||
+	    (padding > 0 && fwrite(zeros, 1, padding, f) != padding))
+	terminate("Error on writing file %s.\n", filename);
+}
+
+/* The mesh's arrays must be in memory. Little endian. */
+void
+scene_write(const char *filename, const Mesh *m,
+	const SceneInstance *instances, uint32_t count)
+{
+    SceneHeader h = {
+	.magic = { 'S', 'C', 'N', 'E' },
+	.version = SCENEVERSION,
+	.blobcount = SCENE_BLOBCOUNT,
+	.pad = 0
+    };
+    SceneBounds b = {
+	.centre = { m->centre[0], m->centre[1], m->centre[2] },
+	.scale = m->scale,
+	.radius = m->radius,
+	.pad = { 0, 0, 0 }
+    };
+    SceneEntry table[SCENE_BLOBCOUNT];
+    uint64_t headersize = sizeof h + sizeof table;
+    uint64_t offset = ALIGN(headersize);
+    FILE *f;
+
+    if ((f = fopen(filename, "wb")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+
+    /* The table is written again once the offsets are known */
+    memset(table, 0, sizeof table);
+    if (fwrite(&h, sizeof h, 1, f) != 1 ||
+	    fwrite(table, sizeof table, 1, f) != 1 ||
+	    fwrite(zeros, 1, ALIGN(headersize) - headersize, f) !=
+	    ALIGN(headersize) - headersize)
+	terminate("Error on writing file %s.\n", filename);
+
+    writeblob(f, filename, &offset, &table[SCENE_BOUNDS], SCENE_BOUNDS,
+	    sizeof(SceneBounds), 1, &b);
+    writeblob(f, filename, &offset, &table[SCENE_VERTICES], SCENE_VERTICES,
+	    sizeof(MeshVertex), m->vertexcount, m->vertices);
+    writeblob(f, filename, &offset, &table[SCENE_INDICES], SCENE_INDICES,
+	    sizeof(uint32_t), m->indexcount, m->indices);
+    writeblob(f, filename, &offset, &table[SCENE_INSTANCES], SCENE_INSTANCES,
+	    sizeof(SceneInstance), count, instances);
+
+    if (fseek(f, sizeof h, SEEK_SET) != 0 ||
+	    fwrite(table, sizeof table, 1, f) != 1 || fclose(f) != 0)
+	terminate("Error on writing file %s.\n", filename);
+}
@@ -0,0 +1,40 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/* Blobs start on and are padded to this, the page size and a multiple of
+ * every device's host pointer import alignment seen */
+#define SCENEALIGN 4096
+
+/* Blob types, a reader skips types it doesn't know */
+enum { SCENE_BOUNDS, SCENE_VERTICES, SCENE_INDICES, SCENE_INSTANCES,
+    SCENE_BLOBCOUNT };
+
+/* Centre and scale dequantise the mesh's positions, as in Mesh */
+typedef struct {
+    float centre[3];
+    float scale;
+    float radius;
+    uint32_t pad[3];
+} SceneBounds;
+
+/* Bounding sphere of one instance of the mesh */
+typedef struct {
+    float x, y, z;
+    float radius;
+} SceneInstance;
+
+typedef struct {
+    const void *data;
+    /* Bytes without the padding */
+    uint64_t size;
+    uint32_t count;
+} SceneBlob;
+
+/* Points into the file's data, missing blobs are empty */
+typedef struct {
+    SceneBlob blobs[SCENE_BLOBCOUNT];
+} Scene;
+
+void scene_read(Scene *s, const void *data, size_t size);
+void scene_write(const char *filename, const Mesh *m,
+	const SceneInstance *instances, uint32_t count);
@@ -1,10 +1,52 @@
 #version 450
 #pragma shader_stage(fragment)
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(location = 0) in vec3 fragColor;
+/* Bindless handle that refers to nothing */
+const uint NOHANDLE = 0xffffffffu;
+
+/* Pipeline variants, must match PipelineKey in pipeline.h */
+const uint COLOUR_VERTEX = 0;
+const uint COLOUR_GREY = 1;
+const uint COLOUR_UV = 2;
+layout(constant_id = 0) const uint COLOURMODE = COLOUR_VERTEX;
+/* Sampling is compiled out of variants without a texture */
+layout(constant_id = 1) const bool TEXTURED = true;
+
+/* Bindless table, indexed by the handles in the push constants */
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler texturesampler;
+
+/* Per-draw data */
+layout(push_constant) uniform Draw {
+    vec2 offset;
+    float scale;
+    float rotation;
+    uint texture;
+    uint buffer;
+    float minlod;
+} draw;
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUV;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    if (COLOURMODE == COLOUR_UV)
+        outColor = vec4(fragUV, 0.0, fragColor.a);
+    else if (COLOURMODE == COLOUR_GREY)
+        outColor = vec4(vec3(dot(fragColor.rgb, vec3(0.299, 0.587, 0.114))),
+                fragColor.a);
+    else
+        outColor = fragColor;
+
+    /* Never sample mips that haven't streamed in yet */
+    if (TEXTURED && draw.texture != NOHANDLE) {
+        float lod = max(textureQueryLod(sampler2D(textures[draw.texture],
+                texturesampler), fragUV).y, draw.minlod);
+
+        outColor *= textureLod(sampler2D(textures[draw.texture],
+                texturesampler), fragUV, lod);
+    }
 }
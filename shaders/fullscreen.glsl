@@ -0,0 +1,9 @@
+#version 450
+#pragma shader_stage(vertex)
+
+/* One triangle covering the viewport, no vertex buffer */
+void main() {
+    vec2 p = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 450
+#pragma shader_stage(fragment)
+
+/* Tonemapped colour */
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput
+    tonemapped;
+
+layout(location = 0) out vec4 outColor;
+
+const float SATURATION = 1.1;
+const float CONTRAST = 1.05;
+const vec3 LIFT = vec3(0.0, 0.005, 0.01);
+
+void main() {
+    vec3 c = subpassLoad(tonemapped).rgb;
+    float l = dot(c, vec3(0.2126, 0.7152, 0.0722));
+
+    c = mix(vec3(l), c, SATURATION);
+    c = (c - 0.5) * CONTRAST + 0.5 + LIFT;
+    outColor = vec4(clamp(c, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,44 @@
+#version 450
+#pragma shader_stage(vertex)
+
+/* Per-frame data, selected from the uniform ring by a dynamic offset */
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 viewproj;
+    float time;
+    float deltatime;
+} frame;
+
+/* Must match SpriteVertex in batch.h */
+struct Vertex {
+    vec2 position;
+    vec2 uv;
+    uint colour;
+    uint pad;
+};
+
+/* Bindless table, vertices are pulled from the buffer in the push constants
+ * by the index buffer's values */
+layout(std430, set = 1, binding = 2) readonly buffer Vertices {
+    Vertex vertices[];
+} buffers[];
+
+/* Per-draw data */
+layout(push_constant) uniform Draw {
+    vec2 offset;
+    float scale;
+    float rotation;
+    uint texture;
+    uint buffer;
+    float minlod;
+} draw;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUV;
+
+void main() {
+    Vertex v = buffers[draw.buffer].vertices[gl_VertexIndex];
+
+    gl_Position = frame.viewproj * vec4(v.position, 0.0, 1.0);
+    fragColor = unpackUnorm4x8(v.colour);
+    fragUV = v.uv;
+}
@@ -0,0 +1,18 @@
+#version 450
+#pragma shader_stage(fragment)
+
+/* Scene colour in linear HDR */
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput
+    scene;
+
+layout(location = 0) out vec4 outColor;
+
+const float EXPOSURE = 1.5;
+
+/* Reinhard on luminance keeps the hue of bright colours */
+void main() {
+    vec3 c = subpassLoad(scene).rgb * EXPOSURE;
+    float l = dot(c, vec3(0.2126, 0.7152, 0.0722));
+
+    outColor = vec4(c / (1.0 + l), 1.0);
+}
@@ -1,21 +1,38 @@
 #version 450
 #pragma shader_stage(vertex)
 
-layout(location = 0) out vec3 fragColor;
+/* Per-frame data, selected from the uniform ring by a dynamic offset */
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 viewproj;
+    float time;
+    float deltatime;
+} frame;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+/* Per-draw data */
+layout(push_constant) uniform Draw {
+    vec2 offset;
+    float scale;
+    float rotation;
+    uint texture;
+    uint buffer;
+    float minlod;
+} draw;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+/* Quantised mesh vertices, the position is within the mesh's bounds and
+ * has a w of one */
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 colour;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUV;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    float c = cos(draw.rotation);
+    float s = sin(draw.rotation);
+    vec2 p = mat2(c, s, -s, c) * position.xy * draw.scale + draw.offset;
+
+    gl_Position = frame.viewproj * vec4(p, 0.0, 1.0);
+    fragColor = colour;
+    /* Texture coordinates span the mesh's bounds */
+    fragUV = position.xy * 0.5 + 0.5;
 }
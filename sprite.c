@@ -0,0 +1,198 @@
+/* Sprite renderer.
+ * Sprites queued during a frame are batched when the frame is recorded, and
+ * their quads are written straight into a persistently mapped buffer, one
+ * per frame in flight, which the vertex shader reads through the bindless
+ * table. The index buffer never changes, so each batch is one indexed draw.
+ * The quads are written by jobs while the frame is recorded, recording only
+ * needs the batches.
+ */
+
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+
+#include "batch.h"
+#include "config.h"
+#include "job.h"
+#include "mem.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "sprite.h"
+#include "util.h"
+#include "vulkan.h"
+
+/* Macros */
+#define INDICES 6
+#define VERTICES 4
+/* Sprites a job writes at least */
+#define WRITEGRAIN 1024
+
+/* Function declarations */
+static void writequads(void *data, uint32_t begin, uint32_t end);
+
+/* Variables */
+static SpriteList list;
+static uint32_t batchcount;
+static VkBuffer vertexbuffers[MAXFRAMES];
+static VkDeviceMemory vertexmemory[MAXFRAMES];
+static SpriteVertex *vertices[MAXFRAMES];
+static uint32_t handles[MAXFRAMES];
+static VkBuffer indexbuffer;
+static VkDeviceMemory indexmemory;
+static VkPipeline pipelines[SPRITE_BLENDCOUNT];
+static VkPipelineLayout pipelinelayout;
+/* Per frame totals for the report */
+static uint64_t frames, totalsprites, totaldraws;
+static uint32_t mostsprites;
+
+/* Function implementations */
+
+/* Draws with the scene's pipeline layout and fragment shader */
+void
+spr_initialise(VkRenderPass renderpass, VkPipelineLayout layout)
+{
+    VkDeviceSize size = (VkDeviceSize) maxsprites * VERTICES *
+	sizeof(SpriteVertex);
+    VkShaderModule vertex, fragment;
+    uint32_t *indices, i;
+
+    batch_initialise(&list, maxsprites);
+
+    for (i = 0; i < MAXFRAMES; i++) {
+	vk_createbuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vertexbuffers[i],
+		&vertexmemory[i]);
+	/* Mapped for good, the frame's fence guards its buffer */
+	if (vkMapMemory(device, vertexmemory[i], 0, VK_WHOLE_SIZE, 0,
+		    (void **) &vertices[i]) != VK_SUCCESS)
+	    terminate("Failed to map sprite buffer.");
+	handles[i] = vk_registerbuffer(vertexbuffers[i], 0, size);
+    }
+
+    /* Two triangles a quad, the same for every frame */
+    vk_createbuffer((VkDeviceSize) maxsprites * INDICES * sizeof(uint32_t),
+	    VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indexbuffer, &indexmemory);
+    if (vkMapMemory(device, indexmemory, 0, VK_WHOLE_SIZE, 0,
+		(void **) &indices) != VK_SUCCESS)
+	terminate("Failed to map sprite index buffer.");
+    for (i = 0; i < maxsprites; i++) {
+	indices[INDICES * i + 0] = VERTICES * i + 0;
+	indices[INDICES * i + 1] = VERTICES * i + 1;
+	indices[INDICES * i + 2] = VERTICES * i + 2;
+	indices[INDICES * i + 3] = VERTICES * i + 2;
+	indices[INDICES * i + 4] = VERTICES * i + 3;
+	indices[INDICES * i + 5] = VERTICES * i + 0;
+    }
+    vkUnmapMemory(device, indexmemory);
+
+    pipelinelayout = layout;
+    vertex = pipe_loadmodule(spriteshader);
+    fragment = pipe_loadmodule(fragmentshader);
+    for (i = 0; i < SPRITE_BLENDCOUNT; i++)
+	pipelines[i] = pipe_create(vertex, fragment, layout, renderpass, 0,
+		i == SPRITE_ALPHA);
+    vkDestroyShaderModule(device, vertex, &allocator);
+    vkDestroyShaderModule(device, fragment, &allocator);
+}
+
+/* The GPU must be idle */
+void
+spr_terminate(void)
+{
+    uint32_t i;
+
+    if (totalsprites > 0)
+	fprintf(stderr, "Sprites: %.0f mean and %u most a frame, %.1f mean "
+		"draws a frame, %u dropped.\n",
+		(double) totalsprites / (double) frames, mostsprites,
+		(double) totaldraws / (double) frames, list.dropped);
+
+    for (i = 0; i < SPRITE_BLENDCOUNT; i++)
+	vkDestroyPipeline(device, pipelines[i], &allocator);
+    vkDestroyBuffer(device, indexbuffer, &allocator);
+    vkFreeMemory(device, indexmemory, &allocator);
+    for (i = 0; i < MAXFRAMES; i++) {
+	vk_unregisterbuffer(handles[i]);
+	vkUnmapMemory(device, vertexmemory[i]);
+	vkDestroyBuffer(device, vertexbuffers[i], &allocator);
+	vkFreeMemory(device, vertexmemory[i], &allocator);
+    }
+    batch_terminate(&list);
+}
+
+void
+writequads(void *data, uint32_t begin, uint32_t end)
+{
+    batch_write(&list, (SpriteVertex *) data, begin, end);
+}
+
+/* Queues a sprite for the next frame */
+void
+spr_draw(const Sprite *s)
+{
+    if (s->blend >= SPRITE_BLENDCOUNT)
+	terminate("Unknown sprite blend mode.");
+
+    batch_add(&list, s);
+}
+
+/* Sorts and batches the frame's sprites */
+void
+spr_build(void)
+{
+    uint32_t count = list.count;
+
+    frames++;
+    batchcount = batch_build(&list);
+    totalsprites += count;
+    totaldraws += batchcount;
+    if (count > mostsprites)
+	mostsprites = count;
+}
+
+/* Writes the built sprites into the frame's buffer as jobs on the counter,
+ * they must finish before the frame is submitted */
+void
+spr_write(uint32_t frame, JobCounter *counter)
+{
+    job_parallelfor("spr_write", writequads, vertices[frame], list.built,
+	    WRITEGRAIN, counter);
+}
+
+/* Inside the scene's render pass with its descriptor sets bound. Sprite
+ * textures are expected to be fully resident. */
+void
+spr_record(VkCommandBuffer cb, uint32_t frame)
+{
+    DrawConstants dc = {
+	.offset = { 0.0f, 0.0f },
+	.scale = 1.0f,
+	.rotation = 0.0f,
+	.texture = NOHANDLE,
+	.buffer = handles[frame],
+	.minlod = 0.0f
+    };
+    uint32_t blend = SPRITE_BLENDCOUNT, i;
+    const SpriteBatch *b;
+
+    if (batchcount == 0)
+	return;
+
+    vkCmdBindIndexBuffer(cb, indexbuffer, 0, VK_INDEX_TYPE_UINT32);
+    for (i = 0; i < batchcount; i++) {
+	b = &list.batches[i];
+	if (b->blend != blend) {
+	    blend = b->blend;
+	    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		    pipelines[blend]);
+	}
+	dc.texture = b->texture;
+	vkCmdPushConstants(cb, pipelinelayout,
+		VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+		sizeof dc, &dc);
+	vkCmdDrawIndexed(cb, INDICES * b->count, 1, INDICES * b->first, 0,
+		0);
+    }
+}
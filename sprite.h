@@ -0,0 +1,8 @@
+#include <vulkan/vulkan.h>
+
+void spr_initialise(VkRenderPass renderpass, VkPipelineLayout layout);
+void spr_terminate(void);
+void spr_draw(const Sprite *s);
+void spr_build(void);
+void spr_write(uint32_t frame, JobCounter *counter);
+void spr_record(VkCommandBuffer cb, uint32_t frame);
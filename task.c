@@ -0,0 +1,124 @@
+/* Task graph.
+ * Runs a small fixed graph on worker threads, starting each task as soon as
+ * the tasks it depends on have finished. The calling thread is one of the
+ * workers. Scheduling is under one lock, tasks are expected to take far
+ * longer than picking them.
+ */
+
+#include <windows.h>
+
+#include "task.h"
+#include "trace.h"
+#include "util.h"
+
+/* Types */
+
+typedef struct {
+    const Task *tasks;
+    uint32_t count;
+    uint32_t all;
+    /* Guarded by the lock */
+    uint32_t started;
+    uint32_t done;
+    uint32_t running;
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+} Graph;
+
+/* Function declarations */
+static int nexttask(const Graph *g);
+static void work(Graph *g);
+static DWORD WINAPI worker(LPVOID param);
+
+/* Function implementations */
+
+/* Lowest ready index first, so a single thread runs the tasks in order */
+int
+nexttask(const Graph *g)
+{
+    uint32_t i;
+
+    for (i = 0; i < g->count; i++)
+	if (!(g->started & TASKBIT(i)) &&
+		(g->tasks[i].deps & g->done) == g->tasks[i].deps)
+	    return (int) i;
+
+    return -1;
+}
+
+void
+work(Graph *g)
+{
+    int i;
+
+    AcquireSRWLockExclusive(&g->lock);
+    while (g->done != g->all) {
+	if ((i = nexttask(g)) < 0) {
+	    /* Nothing is ready and nothing running could make it so */
+	    if (g->running == 0)
+		terminate("Task graph can't complete, check dependencies.");
+	    SleepConditionVariableSRW(&g->cond, &g->lock, INFINITE, 0);
+	    continue;
+	}
+
+	g->started |= TASKBIT(i);
+	g->running++;
+	ReleaseSRWLockExclusive(&g->lock);
+
+	TRACE_BEGIN(g->tasks[i].name);
+	g->tasks[i].run();
+	TRACE_END();
+
+	AcquireSRWLockExclusive(&g->lock);
+	g->done |= TASKBIT(i);
+	g->running--;
+	WakeAllConditionVariable(&g->cond);
+    }
+    ReleaseSRWLockExclusive(&g->lock);
+}
+
+DWORD WINAPI
+worker(LPVOID param)
+{
+    TRACE_THREAD("task worker");
+    work((Graph *) param);
+
+    return 0;
+}
+
+/* Zero threads uses every processor, one runs the graph serially */
+void
+task_run(const Task *tasks, uint32_t count, uint32_t threads)
+{
+    Graph g;
+    HANDLE handles[MAXTASKS];
+    SYSTEM_INFO si;
+    uint32_t i;
+
+    if (count > MAXTASKS)
+	terminate("Too many tasks in graph.");
+
+    if (threads == 0) {
+	GetSystemInfo(&si);
+	threads = si.dwNumberOfProcessors;
+    }
+    /* Extra threads would only wait */
+    if (threads > count)
+	threads = count;
+
+    g.tasks = tasks;
+    g.count = count;
+    g.all = count == MAXTASKS ? ~(uint32_t) 0 : TASKBIT(count) - 1;
+    g.started = g.done = g.running = 0;
+    InitializeSRWLock(&g.lock);
+    InitializeConditionVariable(&g.cond);
+
+    for (i = 1; i < threads; i++)
+	if ((handles[i] = CreateThread(NULL, 0, worker, &g, 0, NULL)) == NULL)
+	    terminate("Failed to create task thread.");
+    work(&g);
+    for (i = 1; i < threads; i++) {
+	WaitForSingleObject(handles[i], INFINITE);
+	CloseHandle(handles[i]);
+    }
+}
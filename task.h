@@ -0,0 +1,15 @@
+#include <stdint.h>
+
+/* Most tasks in one graph, each has a bit in the dependency masks */
+#define MAXTASKS 32
+#define TASKBIT(i) ((uint32_t) 1 << (i))
+
+typedef struct {
+    /* A string literal, it names the trace zone */
+    const char *name;
+    void (*run)(void);
+    /* Tasks in the same graph that have to finish first */
+    uint32_t deps;
+} Task;
+
+void task_run(const Task *tasks, uint32_t count, uint32_t threads);
@@ -0,0 +1,89 @@
+/* Telemetry.
+ * Per frame metrics in a ring in named shared memory, for a collector in
+ * another process to read while the renderer runs, see tools/telread.c.
+ * There's one writer, the main thread, so writing a record is a copy between
+ * two interlocked stores of its sequence and no lock is taken. A reader that
+ * falls more than the ring behind loses the oldest frames, the writer never
+ * waits for it.
+ */
+
+#include <string.h>
+#include <windows.h>
+
+#include "telemetry.h"
+#include "util.h"
+
+/* Variables */
+static HANDLE mapping;
+static TelHeader *header;
+static TelRecord *ring;
+
+/* Function implementations */
+
+/* An empty name leaves telemetry off */
+void
+tel_initialise(const char *name)
+{
+    DWORD size = sizeof(TelHeader) + TEL_RINGSIZE * sizeof(TelRecord);
+
+    if (name[0] == '\0')
+	return;
+
+    /* Backed by the page file, it goes when the last view closes */
+    if ((mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL,
+		    PAGE_READWRITE, 0, size, name)) == NULL)
+	terminate("Failed to create telemetry mapping %s.", name);
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+	terminate("Telemetry mapping %s is already in use.", name);
+    if ((header = (TelHeader *) MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS,
+		    0, 0, size)) == NULL)
+	terminate("Failed to map telemetry.");
+    ring = (TelRecord *) (header + 1);
+
+    /* A new mapping is zeroed. The magic goes last so a reader never sees a
+     * half written header. */
+    header->version = TEL_VERSION;
+    header->recordsize = sizeof(TelRecord);
+    header->ringsize = TEL_RINGSIZE;
+    header->pid = GetCurrentProcessId();
+    MemoryBarrier();
+    memcpy(header->magic, "TELE", 4);
+}
+
+void
+tel_terminate(void)
+{
+    if (header == NULL)
+	return;
+
+    InterlockedExchange(&header->stopped, 1);
+    UnmapViewOfFile(header);
+    CloseHandle(mapping);
+    header = NULL;
+}
+
+/* Main thread only */
+void
+tel_write(const TelFrame *f)
+{
+    LONG64 head;
+    TelRecord *r;
+
+    if (header == NULL)
+	return;
+
+    /* Placed by frame number, as the header says */
+    head = (LONG64) f->frame + 1;
+    r = &ring[f->frame % TEL_RINGSIZE];
+    InterlockedExchange64(&r->sequence, 0);
+    r->f = *f;
+    InterlockedExchange64(&r->sequence, head);
+    InterlockedExchange64(&header->head, head);
+}
+
+/* So the caller can skip gathering what wouldn't be written */
+uint32_t
+tel_enabled(void)
+{
+    return header != NULL;
+}
@@ -0,0 +1,48 @@
+#include <stdint.h>
+#include <windows.h>
+
+/* Shared memory layout, little endian. A TelHeader at offset 0 then
+ * TEL_RINGSIZE TelRecords. Frames count from 0, frame n goes in record
+ * n % TEL_RINGSIZE and head is one past the newest frame written. A reader
+ * copies a record and takes it only if its sequence is the frame number plus
+ * one both before and after the copy, zero means it's being written. */
+#define TEL_VERSION 1
+#define TEL_RINGSIZE 1024
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t recordsize;
+    uint32_t ringsize;
+    uint32_t pid;
+    /* Set once the writer has stopped */
+    volatile LONG stopped;
+    volatile LONG64 head;
+    uint64_t pad[4];
+} TelHeader;
+
+/* Times are in milliseconds, device bytes are zero when unknown */
+typedef struct {
+    uint64_t frame;
+    /* Seconds on the performance counter at the start of the frame */
+    double start;
+    float frametime;
+    float fencewait;
+    float acquire;
+    float submit;
+    float present;
+    /* Swap chain recreations so far */
+    uint32_t recreations;
+    uint64_t hostbytes;
+    uint64_t devicebytes;
+} TelFrame;
+
+typedef struct {
+    volatile LONG64 sequence;
+    TelFrame f;
+} TelRecord;
+
+void tel_initialise(const char *name);
+void tel_terminate(void);
+void tel_write(const TelFrame *f);
+uint32_t tel_enabled(void);
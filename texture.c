@@ -0,0 +1,757 @@
+/* Streaming textures.
+ * KTX2 files are memory-mapped and their mips uploaded smallest first under a
+ * per-frame byte budget, so a low resolution version is usable straight away.
+ * A background thread pages in the next levels so frames never wait on I/O.
+ * Uncompressed images are block compressed on load and stream the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "bc.h"
+#include "cmdstream.h"
+#include "config.h"
+#include "mem.h"
+#include "texture.h"
+#include "trace.h"
+#include "util.h"
+#include "vulkan.h"
+#include "win32.h"
+
+/* Macros */
+#define KTX2HEADERSIZE 80
+#define MAXREGIONS 64
+#define PAGESIZE 4096
+/* Satisfies copy offset alignment for every supported format */
+#define STAGINGALIGN 16
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((VkDeviceSize) (a) - 1))
+
+/* Types */
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} Level;
+
+typedef struct {
+    VkFormat format;
+    uint32_t blockwidth;
+    uint32_t blockheight;
+    uint32_t blockbytes;
+} FormatInfo;
+
+struct Texture {
+    const unsigned char *data;
+    const FormatInfo *fi;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelcount;
+    Level *levels;
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    uint32_t handle;
+    uint32_t initialised;
+    /* Lowest mip level that can be sampled, levelcount when none */
+    uint32_t resident;
+    /* Next block row to upload of level resident - 1 */
+    uint32_t nextrow;
+    /* Lowest mip level that has been paged in */
+    uint32_t prefetched;
+    /* Data is a mapped file rather than our own allocation */
+    uint32_t mapped;
+    /* Written to the command stream, only the recording thread reads it */
+    uint32_t captured;
+    Texture *next;
+};
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    unsigned char *data;
+} Staging;
+
+/* Function declarations */
+static const FormatInfo *findformat(VkFormat format);
+static uint32_t levelwidth(const Texture *t, uint32_t level);
+static uint32_t levelheight(const Texture *t, uint32_t level);
+static uint32_t levelrows(const Texture *t, uint32_t level);
+static VkDeviceSize rowbytes(const Texture *t, uint32_t level);
+static void parsektx2(Texture *t, size_t size, const char *filename);
+static void downsample(unsigned char *dst, const unsigned char *src,
+	uint32_t width, uint32_t height);
+static void addtexture(Texture *t);
+static void createimage(Texture *t);
+static void createstaging(void);
+static void destroystaging(void);
+static void prefetchlevel(const Texture *t, uint32_t level);
+static DWORD WINAPI streamthread(LPVOID param);
+
+/* Variables */
+static const unsigned char ktx2id[] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+static const FormatInfo formats[] = {
+    { VK_FORMAT_R8G8B8A8_UNORM,      1, 1,  4 },
+    { VK_FORMAT_R8G8B8A8_SRGB,       1, 1,  4 },
+    { VK_FORMAT_B8G8R8A8_UNORM,      1, 1,  4 },
+    { VK_FORMAT_B8G8R8A8_SRGB,       1, 1,  4 },
+    { VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 4, 4,  8 },
+    { VK_FORMAT_BC1_RGBA_SRGB_BLOCK,  4, 4,  8 },
+    { VK_FORMAT_BC3_UNORM_BLOCK,      4, 4, 16 },
+    { VK_FORMAT_BC3_SRGB_BLOCK,       4, 4, 16 },
+    { VK_FORMAT_BC4_UNORM_BLOCK,      4, 4,  8 },
+    { VK_FORMAT_BC5_UNORM_BLOCK,      4, 4, 16 },
+    { VK_FORMAT_BC7_UNORM_BLOCK,      4, 4, 16 },
+    { VK_FORMAT_BC7_SRGB_BLOCK,       4, 4, 16 }
+};
+static Texture *textures;
+static Staging staging[MAXFRAMES];
+/* Guards the texture list against the stream thread */
+static SRWLOCK texlock = SRWLOCK_INIT;
+static CONDITION_VARIABLE texcond = CONDITION_VARIABLE_INIT;
+static const Texture *streaming;
+static uint32_t stopping;
+static HANDLE thread;
+
+/* Function implementations */
+
+const FormatInfo *
+findformat(VkFormat format)
+{
+    uint32_t i;
+
+    for (i = 0; i < COUNT(formats); i++)
+	if (formats[i].format == format)
+	    return &formats[i];
+
+    return NULL;
+}
+
+uint32_t
+levelwidth(const Texture *t, uint32_t level)
+{
+    return t->width >> level > 0 ? t->width >> level : 1;
+}
+
+uint32_t
+levelheight(const Texture *t, uint32_t level)
+{
+    return t->height >> level > 0 ? t->height >> level : 1;
+}
+
+uint32_t
+levelrows(const Texture *t, uint32_t level)
+{
+    return (levelheight(t, level) + t->fi->blockheight - 1) /
+	t->fi->blockheight;
+}
+
+VkDeviceSize
+rowbytes(const Texture *t, uint32_t level)
+{
+    return (VkDeviceSize) (levelwidth(t, level) + t->fi->blockwidth - 1) /
+	t->fi->blockwidth * t->fi->blockbytes;
+}
+
+void
+parsektx2(Texture *t, size_t size, const char *filename)
+{
+    uint32_t header[9], maxlevels, i;
+    VkPhysicalDeviceProperties pdp;
+    const unsigned char *p;
+
+    if (size < KTX2HEADERSIZE || memcmp(t->data, ktx2id, sizeof ktx2id) != 0)
+	terminate("Not a KTX2 file %s.\n", filename);
+
+    /* vkFormat, typeSize, pixelWidth, pixelHeight, pixelDepth, layerCount,
+     * faceCount, levelCount, supercompressionScheme */
+    memcpy(header, t->data + sizeof ktx2id, sizeof header);
+    if ((t->fi = findformat((VkFormat) header[0])) == NULL)
+	terminate("Unsupported texture format in %s.\n", filename);
+    if (header[4] != 0 || header[5] > 1 || header[6] != 1 || header[8] != 0)
+	terminate("Only plain 2D textures are supported, %s.\n", filename);
+    if (header[7] == 0)
+	terminate("Texture %s has no mip levels.\n", filename);
+
+    /* Checked before anything is sized from them */
+    vkGetPhysicalDeviceProperties(physicaldevice, &pdp);
+    if (header[2] == 0 || header[3] == 0 ||
+	    header[2] > pdp.limits.maxImageDimension2D ||
+	    header[3] > pdp.limits.maxImageDimension2D)
+	terminate("Texture %s is %ux%u, the GPU allows up to %u.\n",
+		filename, header[2], header[3],
+		pdp.limits.maxImageDimension2D);
+    for (maxlevels = 1; (header[2] | header[3]) >> maxlevels; maxlevels++)
+	;
+    if (header[7] > maxlevels)
+	terminate("Texture %s has %u mip levels, at most %u fit.\n",
+		filename, header[7], maxlevels);
+
+    t->width = header[2];
+    t->height = header[3];
+    t->levelcount = header[7];
+    if (size < KTX2HEADERSIZE + t->levelcount * 3 * sizeof(uint64_t))
+	terminate("Truncated KTX2 file %s.\n", filename);
+
+    /* Level index follows the header, mips are tightly packed rows of
+     * blocks */
+    if ((t->levels = (Level *) malloc(t->levelcount * sizeof(Level))) ==
+	    NULL)
+	terminate("Failed to allocate mip levels.");
+    for (i = 0; i < t->levelcount; i++) {
+	p = t->data + KTX2HEADERSIZE + i * 3 * sizeof(uint64_t);
+	memcpy(&t->levels[i].offset, p, sizeof(uint64_t));
+	memcpy(&t->levels[i].length, p + sizeof(uint64_t), sizeof(uint64_t));
+
+	if (t->levels[i].offset > size ||
+		t->levels[i].length > size - t->levels[i].offset ||
+		t->levels[i].length != levelrows(t, i) * rowbytes(t, i))
+	    terminate("Bad mip level %u in %s.\n", i, filename);
+	if (rowbytes(t, i) > texturebudget)
+	    terminate("Texture %s is too wide to stream.\n", filename);
+    }
+}
+
+void
+downsample(unsigned char *dst, const unsigned char *src, uint32_t width,
+	uint32_t height)
+{
+    uint32_t w = width > 1 ? width / 2 : 1, h = height > 1 ? height / 2 : 1;
+    uint32_t x, y, x1, y1, c;
+
+    /* 2x2 box filter, odd edges repeat the last pixel */
+    for (y = 0; y < h; y++) {
+	y1 = 2 * y + 1 < height ? 2 * y + 1 : 2 * y;
+	for (x = 0; x < w; x++) {
+	    x1 = 2 * x + 1 < width ? 2 * x + 1 : 2 * x;
+	    for (c = 0; c < 4; c++)
+		dst[4 * (y * w + x) + c] = (unsigned char)
+		    ((src[4 * (2 * y * width + 2 * x) + c] +
+		      src[4 * (2 * y * width + x1) + c] +
+		      src[4 * (y1 * width + 2 * x) + c] +
+		      src[4 * (y1 * width + x1) + c] + 2) / 4);
+	}
+    }
+}
+
+void
+createimage(Texture *t)
+{
+    VkMemoryRequirements mr;
+    VkFormatProperties fp;
+    VkImageCreateInfo ici = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.imageType = VK_IMAGE_TYPE_2D,
+	.format = t->fi->format,
+	.extent = { t->width, t->height, 1 },
+	/* Every level exists up front, only residency changes */
+	.mipLevels = t->levelcount,
+	.arrayLayers = 1,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.tiling = VK_IMAGE_TILING_OPTIMAL,
+	.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    VkImageViewCreateInfo ivci = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.image = VK_NULL_HANDLE,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = t->fi->format,
+	.components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+	/* The shader clamps to the resident levels */
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = t->levelcount,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+
+    vkGetPhysicalDeviceFormatProperties(physicaldevice, t->fi->format, &fp);
+    if (!(fp.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+	terminate("Texture format not supported by the GPU.");
+
+    if (vkCreateImage(device, &ici, &allocator, &t->image) != VK_SUCCESS)
+	terminate("Failed to create texture image.");
+
+    vkGetImageMemoryRequirements(device, t->image, &mr);
+    mai.allocationSize = mr.size;
+    mai.memoryTypeIndex = vk_findmemorytype(mr.memoryTypeBits,
+	    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (vkAllocateMemory(device, &mai, &allocator, &t->memory) != VK_SUCCESS)
+	terminate("Failed to allocate texture memory.");
+    if (vkBindImageMemory(device, t->image, t->memory, 0) != VK_SUCCESS)
+	terminate("Failed to bind texture memory.");
+
+    ivci.image = t->image;
+    if (vkCreateImageView(device, &ivci, &allocator, &t->view) != VK_SUCCESS)
+	terminate("Failed to create texture image view.");
+}
+
+void
+createstaging(void)
+{
+    uint32_t i;
+
+    /* One budget's worth per frame in flight, reused once its fence has
+     * signalled */
+    for (i = 0; i < MAXFRAMES; i++) {
+	vk_createbuffer(texturebudget, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&staging[i].buffer, &staging[i].memory);
+
+	if (vkMapMemory(device, staging[i].memory, 0, VK_WHOLE_SIZE, 0,
+		    (void **) &staging[i].data) != VK_SUCCESS)
+	    terminate("Failed to map staging buffer.");
+    }
+}
+
+void
+destroystaging(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < MAXFRAMES; i++) {
+	vkUnmapMemory(device, staging[i].memory);
+	vkDestroyBuffer(device, staging[i].buffer, &allocator);
+	vkFreeMemory(device, staging[i].memory, &allocator);
+    }
+}
+
+void
+prefetchlevel(const Texture *t, uint32_t level)
+{
+    const volatile unsigned char *p = t->data + t->levels[level].offset;
+    uint64_t i;
+    unsigned char sink = 0;
+
+    /* Touch every page so the frame thread's copy never faults to disk */
+    for (i = 0; i < t->levels[level].length; i += PAGESIZE)
+	sink ^= p[i];
+    sink ^= p[t->levels[level].length - 1];
+    UNUSED(sink);
+}
+
+DWORD WINAPI
+streamthread(LPVOID param)
+{
+    Texture *t;
+    uint32_t level;
+
+    UNUSED(param);
+    TRACE_THREAD("texture stream");
+
+    AcquireSRWLockExclusive(&texlock);
+    while (!stopping) {
+	/* Stay up to two levels ahead of the uploads */
+	for (t = textures; t != NULL; t = t->next)
+	    if (t->prefetched > 0 && t->prefetched + 1 >= t->resident)
+		break;
+
+	if (t == NULL) {
+	    SleepConditionVariableSRW(&texcond, &texlock, INFINITE, 0);
+	    continue;
+	}
+
+	level = t->prefetched - 1;
+	streaming = t;
+	ReleaseSRWLockExclusive(&texlock);
+
+	TRACE_CALL(prefetchlevel(t, level));
+
+	AcquireSRWLockExclusive(&texlock);
+	t->prefetched = level;
+	streaming = NULL;
+	WakeAllConditionVariable(&texcond);
+	/* The level can be uploaded */
+	vk_invalidate();
+    }
+    ReleaseSRWLockExclusive(&texlock);
+
+    return 0;
+}
+
+void
+tex_initialise(void)
+{
+    createstaging();
+
+    stopping = 0;
+    if ((thread = CreateThread(NULL, 0, streamthread, NULL, 0, NULL)) ==
+	    NULL)
+	terminate("Failed to create texture stream thread.");
+}
+
+void
+tex_terminate(void)
+{
+    AcquireSRWLockExclusive(&texlock);
+    stopping = 1;
+    WakeAllConditionVariable(&texcond);
+    ReleaseSRWLockExclusive(&texlock);
+
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    while (textures != NULL)
+	tex_destroy(textures);
+    destroystaging();
+}
+
+void
+addtexture(Texture *t)
+{
+    createimage(t);
+    t->handle = vk_registerimage(t->view);
+    t->resident = t->levelcount;
+    t->nextrow = 0;
+
+    AcquireSRWLockExclusive(&texlock);
+    t->next = textures;
+    textures = t;
+    WakeAllConditionVariable(&texcond);
+    ReleaseSRWLockExclusive(&texlock);
+    vk_invalidate();
+}
+
+Texture *
+tex_load(const char *filename)
+{
+    size_t size;
+    Texture *t = (Texture *) calloc(1, sizeof(Texture)), *c;
+    VkFormat format;
+
+    if (t == NULL)
+	terminate("Failed to allocate texture.");
+    t->data = (const unsigned char *) mapfile(filename, &size);
+    t->mapped = 1;
+    parsektx2(t, size, filename);
+
+    /* Only the top level is kept, the mips are rebuilt before
+     * compressing */
+    if (texturecompress && (t->fi->format == VK_FORMAT_R8G8B8A8_UNORM ||
+	    t->fi->format == VK_FORMAT_R8G8B8A8_SRGB)) {
+	format = t->fi->format == VK_FORMAT_R8G8B8A8_SRGB ?
+	    VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	c = tex_create(t->data + t->levels[0].offset, t->width, t->height,
+		format);
+	unmapfile(t->data);
+	free(t->levels);
+	free(t);
+	return c;
+    }
+
+    /* Nothing resident or paged in yet */
+    t->prefetched = t->levelcount;
+    addtexture(t);
+
+    return t;
+}
+
+Texture *
+tex_create(const unsigned char *rgba, uint32_t width, uint32_t height,
+	VkFormat format)
+{
+    Texture *t = (Texture *) calloc(1, sizeof(Texture));
+    unsigned char *data, *mips, *mip;
+    BcImage *images;
+    uint64_t size = 0;
+    size_t mipsize = 0;
+    uint32_t i;
+    BcFormat bf;
+
+    switch (format) {
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	bf = BC1;
+	break;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+	bf = BC3;
+	break;
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+	bf = BC7;
+	break;
+    default:
+	terminate("Texture format can't be compressed.");
+	return NULL;
+    }
+    if (t == NULL)
+	terminate("Failed to allocate texture.");
+
+    t->fi = findformat(format);
+    t->width = width;
+    t->height = height;
+    for (t->levelcount = 1; (width | height) >> t->levelcount;
+	    t->levelcount++)
+	;
+
+    /* Same layout as a KTX2 file's levels */
+    if ((t->levels = (Level *) malloc(t->levelcount * sizeof(Level))) ==
+	    NULL)
+	terminate("Failed to allocate mip levels.");
+    for (i = 0; i < t->levelcount; i++) {
+	t->levels[i].offset = size;
+	t->levels[i].length = levelrows(t, i) * rowbytes(t, i);
+	size += ALIGN(t->levels[i].length, STAGINGALIGN);
+	if (rowbytes(t, i) > texturebudget)
+	    terminate("Texture is too wide to stream.");
+	if (i > 0)
+	    mipsize += (size_t) levelwidth(t, i) * levelheight(t, i) * 4;
+    }
+    data = (unsigned char *) malloc(size);
+    mips = (unsigned char *) malloc(mipsize > 0 ? mipsize : 1);
+    images = (BcImage *) malloc(t->levelcount * sizeof(BcImage));
+    if (data == NULL || mips == NULL || images == NULL)
+	terminate("Failed to allocate texture data.");
+
+    /* Every level is built first so they're compressed in one go */
+    mip = mips;
+    for (i = 0; i < t->levelcount; i++) {
+	images[i].dst = data + t->levels[i].offset;
+	images[i].width = levelwidth(t, i);
+	images[i].height = levelheight(t, i);
+	if (i == 0) {
+	    images[i].rgba = rgba;
+	} else {
+	    downsample(mip, images[i - 1].rgba, images[i - 1].width,
+		    images[i - 1].height);
+	    images[i].rgba = mip;
+	    mip += (size_t) images[i].width * images[i].height * 4;
+	}
+    }
+    bc_compress(images, t->levelcount, bf, BC_AUTO, 0);
+    free(images);
+    free(mips);
+
+    /* Already in memory, nothing to page in */
+    t->data = data;
+    t->mapped = 0;
+    t->prefetched = 0;
+    addtexture(t);
+
+    return t;
+}
+
+/* The GPU must have finished with the texture, e.g. after a device wait */
+void
+tex_destroy(Texture *t)
+{
+    Texture **p;
+
+    AcquireSRWLockExclusive(&texlock);
+    while (streaming == t)
+	SleepConditionVariableSRW(&texcond, &texlock, INFINITE, 0);
+    for (p = &textures; *p != t; p = &(*p)->next)
+	;
+    *p = t->next;
+    ReleaseSRWLockExclusive(&texlock);
+
+    vk_unregisterimage(t->handle);
+    vkDestroyImageView(device, t->view, &allocator);
+    vkDestroyImage(device, t->image, &allocator);
+    vkFreeMemory(device, t->memory, &allocator);
+    if (t->mapped)
+	unmapfile(t->data);
+    else
+	free((void *) t->data);
+    free(t->levels);
+    free(t);
+}
+
+void
+tex_update(VkCommandBuffer cb, uint32_t frame)
+{
+    VkImageMemoryBarrier init[MAXREGIONS], pre[MAXREGIONS], post[MAXREGIONS];
+    VkBufferImageCopy regions[MAXREGIONS];
+    VkImage images[MAXREGIONS];
+    VkImageMemoryBarrier imb = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	.pNext = NULL,
+	.srcAccessMask = 0,
+	.dstAccessMask = 0,
+	.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.image = VK_NULL_HANDLE,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    uint32_t ninit = 0, ncopies = 0, level, rows, i;
+    VkDeviceSize used = 0, rb;
+    Texture *t;
+
+    AcquireSRWLockExclusive(&texlock);
+    for (t = textures; t != NULL && ncopies < MAXREGIONS; t = t->next) {
+	/* Every level is kept shader readable so the view is always valid,
+	 * even though only resident levels are ever sampled */
+	if (!t->initialised) {
+	    init[ninit] = imb;
+	    init[ninit].image = t->image;
+	    init[ninit].subresourceRange.levelCount = t->levelcount;
+	    ninit++;
+	    t->initialised = 1;
+	}
+
+	/* Smallest mips first, stop at the budget or an unpaged level */
+	while (t->resident > 0 && ncopies < MAXREGIONS) {
+	    level = t->resident - 1;
+	    if (level < t->prefetched)
+		break;
+
+	    rb = rowbytes(t, level);
+	    used = ALIGN(used, STAGINGALIGN);
+	    rows = used < texturebudget ? (texturebudget - used) / rb : 0;
+	    if (rows > levelrows(t, level) - t->nextrow)
+		rows = levelrows(t, level) - t->nextrow;
+	    if (rows == 0)
+		goto budgetspent;
+
+	    memcpy(staging[frame].data + used, t->data +
+		    t->levels[level].offset + t->nextrow * rb, rows * rb);
+
+	    regions[ncopies].bufferOffset = used;
+	    regions[ncopies].bufferRowLength = 0;
+	    regions[ncopies].bufferImageHeight = 0;
+	    regions[ncopies].imageSubresource.aspectMask =
+		VK_IMAGE_ASPECT_COLOR_BIT;
+	    regions[ncopies].imageSubresource.mipLevel = level;
+	    regions[ncopies].imageSubresource.baseArrayLayer = 0;
+	    regions[ncopies].imageSubresource.layerCount = 1;
+	    regions[ncopies].imageOffset.x = 0;
+	    regions[ncopies].imageOffset.y = t->nextrow * t->fi->blockheight;
+	    regions[ncopies].imageOffset.z = 0;
+	    regions[ncopies].imageExtent.width = levelwidth(t, level);
+	    /* The last block row may overhang the level */
+	    regions[ncopies].imageExtent.height = rows * t->fi->blockheight;
+	    if (regions[ncopies].imageOffset.y +
+		    regions[ncopies].imageExtent.height > levelheight(t, level))
+		regions[ncopies].imageExtent.height = levelheight(t, level) -
+		    regions[ncopies].imageOffset.y;
+	    regions[ncopies].imageExtent.depth = 1;
+	    images[ncopies] = t->image;
+
+	    /* Leaving shader read only keeps the rows already uploaded */
+	    pre[ncopies] = imb;
+	    pre[ncopies].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	    pre[ncopies].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	    pre[ncopies].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	    pre[ncopies].image = t->image;
+	    pre[ncopies].subresourceRange.baseMipLevel = level;
+	    post[ncopies] = pre[ncopies];
+	    post[ncopies].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	    post[ncopies].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	    post[ncopies].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	    post[ncopies].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	    ncopies++;
+
+	    used += rows * rb;
+	    t->nextrow += rows;
+	    if (t->nextrow < levelrows(t, level))
+		goto budgetspent;
+
+	    /* Draws recorded after this can sample the level */
+	    t->nextrow = 0;
+	    t->resident = level;
+	}
+    }
+budgetspent:
+    /* Let the stream thread page in the next levels, and draw again for
+     * the rest of the budget's copies */
+    if (ncopies > 0) {
+	WakeAllConditionVariable(&texcond);
+	vk_invalidate();
+    }
+    ReleaseSRWLockExclusive(&texlock);
+
+    if (ninit > 0)
+	vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL,
+		ninit, init);
+
+    if (ncopies == 0)
+	return;
+
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+	    VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, ncopies, pre);
+    for (i = 0; i < ncopies; i++)
+	vkCmdCopyBufferToImage(cb, staging[frame].buffer, images[i],
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &regions[i]);
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL,
+	    ncopies, post);
+}
+
+/* While capturing, by the thread recording the frame. Every level is in
+ * memory whatever is resident, a mapped one may fault it in. */
+void
+tex_capture(Texture *t)
+{
+    CsTexture ct = {
+	.handle = t->handle,
+	.format = t->fi->format,
+	.width = t->width,
+	.height = t->height,
+	.levelcount = t->levelcount,
+	.blockwidth = t->fi->blockwidth,
+	.blockheight = t->fi->blockheight,
+	.blockbytes = t->fi->blockbytes
+    };
+    const unsigned char **levels;
+    uint64_t *lengths;
+    uint32_t i;
+
+    if (t->captured)
+	return;
+
+    levels = (const unsigned char **) malloc(t->levelcount *
+	    sizeof(const unsigned char *));
+    lengths = (uint64_t *) malloc(t->levelcount * sizeof(uint64_t));
+    if (levels == NULL || lengths == NULL)
+	terminate("Failed to allocate texture capture.");
+    for (i = 0; i < t->levelcount; i++) {
+	levels[i] = t->data + t->levels[i].offset;
+	lengths[i] = t->levels[i].length;
+    }
+    cs_texture(&ct, levels, lengths);
+    free(levels);
+    free(lengths);
+    t->captured = 1;
+}
+
+uint32_t
+tex_handle(const Texture *t)
+{
+    return t->resident < t->levelcount ? t->handle : NOHANDLE;
+}
+
+float
+tex_minlod(const Texture *t)
+{
+    return (float) t->resident;
+}
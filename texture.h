@@ -0,0 +1,14 @@
+#include <vulkan/vulkan.h>
+
+typedef struct Texture Texture;
+
+void tex_initialise(void);
+void tex_terminate(void);
+Texture *tex_load(const char *filename);
+Texture *tex_create(const unsigned char *rgba, uint32_t width,
+	uint32_t height, VkFormat format);
+void tex_destroy(Texture *t);
+void tex_update(VkCommandBuffer cb, uint32_t frame);
+void tex_capture(Texture *t);
+uint32_t tex_handle(const Texture *t);
+float tex_minlod(const Texture *t);
@@ -0,0 +1,282 @@
+/* Packs a Wavefront OBJ into the renderer's mesh format.
+ * Reads positions, with an optional RGB colour after them, normals and
+ * faces, which are fanned into triangles. Faces without normals get the
+ * area weighted normals of the faces around each position. The mesh is then
+ * run through the mesh pipeline, or with -u only quantised, so the GPU time
+ * of the two orders can be compared.
+ * Usage: meshpack [-u] input.obj output.mesh
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mesh.h"
+#include "../util.h"
+
+/* Macros */
+#define MAXLINE 1024
+#define MAXCORNERS 64
+#define CACHE 16
+
+/* Types */
+typedef struct {
+    void *data;
+    uint32_t count;
+    uint32_t capacity;
+    size_t size;
+} Array;
+
+/* Function declarations */
+static void *push(Array *a);
+static uint32_t corner(const char *s, uint32_t count);
+static uint32_t addvertex(uint32_t p, uint32_t n);
+static void readobj(const char *filename);
+static void smoothnormals(void);
+
+/* Variables */
+static Array positions = { NULL, 0, 0, 6 * sizeof(float) };
+static Array normals = { NULL, 0, 0, 3 * sizeof(float) };
+static Array vertices = { NULL, 0, 0, sizeof(MeshSource) };
+static Array indices = { NULL, 0, 0, sizeof(uint32_t) };
+/* The position and normal each vertex was made from, 0 for no normal */
+static Array keys = { NULL, 0, 0, 2 * sizeof(uint32_t) };
+/* Open addressing from a key to its vertex, UINT32_MAX is empty */
+static uint32_t *table;
+static uint32_t tablesize;
+
+/* Function implementations */
+
+void *
+push(Array *a)
+{
+    if (a->count == a->capacity) {
+	a->capacity = a->capacity == 0 ? 1024 : 2 * a->capacity;
+	if ((a->data = realloc(a->data, a->capacity * a->size)) == NULL)
+	    terminate("Failed to allocate %u elements.\n", a->capacity);
+    }
+
+    return (unsigned char *) a->data + a->count++ * a->size;
+}
+
+/* One based, negative counts back from the last. Returns 0 for none. */
+uint32_t
+corner(const char *s, uint32_t count)
+{
+    long i = strtol(s, NULL, 10);
+
+    if (i < 0)
+	i += (long) count + 1;
+    if (i <= 0 || i > (long) count)
+	terminate("Face index %s out of range.\n", s);
+
+    return (uint32_t) i;
+}
+
+uint32_t
+addvertex(uint32_t p, uint32_t n)
+{
+    uint32_t *key, h, i, j;
+    const float *pos;
+    MeshSource *v;
+
+    /* Keep the table under half full */
+    if (2 * (vertices.count + 1) > tablesize) {
+	free(table);
+	tablesize = tablesize == 0 ? 4096 : 2 * tablesize;
+	if ((table = (uint32_t *) malloc(tablesize * sizeof(uint32_t))) ==
+		NULL)
+	    terminate("Failed to allocate vertex table.\n");
+	memset(table, 0xff, tablesize * sizeof(uint32_t));
+	for (i = 0; i < vertices.count; i++) {
+	    key = (uint32_t *) keys.data + 2 * i;
+	    h = (key[0] * 2654435761u ^ key[1] * 40503u) & (tablesize - 1);
+	    while (table[h] != UINT32_MAX)
+		h = (h + 1) & (tablesize - 1);
+	    table[h] = i;
+	}
+    }
+
+    h = (p * 2654435761u ^ n * 40503u) & (tablesize - 1);
+    for (; (j = table[h]) != UINT32_MAX; h = (h + 1) & (tablesize - 1)) {
+	key = (uint32_t *) keys.data + 2 * j;
+	if (key[0] == p && key[1] == n)
+	    return j;
+    }
+
+    key = (uint32_t *) push(&keys);
+    key[0] = p;
+    key[1] = n;
+    v = (MeshSource *) push(&vertices);
+    pos = (const float *) positions.data + 6 * (p - 1);
+    memcpy(v->position, pos, 3 * sizeof(float));
+    memcpy(v->colour, pos + 3, 3 * sizeof(float));
+    v->colour[3] = 1.0f;
+    if (n != 0)
+	memcpy(v->normal, (const float *) normals.data + 3 * (n - 1),
+		3 * sizeof(float));
+    else
+	v->normal[0] = v->normal[1] = v->normal[2] = 0.0f;
+
+    return table[h] = vertices.count - 1;
+}
+
+void
+readobj(const char *filename)
+{
+    char line[MAXLINE], *tok, *slash;
+    uint32_t face[MAXCORNERS], count, p, n, i;
+    float *f;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+
+    while (fgets(line, sizeof line, fp) != NULL) {
+	if (strncmp(line, "v ", 2) == 0) {
+	    f = (float *) push(&positions);
+	    f[3] = f[4] = f[5] = 1.0f;
+	    sscanf(line + 2, "%f %f %f %f %f %f", &f[0], &f[1], &f[2],
+		    &f[3], &f[4], &f[5]);
+	} else if (strncmp(line, "vn ", 3) == 0) {
+	    f = (float *) push(&normals);
+	    sscanf(line + 3, "%f %f %f", &f[0], &f[1], &f[2]);
+	} else if (strncmp(line, "f ", 2) == 0) {
+	    count = 0;
+	    for (tok = strtok(line + 2, " \t\r\n"); tok != NULL;
+		    tok = strtok(NULL, " \t\r\n")) {
+		if (count == MAXCORNERS)
+		    terminate("Face has more than %u corners.\n", MAXCORNERS);
+		/* p, p/t, p//n or p/t/n, texture coordinates are dropped */
+		p = corner(tok, positions.count);
+		n = 0;
+		if ((slash = strchr(tok, '/')) != NULL &&
+			(slash = strchr(slash + 1, '/')) != NULL)
+		    n = corner(slash + 1, normals.count);
+		face[count++] = addvertex(p, n);
+	    }
+	    for (i = 2; i < count; i++) {
+		*(uint32_t *) push(&indices) = face[0];
+		*(uint32_t *) push(&indices) = face[i - 1];
+		*(uint32_t *) push(&indices) = face[i];
+	    }
+	}
+    }
+
+    if (ferror(fp))
+	terminate("Error reading file %s.\n", filename);
+    fclose(fp);
+}
+
+/* Vertices sharing a position share its normal */
+void
+smoothnormals(void)
+{
+    MeshSource *v = (MeshSource *) vertices.data;
+    const uint32_t *idx = (const uint32_t *) indices.data;
+    const uint32_t *key = (const uint32_t *) keys.data;
+    float *sums, e1[3], e2[3], n[3], *s;
+    const float *p0, *p1, *p2;
+    uint32_t t, c, i;
+
+    if ((sums = (float *) calloc(3 * (size_t) positions.count,
+		    sizeof(float))) == NULL)
+	terminate("Failed to allocate normals.\n");
+
+    for (t = 0; t + 2 < indices.count; t += 3) {
+	p0 = v[idx[t]].position;
+	p1 = v[idx[t + 1]].position;
+	p2 = v[idx[t + 2]].position;
+	for (c = 0; c < 3; c++) {
+	    e1[c] = p1[c] - p0[c];
+	    e2[c] = p2[c] - p0[c];
+	}
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	for (i = 0; i < 3; i++) {
+	    s = sums + 3 * (key[2 * idx[t + i]] - 1);
+	    for (c = 0; c < 3; c++)
+		s[c] += n[c];
+	}
+    }
+
+    for (i = 0; i < vertices.count; i++) {
+	if (key[2 * i + 1] != 0)
+	    continue;
+	s = sums + 3 * (key[2 * i] - 1);
+	memcpy(v[i].normal, s, 3 * sizeof(float));
+    }
+
+    free(sums);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t unoptimised = 0, before, after;
+    float *normal, len;
+    Mesh m;
+    uint32_t i;
+
+    if (argc == 4 && strcmp(argv[1], "-u") == 0) {
+	unoptimised = 1;
+	argv++;
+	argc--;
+    }
+    if (argc != 3) {
+	fprintf(stderr, "Usage: meshpack [-u] input.obj output.mesh\n");
+	return EXIT_FAILURE;
+    }
+
+    readobj(argv[1]);
+    if (indices.count == 0)
+	terminate("No faces in %s.\n", argv[1]);
+    smoothnormals();
+    for (i = 0; i < vertices.count; i++) {
+	normal = ((MeshSource *) vertices.data)[i].normal;
+	len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] +
+		normal[2] * normal[2]);
+	if (len > 0.0f) {
+	    normal[0] /= len;
+	    normal[1] /= len;
+	    normal[2] /= len;
+	}
+    }
+
+    before = mesh_cachemisses((const uint32_t *) indices.data, indices.count,
+	    vertices.count, CACHE);
+    if (unoptimised) {
+	m.base = malloc(vertices.count * sizeof(MeshVertex));
+	if (m.base == NULL)
+	    terminate("Failed to allocate mesh.\n");
+	m.vertices = (MeshVertex *) m.base;
+	m.indices = (uint32_t *) indices.data;
+	m.indexcount = indices.count;
+	mesh_quantise(&m, (const MeshSource *) vertices.data, vertices.count);
+    } else {
+	mesh_build(&m, (MeshSource *) vertices.data, vertices.count,
+		(uint32_t *) indices.data, indices.count);
+    }
+    after = mesh_cachemisses(m.indices, m.indexcount, m.vertexcount, CACHE);
+    mesh_save(&m, argv[2]);
+
+    printf("%u vertices, %u triangles\n", m.vertexcount, m.indexcount / 3);
+    printf("bytes/vertex %u -> %u\n", (uint32_t) sizeof(MeshSource),
+	    (uint32_t) sizeof(MeshVertex));
+    printf("ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u entry FIFO)\n",
+	    3.0 * before / m.indexcount, 3.0 * after / m.indexcount,
+	    (double) before / vertices.count, (double) after / m.vertexcount,
+	    CACHE);
+
+    mesh_free(&m);
+    free(positions.data);
+    free(normals.data);
+    free(vertices.data);
+    free(indices.data);
+    free(keys.data);
+    free(table);
+
+    return EXIT_SUCCESS;
+}
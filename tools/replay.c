@@ -0,0 +1,1471 @@
+/* Replays the commands captured by the renderer, see cmdstream.c.
+ * The captured frames are executed headless into an offscreen target, one
+ * at a time and each waited for, once to warm up and then runs times. For
+ * every frame it reports as CSV the time to record it, its GPU time from
+ * timestamps and the time from submit to its fence, the mean and the
+ * fastest over the runs in microseconds, then the same for the whole
+ * capture. A capture is the same workload wherever it's replayed, to
+ * compare drivers, e.g. lavapipe versions, or builds. It runs on the first
+ * device with a graphics queue. Only the scene pass is captured, the
+ * sprites and the post-processing aren't.
+ * Usage: replay [-n runs] capture
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+#include <windows.h>
+
+#include "../cmdstream.h"
+#include "../mesh.h"
+#include "../pipeline.h"
+#include "../util.h"
+#include "../vulkan.h"
+
+/* Macros */
+#define MAXRUNS 10000
+/* Largest uniform block, as the descriptor's range */
+#define UNIFORMSIZE 256
+/* The renderer's maxtextures, captured handles index the table */
+#define BINDLESSCOUNT 4096
+#define VARIABLE UINT32_MAX
+#define TIMES 3
+/* Satisfies copy offset alignment for every texture format */
+#define STAGINGALIGN 16
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((VkDeviceSize) (a) - 1))
+
+/* Types */
+typedef struct {
+    /* From its CS_BEGINFRAME to past its CS_ENDFRAME */
+    const unsigned char *begin;
+    const unsigned char *end;
+    uint64_t number;
+    uint32_t draws;
+    double sum[TIMES];
+    double min[TIMES];
+} Frame;
+
+/* At its renderer's bindless handle, no data when none was captured */
+typedef struct {
+    CsTexture info;
+    const unsigned char *data;
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+} Texture;
+
+/* Function declarations */
+static void *readfile(const char *filename, size_t *size);
+static void parse(const unsigned char *data, size_t size);
+static uint32_t checkcommand(const CsCommand *c, const unsigned char *args,
+	Frame *f);
+static uint64_t levelsize(const CsTexture *t, uint32_t level);
+static uint32_t checktexture(const CsTexture *t, uint32_t size);
+static uint32_t findmemorytype(uint32_t typefilter,
+	VkMemoryPropertyFlags properties);
+static void createbuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties, VkBuffer *buffer,
+	VkDeviceMemory *memory);
+static void createinstance(void);
+static void createdevice(void);
+static void createtarget(void);
+static void createlayouts(void);
+static void createcommands(void);
+static void createbuffers(void);
+static void createtextures(void);
+static void createmodules(void);
+static VkPipeline getpipeline(const PipelineKey *key);
+static void destroyall(void);
+static void replayframe(const Frame *f, double *t);
+static void addtimes(Frame *f, const double *t, uint32_t run);
+static void printframe(const char *name, const Frame *f, uint32_t runs);
+
+/* Variables */
+static const char * const timenames[TIMES] = { "record", "gpu", "wall" };
+static const uint32_t argsizes[CS_OPCOUNT] = {
+    [CS_SHADER]        = VARIABLE,
+    [CS_MESH]          = VARIABLE,
+    [CS_TEXTURE]       = VARIABLE,
+    [CS_BEGINFRAME]    = sizeof(uint64_t),
+    [CS_BEGINPASS]     = sizeof(CsPass),
+    [CS_BINDPIPELINE]  = sizeof(PipelineKey),
+    [CS_PUSHCONSTANTS] = sizeof(DrawConstants),
+    [CS_DRAWINDEXED]   = sizeof(CsDraw),
+    [CS_ENDPASS]       = 0,
+    [CS_UNIFORMS]      = VARIABLE,
+    [CS_ENDFRAME]      = 0
+};
+static Frame *frames;
+static uint32_t framecount;
+static const uint32_t *shadercode[2];
+static size_t shadersize[2];
+static CsMesh mesh;
+static const MeshVertex *vertices;
+static const uint32_t *indices;
+static Texture textures[BINDLESSCOUNT];
+static VkFormat format = VK_FORMAT_UNDEFINED;
+static VkExtent2D targetextent;
+static VkInstance instance;
+VkPhysicalDevice physicaldevice;
+VkDevice device;
+static uint32_t queuefamily;
+static VkQueue queue;
+static float timestampperiod;
+static uint64_t timestampmask;
+static VkRenderPass renderpass;
+static VkImage targetimage;
+static VkDeviceMemory targetmemory;
+static VkImageView targetview;
+static VkFramebuffer framebuffer;
+static VkSampler sampler;
+static VkDescriptorSetLayout setlayouts[2];
+static VkPipelineLayout pipelinelayout;
+static VkDescriptorPool descriptorpools[2];
+static VkDescriptorSet sets[2];
+static VkShaderModule modules[2];
+/* By colour mode, then untextured or textured */
+static VkPipeline pipelines[2 * COLOUR_COUNT];
+static VkBuffer uniformbuffer, meshbuffer;
+static VkDeviceMemory uniformmemory, meshmemory;
+static unsigned char *uniformdata;
+static VkCommandPool commandpool;
+static VkCommandBuffer commandbuffer;
+static VkFence fence;
+static VkQueryPool querypool;
+
+/* Function implementations */
+
+void *
+readfile(const char *filename, size_t *size)
+{
+    void *data;
+    long end = 0;
+    FILE *f;
+
+    if ((f = fopen(filename, "rb")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+    if (fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) != 0)
+	terminate("Error on sizing file %s.\n", filename);
+    *size = (size_t) end;
+    /* malloc() aligns enough for the SPIR-V and the arguments */
+    if ((data = malloc(*size)) == NULL)
+	terminate("Failed to allocate %zu bytes.\n", *size);
+    if (fread(data, 1, *size, f) != *size)
+	terminate("Error reading file %s.\n", filename);
+    fclose(f);
+
+    return data;
+}
+
+/* Checks every command once so replaying trusts them */
+void
+parse(const unsigned char *data, size_t size)
+{
+    const unsigned char *p, *args, *end = data + size;
+    const CsHeader *h = (const CsHeader *) data;
+    Frame *f = NULL;
+    CsCommand c;
+    uint32_t n = 0, resource;
+
+    if (size < sizeof(CsHeader) || memcmp(h->magic, "CMDS", 4) != 0 ||
+	    h->version != CS_VERSION)
+	terminate("Not a version %u command stream.\n", CS_VERSION);
+    if (h->vertexsize != sizeof(MeshVertex) ||
+	    h->constantsize != sizeof(DrawConstants) ||
+	    h->keysize != sizeof(PipelineKey))
+	terminate("Command stream is from an incompatible build.\n");
+    if ((framecount = h->framecount) == 0)
+	terminate("Command stream has no frames, was it cut short?\n");
+    if ((frames = (Frame *) calloc(framecount, sizeof(Frame))) == NULL)
+	terminate("Failed to allocate %u frames.\n", framecount);
+
+    for (p = data + sizeof(CsHeader); p < end; p = args + c.size) {
+	if ((size_t) (end - p) < sizeof c)
+	    terminate("Command stream is truncated.\n");
+	memcpy(&c, p, sizeof c);
+	args = p + sizeof c;
+	if (c.op >= CS_OPCOUNT || c.size % 4 != 0 ||
+		c.size > (size_t) (end - args) ||
+		(argsizes[c.op] != VARIABLE && c.size != argsizes[c.op]))
+	    terminate("Bad command at offset %zu.\n", (size_t) (p - data));
+	/* The resources come first, everything else is within a frame */
+	resource = c.op == CS_SHADER || c.op == CS_MESH;
+	if (resource ? f != NULL || n > 0 :
+		(f == NULL) != (c.op == CS_BEGINFRAME))
+	    terminate("Command %u out of place at offset %zu.\n", c.op,
+		    (size_t) (p - data));
+
+	if (c.op == CS_BEGINFRAME) {
+	    if (n == framecount)
+		terminate("Command stream has more than %u frames.\n",
+			framecount);
+	    f = &frames[n];
+	    f->begin = p;
+	    memcpy(&f->number, args, sizeof f->number);
+	}
+	if (!checkcommand(&c, args, f))
+	    terminate("Bad command %u at offset %zu.\n", c.op,
+		    (size_t) (p - data));
+	if (c.op == CS_ENDFRAME) {
+	    f->end = args;
+	    f = NULL;
+	    n++;
+	}
+    }
+
+    if (n != framecount || f != NULL)
+	terminate("Command stream has %u of %u frames.\n", n, framecount);
+    if (shadercode[0] == NULL || shadercode[1] == NULL ||
+	    vertices == NULL || format == VK_FORMAT_UNDEFINED)
+	terminate("Command stream is missing its shaders, mesh or pass.\n");
+}
+
+/* The arguments of one command against the resources and the state before
+ * it. Draws are only in a pass with a pipeline bound, and only sample
+ * textures captured before them. */
+uint32_t
+checkcommand(const CsCommand *c, const unsigned char *args, Frame *f)
+{
+    static uint32_t inpass, bound;
+    uint32_t stage, i;
+    DrawConstants dc;
+    CsTexture texture;
+    PipelineKey key;
+    CsPass pass;
+    CsDraw draw;
+
+    switch (c->op) {
+    case CS_SHADER:
+	memcpy(&stage, args, sizeof stage);
+	i = stage == VK_SHADER_STAGE_VERTEX_BIT ? 0 :
+	    stage == VK_SHADER_STAGE_FRAGMENT_BIT ? 1 : 2;
+	if (i == 2 || c->size <= sizeof stage)
+	    return 0;
+	shadercode[i] = (const uint32_t *) (args + sizeof stage);
+	shadersize[i] = c->size - sizeof stage;
+	return 1;
+    case CS_MESH:
+	if (c->size < sizeof mesh)
+	    return 0;
+	memcpy(&mesh, args, sizeof mesh);
+	if (c->size != sizeof mesh + (uint64_t) mesh.vertexcount *
+		sizeof(MeshVertex) + (uint64_t) mesh.indexcount *
+		sizeof(uint32_t) || mesh.vertexcount == 0)
+	    return 0;
+	vertices = (const MeshVertex *) (args + sizeof mesh);
+	indices = (const uint32_t *) (vertices + mesh.vertexcount);
+	for (i = 0; i < mesh.indexcount; i++)
+	    if (indices[i] >= mesh.vertexcount)
+		return 0;
+	return 1;
+    case CS_TEXTURE:
+	if (inpass || c->size < sizeof texture)
+	    return 0;
+	memcpy(&texture, args, sizeof texture);
+	if (texture.handle >= BINDLESSCOUNT ||
+		textures[texture.handle].data != NULL ||
+		!checktexture(&texture, c->size - sizeof texture))
+	    return 0;
+	textures[texture.handle].info = texture;
+	textures[texture.handle].data = args + sizeof texture;
+	return 1;
+    case CS_BEGINPASS:
+	memcpy(&pass, args, sizeof pass);
+	if (inpass || vertices == NULL || pass.extent.width == 0 ||
+		pass.extent.height == 0 ||
+		pass.extent.width > pass.target.width ||
+		pass.extent.height > pass.target.height ||
+		(format != VK_FORMAT_UNDEFINED && pass.format != format))
+	    return 0;
+	/* Drawn into the largest target the frames had */
+	format = pass.format;
+	if (pass.target.width > targetextent.width)
+	    targetextent.width = pass.target.width;
+	if (pass.target.height > targetextent.height)
+	    targetextent.height = pass.target.height;
+	inpass = 1;
+	bound = 0;
+	return 1;
+    case CS_BINDPIPELINE:
+	memcpy(&key, args, sizeof key);
+	bound = 1;
+	return inpass && key.colourmode < COLOUR_COUNT &&
+	    key.textured <= VK_TRUE;
+    case CS_PUSHCONSTANTS:
+	/* The renderer draws with no buffer, buffers aren't captured */
+	memcpy(&dc, args, sizeof dc);
+	return inpass && dc.buffer == NOHANDLE && (dc.texture == NOHANDLE ||
+		(dc.texture < BINDLESSCOUNT &&
+		 textures[dc.texture].data != NULL));
+    case CS_DRAWINDEXED:
+	memcpy(&draw, args, sizeof draw);
+	f->draws++;
+	return inpass && bound && (uint64_t) draw.firstindex +
+	    draw.indexcount <= mesh.indexcount;
+    case CS_ENDPASS:
+	i = inpass;
+	inpass = 0;
+	return i;
+    case CS_UNIFORMS:
+	return c->size <= UNIFORMSIZE;
+    case CS_ENDFRAME:
+	return !inpass;
+    default:
+	return 1;
+    }
+}
+
+uint64_t
+levelsize(const CsTexture *t, uint32_t level)
+{
+    uint32_t w = t->width >> level > 0 ? t->width >> level : 1;
+    uint32_t h = t->height >> level > 0 ? t->height >> level : 1;
+
+    return (uint64_t) ((w + t->blockwidth - 1) / t->blockwidth) *
+	((h + t->blockheight - 1) / t->blockheight) * t->blockbytes;
+}
+
+/* A plain 2D chain of levels filling the size after the CsTexture. The
+ * format is checked against the device once there is one. */
+uint32_t
+checktexture(const CsTexture *t, uint32_t size)
+{
+    uint64_t total = 0;
+    uint32_t maxlevels, i;
+
+    if (t->width == 0 || t->height == 0 || t->levelcount == 0 ||
+	    t->blockwidth == 0 || t->blockheight == 0 ||
+	    t->blockbytes == 0 || t->blockbytes % 4 != 0)
+	return 0;
+    for (maxlevels = 1; (t->width | t->height) >> maxlevels; maxlevels++)
+	;
+    if (t->levelcount > maxlevels)
+	return 0;
+    for (i = 0; i < t->levelcount; i++)
+	total += levelsize(t, i);
+
+    return total == size;
+}
+
+uint32_t
+findmemorytype(uint32_t typefilter, VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties mp;
+    uint32_t i;
+
+    vkGetPhysicalDeviceMemoryProperties(physicaldevice, &mp);
+    for (i = 0; i < mp.memoryTypeCount; i++)
+	if ((typefilter & (1 << i)) &&
+		(mp.memoryTypes[i].propertyFlags & properties) == properties)
+	    return i;
+    terminate("Failed to find suitable memory type.");
+
+    return 0;
+}
+
+void
+createbuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties, VkBuffer *buffer,
+	VkDeviceMemory *memory)
+{
+    VkBufferCreateInfo bci = {
+	.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.size = size,
+	.usage = usage,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    VkMemoryRequirements mr;
+
+    if (vkCreateBuffer(device, &bci, NULL, buffer) != VK_SUCCESS)
+	terminate("Failed to create buffer.");
+    vkGetBufferMemoryRequirements(device, *buffer, &mr);
+    mai.allocationSize = mr.size;
+    mai.memoryTypeIndex = findmemorytype(mr.memoryTypeBits, properties);
+    if (vkAllocateMemory(device, &mai, NULL, memory) != VK_SUCCESS ||
+	    vkBindBufferMemory(device, *buffer, *memory, 0) != VK_SUCCESS)
+	terminate("Failed to allocate buffer memory.");
+}
+
+void
+createinstance(void)
+{
+    VkApplicationInfo ai = {
+	.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+	.pNext = NULL,
+	.pApplicationName = "replay",
+	.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+	.pEngineName = "No Engine",
+	.engineVersion = VK_MAKE_VERSION(1, 0, 0),
+	.apiVersion = VK_API_VERSION_1_1
+    };
+    VkInstanceCreateInfo ci = {
+	.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.pApplicationInfo = &ai,
+	.enabledLayerCount = 0,
+	.ppEnabledLayerNames = NULL,
+	.enabledExtensionCount = 0,
+	.ppEnabledExtensionNames = NULL
+    };
+    VkPhysicalDeviceProperties pdp;
+    uint32_t count = 1;
+
+    if (vkCreateInstance(&ci, NULL, &instance) != VK_SUCCESS)
+	terminate("Failed to create instance.");
+
+    /* VK_INCOMPLETE with more than one */
+    vkEnumeratePhysicalDevices(instance, &count, &physicaldevice);
+    if (count == 0 || physicaldevice == VK_NULL_HANDLE)
+	terminate("Failed to find a GPU with Vulkan support.");
+    vkGetPhysicalDeviceProperties(physicaldevice, &pdp);
+    timestampperiod = pdp.limits.timestampPeriod;
+    fprintf(stderr, "Device: %s\n", pdp.deviceName);
+}
+
+/* With what the bindless table needs, as the renderer does */
+void
+createdevice(void)
+{
+    const char *exts[] = {
+	VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+	VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
+    };
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT difs = {
+	.sType =
+	    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+	.pNext = NULL,
+	.runtimeDescriptorArray = VK_TRUE,
+	.descriptorBindingPartiallyBound = VK_TRUE,
+	.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+	.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+	.descriptorBindingUpdateUnusedWhilePending = VK_TRUE
+    };
+    VkPhysicalDeviceFeatures pdf = { 0 };
+    float prio = 1.0f;
+    VkDeviceQueueCreateInfo dqci = {
+	.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.queueFamilyIndex = 0,
+	.queueCount = 1,
+	.pQueuePriorities = &prio
+    };
+    VkDeviceCreateInfo dci = {
+	.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+	.pNext = &difs,
+	.flags = 0,
+	.queueCreateInfoCount = 1,
+	.pQueueCreateInfos = &dqci,
+	.enabledLayerCount = 0,
+	.ppEnabledLayerNames = NULL,
+	.enabledExtensionCount = COUNT(exts),
+	.ppEnabledExtensionNames = exts,
+	.pEnabledFeatures = &pdf
+    };
+    VkQueueFamilyProperties *qfps;
+    uint32_t count, i;
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &count, NULL);
+    if ((qfps = (VkQueueFamilyProperties *) malloc(count *
+		    sizeof(VkQueueFamilyProperties))) == NULL)
+	terminate("Failed to allocate queue families.");
+    vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &count, qfps);
+    for (i = 0; i < count; i++)
+	if (qfps[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+	    break;
+    if (i == count)
+	terminate("Failed to find a graphics queue.");
+    queuefamily = dqci.queueFamilyIndex = i;
+    /* No timestamps leaves the GPU times at zero */
+    if (qfps[i].timestampValidBits > 0)
+	timestampmask = qfps[i].timestampValidBits == 64 ? UINT64_MAX :
+	    ((uint64_t) 1 << qfps[i].timestampValidBits) - 1;
+    free(qfps);
+
+    if (vkCreateDevice(physicaldevice, &dci, NULL, &device) != VK_SUCCESS)
+	terminate("Failed to create logical device.");
+    vkGetDeviceQueue(device, queuefamily, 0, &queue);
+}
+
+/* The scene's colour attachment alone, the post-processing isn't captured.
+ * Cleared by every pass so its contents needn't be kept. */
+void
+createtarget(void)
+{
+    VkAttachmentDescription ad = {
+	.flags = 0,
+	.format = format,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+	.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+    VkAttachmentReference ar = {
+	.attachment = 0,
+	.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+    VkSubpassDescription sd = {
+	.flags = 0,
+	.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+	.inputAttachmentCount = 0,
+	.pInputAttachments = NULL,
+	.colorAttachmentCount = 1,
+	.pColorAttachments = &ar,
+	.pResolveAttachments = NULL,
+	.pDepthStencilAttachment = NULL,
+	.preserveAttachmentCount = 0,
+	.pPreserveAttachments = NULL
+    };
+    VkRenderPassCreateInfo rpci = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.attachmentCount = 1,
+	.pAttachments = &ad,
+	.subpassCount = 1,
+	.pSubpasses = &sd,
+	.dependencyCount = 0,
+	.pDependencies = NULL
+    };
+    VkImageCreateInfo ici = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.imageType = VK_IMAGE_TYPE_2D,
+	.format = format,
+	.extent = { targetextent.width, targetextent.height, 1 },
+	.mipLevels = 1,
+	.arrayLayers = 1,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.tiling = VK_IMAGE_TILING_OPTIMAL,
+	.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    VkImageViewCreateInfo ivci = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.image = VK_NULL_HANDLE,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = format,
+	.components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    VkFramebufferCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.renderPass = VK_NULL_HANDLE,
+	.attachmentCount = 1,
+	.pAttachments = &targetview,
+	.width = targetextent.width,
+	.height = targetextent.height,
+	.layers = 1
+    };
+    VkFormatProperties fp;
+    VkMemoryRequirements mr;
+
+    vkGetPhysicalDeviceFormatProperties(physicaldevice, format, &fp);
+    if (!(fp.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+	terminate("Captured format %d not supported by the GPU.", format);
+
+    if (vkCreateRenderPass(device, &rpci, NULL, &renderpass) != VK_SUCCESS)
+	terminate("Failed to create render pass.");
+    if (vkCreateImage(device, &ici, NULL, &targetimage) != VK_SUCCESS)
+	terminate("Failed to create render target.");
+    vkGetImageMemoryRequirements(device, targetimage, &mr);
+    mai.allocationSize = mr.size;
+    mai.memoryTypeIndex = findmemorytype(mr.memoryTypeBits,
+	    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (vkAllocateMemory(device, &mai, NULL, &targetmemory) != VK_SUCCESS ||
+	    vkBindImageMemory(device, targetimage, targetmemory, 0) !=
+	    VK_SUCCESS)
+	terminate("Failed to allocate render target memory.");
+    ivci.image = targetimage;
+    if (vkCreateImageView(device, &ivci, NULL, &targetview) != VK_SUCCESS)
+	terminate("Failed to create render target view.");
+    fci.renderPass = renderpass;
+    if (vkCreateFramebuffer(device, &fci, NULL, &framebuffer) != VK_SUCCESS)
+	terminate("Failed to create framebuffer.");
+}
+
+/* The per-frame uniforms and the bindless table, in the renderer's sets.
+ * Only the captured textures are written to the table, there are no
+ * buffers. */
+void
+createlayouts(void)
+{
+    VkSamplerCreateInfo sci = {
+	.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.magFilter = VK_FILTER_LINEAR,
+	.minFilter = VK_FILTER_LINEAR,
+	.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+	.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.mipLodBias = 0.0f,
+	.anisotropyEnable = VK_FALSE,
+	.maxAnisotropy = 1.0f,
+	.compareEnable = VK_FALSE,
+	.compareOp = VK_COMPARE_OP_ALWAYS,
+	.minLod = 0.0f,
+	.maxLod = 1000.0f,
+	.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+	.unnormalizedCoordinates = VK_FALSE
+    };
+    VkDescriptorSetLayoutBinding uniformbinding = {
+	.binding = 0,
+	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.descriptorCount = 1,
+	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+	.pImmutableSamplers = NULL
+    };
+    VkDescriptorSetLayoutBinding bindlessbindings[] = {
+	{
+	    .binding = 0,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+	    .descriptorCount = BINDLESSCOUNT,
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = NULL
+	},
+	{
+	    .binding = 1,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+	    .descriptorCount = 1,
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = &sampler
+	},
+	{
+	    .binding = 2,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+	    .descriptorCount = BINDLESSCOUNT,
+	    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+		VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = NULL
+	}
+    };
+    VkDescriptorBindingFlags bindingflags[] = {
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+	0,
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT dslbfci = {
+	.sType =
+	   VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+	.pNext = NULL,
+	.bindingCount = COUNT(bindingflags),
+	.pBindingFlags = bindingflags
+    };
+    VkDescriptorSetLayoutCreateInfo dslcis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .bindingCount = 1,
+	    .pBindings = &uniformbinding
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	    .pNext = &dslbfci,
+	    .flags =
+		VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+	    .bindingCount = COUNT(bindlessbindings),
+	    .pBindings = bindlessbindings
+	}
+    };
+    VkPushConstantRange pcr = {
+	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+	.offset = 0,
+	.size = sizeof(DrawConstants)
+    };
+    VkPipelineLayoutCreateInfo plci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.setLayoutCount = COUNT(setlayouts),
+	.pSetLayouts = setlayouts,
+	.pushConstantRangeCount = 1,
+	.pPushConstantRanges = &pcr
+    };
+    VkDescriptorPoolSize uniformsize = {
+	VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1
+    };
+    VkDescriptorPoolSize bindlesssizes[] = {
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,  BINDLESSCOUNT },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER,        1 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, BINDLESSCOUNT }
+    };
+    VkDescriptorPoolCreateInfo dpcis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .maxSets = 1,
+	    .poolSizeCount = 1,
+	    .pPoolSizes = &uniformsize
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+	    .maxSets = 1,
+	    .poolSizeCount = COUNT(bindlesssizes),
+	    .pPoolSizes = bindlesssizes
+	}
+    };
+    VkDescriptorSetAllocateInfo dsai = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+	.pNext = NULL,
+	.descriptorPool = VK_NULL_HANDLE,
+	.descriptorSetCount = 1,
+	.pSetLayouts = NULL
+    };
+    uint32_t i;
+
+    if (vkCreateSampler(device, &sci, NULL, &sampler) != VK_SUCCESS)
+	terminate("Failed to create sampler.");
+    for (i = 0; i < COUNT(setlayouts); i++) {
+	if (vkCreateDescriptorSetLayout(device, &dslcis[i], NULL,
+		    &setlayouts[i]) != VK_SUCCESS)
+	    terminate("Failed to create descriptor set layout.");
+	if (vkCreateDescriptorPool(device, &dpcis[i], NULL,
+		    &descriptorpools[i]) != VK_SUCCESS)
+	    terminate("Failed to create descriptor pool.");
+	dsai.descriptorPool = descriptorpools[i];
+	dsai.pSetLayouts = &setlayouts[i];
+	if (vkAllocateDescriptorSets(device, &dsai, &sets[i]) != VK_SUCCESS)
+	    terminate("Failed to allocate descriptor sets.");
+    }
+    if (vkCreatePipelineLayout(device, &plci, NULL, &pipelinelayout) !=
+	    VK_SUCCESS)
+	terminate("Failed to create pipeline layout.");
+}
+
+void
+createcommands(void)
+{
+    VkCommandPoolCreateInfo cpci = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+	.queueFamilyIndex = queuefamily
+    };
+    VkCommandBufferAllocateInfo cbai = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+	.pNext = NULL,
+	.commandPool = VK_NULL_HANDLE,
+	.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+	.commandBufferCount = 1
+    };
+    VkFenceCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0
+    };
+    VkQueryPoolCreateInfo qpci = {
+	.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.queryType = VK_QUERY_TYPE_TIMESTAMP,
+	.queryCount = 2,
+	.pipelineStatistics = 0
+    };
+
+    if (vkCreateCommandPool(device, &cpci, NULL, &commandpool) != VK_SUCCESS)
+	terminate("Failed to create command pool.");
+    cbai.commandPool = commandpool;
+    if (vkAllocateCommandBuffers(device, &cbai, &commandbuffer) != VK_SUCCESS)
+	terminate("Failed to allocate command buffer.");
+    if (vkCreateFence(device, &fci, NULL, &fence) != VK_SUCCESS)
+	terminate("Failed to create fence.");
+    if (timestampmask != 0 && vkCreateQueryPool(device, &qpci, NULL,
+		&querypool) != VK_SUCCESS)
+	terminate("Failed to create query pool.");
+}
+
+/* The mesh goes through staging to device local memory as the renderer's
+ * does, so vertex fetch costs the same */
+void
+createbuffers(void)
+{
+    VkDeviceSize vsize = mesh.vertexcount * sizeof(MeshVertex);
+    VkDeviceSize isize = mesh.indexcount * sizeof(uint32_t);
+    VkBufferCopy copy = {
+	.srcOffset = 0,
+	.dstOffset = 0,
+	.size = vsize + isize
+    };
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	.pInheritanceInfo = NULL
+    };
+    VkSubmitInfo si = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.pNext = NULL,
+	.waitSemaphoreCount = 0,
+	.pWaitSemaphores = NULL,
+	.pWaitDstStageMask = NULL,
+	.commandBufferCount = 1,
+	.pCommandBuffers = &commandbuffer,
+	.signalSemaphoreCount = 0,
+	.pSignalSemaphores = NULL
+    };
+    VkDescriptorBufferInfo dbi = {
+	.buffer = VK_NULL_HANDLE,
+	.offset = 0,
+	.range = UNIFORMSIZE
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = VK_NULL_HANDLE,
+	.dstBinding = 0,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.pImageInfo = NULL,
+	.pBufferInfo = &dbi,
+	.pTexelBufferView = NULL
+    };
+    VkBuffer staging;
+    VkDeviceMemory stagingmemory;
+    unsigned char *mapped;
+
+    /* Every frame is waited for so one slot will do */
+    createbuffer(UNIFORMSIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformbuffer,
+	    &uniformmemory);
+    if (vkMapMemory(device, uniformmemory, 0, VK_WHOLE_SIZE, 0,
+		(void **) &uniformdata) != VK_SUCCESS)
+	terminate("Failed to map uniform buffer.");
+    memset(uniformdata, 0, UNIFORMSIZE);
+    dbi.buffer = uniformbuffer;
+    wds.dstSet = sets[0];
+    vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
+
+    createbuffer(vsize + isize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+	    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &meshbuffer, &meshmemory);
+    createbuffer(vsize + isize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging, &stagingmemory);
+    if (vkMapMemory(device, stagingmemory, 0, VK_WHOLE_SIZE, 0,
+		(void **) &mapped) != VK_SUCCESS)
+	terminate("Failed to map mesh staging buffer.");
+    memcpy(mapped, vertices, vsize);
+    memcpy(mapped + vsize, indices, isize);
+    vkUnmapMemory(device, stagingmemory);
+
+    /* The fence wait makes the copy visible to the frames */
+    vkBeginCommandBuffer(commandbuffer, &cbbi);
+    vkCmdCopyBuffer(commandbuffer, staging, meshbuffer, 1, &copy);
+    if (vkEndCommandBuffer(commandbuffer) != VK_SUCCESS ||
+	    vkQueueSubmit(queue, 1, &si, fence) != VK_SUCCESS ||
+	    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) !=
+	    VK_SUCCESS)
+	terminate("Failed to upload mesh.");
+    vkResetFences(device, 1, &fence);
+    vkDestroyBuffer(device, staging, NULL);
+    vkFreeMemory(device, stagingmemory, NULL);
+}
+
+/* Every level is uploaded through one staging buffer and the texture
+ * written to the table at its captured handle, before any frame */
+void
+createtextures(void)
+{
+    VkImageCreateInfo ici = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.imageType = VK_IMAGE_TYPE_2D,
+	.format = VK_FORMAT_UNDEFINED,
+	.extent = { 0, 0, 1 },
+	.mipLevels = 0,
+	.arrayLayers = 1,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.tiling = VK_IMAGE_TILING_OPTIMAL,
+	.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+    VkImageViewCreateInfo ivci = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.image = VK_NULL_HANDLE,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = VK_FORMAT_UNDEFINED,
+	.components.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.components.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 0,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    VkImageMemoryBarrier imb = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	.pNext = NULL,
+	.srcAccessMask = 0,
+	.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.image = VK_NULL_HANDLE,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 0,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    VkBufferImageCopy region = {
+	.bufferOffset = 0,
+	.bufferRowLength = 0,
+	.bufferImageHeight = 0,
+	.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+	.imageSubresource.mipLevel = 0,
+	.imageSubresource.baseArrayLayer = 0,
+	.imageSubresource.layerCount = 1,
+	.imageOffset = { 0, 0, 0 },
+	.imageExtent = { 0, 0, 1 }
+    };
+    VkDescriptorImageInfo dii = {
+	.sampler = VK_NULL_HANDLE,
+	.imageView = VK_NULL_HANDLE,
+	.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = VK_NULL_HANDLE,
+	.dstBinding = 0,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+	.pImageInfo = &dii,
+	.pBufferInfo = NULL,
+	.pTexelBufferView = NULL
+    };
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	.pInheritanceInfo = NULL
+    };
+    VkSubmitInfo si = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.pNext = NULL,
+	.waitSemaphoreCount = 0,
+	.pWaitSemaphores = NULL,
+	.pWaitDstStageMask = NULL,
+	.commandBufferCount = 1,
+	.pCommandBuffers = &commandbuffer,
+	.signalSemaphoreCount = 0,
+	.pSignalSemaphores = NULL
+    };
+    VkBuffer staging;
+    VkDeviceMemory stagingmemory;
+    VkMemoryRequirements mr;
+    VkFormatProperties fp;
+    VkDeviceSize size = 0, length;
+    const unsigned char *src;
+    unsigned char *mapped;
+    uint32_t i, level;
+    Texture *t;
+
+    for (i = 0; i < BINDLESSCOUNT; i++)
+	for (level = 0; textures[i].data != NULL &&
+		level < textures[i].info.levelcount; level++)
+	    size += ALIGN(levelsize(&textures[i].info, level), STAGINGALIGN);
+    if (size == 0)
+	return;
+
+    createbuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging, &stagingmemory);
+    if (vkMapMemory(device, stagingmemory, 0, VK_WHOLE_SIZE, 0,
+		(void **) &mapped) != VK_SUCCESS)
+	terminate("Failed to map texture staging buffer.");
+    vkBeginCommandBuffer(commandbuffer, &cbbi);
+
+    for (i = 0; i < BINDLESSCOUNT; i++) {
+	t = &textures[i];
+	if (t->data == NULL)
+	    continue;
+
+	vkGetPhysicalDeviceFormatProperties(physicaldevice, t->info.format,
+		&fp);
+	if (!(fp.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+	    terminate("Captured texture format %d not supported by the GPU.",
+		    t->info.format);
+	ici.format = ivci.format = t->info.format;
+	ici.extent.width = t->info.width;
+	ici.extent.height = t->info.height;
+	ici.mipLevels = t->info.levelcount;
+	if (vkCreateImage(device, &ici, NULL, &t->image) != VK_SUCCESS)
+	    terminate("Failed to create texture image.");
+	vkGetImageMemoryRequirements(device, t->image, &mr);
+	mai.allocationSize = mr.size;
+	mai.memoryTypeIndex = findmemorytype(mr.memoryTypeBits,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (vkAllocateMemory(device, &mai, NULL, &t->memory) != VK_SUCCESS ||
+		vkBindImageMemory(device, t->image, t->memory, 0) !=
+		VK_SUCCESS)
+	    terminate("Failed to allocate texture memory.");
+	ivci.image = t->image;
+	ivci.subresourceRange.levelCount = t->info.levelcount;
+	if (vkCreateImageView(device, &ivci, NULL, &t->view) != VK_SUCCESS)
+	    terminate("Failed to create texture image view.");
+
+	imb.srcAccessMask = 0;
+	imb.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imb.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imb.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imb.image = t->image;
+	imb.subresourceRange.levelCount = t->info.levelcount;
+	vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imb);
+	src = t->data;
+	for (level = 0; level < t->info.levelcount; level++) {
+	    length = levelsize(&t->info, level);
+	    memcpy(mapped + region.bufferOffset, src, length);
+	    src += length;
+	    region.imageSubresource.mipLevel = level;
+	    region.imageExtent.width = t->info.width >> level > 0 ?
+		t->info.width >> level : 1;
+	    region.imageExtent.height = t->info.height >> level > 0 ?
+		t->info.height >> level : 1;
+	    vkCmdCopyBufferToImage(commandbuffer, staging, t->image,
+		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	    region.bufferOffset += ALIGN(length, STAGINGALIGN);
+	}
+	imb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	imb.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imb.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier(commandbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1,
+		&imb);
+
+	dii.imageView = t->view;
+	wds.dstSet = sets[1];
+	wds.dstArrayElement = i;
+	vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
+    }
+
+    /* The fence wait makes the copies visible to the frames */
+    if (vkEndCommandBuffer(commandbuffer) != VK_SUCCESS ||
+	    vkQueueSubmit(queue, 1, &si, fence) != VK_SUCCESS ||
+	    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) !=
+	    VK_SUCCESS)
+	terminate("Failed to upload textures.");
+    vkResetFences(device, 1, &fence);
+    vkUnmapMemory(device, stagingmemory);
+    vkDestroyBuffer(device, staging, NULL);
+    vkFreeMemory(device, stagingmemory, NULL);
+}
+
+/* From the captured SPIR-V, not whatever is in shaders/ now */
+void
+createmodules(void)
+{
+    VkShaderModuleCreateInfo ci = {
+	.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.codeSize = 0,
+	.pCode = NULL
+    };
+    uint32_t i;
+
+    for (i = 0; i < COUNT(modules); i++) {
+	ci.codeSize = shadersize[i];
+	ci.pCode = shadercode[i];
+	if (vkCreateShaderModule(device, &ci, NULL, &modules[i]) !=
+		VK_SUCCESS)
+	    terminate("Failed to create shader module.");
+    }
+}
+
+/* From the renderer's scene pipeline state in pipeline.h, created on first
+ * use in the warm up */
+VkPipeline
+getpipeline(const PipelineKey *key)
+{
+    uint32_t i = key->colourmode * 2 + key->textured;
+    VkSpecializationInfo si = {
+	.mapEntryCount = COUNT(pipespecentries),
+	.pMapEntries = pipespecentries,
+	.dataSize = sizeof *key,
+	.pData = key
+    };
+    VkPipelineShaderStageCreateInfo psscis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .stage = VK_SHADER_STAGE_VERTEX_BIT,
+	    .module = modules[0],
+	    .pName = "main",
+	    .pSpecializationInfo = NULL
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .pNext = NULL,
+	    .flags = 0,
+	    .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .module = modules[1],
+	    .pName = "main",
+	    .pSpecializationInfo = &si
+	}
+    };
+    VkGraphicsPipelineCreateInfo gpci = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.stageCount = COUNT(psscis),
+	.pStages = psscis,
+	.pVertexInputState = &pipevertexinput,
+	.pInputAssemblyState = &pipeinputassembly,
+	.pTessellationState = NULL,
+	.pViewportState = &pipeviewport,
+	.pRasterizationState = &piperasterisation,
+	.pMultisampleState = &pipemultisample,
+	.pDepthStencilState = NULL,
+	.pColorBlendState = &pipeblend,
+	.pDynamicState = &pipedynamic,
+	.layout = pipelinelayout,
+	.renderPass = renderpass,
+	.subpass = 0,
+	.basePipelineHandle = VK_NULL_HANDLE,
+	.basePipelineIndex = -1
+    };
+
+    if (pipelines[i] == VK_NULL_HANDLE &&
+	    vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci, NULL,
+		&pipelines[i]) != VK_SUCCESS)
+	terminate("Failed to create graphics pipeline.");
+
+    return pipelines[i];
+}
+
+void
+destroyall(void)
+{
+    uint32_t i;
+
+    vkDeviceWaitIdle(device);
+    if (querypool != VK_NULL_HANDLE)
+	vkDestroyQueryPool(device, querypool, NULL);
+    vkDestroyFence(device, fence, NULL);
+    vkDestroyCommandPool(device, commandpool, NULL);
+    vkDestroyBuffer(device, meshbuffer, NULL);
+    vkFreeMemory(device, meshmemory, NULL);
+    vkUnmapMemory(device, uniformmemory);
+    vkDestroyBuffer(device, uniformbuffer, NULL);
+    vkFreeMemory(device, uniformmemory, NULL);
+    for (i = 0; i < BINDLESSCOUNT; i++) {
+	if (textures[i].data == NULL)
+	    continue;
+	vkDestroyImageView(device, textures[i].view, NULL);
+	vkDestroyImage(device, textures[i].image, NULL);
+	vkFreeMemory(device, textures[i].memory, NULL);
+    }
+    for (i = 0; i < COUNT(pipelines); i++)
+	vkDestroyPipeline(device, pipelines[i], NULL);
+    for (i = 0; i < COUNT(modules); i++)
+	vkDestroyShaderModule(device, modules[i], NULL);
+    vkDestroyPipelineLayout(device, pipelinelayout, NULL);
+    for (i = 0; i < COUNT(setlayouts); i++) {
+	vkDestroyDescriptorPool(device, descriptorpools[i], NULL);
+	vkDestroyDescriptorSetLayout(device, setlayouts[i], NULL);
+    }
+    vkDestroySampler(device, sampler, NULL);
+    vkDestroyFramebuffer(device, framebuffer, NULL);
+    vkDestroyImageView(device, targetview, NULL);
+    vkDestroyImage(device, targetimage, NULL);
+    vkFreeMemory(device, targetmemory, NULL);
+    vkDestroyRenderPass(device, renderpass, NULL);
+    vkDestroyDevice(device, NULL);
+    vkDestroyInstance(instance, NULL);
+}
+
+/* Records the frame's commands as drawscene() did, then submits it and
+ * waits. The times are in seconds: recording, GPU and submit to fence. */
+void
+replayframe(const Frame *f, double *t)
+{
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	.pInheritanceInfo = NULL
+    };
+    VkClearValue clearcolour;
+    VkRenderPassBeginInfo rpbi = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+	.pNext = NULL,
+	.renderPass = renderpass,
+	.framebuffer = framebuffer,
+	.renderArea.offset = { 0, 0 },
+	.renderArea.extent = { 0, 0 },
+	.clearValueCount = 1,
+	.pClearValues = &clearcolour
+    };
+    VkViewport viewport = {
+	.x = 0.0f,
+	.y = 0.0f,
+	.width = 0.0f,
+	.height = 0.0f,
+	.minDepth = 0.0f,
+	.maxDepth = 1.0f
+    };
+    VkRect2D scissor = {
+	.offset = { 0, 0 },
+	.extent = { 0, 0 }
+    };
+    VkSubmitInfo si = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.pNext = NULL,
+	.waitSemaphoreCount = 0,
+	.pWaitSemaphores = NULL,
+	.pWaitDstStageMask = NULL,
+	.commandBufferCount = 1,
+	.pCommandBuffers = &commandbuffer,
+	.signalSemaphoreCount = 0,
+	.pSignalSemaphores = NULL
+    };
+    const unsigned char *p, *args;
+    uint32_t dynamicoffset = 0;
+    VkDeviceSize zero = 0;
+    uint64_t ts[2];
+    PipelineKey key;
+    CsCommand c;
+    CsPass pass;
+    CsDraw draw;
+    double start;
+
+    start = gettime();
+    vkResetCommandBuffer(commandbuffer, 0);
+    if (vkBeginCommandBuffer(commandbuffer, &cbbi) != VK_SUCCESS)
+	terminate("Failed to begin recording command buffer.");
+    if (querypool != VK_NULL_HANDLE) {
+	vkCmdResetQueryPool(commandbuffer, querypool, 0, 2);
+	vkCmdWriteTimestamp(commandbuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		querypool, 0);
+    }
+
+    for (p = f->begin; p < f->end; p = args + c.size) {
+	memcpy(&c, p, sizeof c);
+	args = p + sizeof c;
+	switch (c.op) {
+	case CS_BEGINPASS:
+	    memcpy(&pass, args, sizeof pass);
+	    memcpy(clearcolour.color.float32, pass.clear, sizeof pass.clear);
+	    rpbi.renderArea.extent = scissor.extent = pass.extent;
+	    viewport.width = (float) pass.extent.width;
+	    viewport.height = (float) pass.extent.height;
+	    vkCmdBeginRenderPass(commandbuffer, &rpbi,
+		    VK_SUBPASS_CONTENTS_INLINE);
+	    vkCmdSetViewport(commandbuffer, 0, 1, &viewport);
+	    vkCmdSetScissor(commandbuffer, 0, 1, &scissor);
+	    vkCmdBindDescriptorSets(commandbuffer,
+		    VK_PIPELINE_BIND_POINT_GRAPHICS, pipelinelayout, 0,
+		    COUNT(sets), sets, 1, &dynamicoffset);
+	    vkCmdBindVertexBuffers(commandbuffer, 0, 1, &meshbuffer, &zero);
+	    vkCmdBindIndexBuffer(commandbuffer, meshbuffer,
+		    mesh.vertexcount * sizeof(MeshVertex),
+		    VK_INDEX_TYPE_UINT32);
+	    break;
+	case CS_BINDPIPELINE:
+	    memcpy(&key, args, sizeof key);
+	    vkCmdBindPipeline(commandbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+		    getpipeline(&key));
+	    break;
+	case CS_PUSHCONSTANTS:
+	    vkCmdPushConstants(commandbuffer, pipelinelayout,
+		    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+		    0, sizeof(DrawConstants), args);
+	    break;
+	case CS_DRAWINDEXED:
+	    memcpy(&draw, args, sizeof draw);
+	    vkCmdDrawIndexed(commandbuffer, draw.indexcount,
+		    draw.instancecount, draw.firstindex, draw.vertexoffset,
+		    draw.firstinstance);
+	    break;
+	case CS_ENDPASS:
+	    vkCmdEndRenderPass(commandbuffer);
+	    break;
+	case CS_UNIFORMS:
+	    /* The last frame has been waited for */
+	    memcpy(uniformdata, args, c.size);
+	    break;
+	default:
+	    break;
+	}
+    }
+
+    if (querypool != VK_NULL_HANDLE)
+	vkCmdWriteTimestamp(commandbuffer,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, querypool, 1);
+    if (vkEndCommandBuffer(commandbuffer) != VK_SUCCESS)
+	terminate("Failed to record command buffer.");
+    t[0] = gettime() - start;
+
+    start = gettime();
+    if (vkQueueSubmit(queue, 1, &si, fence) != VK_SUCCESS)
+	terminate("Failed to submit draw command buffer.");
+    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+    t[2] = gettime() - start;
+    vkResetFences(device, 1, &fence);
+
+    t[1] = 0.0;
+    if (querypool != VK_NULL_HANDLE && vkGetQueryPoolResults(device,
+		querypool, 0, 2, sizeof ts, ts, sizeof ts[0],
+		VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+	t[1] = (double) ((ts[1] - ts[0]) & timestampmask) *
+	    timestampperiod * 1e-9;
+}
+
+void
+addtimes(Frame *f, const double *t, uint32_t run)
+{
+    uint32_t i;
+
+    for (i = 0; i < TIMES; i++) {
+	f->sum[i] += t[i];
+	if (run == 0 || t[i] < f->min[i])
+	    f->min[i] = t[i];
+    }
+}
+
+void
+printframe(const char *name, const Frame *f, uint32_t runs)
+{
+    uint32_t i;
+
+    printf("%s,%u", name, f->draws);
+    for (i = 0; i < TIMES; i++)
+	printf(",%.3f,%.3f", f->sum[i] / runs * 1e6, f->min[i] * 1e6);
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t runs = 10, run, i, j;
+    double t[TIMES], runtotal[TIMES];
+    char name[32];
+    Frame total;
+    void *data;
+    size_t size;
+
+    if (argc == 4 && strcmp(argv[1], "-n") == 0)
+	runs = (uint32_t) atoi(argv[2]);
+    if (!(argc == 2 || (argc == 4 && runs > 0 && runs <= MAXRUNS))) {
+	fprintf(stderr, "Usage: %s [-n runs] capture\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    data = readfile(argv[argc - 1], &size);
+    parse((const unsigned char *) data, size);
+
+    createinstance();
+    createdevice();
+    createtarget();
+    createlayouts();
+    createcommands();
+    createbuffers();
+    createtextures();
+    createmodules();
+    if (querypool == VK_NULL_HANDLE)
+	fprintf(stderr, "No timestamps on this queue, GPU times are zero.\n");
+
+    /* Creates the pipelines and warms the driver's caches */
+    for (i = 0; i < framecount; i++)
+	replayframe(&frames[i], t);
+
+    memset(&total, 0, sizeof total);
+    for (run = 0; run < runs; run++) {
+	memset(runtotal, 0, sizeof runtotal);
+	for (i = 0; i < framecount; i++) {
+	    replayframe(&frames[i], t);
+	    addtimes(&frames[i], t, run);
+	    for (j = 0; j < TIMES; j++)
+		runtotal[j] += t[j];
+	}
+	addtimes(&total, runtotal, run);
+    }
+
+    printf("frame,draws");
+    for (i = 0; i < TIMES; i++)
+	printf(",%s_mean_us,%s_min_us", timenames[i], timenames[i]);
+    printf("\n");
+    for (i = 0; i < framecount; i++) {
+	snprintf(name, sizeof name, "%llu",
+		(unsigned long long) frames[i].number);
+	printframe(name, &frames[i], runs);
+	total.draws += frames[i].draws;
+    }
+    printframe("total", &total, runs);
+
+    destroyall();
+    free(frames);
+    free(data);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/* Packs a mesh from meshpack and its instances into a scene file.
+ * The instances are read as lines of x y z radius, blank lines and lines
+ * starting with # are skipped. Without them the mesh is drawn once at the
+ * origin.
+ * Usage: scenepack input.mesh [instances.txt] output.scene
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mesh.h"
+#include "../scene.h"
+#include "../util.h"
+
+/* Macros */
+#define MAXLINE 256
+
+/* Function declarations */
+static void *readfile(const char *filename, size_t *size);
+static SceneInstance *readinstances(const char *filename, uint32_t *count);
+
+/* Function implementations */
+
+void *
+readfile(const char *filename, size_t *size)
+{
+    void *data;
+    long end = 0;
+    FILE *f;
+
+    if ((f = fopen(filename, "rb")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+    if (fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) != 0)
+	terminate("Error on sizing file %s.\n", filename);
+    *size = (size_t) end;
+    /* malloc() aligns enough for mesh_read() */
+    if ((data = malloc(*size)) == NULL)
+	terminate("Failed to allocate %zu bytes.\n", *size);
+    if (fread(data, 1, *size, f) != *size)
+	terminate("Error reading file %s.\n", filename);
+    fclose(f);
+
+    return data;
+}
+
+SceneInstance *
+readinstances(const char *filename, uint32_t *count)
+{
+    SceneInstance *instances = NULL, *in;
+    uint32_t capacity = 0, n = 0;
+    char line[MAXLINE], *p;
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL)
+	terminate("Could not open file %s.\n", filename);
+
+    while (fgets(line, sizeof line, f) != NULL) {
+	n++;
+	for (p = line; *p == ' ' || *p == '\t'; p++)
+	    ;
+	if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+	    continue;
+	if (*count == capacity) {
+	    capacity = capacity == 0 ? 1024 : 2 * capacity;
+	    if ((instances = (SceneInstance *) realloc(instances, capacity *
+			    sizeof(SceneInstance))) == NULL)
+		terminate("Failed to allocate %u instances.\n", capacity);
+	}
+	in = &instances[*count];
+	if (sscanf(p, "%f %f %f %f", &in->x, &in->y, &in->z, &in->radius) !=
+		4 || in->radius < 0.0f)
+	    terminate("Bad instance on line %u of %s.\n", n, filename);
+	(*count)++;
+    }
+
+    if (ferror(f))
+	terminate("Error reading file %s.\n", filename);
+    fclose(f);
+
+    return instances;
+}
+
+int
+main(int argc, char *argv[])
+{
+    SceneInstance *instances = NULL;
+    uint32_t count = 0;
+    void *data;
+    size_t size;
+    Mesh m;
+
+    if (argc != 3 && argc != 4) {
+	fprintf(stderr,
+		"Usage: scenepack input.mesh [instances.txt] output.scene\n");
+	return EXIT_FAILURE;
+    }
+
+    data = readfile(argv[1], &size);
+    mesh_read(&m, data, size);
+    if (argc == 4)
+	instances = readinstances(argv[2], &count);
+    scene_write(argv[argc - 1], &m, instances, count);
+
+    printf("%u vertices, %u triangles, %u instances\n", m.vertexcount,
+	    m.indexcount / 3, count);
+
+    free(instances);
+    free(data);
+
+    return EXIT_SUCCESS;
+}
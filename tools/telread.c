@@ -0,0 +1,215 @@
+/* Reads the renderer's telemetry from shared memory while it runs.
+ * Prints every frame, or with -a the mean and worst of each time and the
+ * latest counters every so many seconds. It starts from the oldest frame
+ * still in the ring and stops when the renderer does. Frames overwritten
+ * before they were read are counted as dropped.
+ * Usage: telread [-a seconds] name
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "../telemetry.h"
+#include "../util.h"
+
+/* Macros */
+/* A tenth of the ring at 1000 frames a second */
+#define POLLMS 100
+#define TIMES 5
+
+/* Types */
+typedef struct {
+    uint64_t count;
+    double sum[TIMES];
+    double max[TIMES];
+    TelFrame last;
+} Aggregate;
+
+/* Function declarations */
+static const TelHeader *openring(const char *name);
+static uint32_t readrecord(const TelRecord *r, uint64_t index, TelFrame *f);
+static void frametimes(const TelFrame *f, double *t);
+static void printframe(const TelFrame *f);
+static void addframe(Aggregate *a, const TelFrame *f);
+static void printaggregate(Aggregate *a, uint64_t dropped);
+
+/* Variables */
+static const char * const timenames[TIMES] = {
+    "frame", "fence", "acquire", "submit", "present"
+};
+
+/* Function implementations */
+
+const TelHeader *
+openring(const char *name)
+{
+    const TelHeader *h;
+    HANDLE mapping;
+    uint32_t tries;
+
+    if ((mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name)) == NULL)
+	terminate("Could not open telemetry %s, is the renderer writing it?\n",
+		name);
+    if ((h = (const TelHeader *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0,
+		    0)) == NULL)
+	terminate("Could not map telemetry %s.\n", name);
+    CloseHandle(mapping);
+
+    /* The magic is written last */
+    for (tries = 0; memcmp(h->magic, "TELE", 4) != 0; tries++) {
+	if (tries == 10)
+	    terminate("Telemetry %s has no header.\n", name);
+	Sleep(POLLMS);
+    }
+    MemoryBarrier();
+    if (h->version != TEL_VERSION || h->recordsize != sizeof(TelRecord) ||
+	    h->ringsize != TEL_RINGSIZE)
+	terminate("Not version %u telemetry.\n", TEL_VERSION);
+
+    return h;
+}
+
+/* Fails if the record is being written or was overwritten during the copy */
+uint32_t
+readrecord(const TelRecord *r, uint64_t index, TelFrame *f)
+{
+    LONG64 sequence = r->sequence;
+
+    MemoryBarrier();
+    *f = r->f;
+    MemoryBarrier();
+
+    return sequence == (LONG64) index + 1 && r->sequence == sequence;
+}
+
+void
+frametimes(const TelFrame *f, double *t)
+{
+    t[0] = f->frametime;
+    t[1] = f->fencewait;
+    t[2] = f->acquire;
+    t[3] = f->submit;
+    t[4] = f->present;
+}
+
+void
+printframe(const TelFrame *f)
+{
+    double t[TIMES];
+    uint32_t i;
+
+    frametimes(f, t);
+    printf("%10llu", (unsigned long long) f->frame);
+    for (i = 0; i < TIMES; i++)
+	printf(" %8.3f", t[i]);
+    printf(" %6u %10.1f %10.1f\n", f->recreations,
+	    (double) f->hostbytes / (1 << 10),
+	    (double) f->devicebytes / (1 << 20));
+}
+
+void
+addframe(Aggregate *a, const TelFrame *f)
+{
+    double t[TIMES];
+    uint32_t i;
+
+    frametimes(f, t);
+    for (i = 0; i < TIMES; i++) {
+	a->sum[i] += t[i];
+	if (t[i] > a->max[i])
+	    a->max[i] = t[i];
+    }
+    a->count++;
+    a->last = *f;
+}
+
+/* Then starts the next interval */
+void
+printaggregate(Aggregate *a, uint64_t dropped)
+{
+    uint32_t i;
+
+    if (a->count == 0)
+	return;
+    printf("%llu frames to %llu, %llu dropped, %u recreations, host %.1f KB, "
+	    "device %.1f MB\n", (unsigned long long) a->count,
+	    (unsigned long long) a->last.frame, (unsigned long long) dropped,
+	    a->last.recreations, (double) a->last.hostbytes / (1 << 10),
+	    (double) a->last.devicebytes / (1 << 20));
+    for (i = 0; i < TIMES; i++)
+	printf("  %-8s mean %8.3f ms max %8.3f ms\n", timenames[i],
+		a->sum[i] / (double) a->count, a->max[i]);
+    fflush(stdout);
+    memset(a, 0, sizeof *a);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const TelHeader *h;
+    const TelRecord *ring;
+    HANDLE process;
+    uint64_t next, head, dropped = 0;
+    DWORD interval = 0, elapsed = 0;
+    Aggregate a;
+    TelFrame f;
+
+    if (argc == 4 && strcmp(argv[1], "-a") == 0)
+	interval = (DWORD) (atof(argv[2]) * 1000.0);
+    if (!(argc == 2 || (argc == 4 && interval > 0))) {
+	fprintf(stderr, "Usage: %s [-a seconds] name\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    h = openring(argv[argc - 1]);
+    ring = (const TelRecord *) (h + 1);
+    /* To notice a renderer that died without saying so */
+    process = OpenProcess(SYNCHRONIZE, FALSE, h->pid);
+    memset(&a, 0, sizeof a);
+    if (interval == 0)
+	printf("%10s %8s %8s %8s %8s %8s %6s %10s %10s\n", "frame", "ms",
+		"fence", "acquire", "submit", "present", "recr", "host KB",
+		"device MB");
+
+    head = (uint64_t) h->head;
+    next = head > TEL_RINGSIZE ? head - TEL_RINGSIZE : 0;
+    for (;;) {
+	head = (uint64_t) h->head;
+	MemoryBarrier();
+	if (head - next > TEL_RINGSIZE) {
+	    dropped += head - TEL_RINGSIZE - next;
+	    next = head - TEL_RINGSIZE;
+	}
+	for (; next < head; next++)
+	    if (!readrecord(&ring[next % TEL_RINGSIZE], next, &f))
+		dropped++;
+	    else if (interval > 0)
+		addframe(&a, &f);
+	    else
+		printframe(&f);
+
+	if (interval > 0 && (elapsed += POLLMS) >= interval) {
+	    printaggregate(&a, dropped);
+	    elapsed = 0;
+	}
+	/* Anything written before it stopped has been read */
+	if ((h->stopped || (process != NULL &&
+			WaitForSingleObject(process, 0) == WAIT_OBJECT_0)) &&
+		(uint64_t) h->head == next)
+	    break;
+	if (interval == 0)
+	    fflush(stdout);
+	Sleep(POLLMS);
+    }
+
+    printaggregate(&a, dropped);
+    if (interval == 0)
+	printf("%llu dropped\n", (unsigned long long) dropped);
+    if (process != NULL)
+	CloseHandle(process);
+    UnmapViewOfFile(h);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+/* Trace recorder.
+ * Each registered thread writes begin and end events into its own ring, so
+ * recording takes no locks. GPU work goes in a ring of its own once it has
+ * been placed on the CPU clock. Dumps are Chrome trace event JSON, which
+ * chrome://tracing and Perfetto both load.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "trace.h"
+#include "util.h"
+#include "win32.h"
+
+/* Macros */
+#define MAXTHREADS 64
+/* Events per thread, a power of two */
+#define RINGSIZE 65536
+#define GPUTHREAD "GPU"
+
+/* Types */
+
+typedef struct {
+    const char *name;
+    /* Seconds on the gettime() clock */
+    double ts;
+    double dur;
+    char phase;
+} TraceEvent;
+
+typedef struct {
+    const char *name;
+    DWORD tid;
+    /* Only the owning thread writes, the dump reads */
+    volatile LONG64 head;
+    TraceEvent events[RINGSIZE];
+} TraceRing;
+
+/* Function declarations */
+static BOOL CALLBACK initonce(INIT_ONCE *once, void *param, void **context);
+static TraceRing *newring(const char *name, DWORD tid);
+static void record(TraceRing *r, const char *name, double ts, double dur,
+	char phase);
+
+/* Variables */
+static INIT_ONCE initialised = INIT_ONCE_STATIC_INIT;
+static DWORD tlsindex = TLS_OUT_OF_INDEXES;
+static double starttime;
+static TraceRing *rings[MAXTHREADS];
+static volatile LONG ringcount;
+static TraceRing *gpuring;
+
+/* Function implementations */
+
+BOOL CALLBACK
+initonce(INIT_ONCE *once, void *param, void **context)
+{
+    UNUSED(once);
+    UNUSED(param);
+    UNUSED(context);
+
+    if ((tlsindex = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+	terminate("Failed to allocate trace thread storage.");
+    starttime = gettime();
+    gpuring = newring(GPUTHREAD, 0);
+
+    return TRUE;
+}
+
+TraceRing *
+newring(const char *name, DWORD tid)
+{
+    TraceRing *r;
+    LONG i;
+
+    if ((i = InterlockedIncrement(&ringcount) - 1) >= MAXTHREADS)
+	terminate("Too many traced threads.");
+    if ((r = (TraceRing *) calloc(1, sizeof(TraceRing))) == NULL)
+	terminate("Failed to allocate trace ring.");
+    r->name = name;
+    r->tid = tid;
+    rings[i] = r;
+
+    return r;
+}
+
+void
+record(TraceRing *r, const char *name, double ts, double dur, char phase)
+{
+    LONG64 head = r->head;
+    TraceEvent *e = &r->events[head & (RINGSIZE - 1)];
+
+    /* Oldest events are overwritten when the ring is full */
+    e->name = name;
+    e->ts = ts;
+    e->dur = dur;
+    e->phase = phase;
+    /* Publish only after the event is written */
+    InterlockedExchange64(&r->head, head + 1);
+}
+
+/* Threads that never register aren't traced */
+void
+trace_thread(const char *name)
+{
+    InitOnceExecuteOnce(&initialised, initonce, NULL, NULL);
+    TlsSetValue(tlsindex, newring(name, GetCurrentThreadId()));
+}
+
+void
+trace_begin(const char *name)
+{
+    TraceRing *r;
+
+    if (tlsindex != TLS_OUT_OF_INDEXES &&
+	    (r = (TraceRing *) TlsGetValue(tlsindex)) != NULL)
+	record(r, name, gettime(), 0.0, 'B');
+}
+
+void
+trace_end(void)
+{
+    TraceRing *r;
+
+    if (tlsindex != TLS_OUT_OF_INDEXES &&
+	    (r = (TraceRing *) TlsGetValue(tlsindex)) != NULL)
+	record(r, NULL, gettime(), 0.0, 'E');
+}
+
+/* Times are on the gettime() clock, call from one thread only */
+void
+trace_gpu(const char *name, double begin, double end)
+{
+    if (gpuring != NULL)
+	record(gpuring, name, begin, end - begin, 'X');
+}
+
+/* Events written during the dump may be torn or missed */
+void
+trace_dump(const char *filename)
+{
+    FILE *fp;
+    TraceRing *r;
+    const TraceEvent *e;
+    LONG64 head, i;
+    LONG count = ringcount, n;
+    DWORD pid = GetCurrentProcessId();
+    const char *sep = "";
+
+    if ((fp = fopen(filename, "w")) == NULL)
+	terminate("Could not open trace file %s.\n", filename);
+
+    fputs("{\"traceEvents\":[\n", fp);
+    for (n = 0; n < count && n < MAXTHREADS; n++) {
+	/* Skip a ring still being registered */
+	if ((r = rings[n]) == NULL)
+	    continue;
+
+	fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,"
+		"\"tid\":%lu,\"args\":{\"name\":\"%s\"}}", sep,
+		(unsigned long) pid, (unsigned long) r->tid, r->name);
+	sep = ",\n";
+
+	head = InterlockedCompareExchange64(&r->head, 0, 0);
+	for (i = head > RINGSIZE ? head - RINGSIZE : 0; i < head; i++) {
+	    e = &r->events[i & (RINGSIZE - 1)];
+	    fprintf(fp, "%s{\"ph\":\"%c\",\"pid\":%lu,\"tid\":%lu,"
+		    "\"ts\":%.3f", sep, e->phase, (unsigned long) pid,
+		    (unsigned long) r->tid, (e->ts - starttime) * 1e6);
+	    if (e->name != NULL)
+		fprintf(fp, ",\"name\":\"%s\"", e->name);
+	    if (e->phase == 'X')
+		fprintf(fp, ",\"dur\":%.3f", e->dur * 1e6);
+	    fputc('}', fp);
+	}
+    }
+    fputs("\n]}\n", fp);
+
+    if (fclose(fp) == EOF)
+	terminate("Error on closing file %s.\n", filename);
+}
@@ -0,0 +1,24 @@
+/* Zones compile out unless built with TRACE. Names must be string literals
+ * that need no JSON escaping. */
+#ifdef TRACE
+#define TRACE_THREAD(name)    trace_thread(name)
+#define TRACE_BEGIN(name)     trace_begin(name)
+#define TRACE_END()           trace_end()
+#define TRACE_CALL(call)      do { trace_begin(#call); call; trace_end(); } \
+    while (0)
+#define TRACE_GPU(name, b, e) trace_gpu(name, b, e)
+#define TRACE_DUMP(filename)  trace_dump(filename)
+#else
+#define TRACE_THREAD(name)    ((void) 0)
+#define TRACE_BEGIN(name)     ((void) 0)
+#define TRACE_END()           ((void) 0)
+#define TRACE_CALL(call)      call
+#define TRACE_GPU(name, b, e) ((void) 0)
+#define TRACE_DUMP(filename)  ((void) 0)
+#endif /* TRACE */
+
+void trace_thread(const char *name);
+void trace_begin(const char *name);
+void trace_end(void);
+void trace_gpu(const char *name, double begin, double end);
+void trace_dump(const char *filename);
@@ -1,6 +1,15 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <windows.h>
+
+#include "util.h"
+
+/* Function declarations */
+static const void *mapview(const char *filename, size_t *size,
+	DWORD protect, DWORD access);
+
+/* Function implementations */
 
 void
 terminate(const char *fmt, ...)
@@ -13,3 +22,67 @@ terminate(const char *fmt, ...)
 
     exit(EXIT_FAILURE);
 }
+
+/* Seconds on the performance counter */
+double
+gettime(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    /* Performance counter frequency is fixed at boot */
+    if (frequency.QuadPart == 0)
+	QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+}
+
+const void *
+mapview(const char *filename, size_t *size, DWORD protect, DWORD access)
+{
+    HANDLE file, mapping;
+    LARGE_INTEGER filesize;
+    const void *data;
+
+    file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+	    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+	terminate("Could not open file %s.\n", filename);
+
+    if (!GetFileSizeEx(file, &filesize) || filesize.QuadPart == 0)
+	terminate("Error on sizing file %s.\n", filename);
+    *size = (size_t) filesize.QuadPart;
+
+    /* The view keeps the mapping and file alive after the handles close */
+    if ((mapping = CreateFileMapping(file, NULL, protect, 0, 0, NULL)) ==
+	    NULL)
+	terminate("Error on mapping file %s.\n", filename);
+    if ((data = MapViewOfFile(mapping, access, 0, 0, 0)) == NULL)
+	terminate("Error on viewing file %s.\n", filename);
+
+    CloseHandle(mapping);
+    CloseHandle(file);
+
+    return data;
+}
+
+const void *
+mapfile(const char *filename, size_t *size)
+{
+    return mapview(filename, size, PAGE_READONLY, FILE_MAP_READ);
+}
+
+/* Copy on write, so the pages are writable as far as a driver importing them
+ * can tell. Still read from the file, a page is only copied if written. */
+const void *
+mapfilecopy(const char *filename, size_t *size)
+{
+    return mapview(filename, size, PAGE_WRITECOPY, FILE_MAP_COPY);
+}
+
+void
+unmapfile(const void *data)
+{
+    UnmapViewOfFile(data);
+}
@@ -3,3 +3,7 @@
 #define UNUSED(x) (void) (x)
 
 void terminate(const char *fmt, ...);
+double gettime(void);
+const void *mapfile(const char *filename, size_t *size);
+const void *mapfilecopy(const char *filename, size_t *size);
+void unmapfile(const void *data);
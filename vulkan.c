@@ -4,20 +4,37 @@
  */
 
 #include <assert.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_win32.h>
 #include <windows.h>
 
+#include "batch.h"
+#include "capture.h"
+#include "cmdstream.h"
 #include "config.h"
+#include "cull.h"
+#include "graph.h"
+#include "job.h"
+#include "latency.h"
+#include "mem.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "post.h"
+#include "scene.h"
+#include "sprite.h"
+#include "task.h"
+#include "telemetry.h"
+#include "texture.h"
+#include "trace.h"
 #include "util.h"
 #include "vulkan.h"
 #include "win32.h"
 
-/* Macros */
-#define MAXFRAMES 2
-
 /* Types */
 
 typedef struct {
@@ -42,9 +59,57 @@ typedef struct {
     VkFormat imageformat;
     VkExtent2D extent;
     VkImageView *imageviews;
-    VkFramebuffer *framebuffers;
 } SwapChain;
 
+/* Another window showing the frame, presented along with the main one. Its
+ * swap chain is null while the window has no area and its surface once the
+ * window is closed. */
+typedef struct {
+    HWND hwnd;
+    VkSurfaceKHR surface;
+    SwapChain swapchain;
+    /* Holds the swap chain's images */
+    Arena arena;
+    VkSemaphore imagesems[MAXFRAMES];
+    uint32_t imageindex;
+    uint32_t acquired;
+    uint32_t resized;
+    /* Scaled by a blit where the formats allow, else copied unscaled */
+    uint32_t blit;
+    VkFilter filter;
+} View;
+
+/* Offscreen colour target, its images belong to the render graph. Allocated
+ * at the swap chain size and rendered into a scaled sub-rect. */
+typedef struct {
+    VkFramebuffer framebuffers[MAXFRAMES];
+    VkExtent2D extent;
+    VkFilter filter;
+} RenderTarget;
+
+/* Per-frame parameters, must match the std140 uniform block in vertex.glsl */
+typedef struct {
+    float viewproj[16];
+    float time;
+    float deltatime;
+    float pad[2];
+} FrameUniforms;
+
+/* Lock-free free list of descriptor slots. The head packs an ABA tag in the
+ * high 32 bits with the first free slot in the low 32 bits. */
+typedef struct {
+    volatile LONG64 head;
+    volatile LONG *next;
+    uint32_t count;
+} SlotList;
+
+/* Slot released by a loader thread, reused once the GPU can't see it */
+typedef struct {
+    uint64_t frame;
+    uint32_t slot;
+    uint32_t binding;
+} RetiredSlot;
+
 /* Function declarations */
 #ifdef DEBUG
 static uint32_t checklayersupport(void);
@@ -72,78 +137,319 @@ static void destroydebugmessenger(void);
 static void createinstance(void);
 static void destroyinstance(void);
 static QueueFamilies findqueuefamilies(VkPhysicalDevice pd);
+static uint32_t hasdeviceext(VkPhysicalDevice pd, const char *name);
 static uint32_t checkdeviceext(VkPhysicalDevice pd);
+static uint32_t checkdevicefeatures(VkPhysicalDevice pd);
+static uint32_t checklibrarysupport(VkPhysicalDevice pd);
+static uint32_t checkpresentwaitsupport(VkPhysicalDevice pd);
+static uint32_t checkhostimportsupport(VkPhysicalDevice pd);
 static uint32_t isdevicesuitable(VkPhysicalDevice pd);
 static void pickphysicaldevice(void);
 static void createlogicaldevice(void);
 static void destroylogicaldevice(void);
+static VkSurfaceKHR createwindowsurface(HWND window);
 static void createsurface(void);
 static void destroysurface(void);
-static SwapChainDetails queryswapchaindetails(VkPhysicalDevice pd);
-static void freeswapchaindetails(SwapChainDetails details);
+static SwapChainDetails queryswapchaindetails(VkPhysicalDevice pd,
+	VkSurfaceKHR s);
 static VkSurfaceFormatKHR chooseswapsurfaceformat(SwapChainDetails details);
 static VkPresentModeKHR chooseswappresentmode(SwapChainDetails details);
-static VkExtent2D chooseswapextent(SwapChainDetails details);
+static VkExtent2D chooseswapextent(SwapChainDetails details, HWND window);
+static void choosesurfaceformat(void);
+static void initswapchain(SwapChain *sc, Arena *a, VkSurfaceKHR s,
+	HWND window,
+	VkImageUsageFlags usage);
 static void createswapchain(void);
 static void destroyswapchain(void);
 static void recreateswapchain(void);
+static void createviews(void);
+static void chooseviewcopy(View *v);
+static void destroyview(View *v);
+static void destroyviews(void);
+static void recreateviewswapchain(View *v);
+static void acquireviews(uint32_t frame);
 static void createimageviews(void);
 static void destroyimageviews(void);
-static void creategraphicspipeline(void);
-static char *createshadercode(const char *filename, size_t *size);
-static void deleteshadercode(char **code);
-static VkShaderModule createshadermodule(const char *code, size_t size);
 static void createrenderpass(void);
 static void destroyrenderpass(void);
+static void createpostprocess(void);
+static void destroypostprocess(void);
+static void createdescriptorsetlayout(void);
+static void destroydescriptorsetlayout(void);
+static void initslotlist(SlotList *list, uint32_t count);
+static void freeslotlist(SlotList *list);
+static uint32_t allocslot(SlotList *list);
+static void releaseslot(SlotList *list, uint32_t slot);
+static void createbindlesstable(void);
+static void destroybindlesstable(void);
+static void retireslot(uint32_t binding, uint32_t slot);
+static void releaseretiredslots(void);
 static void creategraphicspipeline(void);
 static void destroygraphicspipeline(void);
+static void declarerendergraph(void);
+static void createrendertarget(void);
 static void createframebuffers(void);
 static void destroyframebuffers(void);
+static void createquerypool(void);
+static void destroyquerypool(void);
+static VkBuffer importhost(const void *p, VkDeviceSize size,
+	VkDeviceMemory *memory);
+static void uploadmesh(void);
+static void createmesh(void);
+static void destroymesh(void);
+static void updaterenderscale(uint32_t frame);
+static uint64_t querydevicebytes(void);
+static double telclock(void);
+#ifdef TRACE
+static void initcalibration(void);
+static void tracegpuframe(const uint64_t *ts);
+#endif /* TRACE */
+static void drawscene(VkCommandBuffer cb, uint32_t frame);
+static void scenedone(VkCommandBuffer cb, uint32_t frame);
+static void blitscene(VkCommandBuffer cb, VkImage src, VkExtent2D extent,
+	VkImage dst);
+static void upscale(VkCommandBuffer cb, uint32_t frame);
+static void recordrepeat(VkCommandBuffer cb, uint32_t imageindex);
+static void captureframe(VkCommandBuffer cb, uint32_t frame);
+static void blitviews(VkCommandBuffer cb, uint32_t frame);
 static void createcommandpool(void);
 static void destroycommandpool(void);
 static void createcommandpool(void);
+static void createuniformbuffer(void);
+static void destroyuniformbuffer(void);
+static void viewprojection(float *m);
+static void updateuniformbuffer(uint32_t frame);
+static void uniformjob(void *data);
+static void createdescriptorpool(void);
+static void destroydescriptorpool(void);
+static void createdescriptorsets(void);
 static void createcommandbuffers(void);
 static void recordcommandbuffer(VkCommandBuffer commandbuffers,
 	uint32_t imageindex);
+static void recordjob(void *data);
+static void spritejob(void *data);
+static void culljob(void *data);
 static void createsyncobjects(void);
 static void destroysyncobjects(void);
+static void initcapture(void);
+static void initcommandstream(void);
+static void inittextures(void);
+static void initsprites(void);
+static void initobjects(void);
+static void adddemosprites(void);
+static uint32_t animating(void);
+static double cputime(void);
+static void reportusage(void);
 static void devicewait(void);
 
 /* Variables */
-static const char readonlybinary[] = "rb";
 static const uint32_t queuecount = 2;
 #ifdef DEBUG
 static const char * const layers[] = { "VK_LAYER_KHRONOS_validation" };
 static const char * const exts[] = {
     VK_KHR_SURFACE_EXTENSION_NAME,
     VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+    VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME,
     VK_EXT_DEBUG_UTILS_EXTENSION_NAME
 };
 VkDebugUtilsMessengerEXT debugmessenger;
 #else
 static const char * const exts[] = {
     VK_KHR_SURFACE_EXTENSION_NAME,
-    VK_KHR_WIN32_SURFACE_EXTENSION_NAME
+    VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+    VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+    VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME
 };
 #endif /* DEBUG */
-static const char * const deviceexts[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+static const char * const deviceexts[] = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+    VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
+};
+/* Optional, for linking pipelines from precompiled parts */
+static const char * const libraryexts[] = {
+    VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
+    VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME
+};
+/* Optional, for timing presents to the display */
+static const char * const presentexts[] = {
+    VK_KHR_PRESENT_ID_EXTENSION_NAME,
+    VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+};
+/* Optional, for copying to the GPU straight from mapped files */
+static const char * const hostexts[] = {
+    VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+    VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME
+};
+/* Drawn when there's no mesh file, facing the camera */
+static const MeshSource trianglevertices[] = {
+    { {  0.0f, -0.5f, 0.0f }, { 0.0f, 0.0f, -1.0f },
+	{ 1.0f, 0.0f, 0.0f, 1.0f } },
+    { {  0.5f,  0.5f, 0.0f }, { 0.0f, 0.0f, -1.0f },
+	{ 0.0f, 1.0f, 0.0f, 1.0f } },
+    { { -0.5f,  0.5f, 0.0f }, { 0.0f, 0.0f, -1.0f },
+	{ 0.0f, 0.0f, 1.0f, 1.0f } }
+};
+static const uint32_t triangleindices[] = { 0, 1, 2 };
+/* Bindings of the bindless table in set 1 */
+enum { BINDLESS_IMAGES, BINDLESS_SAMPLER, BINDLESS_BUFFERS };
 static VkInstance instance;
-static VkPhysicalDevice physicaldevice = VK_NULL_HANDLE;
-static VkDevice device;
+VkPhysicalDevice physicaldevice = VK_NULL_HANDLE;
+VkDevice device;
 static VkQueue graphics;
 static VkQueue present;
 static VkSurfaceKHR surface;
+static uint32_t haslibraries;
+static uint32_t haspresentwait;
+static uint32_t hashostimport;
+static uint32_t hasmemorybudget;
+static PFN_vkGetPhysicalDeviceMemoryProperties2KHR getmemoryproperties2;
+static VkDeviceSize hostalignment;
+static PFN_vkGetMemoryHostPointerPropertiesEXT gethostpointerproperties;
+static VkSurfaceFormatKHR surfaceformat;
 static SwapChain swapchain;
+/* Its images and views, reset when it's recreated */
+static Arena swapchainarena;
+static View views[MAXWINDOWS - 1];
+static uint64_t viewpresents, viewskips;
+static RenderTarget rendertarget;
+static float renderscale = 1.0f;
+/* Smoothed GPU frame time in milliseconds, zero until first measured */
+static double gputime;
+/* Totals for the report */
+static double gputotal;
+static uint64_t gpuframes;
+static VkQueryPool querypool = VK_NULL_HANDLE;
+static uint64_t timestampmask;
+static float timestampperiod;
+static uint32_t queried[MAXFRAMES];
+#ifdef TRACE
+static uint32_t calibrated;
+static PFN_vkGetCalibratedTimestampsEXT getcalibratedtimestamps;
+/* Seconds per performance counter tick */
+static double qpcperiod;
+#endif /* TRACE */
+static VkDescriptorSetLayout descriptorsetlayout;
+static VkDescriptorPool descriptorpool;
+static VkDescriptorSet descriptorset;
+static VkBuffer uniformbuffer;
+static VkDeviceMemory uniformmemory;
+static unsigned char *uniformdata;
+static VkDeviceSize uniformstride;
+static double starttime, lasttime;
+static VkSampler bindlesssampler;
+static VkDescriptorSetLayout bindlesslayout;
+static VkDescriptorPool bindlesspool;
+static VkDescriptorSet bindlessset;
+static SlotList imageslots;
+static SlotList bufferslots;
+static SRWLOCK bindlesslock = SRWLOCK_INIT;
+static RetiredSlot *retired;
+static uint32_t retiredhead, retiredcount, retiredsize;
+static Texture *texture;
+/* Counts and bounds, the arrays are only in the buffer */
+static Mesh mesh;
+static VkBuffer meshbuffer;
+static VkDeviceMemory meshmemory;
+static VkDeviceSize meshindexoffset;
+static uint32_t meshimported;
+static double meshuploadtime;
+/* Mapped until exit, its pages are dropped once unused */
+static Scene scene;
+static const void *scenedata;
+static ObjectStore objects;
+static uint32_t colourmode = COLOUR_VERTEX;
 static VkPipelineLayout pipelinelayout;
 static VkRenderPass renderpass;
-static VkPipeline graphicspipeline;
+static uint32_t scenecolour, backbuffer;
 static VkCommandPool commandpool;
 static VkCommandBuffer commandbuffers[MAXFRAMES];
 static VkSemaphore imagesems[MAXFRAMES];
 static VkSemaphore rendersems[MAXFRAMES];
 static VkFence framefences[MAXFRAMES];
 static uint32_t currentframe = 0;
+static uint64_t framecount = 0;
 static uint32_t framebufferresized = 0;
+static uint32_t recreations;
+#ifdef DEBUG
+static double inittime;
+#endif /* DEBUG */
+/* Telemetry, the device's bytes are only queried every so often */
+static uint32_t telemetry;
+static double lastframestart;
+static uint64_t devicebytes;
+/* Render on demand. Set by any thread when something has changed since the
+ * last frame was drawn, exposed when only the main window needs its image
+ * again. */
+static volatile LONG dirty = 1;
+static uint32_t exposed;
+/* The last frame drawn, its scene colour stays readable till it's reused */
+static uint32_t lastframe, lastdrawn;
+static VkExtent2D lastextent;
+/* For the usage report, from the end of initialisation */
+static double runtime, runcpu;
+static uint64_t drawncount, repeatcount;
+/* Initialisation once the device exists, listed in serial order. The render
+ * pass only needs the surface format so the pipeline can build while the
+ * swap chain is created. */
+enum {
+    TASK_SURFACEFORMAT, TASK_SWAPCHAIN, TASK_IMAGEVIEWS, TASK_RENDERPASS,
+    TASK_SETLAYOUT, TASK_BINDLESS, TASK_SHADERS, TASK_PIPELINE, TASK_POST,
+    TASK_RENDERGRAPH, TASK_RENDERTARGET, TASK_FRAMEBUFFERS, TASK_QUERYPOOL,
+    TASK_COMMANDPOOL, TASK_UNIFORMS, TASK_DESCRIPTORPOOL, TASK_DESCRIPTORSETS,
+    TASK_COMMANDBUFFERS, TASK_SYNC, TASK_CAPTURE, TASK_TEXTURES, TASK_SPRITES,
+    TASK_MESH, TASK_OBJECTS, TASK_VIEWS, TASK_COUNT
+};
+static const Task inittasks[TASK_COUNT] = {
+    [TASK_SURFACEFORMAT]  = { "choosesurfaceformat", choosesurfaceformat,
+	0 },
+    [TASK_SWAPCHAIN]      = { "createswapchain", createswapchain,
+	TASKBIT(TASK_SURFACEFORMAT) },
+    [TASK_IMAGEVIEWS]     = { "createimageviews", createimageviews,
+	TASKBIT(TASK_SWAPCHAIN) },
+    [TASK_RENDERPASS]     = { "createrenderpass", createrenderpass,
+	TASKBIT(TASK_SURFACEFORMAT) },
+    [TASK_SETLAYOUT]      = { "createdescriptorsetlayout",
+	createdescriptorsetlayout, 0 },
+    [TASK_BINDLESS]       = { "createbindlesstable", createbindlesstable, 0 },
+    [TASK_SHADERS]        = { "pipe_loadshaders", pipe_loadshaders, 0 },
+    [TASK_PIPELINE]       = { "creategraphicspipeline",
+	creategraphicspipeline, TASKBIT(TASK_RENDERPASS) |
+	    TASKBIT(TASK_SETLAYOUT) | TASKBIT(TASK_BINDLESS) |
+	    TASKBIT(TASK_SHADERS) },
+    [TASK_POST]           = { "createpostprocess", createpostprocess,
+	TASKBIT(TASK_RENDERPASS) },
+    [TASK_RENDERGRAPH]    = { "declarerendergraph", declarerendergraph,
+	TASKBIT(TASK_SURFACEFORMAT) },
+    [TASK_RENDERTARGET]   = { "createrendertarget", createrendertarget,
+	TASKBIT(TASK_SWAPCHAIN) | TASKBIT(TASK_RENDERGRAPH) },
+    [TASK_FRAMEBUFFERS]   = { "createframebuffers", createframebuffers,
+	TASKBIT(TASK_RENDERPASS) | TASKBIT(TASK_POST) |
+	    TASKBIT(TASK_RENDERTARGET) },
+    [TASK_QUERYPOOL]      = { "createquerypool", createquerypool, 0 },
+    [TASK_COMMANDPOOL]    = { "createcommandpool", createcommandpool, 0 },
+    [TASK_UNIFORMS]       = { "createuniformbuffer", createuniformbuffer, 0 },
+    [TASK_DESCRIPTORPOOL] = { "createdescriptorpool", createdescriptorpool,
+	0 },
+    [TASK_DESCRIPTORSETS] = { "createdescriptorsets", createdescriptorsets,
+	TASKBIT(TASK_SETLAYOUT) | TASKBIT(TASK_UNIFORMS) |
+	    TASKBIT(TASK_DESCRIPTORPOOL) },
+    [TASK_COMMANDBUFFERS] = { "createcommandbuffers", createcommandbuffers,
+	TASKBIT(TASK_COMMANDPOOL) },
+    [TASK_SYNC]           = { "createsyncobjects", createsyncobjects, 0 },
+    [TASK_CAPTURE]        = { "initcapture", initcapture,
+	TASKBIT(TASK_SWAPCHAIN) },
+    [TASK_TEXTURES]       = { "inittextures", inittextures,
+	TASKBIT(TASK_BINDLESS) },
+    [TASK_SPRITES]        = { "initsprites", initsprites,
+	TASKBIT(TASK_PIPELINE) },
+    [TASK_MESH]           = { "createmesh", createmesh, 0 },
+    [TASK_OBJECTS]        = { "initobjects", initobjects,
+	TASKBIT(TASK_MESH) },
+    [TASK_VIEWS]          = { "createviews", createviews,
+	TASKBIT(TASK_SURFACEFORMAT) }
+};
 
 /* Function implementations */
 
@@ -157,8 +463,8 @@ checklayersupport(void)
 
     /* Get available layers */
     vkEnumerateInstanceLayerProperties(&availablecount, NULL);
-    availablelayers = (VkLayerProperties *) malloc(availablecount *
-	    sizeof(VkLayerProperties));
+    availablelayers = (VkLayerProperties *) mem_alloc(&initarena,
+	    availablecount * sizeof(VkLayerProperties));
     vkEnumerateInstanceLayerProperties(&availablecount, availablelayers);
 
     /* Check if layers we need are available */
@@ -172,15 +478,12 @@ checklayersupport(void)
 	    }
 	}
 
-	if (found) {
+	if (found)
 	    continue;
-	} else {
-	    free(availablelayers);
+	else
 	    return 0;
-	}
     }
 
-    free(availablelayers);
     return 1;
 }
 
@@ -259,15 +562,15 @@ createdebugmessenger(void)
 {
     VkDebugUtilsMessengerCreateInfoEXT ci = createdebugci();
 
-    if (CreateDebugUtilsMessengerEXT(instance, &ci, NULL, &debugmessenger) !=
-	    VK_SUCCESS)
+    if (CreateDebugUtilsMessengerEXT(instance, &ci, &allocator,
+		&debugmessenger) != VK_SUCCESS)
 	terminate("Failed to set up debug messenger.");
 }
 
 void
 destroydebugmessenger(void)
 {
-    DestroyDebugUtilsMessengerEXT(instance, debugmessenger, NULL);
+    DestroyDebugUtilsMessengerEXT(instance, debugmessenger, &allocator);
 }
 
 #endif // DEBUG
@@ -275,30 +578,58 @@ destroydebugmessenger(void)
 void
 vk_initialise(void)
 {
-    createinstance();
 #ifdef DEBUG
-    createdebugmessenger();
+    inittime = gettime();
 #endif /* DEBUG */
-    createsurface();
-    pickphysicaldevice();
-    createlogicaldevice();
-    createswapchain();
-    createimageviews();
-    createrenderpass();
-    creategraphicspipeline();
-    createframebuffers();
-    createcommandpool();
-    createcommandbuffers();
-    createsyncobjects();
+    TRACE_BEGIN("vk_initialise");
+    TRACE_CALL(mem_initialise());
+    mem_createarena(&swapchainarena, swapchainarenasize);
+    TRACE_CALL(tel_initialise(telemetryname));
+    telemetry = tel_enabled();
+    TRACE_CALL(initcommandstream());
+    TRACE_CALL(job_initialise(jobthreads));
+    TRACE_CALL(createinstance());
+#ifdef DEBUG
+    TRACE_CALL(createdebugmessenger());
+#endif /* DEBUG */
+    TRACE_CALL(createsurface());
+    TRACE_CALL(pickphysicaldevice());
+    TRACE_CALL(createlogicaldevice());
+    /* Everything else only needs the device and the tasks before it */
+    task_run(inittasks, TASK_COUNT, initthreads);
+
+    /* Temporary arrays from initialisation aren't needed any more */
+    mem_reset(&initarena, 0);
+    runtime = gettime();
+    runcpu = cputime();
+    TRACE_END();
 }
 
 void
 vk_terminate(void)
 {
     devicewait();
+    reportusage();
+    job_terminate();
+    cap_terminate();
+    cs_terminate();
+    spr_terminate();
+    cull_terminate(&objects);
+    tex_terminate();
     destroyswapchain();
+    mem_destroyarena(&swapchainarena);
+    destroyviews();
+    lat_terminate();
+    rg_terminate();
+    destroyquerypool();
+    destroymesh();
     destroygraphicspipeline();
+    destroypostprocess();
     destroyrenderpass();
+    destroydescriptorpool();
+    destroyuniformbuffer();
+    destroydescriptorsetlayout();
+    destroybindlesstable();
     destroysyncobjects();
     destroycommandpool();
     destroylogicaldevice();
@@ -307,6 +638,11 @@ vk_terminate(void)
 #endif /* DEBUG */
     destroysurface();
     destroyinstance();
+    tel_terminate();
+#ifdef DEBUG
+    mem_report();
+#endif /* DEBUG */
+    mem_terminate();
 }
 
 void
@@ -351,14 +687,14 @@ createinstance(void)
 	terminate("Validation layers requested, but not available.");
 #endif /* DEBUG */
 
-    if(vkCreateInstance(&ci, NULL, &instance) != VK_SUCCESS)
+    if(vkCreateInstance(&ci, &allocator, &instance) != VK_SUCCESS)
 	terminate("Failed to create instance.\n");
 }
 
 void
 destroyinstance(void)
 {
-    vkDestroyInstance(instance, NULL);
+    vkDestroyInstance(instance, &allocator);
 }
 
 QueueFamilies
@@ -371,7 +707,7 @@ findqueuefamilies(VkPhysicalDevice pd)
 
     /* Get available queue families */
     vkGetPhysicalDeviceQueueFamilyProperties(pd, &qfpcount, NULL);
-    qfps = (VkQueueFamilyProperties *) malloc(qfpcount *
+    qfps = (VkQueueFamilyProperties *) mem_alloc(&initarena, qfpcount *
 	    sizeof(VkQueueFamilyProperties));
     vkGetPhysicalDeviceQueueFamilyProperties(pd, &qfpcount, qfps);
 
@@ -396,44 +732,162 @@ findqueuefamilies(VkPhysicalDevice pd)
 	}
     }
 
-    free(qfps);
     return qf;
 }
 
 uint32_t
-checkdeviceext(VkPhysicalDevice pd)
+hasdeviceext(VkPhysicalDevice pd, const char *name)
 {
-    uint32_t availablecount, i, j, found;
+    uint32_t availablecount, i;
     VkExtensionProperties *availableexts;
 
     /* Get available extensions */
     vkEnumerateDeviceExtensionProperties(pd, NULL, &availablecount, NULL);
-    availableexts = (VkExtensionProperties *) malloc(availablecount *
-	    sizeof(VkExtensionProperties));
+    availableexts = (VkExtensionProperties *) mem_alloc(&initarena,
+	    availablecount * sizeof(VkExtensionProperties));
     vkEnumerateDeviceExtensionProperties(pd, NULL, &availablecount,
 	    availableexts);
 
-    /* Check we have required extensions */
-    for (i = 0; i < COUNT(deviceexts); i++) {
-	found = 0;
+    for (i = 0; i < availablecount; i++)
+	if (strcmp(name, availableexts[i].extensionName) == 0)
+	    return 1;
 
-	for (j = 0; j < availablecount; j++) {
-	    if (strcmp(deviceexts[i], availableexts[j].extensionName) == 0) {
-		found = 1;
-		break;
-	    }
-	}
+    return 0;
+}
+
+uint32_t
+checkdeviceext(VkPhysicalDevice pd)
+{
+    uint32_t i;
 
-	if (!found) {
-	    free(availableexts);
+    /* Check we have required extensions */
+    for (i = 0; i < COUNT(deviceexts); i++)
+	if (!hasdeviceext(pd, deviceexts[i]))
 	    return 0;
-	}
-    }
 
-    free(availableexts);
     return 1;
 }
 
+uint32_t
+checkdevicefeatures(VkPhysicalDevice pd)
+{
+    PFN_vkGetPhysicalDeviceFeatures2KHR getfeatures2 =
+	(PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance,
+		"vkGetPhysicalDeviceFeatures2KHR");
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT difs = {
+	.sType =
+	    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+	.pNext = NULL
+    };
+    VkPhysicalDeviceFeatures2 pdf2 = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+	.pNext = &difs
+    };
+
+    if (getfeatures2 == NULL)
+	return 0;
+    getfeatures2(pd, &pdf2);
+
+    /* Needed by the bindless table */
+    return difs.runtimeDescriptorArray &&
+	difs.descriptorBindingPartiallyBound &&
+	difs.descriptorBindingSampledImageUpdateAfterBind &&
+	difs.descriptorBindingStorageBufferUpdateAfterBind &&
+	difs.descriptorBindingUpdateUnusedWhilePending;
+}
+
+/* Monolithic pipelines are used without it */
+uint32_t
+checklibrarysupport(VkPhysicalDevice pd)
+{
+    PFN_vkGetPhysicalDeviceFeatures2KHR getfeatures2 =
+	(PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance,
+		"vkGetPhysicalDeviceFeatures2KHR");
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gplfs = {
+	.sType =
+	VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+	.pNext = NULL
+    };
+    VkPhysicalDeviceFeatures2 pdf2 = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+	.pNext = &gplfs
+    };
+    uint32_t i;
+
+    for (i = 0; i < COUNT(libraryexts); i++)
+	if (!hasdeviceext(pd, libraryexts[i]))
+	    return 0;
+
+    if (getfeatures2 == NULL)
+	return 0;
+    getfeatures2(pd, &pdf2);
+
+    return gplfs.graphicsPipelineLibrary;
+}
+
+/* Latency is timed to the present call without it */
+uint32_t
+checkpresentwaitsupport(VkPhysicalDevice pd)
+{
+    PFN_vkGetPhysicalDeviceFeatures2KHR getfeatures2 =
+	(PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance,
+		"vkGetPhysicalDeviceFeatures2KHR");
+    VkPhysicalDevicePresentWaitFeaturesKHR pwfs = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+	.pNext = NULL
+    };
+    VkPhysicalDevicePresentIdFeaturesKHR pifs = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+	.pNext = &pwfs
+    };
+    VkPhysicalDeviceFeatures2 pdf2 = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+	.pNext = &pifs
+    };
+    uint32_t i;
+
+    for (i = 0; i < COUNT(presentexts); i++)
+	if (!hasdeviceext(pd, presentexts[i]))
+	    return 0;
+
+    if (getfeatures2 == NULL)
+	return 0;
+    getfeatures2(pd, &pdf2);
+
+    return pifs.presentId && pwfs.presentWait;
+}
+
+/* Scene blobs are aligned for any import alignment up to theirs */
+uint32_t
+checkhostimportsupport(VkPhysicalDevice pd)
+{
+    PFN_vkGetPhysicalDeviceProperties2KHR getproperties2 =
+	(PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(
+		instance, "vkGetPhysicalDeviceProperties2KHR");
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT pemhp = {
+	.sType =
+	VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+	.pNext = NULL,
+	.minImportedHostPointerAlignment = 0
+    };
+    VkPhysicalDeviceProperties2 pdp2 = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+	.pNext = &pemhp
+    };
+    uint32_t i;
+
+    for (i = 0; i < COUNT(hostexts); i++)
+	if (!hasdeviceext(pd, hostexts[i]))
+	    return 0;
+
+    if (getproperties2 == NULL)
+	return 0;
+    getproperties2(pd, &pdp2);
+    hostalignment = pemhp.minImportedHostPointerAlignment;
+
+    return hostalignment > 0 && SCENEALIGN % hostalignment == 0;
+}
+
 uint32_t
 isdevicesuitable(VkPhysicalDevice pd)
 {
@@ -441,16 +895,18 @@ isdevicesuitable(VkPhysicalDevice pd)
     SwapChainDetails details;
     uint32_t extssupport = checkdeviceext(pd);
     uint32_t swapchainadequate = 0;
+    uint32_t featuressupport = 0;
 
     if (extssupport) {
-	details = queryswapchaindetails(pd);
+	details = queryswapchaindetails(pd, surface);
 	swapchainadequate =
 	    details.formats      != NULL &&
 	    details.presentmodes != NULL;
-	freeswapchaindetails(details);
+	featuressupport = checkdevicefeatures(pd);
     }
 
-    return qf.isSuitable && extssupport && swapchainadequate;
+    return qf.isSuitable && extssupport && swapchainadequate &&
+	featuressupport;
 }
 
 void
@@ -463,7 +919,8 @@ pickphysicaldevice(void)
     vkEnumeratePhysicalDevices(instance, &pdcount, NULL);
     if (pdcount == 0)
 	terminate("Failed to find GPUs with Vulkan support.");
-    pds = (VkPhysicalDevice *) malloc(pdcount * sizeof(VkPhysicalDevice));
+    pds = (VkPhysicalDevice *) mem_alloc(&initarena, pdcount *
+	    sizeof(VkPhysicalDevice));
     vkEnumeratePhysicalDevices(instance, &pdcount, pds);
 
     /* Select the first suitable device */
@@ -474,7 +931,6 @@ pickphysicaldevice(void)
 	}
     }
 
-    free(pds);
     if (physicaldevice == VK_NULL_HANDLE)
 	terminate("Failed to find a suitable GPU.");
 }
@@ -486,12 +942,41 @@ createlogicaldevice(void)
     QueueFamilies qf = findqueuefamilies(physicaldevice);
     float prio = 1.0f;
     VkDeviceQueueCreateInfo *dqcis = (VkDeviceQueueCreateInfo *)
-	malloc(qf.count * sizeof(VkDeviceQueueCreateInfo));
-    /* Not specifying any physical device features */
+	mem_alloc(&initarena, qf.count * sizeof(VkDeviceQueueCreateInfo));
+    const char *enabledexts[COUNT(deviceexts) + COUNT(libraryexts) +
+	COUNT(presentexts) + COUNT(hostexts) + 2];
+    /* Not specifying any core physical device features */
     VkPhysicalDeviceFeatures pdf = { 0 };
+    /* Only what the bindless table needs */
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT difs = {
+	.sType =
+	    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+	.pNext = NULL,
+	.runtimeDescriptorArray = VK_TRUE,
+	.descriptorBindingPartiallyBound = VK_TRUE,
+	.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+	.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+	.descriptorBindingUpdateUnusedWhilePending = VK_TRUE
+    };
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gplfs = {
+	.sType =
+	VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+	.pNext = NULL,
+	.graphicsPipelineLibrary = VK_TRUE
+    };
+    VkPhysicalDevicePresentWaitFeaturesKHR pwfs = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+	.pNext = NULL,
+	.presentWait = VK_TRUE
+    };
+    VkPhysicalDevicePresentIdFeaturesKHR pifs = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+	.pNext = &pwfs,
+	.presentId = VK_TRUE
+    };
     VkDeviceCreateInfo dci = {
 	.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-	.pNext = NULL,
+	.pNext = &difs,
 	.flags = 0,
 	.queueCreateInfoCount = qf.count,
 	.pQueueCreateInfos = dqcis,
@@ -504,10 +989,42 @@ createlogicaldevice(void)
 	.ppEnabledLayerNames = NULL,
 #endif /* DEBUG */
 	.enabledExtensionCount = COUNT(deviceexts),
-	.ppEnabledExtensionNames = deviceexts,
+	.ppEnabledExtensionNames = enabledexts,
 	.pEnabledFeatures = &pdf
     };
 
+    memcpy(enabledexts, deviceexts, sizeof deviceexts);
+    /* Faster pipeline variants, only if available */
+    if (pipelinelibraries &&
+	    (haslibraries = checklibrarysupport(physicaldevice))) {
+	for (i = 0; i < COUNT(libraryexts); i++)
+	    enabledexts[dci.enabledExtensionCount++] = libraryexts[i];
+	difs.pNext = &gplfs;
+    }
+    /* Present timing, only if available */
+    if ((haspresentwait = checkpresentwaitsupport(physicaldevice))) {
+	for (i = 0; i < COUNT(presentexts); i++)
+	    enabledexts[dci.enabledExtensionCount++] = presentexts[i];
+	pwfs.pNext = difs.pNext;
+	difs.pNext = &pifs;
+    }
+    /* Uploads without a staging copy, only if available */
+    if ((hashostimport = checkhostimportsupport(physicaldevice)))
+	for (i = 0; i < COUNT(hostexts); i++)
+	    enabledexts[dci.enabledExtensionCount++] = hostexts[i];
+    /* Device memory use for telemetry, only if available */
+    if (telemetryname[0] != '\0' && (hasmemorybudget = hasdeviceext(
+		    physicaldevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)))
+	enabledexts[dci.enabledExtensionCount++] =
+	    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+#ifdef TRACE
+    /* Puts GPU work on the CPU timeline, only if available */
+    if ((calibrated = hasdeviceext(physicaldevice,
+		    VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)))
+	enabledexts[dci.enabledExtensionCount++] =
+	    VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME;
+#endif /* TRACE */
+
     /* Create a queue for each queue family */
     for (i = 0; i < qf.count; i++) {
 	dqcis[i].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
@@ -519,81 +1036,94 @@ createlogicaldevice(void)
     }
 
     /* Create the logical device */
-    if (vkCreateDevice(physicaldevice, &dci, NULL, &device) != VK_SUCCESS)
+    if (vkCreateDevice(physicaldevice, &dci, &allocator, &device) != VK_SUCCESS)
 	terminate("Failed to create logical device.");
 
     /* Get the queue handles */
     vkGetDeviceQueue(device, qf.graphics, 0, &graphics);
     vkGetDeviceQueue(device, qf.present,  0, &present);
+    if (hashostimport && (gethostpointerproperties =
+		(PFN_vkGetMemoryHostPointerPropertiesEXT) vkGetDeviceProcAddr(
+		    device, "vkGetMemoryHostPointerPropertiesEXT")) == NULL)
+	hashostimport = 0;
+    if (hasmemorybudget && (getmemoryproperties2 =
+		(PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+		vkGetInstanceProcAddr(instance,
+		    "vkGetPhysicalDeviceMemoryProperties2KHR")) == NULL)
+	hasmemorybudget = 0;
+    lat_initialise(haspresentwait);
+#ifdef TRACE
+    initcalibration();
+#endif /* TRACE */
 }
 
 void
 destroylogicaldevice(void)
 {
-    vkDestroyDevice(device, NULL);
+    vkDestroyDevice(device, &allocator);
 }
 
-void
-createsurface(void)
+VkSurfaceKHR
+createwindowsurface(HWND window)
 {
     VkWin32SurfaceCreateInfoKHR win32sci = {
 	.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
 	.pNext = NULL,
 	.flags = 0,
 	.hinstance = GetModuleHandle(NULL),
-	.hwnd = hwnd
+	.hwnd = window
     };
+    VkSurfaceKHR s;
 
-    if (vkCreateWin32SurfaceKHR(instance, &win32sci, NULL, &surface) !=
+    if (vkCreateWin32SurfaceKHR(instance, &win32sci, &allocator, &s) !=
 	    VK_SUCCESS)
 	terminate("Failed to create window surface.");
+
+    return s;
+}
+
+void
+createsurface(void)
+{
+    surface = createwindowsurface(hwnd);
 }
 
 void
 destroysurface(void)
 {
-    vkDestroySurfaceKHR(instance, surface, NULL);
+    vkDestroySurfaceKHR(instance, surface, &allocator);
 }
 
 SwapChainDetails
-queryswapchaindetails(VkPhysicalDevice pd)
+queryswapchaindetails(VkPhysicalDevice pd, VkSurfaceKHR s)
 {
     SwapChainDetails details;
 
     /* Get basic surface capabilities */
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(pd, surface,
-	    &details.capabilities);
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(pd, s, &details.capabilities);
 
     /* Get supported surface formats */
-    vkGetPhysicalDeviceSurfaceFormatsKHR(pd, surface,
-	    &details.formatcount, NULL);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(pd, s, &details.formatcount, NULL);
     if (details.formatcount > 0) {
-	details.formats = (VkSurfaceFormatKHR *) malloc(details.formatcount *
-		sizeof(VkSurfaceFormatKHR));
-	vkGetPhysicalDeviceSurfaceFormatsKHR(pd, surface,
-		&details.formatcount, details.formats);
+	details.formats = (VkSurfaceFormatKHR *) mem_alloc(&initarena,
+		details.formatcount * sizeof(VkSurfaceFormatKHR));
+	vkGetPhysicalDeviceSurfaceFormatsKHR(pd, s, &details.formatcount,
+		details.formats);
     }
 
     /* Get supported presentation modes */
-    vkGetPhysicalDeviceSurfacePresentModesKHR(pd, surface,
+    vkGetPhysicalDeviceSurfacePresentModesKHR(pd, s,
 	    &details.presentmodecount, NULL);
     if (details.presentmodecount > 0) {
-	details.presentmodes = (VkPresentModeKHR *)
-	    malloc(details.presentmodecount * sizeof(VkPresentModeKHR));
-	vkGetPhysicalDeviceSurfacePresentModesKHR(pd, surface,
+	details.presentmodes = (VkPresentModeKHR *) mem_alloc(&initarena,
+		details.presentmodecount * sizeof(VkPresentModeKHR));
+	vkGetPhysicalDeviceSurfacePresentModesKHR(pd, s,
 		&details.presentmodecount, details.presentmodes);
     }
 
     return details;
 }
 
-void
-freeswapchaindetails(SwapChainDetails details)
-{
-    free(details.formats);
-    free(details.presentmodes);
-}
-
 VkSurfaceFormatKHR
 chooseswapsurfaceformat(SwapChainDetails details)
 {
@@ -625,7 +1155,7 @@ chooseswappresentmode(SwapChainDetails details)
 }
 
 VkExtent2D
-chooseswapextent(SwapChainDetails details)
+chooseswapextent(SwapChainDetails details, HWND window)
 {
     VkExtent2D extent;
     RECT rcClient;
@@ -636,7 +1166,7 @@ chooseswapextent(SwapChainDetails details)
 
     /* Check if width and height don't match the resolution */
     if (details.capabilities.currentExtent.width == UINT32_MAX) {
-	GetClientRect(hwnd, &rcClient);
+	GetClientRect(window, &rcClient);
 	extent.width  = CLAMP((uint32_t) rcClient.right, minwidth, maxwidth);
 	extent.height = CLAMP((uint32_t) rcClient.bottom, minheight,
 		maxheight);
@@ -647,28 +1177,40 @@ chooseswapextent(SwapChainDetails details)
     }
 }
 
+/* Chosen once, the render pass and pipeline outlive the swap chain */
 void
-createswapchain(void)
+choosesurfaceformat(void)
+{
+    surfaceformat = chooseswapsurfaceformat(queryswapchaindetails(
+		physicaldevice, surface));
+}
+
+/* For the main window and the views, in the main window's format where the
+ * surface has it. A window with no area, e.g. minimised, gets a null
+ * handle. The arena is the swap chain's own, the one before it must have
+ * been destroyed. */
+void
+initswapchain(SwapChain *sc, Arena *a, VkSurfaceKHR s, HWND window,
+	VkImageUsageFlags usage)
 {
-    SwapChainDetails details = queryswapchaindetails(physicaldevice);
+    SwapChainDetails details = queryswapchaindetails(physicaldevice, s);
     uint32_t imagecount = details.capabilities.minImageCount + 1;
-    VkSurfaceFormatKHR sf = chooseswapsurfaceformat(details);
     VkPresentModeKHR pm = chooseswappresentmode(details);
-    VkExtent2D extent = chooseswapextent(details);
+    VkExtent2D extent = chooseswapextent(details, window);
+    VkSurfaceFormatKHR format = chooseswapsurfaceformat(details);
     uint32_t maximagecount = details.capabilities.maxImageCount;
     QueueFamilies qf = findqueuefamilies(physicaldevice);
     uint32_t qfi[] = { qf.graphics, qf.present };
     VkSwapchainCreateInfoKHR ci = {
 	.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
 	.pNext = NULL,
-	.surface = surface,
+	.surface = s,
 	.minImageCount = 0,
-	.imageFormat = sf.format,
-	.imageColorSpace = sf.colorSpace,
+	.imageFormat = VK_FORMAT_UNDEFINED,
+	.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
 	.imageExtent = extent,
 	.imageArrayLayers = 1,
-	/* Render directly */
-	.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+	.imageUsage = usage,
 	/* Use exclusive for best perfomance, if queue familes are the same */
 	.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
 	.queueFamilyIndexCount = 0,
@@ -681,6 +1223,27 @@ createswapchain(void)
 	.clipped = VK_TRUE,
 	.oldSwapchain = VK_NULL_HANDLE
     };
+    uint32_t i;
+
+    memset(sc, 0, sizeof *sc);
+    mem_reset(a, 0);
+    if (extent.width == 0 || extent.height == 0)
+	return;
+
+    if (!(details.capabilities.supportedUsageFlags &
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+	terminate("Swap chain images can't be blitted to.");
+    if ((usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) &&
+	    !(details.capabilities.supportedUsageFlags &
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+	terminate("Swap chain images can't be copied from.");
+
+    for (i = 0; i < details.formatcount; i++)
+	if (details.formats[i].format == surfaceformat.format &&
+		details.formats[i].colorSpace == surfaceformat.colorSpace)
+	    format = surfaceformat;
+    ci.imageFormat = format.format;
+    ci.imageColorSpace = format.colorSpace;
 
     if (maximagecount > 0 && imagecount > maximagecount)
 	imagecount = maximagecount;
@@ -693,29 +1256,43 @@ createswapchain(void)
 	ci.pQueueFamilyIndices = qfi;
     }
 
-    if (vkCreateSwapchainKHR(device, &ci, NULL, &swapchain.handle) !=
+    if (vkCreateSwapchainKHR(device, &ci, &allocator, &sc->handle) !=
 	    VK_SUCCESS)
 	terminate("Failed to create swap chain.");
 
     /* Get the swap chain image handles */
-    vkGetSwapchainImagesKHR(device, swapchain.handle, &imagecount, NULL);
-    swapchain.images = (VkImage *) malloc(imagecount * sizeof(VkImage));
-    swapchain.imagecount = imagecount;
-    vkGetSwapchainImagesKHR(device, swapchain.handle, &imagecount,
-	    swapchain.images);
+    vkGetSwapchainImagesKHR(device, sc->handle, &imagecount, NULL);
+    sc->images = (VkImage *) mem_alloc(a, imagecount * sizeof(VkImage));
+    sc->imagecount = imagecount;
+    vkGetSwapchainImagesKHR(device, sc->handle, &imagecount, sc->images);
+
+    sc->imageformat = format.format;
+    sc->extent = extent;
+}
 
-    swapchain.imageformat = sf.format;
-    swapchain.extent = extent;
-    freeswapchaindetails(details);
+void
+createswapchain(void)
+{
+    /* Rendering is offscreen, then scaled up into the swap chain */
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    /* Captured frames are copied out of the swap chain and the views are
+     * blitted from it */
+    if (capturefile[0] != '\0' || viewcount > 0)
+	usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+    initswapchain(&swapchain, &swapchainarena, surface, hwnd, usage);
+    if (swapchain.handle == VK_NULL_HANDLE)
+	terminate("Window has no area to present to.");
 }
 
 void
 destroyswapchain(void)
 {
+    lat_flush();
     destroyframebuffers();
     destroyimageviews();
-    vkDestroySwapchainKHR(device, swapchain.handle, NULL);
-    free(swapchain.images);
+    vkDestroySwapchainKHR(device, swapchain.handle, &allocator);
 }
 
 void
@@ -726,7 +1303,158 @@ recreateswapchain(void)
 
     createswapchain();
     createimageviews();
+    createrendertarget();
     createframebuffers();
+    mem_reset(&initarena, 0);
+    recreations++;
+
+    /* The render target is new, so there's nothing to present again */
+    lastdrawn = 0;
+    vk_invalidate();
+}
+
+/* Presented from the queue picked for the main window */
+void
+createviews(void)
+{
+    QueueFamilies qf = findqueuefamilies(physicaldevice);
+    VkSemaphoreCreateInfo sci = {
+	.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0
+    };
+    VkBool32 supported;
+    uint32_t i, j;
+    View *v;
+
+    for (i = 0; i < viewcount; i++) {
+	v = &views[i];
+	v->hwnd = viewhwnds[i];
+	v->surface = createwindowsurface(v->hwnd);
+	vkGetPhysicalDeviceSurfaceSupportKHR(physicaldevice, qf.present,
+		v->surface, &supported);
+	if (!supported)
+	    terminate("Can't present to view windows.");
+
+	for (j = 0; j < MAXFRAMES; j++)
+	    if (vkCreateSemaphore(device, &sci, &allocator,
+			&v->imagesems[j]) != VK_SUCCESS)
+		terminate("Failed to create semaphores.");
+
+	mem_createarena(&v->arena, swapchainarenasize);
+	initswapchain(&v->swapchain, &v->arena, v->surface, v->hwnd,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+	chooseviewcopy(v);
+	if (v->swapchain.handle != VK_NULL_HANDLE && !v->blit)
+	    fprintf(stderr, "View %u can't be blitted to, it's copied "
+		    "unscaled.\n", i + 1);
+    }
+}
+
+/* From the main window's image, which is in the format chosen for its
+ * surface */
+void
+chooseviewcopy(View *v)
+{
+    VkFormatProperties src, dst;
+
+    if (v->swapchain.handle == VK_NULL_HANDLE)
+	return;
+
+    vkGetPhysicalDeviceFormatProperties(physicaldevice, surfaceformat.format,
+	    &src);
+    vkGetPhysicalDeviceFormatProperties(physicaldevice,
+	    v->swapchain.imageformat, &dst);
+    v->blit = (src.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) &&
+	(dst.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+    v->filter = src.optimalTilingFeatures &
+	VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT ?
+	VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+    /* A copy doesn't convert */
+    if (!v->blit && v->swapchain.imageformat != surfaceformat.format)
+	terminate("Can't show the frame in a view window's format.");
+}
+
+/* The GPU must be done with it */
+void
+destroyview(View *v)
+{
+    uint32_t i;
+
+    if (v->surface == VK_NULL_HANDLE)
+	return;
+
+    if (v->swapchain.handle != VK_NULL_HANDLE)
+	vkDestroySwapchainKHR(device, v->swapchain.handle, &allocator);
+    mem_destroyarena(&v->arena);
+    for (i = 0; i < MAXFRAMES; i++)
+	vkDestroySemaphore(device, v->imagesems[i], &allocator);
+    vkDestroySurfaceKHR(instance, v->surface, &allocator);
+    v->surface = VK_NULL_HANDLE;
+}
+
+void
+destroyviews(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < viewcount; i++)
+	destroyview(&views[i]);
+
+    if (viewcount > 0)
+	fprintf(stderr, "Views: %llu images presented with the main "
+		"window's, %llu skipped as not ready.\n",
+		(unsigned long long) viewpresents,
+		(unsigned long long) viewskips);
+}
+
+void
+recreateviewswapchain(View *v)
+{
+    devicewait();
+    if (v->swapchain.handle != VK_NULL_HANDLE)
+	vkDestroySwapchainKHR(device, v->swapchain.handle, &allocator);
+    initswapchain(&v->swapchain, &v->arena, v->surface, v->hwnd,
+	    VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    chooseviewcopy(v);
+    mem_reset(&initarena, 0);
+}
+
+/* After the main window's image. A view never holds up the frame, if its
+ * next image isn't ready it keeps showing the last one. */
+void
+acquireviews(uint32_t frame)
+{
+    VkResult result;
+    uint32_t i;
+    View *v;
+
+    for (i = 0; i < viewcount; i++) {
+	v = &views[i];
+	v->acquired = 0;
+	if (v->surface == VK_NULL_HANDLE)
+	    continue;
+	if (v->resized) {
+	    v->resized = 0;
+	    recreateviewswapchain(v);
+	}
+	if (v->swapchain.handle == VK_NULL_HANDLE)
+	    continue;
+
+	result = vkAcquireNextImageKHR(device, v->swapchain.handle, 0,
+		v->imagesems[frame], VK_NULL_HANDLE, &v->imageindex);
+	if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+	    v->acquired = 1;
+	else if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	    v->resized = 1;
+	/* Drawn again so the view catches up */
+	else if (result == VK_TIMEOUT || result == VK_NOT_READY) {
+	    viewskips++;
+	    vk_invalidate();
+	}
+	else
+	    terminate("Failed to acquire view swap chain image.");
+    }
 }
 
 void
@@ -754,13 +1482,13 @@ createimageviews(void)
 	.subresourceRange.layerCount     = 1
     };
 
-    swapchain.imageviews = (VkImageView *) malloc(swapchain.imagecount *
-	    sizeof(VkImageView));
+    swapchain.imageviews = (VkImageView *) mem_alloc(&swapchainarena,
+	    swapchain.imagecount * sizeof(VkImageView));
 
     for (i = 0; i < swapchain.imagecount; i++) {
 	ci.image = swapchain.images[i];
 
-	if (vkCreateImageView(device, &ci, NULL, &swapchain.imageviews[i]) !=
+	if (vkCreateImageView(device, &ci, &allocator, &swapchain.imageviews[i]) !=
 		VK_SUCCESS)
 	    terminate("Failed to create image views.");
     }
@@ -772,56 +1500,7 @@ destroyimageviews(void)
     uint32_t i;
 
     for (i = 0; i < swapchain.imagecount; i++)
-	vkDestroyImageView(device, swapchain.imageviews[i], NULL);
-
-    free(swapchain.imageviews);
-}
-
-char *
-createshadercode(const char *filename, size_t *size)
-{
-    FILE *fp;
-    char *code;
-
-    if ((fp = fopen(filename, readonlybinary)) == NULL)
-	terminate("Could not open file %s.\n", filename);
-
-    if (fseek(fp, 0L, SEEK_END) != 0)
-	terminate("Error on seeking file %s.\n", filename);
-    *size = ftell(fp);
-    rewind(fp);
-    code = (char *) malloc(*size * sizeof(char));
-    if (fread(code, sizeof(char), *size, fp) < *size)
-	terminate("Error reading file %s.\n", filename);
-
-    if (fclose(fp) == EOF)
-	terminate("Error on closing file %s.\n", filename);
-
-    return code;
-}
-
-void
-deleteshadercode(char **code)
-{
-    free(*code);
-}
-
-VkShaderModule
-createshadermodule(const char *code, size_t size)
-{
-    VkShaderModuleCreateInfo ci = {
-	.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-	.pNext = NULL,
-	.flags = 0,
-	.codeSize = size,
-	.pCode = (const uint32_t *) code
-    };
-    VkShaderModule sm;
-
-    if (vkCreateShaderModule(device, &ci, NULL, &sm) != VK_SUCCESS)
-	terminate("Failed to create shader module.");
-
-    return sm;
+	vkDestroyImageView(device, swapchain.imageviews[i], &allocator);
 }
 
 void
@@ -829,7 +1508,9 @@ createrenderpass(void)
 {
     VkAttachmentDescription colorattachment = {
 	.flags = 0,
-	.format = swapchain.imageformat,
+	/* Post-processing tonemaps the scene down from HDR */
+	.format = postprocess == POST_PASSES ? POST_HDRFORMAT :
+	    surfaceformat.format,
 	.samples = VK_SAMPLE_COUNT_1_BIT,
 	/* Clear to black before rendering */
 	.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
@@ -837,9 +1518,9 @@ createrenderpass(void)
 	/* Not using the stencile buffer */
 	.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 	.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-	/* Get image ready for presentation after rendering */
-	.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+	/* The render graph transitions the image around the pass */
+	.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
     };
     /* Single subpass as a colour buffer */
     VkAttachmentReference colorattachmentref = {
@@ -859,18 +1540,6 @@ createrenderpass(void)
 	.preserveAttachmentCount = 0,
 	.pPreserveAttachments = NULL
     };
-    VkSubpassDependency dependency = {
-	/* Implicit subpass before render pass */
-	.srcSubpass = VK_SUBPASS_EXTERNAL,
-	.dstSubpass = 0,
-	/* Wait for swap chain to finish reading image */
-	.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-	.srcAccessMask = 0,
-	/* Writing the colour attachment needs to wait */
-	.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-	.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-	.dependencyFlags = 0
-    };
     VkRenderPassCreateInfo rpci = {
 	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
 	.pNext = NULL,
@@ -879,235 +1548,1303 @@ createrenderpass(void)
 	.pAttachments = &colorattachment,
 	.subpassCount = 1,
 	.pSubpasses = &subpass,
-	.dependencyCount = 1,
-	.pDependencies = &dependency
+	/* Barriers come from the render graph */
+	.dependencyCount = 0,
+	.pDependencies = NULL
     };
 
-    if (vkCreateRenderPass(device, &rpci, NULL, &renderpass) != VK_SUCCESS)
+    if (postprocess == POST_SUBPASSES) {
+	renderpass = post_createrenderpass(surfaceformat.format);
+	return;
+    }
+
+    if (vkCreateRenderPass(device, &rpci, &allocator, &renderpass) !=
+	    VK_SUCCESS)
 	terminate("Failed to create render pass.");
 }
 
 void
 destroyrenderpass(void)
 {
-    vkDestroyRenderPass(device, renderpass, NULL);
+    vkDestroyRenderPass(device, renderpass, &allocator);
 }
 
 void
-creategraphicspipeline(void)
+createpostprocess(void)
 {
-    size_t vertexcodesize, fragmentcodesize;
-    char *vertexcode = createshadercode(vertexshader, &vertexcodesize);
-    char *fragmentcode = createshadercode(fragmentshader, &fragmentcodesize);
-    VkShaderModule vertexsm = createshadermodule(vertexcode, vertexcodesize);
-    VkShaderModule fragmentsm = createshadermodule(fragmentcode,
-	    fragmentcodesize);
-    VkPipelineShaderStageCreateInfo vertexpssci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-	.pNext = NULL,
-	.flags = 0,
-	.stage = VK_SHADER_STAGE_VERTEX_BIT,
-	.module = vertexsm,
-	.pName = shaderentry,
-	.pSpecializationInfo = NULL
+    if (postprocess != POST_OFF)
+	post_initialise(renderpass, surfaceformat.format);
+}
+
+void
+destroypostprocess(void)
+{
+    if (postprocess != POST_OFF)
+	post_terminate();
+}
+
+void
+createdescriptorsetlayout(void)
+{
+    /* Per-frame uniforms, the offset into the ring is given at bind time */
+    VkDescriptorSetLayoutBinding binding = {
+	.binding = 0,
+	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.descriptorCount = 1,
+	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+	.pImmutableSamplers = NULL
     };
-    VkPipelineShaderStageCreateInfo fragmentpssci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    VkDescriptorSetLayoutCreateInfo dslci = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 	.pNext = NULL,
 	.flags = 0,
-	.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-	.module = fragmentsm,
-	.pName = shaderentry,
-	.pSpecializationInfo = NULL
-    };
-    VkPipelineShaderStageCreateInfo psscis[] = {
-	vertexpssci,
-	fragmentpssci
-    };
-    /* No vertex data to load */
-    VkPipelineVertexInputStateCreateInfo pvisci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-	.pNext = NULL,
-	.flags = 0,
-	.vertexBindingDescriptionCount = 0,
-	.pVertexBindingDescriptions = NULL,
-	.vertexAttributeDescriptionCount = 0,
-	.pVertexAttributeDescriptions = NULL
+	.bindingCount = 1,
+	.pBindings = &binding
     };
-    VkPipelineInputAssemblyStateCreateInfo piasci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+
+    if (vkCreateDescriptorSetLayout(device, &dslci, &allocator,
+		&descriptorsetlayout) != VK_SUCCESS)
+	terminate("Failed to create descriptor set layout.");
+}
+
+void
+destroydescriptorsetlayout(void)
+{
+    vkDestroyDescriptorSetLayout(device, descriptorsetlayout, &allocator);
+}
+
+void
+initslotlist(SlotList *list, uint32_t count)
+{
+    uint32_t i;
+
+    list->next = (volatile LONG *) malloc(count * sizeof(LONG));
+    list->count = count;
+
+    /* Every slot starts free, chained in order */
+    for (i = 0; i < count; i++)
+	list->next[i] = (LONG) (i + 1 < count ? i + 1 : NOHANDLE);
+    list->head = 0;
+}
+
+void
+freeslotlist(SlotList *list)
+{
+    free((void *) list->next);
+}
+
+uint32_t
+allocslot(SlotList *list)
+{
+    LONG64 old, new;
+    uint32_t slot;
+
+    do {
+	old = list->head;
+	slot = (uint32_t) old;
+	if (slot == NOHANDLE)
+	    return NOHANDLE;
+	/* A stale next is caught by the tag changing */
+	new = (LONG64) (((uint64_t) old >> 32) + 1) << 32 |
+	    (uint32_t) list->next[slot];
+    } while (InterlockedCompareExchange64(&list->head, new, old) != old);
+
+    return slot;
+}
+
+void
+releaseslot(SlotList *list, uint32_t slot)
+{
+    LONG64 old, new;
+
+    do {
+	old = list->head;
+	list->next[slot] = (LONG) (uint32_t) old;
+	new = (LONG64) (((uint64_t) old >> 32) + 1) << 32 | slot;
+    } while (InterlockedCompareExchange64(&list->head, new, old) != old);
+}
+
+void
+createbindlesstable(void)
+{
+    /* One sampler for every texture, baked into the layout */
+    VkSamplerCreateInfo sci = {
+	.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
 	.pNext = NULL,
 	.flags = 0,
-	.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-	.primitiveRestartEnable = VK_FALSE
+	.magFilter = VK_FILTER_LINEAR,
+	.minFilter = VK_FILTER_LINEAR,
+	.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+	.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+	.mipLodBias = 0.0f,
+	.anisotropyEnable = VK_FALSE,
+	.maxAnisotropy = 1.0f,
+	.compareEnable = VK_FALSE,
+	.compareOp = VK_COMPARE_OP_ALWAYS,
+	.minLod = 0.0f,
+	.maxLod = VK_LOD_CLAMP_NONE,
+	.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+	.unnormalizedCoordinates = VK_FALSE
     };
-    /* Viewport and scissor state will be specified at drawing time */
-    VkDynamicState dynamicstates[] = {
-	VK_DYNAMIC_STATE_VIEWPORT,
-	VK_DYNAMIC_STATE_SCISSOR
+    VkDescriptorSetLayoutBinding bindings[] = {
+	{
+	    .binding = BINDLESS_IMAGES,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+	    .descriptorCount = maxtextures,
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = NULL
+	},
+	{
+	    .binding = BINDLESS_SAMPLER,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+	    .descriptorCount = 1,
+	    .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = &bindlesssampler
+	},
+	{
+	    .binding = BINDLESS_BUFFERS,
+	    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+	    .descriptorCount = maxbuffers,
+	    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+		VK_SHADER_STAGE_FRAGMENT_BIT,
+	    .pImmutableSamplers = NULL
+	}
     };
-    VkPipelineDynamicStateCreateInfo pdsci = { 
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+    /* Slots may be written while the set is bound and in flight, as long as
+     * the GPU isn't using them, and unwritten slots are never read */
+    VkDescriptorBindingFlags bindingflags[] = {
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+	0,
+	VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+	    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT
+    };
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT dslbfci = {
+	.sType =
+	   VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
 	.pNext = NULL,
-	.flags = 0,
-	.dynamicStateCount = COUNT(dynamicstates),
-	.pDynamicStates = dynamicstates
+	.bindingCount = COUNT(bindingflags),
+	.pBindingFlags = bindingflags
+    };
+    VkDescriptorSetLayoutCreateInfo dslci = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	.pNext = &dslbfci,
+	.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+	.bindingCount = COUNT(bindings),
+	.pBindings = bindings
     };
-    VkPipelineViewportStateCreateInfo pvsci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+    VkDescriptorPoolSize dpss[] = {
+	{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,  maxtextures },
+	{ VK_DESCRIPTOR_TYPE_SAMPLER,        1 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxbuffers }
+    };
+    VkDescriptorPoolCreateInfo dpci = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
 	.pNext = NULL,
-	.flags = 0,
-	.viewportCount = 1,
-	.pViewports = NULL,
-	.scissorCount = 1,
-	.pScissors = NULL
+	.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+	.maxSets = 1,
+	.poolSizeCount = COUNT(dpss),
+	.pPoolSizes = dpss
     };
-    VkPipelineRasterizationStateCreateInfo prsci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+    VkDescriptorSetAllocateInfo dsai = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
 	.pNext = NULL,
-	.flags = 0,
-	/* Discard fragments that are not visibile */
-	.depthClampEnable = VK_FALSE,
-	/* Don't disable rastersizer */
-	.rasterizerDiscardEnable = VK_FALSE,
-	.polygonMode = VK_POLYGON_MODE_FILL,
-	.cullMode = VK_CULL_MODE_BACK_BIT,
-	/* Clockwise vertex order for faces to be considered front-facing */
-	.frontFace = VK_FRONT_FACE_CLOCKWISE,
-	.depthBiasEnable = VK_FALSE,
-	.depthBiasConstantFactor = 0.0f,
-	.depthBiasClamp = 0.0f,
-	.depthBiasSlopeFactor = 0.0f,
-	.lineWidth = 1.0f
-    };
-    /* Disable multisampling */
-    VkPipelineMultisampleStateCreateInfo pmsci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+	.descriptorPool = VK_NULL_HANDLE,
+	.descriptorSetCount = 1,
+	.pSetLayouts = &bindlesslayout
+    };
+
+    if (vkCreateSampler(device, &sci, &allocator, &bindlesssampler) !=
+	    VK_SUCCESS)
+	terminate("Failed to create texture sampler.");
+
+    if (vkCreateDescriptorSetLayout(device, &dslci, &allocator,
+		&bindlesslayout) != VK_SUCCESS)
+	terminate("Failed to create bindless descriptor set layout.");
+
+    if (vkCreateDescriptorPool(device, &dpci, &allocator, &bindlesspool) !=
+	    VK_SUCCESS)
+	terminate("Failed to create bindless descriptor pool.");
+
+    /* The one set lives as long as the device */
+    dsai.descriptorPool = bindlesspool;
+    if (vkAllocateDescriptorSets(device, &dsai, &bindlessset) != VK_SUCCESS)
+	terminate("Failed to allocate bindless descriptor set.");
+
+    initslotlist(&imageslots, maxtextures);
+    initslotlist(&bufferslots, maxbuffers);
+
+    /* Can't retire more slots than exist */
+    retiredsize = maxtextures + maxbuffers;
+    if ((retired = (RetiredSlot *) malloc(retiredsize *
+		    sizeof(RetiredSlot))) == NULL)
+	terminate("Failed to allocate retired slots.");
+    retiredhead = retiredcount = 0;
+}
+
+void
+destroybindlesstable(void)
+{
+    free(retired);
+    freeslotlist(&bufferslots);
+    freeslotlist(&imageslots);
+    vkDestroyDescriptorPool(device, bindlesspool, &allocator);
+    vkDestroyDescriptorSetLayout(device, bindlesslayout, &allocator);
+    vkDestroySampler(device, bindlesssampler, &allocator);
+}
+
+uint32_t
+vk_registerimage(VkImageView view)
+{
+    uint32_t slot;
+    VkDescriptorImageInfo dii = {
+	.sampler = VK_NULL_HANDLE,
+	.imageView = view,
+	.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = bindlessset,
+	.dstBinding = BINDLESS_IMAGES,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+	.pImageInfo = &dii,
+	.pBufferInfo = NULL,
+	.pTexelBufferView = NULL
+    };
+
+    if ((slot = allocslot(&imageslots)) == NOHANDLE)
+	terminate("Out of bindless image slots.");
+
+    /* Updates to one set must be externally synchronised */
+    wds.dstArrayElement = slot;
+    AcquireSRWLockExclusive(&bindlesslock);
+    vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
+    ReleaseSRWLockExclusive(&bindlesslock);
+
+    return slot;
+}
+
+uint32_t
+vk_registerbuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    uint32_t slot;
+    VkDescriptorBufferInfo dbi = {
+	.buffer = buffer,
+	.offset = offset,
+	.range = range
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = bindlessset,
+	.dstBinding = BINDLESS_BUFFERS,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+	.pImageInfo = NULL,
+	.pBufferInfo = &dbi,
+	.pTexelBufferView = NULL
+    };
+
+    if ((slot = allocslot(&bufferslots)) == NOHANDLE)
+	terminate("Out of bindless buffer slots.");
+
+    wds.dstArrayElement = slot;
+    AcquireSRWLockExclusive(&bindlesslock);
+    vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
+    ReleaseSRWLockExclusive(&bindlesslock);
+
+    return slot;
+}
+
+void
+retireslot(uint32_t binding, uint32_t slot)
+{
+    RetiredSlot *rs;
+
+    /* Frames already submitted may still read the slot */
+    AcquireSRWLockExclusive(&bindlesslock);
+    /* Only a slot unregistered twice can overflow, the oldest entry would
+     * be overwritten while still in use */
+    if (retiredcount == retiredsize)
+	terminate("Too many bindless slots retired.");
+    rs = &retired[(retiredhead + retiredcount++) % retiredsize];
+    rs->frame = framecount;
+    rs->slot = slot;
+    rs->binding = binding;
+    ReleaseSRWLockExclusive(&bindlesslock);
+}
+
+void
+vk_unregisterimage(uint32_t handle)
+{
+    retireslot(BINDLESS_IMAGES, handle);
+}
+
+void
+vk_unregisterbuffer(uint32_t handle)
+{
+    retireslot(BINDLESS_BUFFERS, handle);
+}
+
+void
+releaseretiredslots(void)
+{
+    RetiredSlot *rs;
+
+    /* Called after waiting on the oldest frame, so every submission from
+     * MAXFRAMES frames ago has completed */
+    AcquireSRWLockExclusive(&bindlesslock);
+    while (retiredcount > 0) {
+	rs = &retired[retiredhead];
+	if (rs->frame + MAXFRAMES > framecount)
+	    break;
+
+	releaseslot(rs->binding == BINDLESS_IMAGES ? &imageslots :
+		&bufferslots, rs->slot);
+	retiredhead = (retiredhead + 1) % retiredsize;
+	retiredcount--;
+    }
+    ReleaseSRWLockExclusive(&bindlesslock);
+}
+
+/* Variants are built by the pipeline manager */
+void
+creategraphicspipeline(void)
+{
+    /* Per-draw data is pushed straight into the command buffer */
+    VkPushConstantRange pcr = {
+	.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+	.offset = 0,
+	.size = sizeof(DrawConstants)
+    };
+    /* Per-frame uniforms then the bindless table */
+    VkDescriptorSetLayout setlayouts[] = {
+	descriptorsetlayout,
+	bindlesslayout
+    };
+    VkPipelineLayoutCreateInfo plci = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 	.pNext = NULL,
 	.flags = 0,
-	.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-	.sampleShadingEnable = VK_FALSE,
-	.minSampleShading = 0.0f,
-	.pSampleMask = NULL,
-	.alphaToCoverageEnable = VK_FALSE,
-	.alphaToOneEnable = VK_FALSE
-    };
-    /* Disable colour blending */
-    VkPipelineColorBlendAttachmentState pcbas = {
-	.blendEnable = VK_FALSE,
-	.srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
-	.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
-	.colorBlendOp = VK_BLEND_OP_ADD,
-	.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-	.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
-	.alphaBlendOp = VK_BLEND_OP_ADD,
-	.colorWriteMask =
-	    VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-	    VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
-    };
-    VkPipelineColorBlendStateCreateInfo pcbsci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+	.setLayoutCount = COUNT(setlayouts),
+	.pSetLayouts = setlayouts,
+	.pushConstantRangeCount = 1,
+	.pPushConstantRanges = &pcr
+    };
+    PipelineKey key;
+    uint32_t i;
+
+    if (vkCreatePipelineLayout(device, &plci, &allocator, &pipelinelayout) !=
+	    VK_SUCCESS)
+	terminate("Failed to create pipeline layout.");
+
+    pipe_initialise(renderpass, pipelinelayout, haslibraries);
+
+    /* Start on every variant a key press can ask for */
+    for (i = 0; i < 2 * COLOUR_COUNT; i++) {
+	key.colourmode = i / 2;
+	key.textured = i % 2;
+	pipe_request(key);
+    }
+}
+
+void
+destroygraphicspipeline(void)
+{
+    pipe_terminate();
+    vkDestroyPipelineLayout(device, pipelinelayout, &allocator);
+}
+
+/* The frame: draw the scene offscreen, scale it into the swap chain image
+ * and optionally read that back for capture */
+void
+declarerendergraph(void)
+{
+    uint32_t pass;
+
+    scenecolour = rg_image("scene colour", surfaceformat.format);
+    backbuffer = rg_import("backbuffer", VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+    pass = rg_pass("scene", drawscene, 0);
+    if (postprocess == POST_OFF)
+	rg_use(pass, scenecolour, RG_COLOUR_WRITE);
+    else
+	post_declare(pass, scenecolour);
+
+    /* Ends the GPU time the render scale controls, before the fixed cost
+     * of the upscale and any readbacks */
+    rg_pass("scene done", scenedone, 1);
+
+    pass = rg_pass("upscale", upscale, 0);
+    rg_use(pass, scenecolour, RG_TRANSFER_READ);
+    rg_use(pass, backbuffer, RG_TRANSFER_WRITE);
+    /* Blitted again by frames that only present, whatever slot they're in */
+    if (ondemand && repeatexposed)
+	rg_readlater(scenecolour, RG_TRANSFER_READ);
+
+    if (capturefile[0] != '\0') {
+	pass = rg_pass("capture", captureframe, 1);
+	rg_use(pass, backbuffer, RG_TRANSFER_READ);
+    }
+
+    /* Their images aren't in the graph, so it would cull the pass */
+    if (viewcount > 0) {
+	pass = rg_pass("views", blitviews, 1);
+	rg_use(pass, backbuffer, RG_TRANSFER_READ);
+    }
+}
+
+void
+createrendertarget(void)
+{
+    VkFormatProperties fp;
+
+    vkGetPhysicalDeviceFormatProperties(physicaldevice, swapchain.imageformat,
+	    &fp);
+    if (!(fp.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) ||
+	    !(fp.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT))
+	terminate("Render target format not supported by the GPU.");
+    /* Bilinear upscale if the format can be filtered */
+    rendertarget.filter = fp.optimalTilingFeatures &
+	VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT ?
+	VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+    rendertarget.extent = swapchain.extent;
+
+    /* Largest the render scale allows, so rescaling never reallocates */
+    rg_compile(swapchain.extent);
+}
+
+void
+createframebuffers(void)
+{
+    VkImageView views[3];
+    uint32_t i;
+    VkFramebufferCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
 	.pNext = NULL,
 	.flags = 0,
-	.logicOpEnable = VK_FALSE,
-	.logicOp = VK_LOGIC_OP_COPY,
+	.renderPass = renderpass,
 	.attachmentCount = 1,
-	.pAttachments = &pcbas,
-	.blendConstants[0] = 0.0f,
-	.blendConstants[1] = 0.0f,
-	.blendConstants[2] = 0.0f,
-	.blendConstants[3] = 0.0f
+	.pAttachments = views,
+	.width = rendertarget.extent.width,
+	.height = rendertarget.extent.height,
+	.layers = 1
     };
-    VkPipelineLayoutCreateInfo plci = {
-	.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+
+    for (i = 0; i < MAXFRAMES; i++) {
+	if (postprocess == POST_OFF)
+	    views[0] = rg_getview(scenecolour, i);
+	else
+	    fci.attachmentCount = post_attachments(i, views);
+
+	if (vkCreateFramebuffer(device, &fci, &allocator,
+		    &rendertarget.framebuffers[i]) != VK_SUCCESS)
+	    terminate("Failed to create framebuffer.");
+    }
+
+    if (postprocess != POST_OFF)
+	post_createframebuffers(rendertarget.extent);
+}
+
+void
+destroyframebuffers(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < MAXFRAMES; i++)
+	vkDestroyFramebuffer(device, rendertarget.framebuffers[i], &allocator);
+    if (postprocess != POST_OFF)
+	post_destroyframebuffers();
+}
+
+void
+createquerypool(void)
+{
+    QueueFamilies qf = findqueuefamilies(physicaldevice);
+    VkPhysicalDeviceProperties pdp;
+    VkQueueFamilyProperties *qfp;
+    uint32_t count, bits;
+    VkQueryPoolCreateInfo qpci = {
+	.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
 	.pNext = NULL,
 	.flags = 0,
-	.setLayoutCount = 0,
-	.pSetLayouts = NULL,
-	.pushConstantRangeCount = 0,
-	.pPushConstantRanges = NULL
+	.queryType = VK_QUERY_TYPE_TIMESTAMP,
+	/* Start and end of each frame in flight */
+	.queryCount = 2 * MAXFRAMES,
+	.pipelineStatistics = 0
     };
-    VkGraphicsPipelineCreateInfo gpci = {
-	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &count, NULL);
+    qfp = (VkQueueFamilyProperties *) mem_alloc(&initarena, count *
+	    sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(physicaldevice, &count, qfp);
+    bits = qfp[qf.graphics].timestampValidBits;
+
+    /* Without timestamps the render scale stays put */
+    if (bits == 0)
+	return;
+    timestampmask = bits >= 64 ? UINT64_MAX : ((uint64_t) 1 << bits) - 1;
+    vkGetPhysicalDeviceProperties(physicaldevice, &pdp);
+    timestampperiod = pdp.limits.timestampPeriod;
+
+    if (vkCreateQueryPool(device, &qpci, &allocator, &querypool) != VK_SUCCESS)
+	terminate("Failed to create query pool.");
+}
+
+void
+destroyquerypool(void)
+{
+    if (gpuframes > 0)
+	fprintf(stderr, "GPU frame time: %.3f ms mean over %llu frames.\n",
+		gputotal / (double) gpuframes, (unsigned long long) gpuframes);
+
+    if (querypool != VK_NULL_HANDLE)
+	vkDestroyQueryPool(device, querypool, &allocator);
+}
+
+/* Imports mapped pages as a transfer source, or returns VK_NULL_HANDLE if
+ * the pointer isn't aligned or the driver won't take them. Some drivers
+ * refuse read only pages, so the scene is mapped copy on write. */
+VkBuffer
+importhost(const void *p, VkDeviceSize size, VkDeviceMemory *memory)
+{
+    VkDeviceSize padded = (size + hostalignment - 1) & ~(hostalignment - 1);
+    VkExternalMemoryBufferCreateInfo embci = {
+	.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
 	.pNext = NULL,
+	.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT
+    };
+    VkBufferCreateInfo bci = {
+	.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	.pNext = &embci,
 	.flags = 0,
-	.stageCount = COUNT(psscis),
-	.pStages = psscis,
-	.pVertexInputState = &pvisci,
-	.pInputAssemblyState = &piasci,
-	.pTessellationState = NULL,
-	.pViewportState = &pvsci,
-	.pRasterizationState = &prsci,
-	.pMultisampleState = &pmsci,
-	.pColorBlendState = &pcbsci,
-	.pDynamicState = &pdsci,
-	.layout = VK_NULL_HANDLE,
+	.size = padded,
+	.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL
+    };
+    VkMemoryHostPointerPropertiesEXT mhpp = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+	.pNext = NULL,
+	.memoryTypeBits = 0
+    };
+    /* The driver only reads through it */
+    VkImportMemoryHostPointerInfoEXT imhpi = {
+	.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+	.pNext = NULL,
+	.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+	.pHostPointer = (void *) p
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = &imhpi,
+	.allocationSize = padded,
+	.memoryTypeIndex = 0
+    };
+    VkMemoryRequirements mr;
+    VkBuffer buffer;
+    uint32_t types;
+
+    if ((uintptr_t) p % hostalignment != 0 ||
+	    gethostpointerproperties(device, imhpi.handleType, p, &mhpp) !=
+	    VK_SUCCESS)
+	return VK_NULL_HANDLE;
+
+    if (vkCreateBuffer(device, &bci, &allocator, &buffer) != VK_SUCCESS)
+	return VK_NULL_HANDLE;
+    vkGetBufferMemoryRequirements(device, buffer, &mr);
+    types = mr.memoryTypeBits & mhpp.memoryTypeBits;
+    if (types == 0 || mr.size > padded) {
+	vkDestroyBuffer(device, buffer, &allocator);
+	return VK_NULL_HANDLE;
+    }
+    while (!(types & (1u << mai.memoryTypeIndex)))
+	mai.memoryTypeIndex++;
+
+    if (vkAllocateMemory(device, &mai, &allocator, memory) != VK_SUCCESS) {
+	vkDestroyBuffer(device, buffer, &allocator);
+	return VK_NULL_HANDLE;
+    }
+    if (vkBindBufferMemory(device, buffer, *memory, 0) != VK_SUCCESS) {
+	vkDestroyBuffer(device, buffer, &allocator);
+	vkFreeMemory(device, *memory, &allocator);
+	return VK_NULL_HANDLE;
+    }
+
+    return buffer;
+}
+
+/* Copies the mesh into device local memory and waits for it. A scene's
+ * blobs are copied from where they're mapped if the device can import
+ * them, anything else is copied into a staging buffer first. */
+void
+uploadmesh(void)
+{
+    VkDeviceSize vsize = mesh.vertexcount * sizeof(MeshVertex);
+    VkDeviceSize isize = mesh.indexcount * sizeof(uint32_t);
+    VkBuffer sources[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+    VkDeviceMemory sourcememory[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+    VkBufferCopy copies[2] = {
+	{ .srcOffset = 0, .dstOffset = 0, .size = vsize },
+	{ .srcOffset = 0, .dstOffset = vsize, .size = isize }
+    };
+    VkCommandPoolCreateInfo cpci = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+	.queueFamilyIndex = findqueuefamilies(physicaldevice).graphics
+    };
+    VkCommandBufferAllocateInfo cbai = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+	.pNext = NULL,
+	.commandPool = VK_NULL_HANDLE,
+	.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+	.commandBufferCount = 1
+    };
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.pNext = NULL,
+	.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	.pInheritanceInfo = NULL
+    };
+    /* Frames read the mesh as vertices and indices */
+    VkMemoryBarrier mb = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+	.pNext = NULL,
+	.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+	    VK_ACCESS_INDEX_READ_BIT
+    };
+    VkFenceCreateInfo fci = {
+	.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0
+    };
+    VkSubmitInfo si = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.pNext = NULL,
+	.waitSemaphoreCount = 0,
+	.pWaitSemaphores = NULL,
+	.pWaitDstStageMask = NULL,
+	.commandBufferCount = 1,
+	.pCommandBuffers = NULL,
+	.signalSemaphoreCount = 0,
+	.pSignalSemaphores = NULL
+    };
+    VkCommandPool pool;
+    VkCommandBuffer cb;
+    VkFence fence;
+    unsigned char *mapped;
+    double start = gettime();
+    uint32_t i;
+
+    meshindexoffset = vsize;
+    vk_createbuffer(vsize + isize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+	    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &meshbuffer, &meshmemory);
+
+    if (hashostimport) {
+	sources[0] = importhost(mesh.vertices, vsize, &sourcememory[0]);
+	sources[1] = importhost(mesh.indices, isize, &sourcememory[1]);
+    }
+    meshimported = sources[0] != VK_NULL_HANDLE &&
+	sources[1] != VK_NULL_HANDLE;
+    if (!meshimported) {
+	for (i = 0; i < 2; i++)
+	    if (sources[i] != VK_NULL_HANDLE) {
+		vkDestroyBuffer(device, sources[i], &allocator);
+		vkFreeMemory(device, sourcememory[i], &allocator);
+	    }
+	vk_createbuffer(vsize + isize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &sources[0],
+		&sourcememory[0]);
+	if (vkMapMemory(device, sourcememory[0], 0, VK_WHOLE_SIZE, 0,
+		    (void **) &mapped) != VK_SUCCESS)
+	    terminate("Failed to map mesh staging buffer.");
+	memcpy(mapped, mesh.vertices, vsize);
+	memcpy(mapped + vsize, mesh.indices, isize);
+	vkUnmapMemory(device, sourcememory[0]);
+	sources[1] = sources[0];
+	sourcememory[1] = VK_NULL_HANDLE;
+	copies[1].srcOffset = vsize;
+    }
+
+    /* Its own pool, the frames' is created by another task */
+    if (vkCreateCommandPool(device, &cpci, &allocator, &pool) != VK_SUCCESS)
+	terminate("Failed to create mesh upload command pool.");
+    cbai.commandPool = pool;
+    if (vkAllocateCommandBuffers(device, &cbai, &cb) != VK_SUCCESS)
+	terminate("Failed to allocate mesh upload command buffer.");
+    vkBeginCommandBuffer(cb, &cbbi);
+    vkCmdCopyBuffer(cb, sources[0], meshbuffer, 1, &copies[0]);
+    vkCmdCopyBuffer(cb, sources[1], meshbuffer, 1, &copies[1]);
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &mb, 0, NULL, 0, NULL);
+    if (vkEndCommandBuffer(cb) != VK_SUCCESS)
+	terminate("Failed to record mesh upload.");
+
+    /* Nothing else submits until the first frame */
+    si.pCommandBuffers = &cb;
+    if (vkCreateFence(device, &fci, &allocator, &fence) != VK_SUCCESS ||
+	    vkQueueSubmit(graphics, 1, &si, fence) != VK_SUCCESS ||
+	    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) !=
+	    VK_SUCCESS)
+	terminate("Failed to upload mesh.");
+
+    vkDestroyFence(device, fence, &allocator);
+    vkDestroyCommandPool(device, pool, &allocator);
+    for (i = 0; i < 2; i++) {
+	if (i == 0 || sources[1] != sources[0])
+	    vkDestroyBuffer(device, sources[i], &allocator);
+	vkFreeMemory(device, sourcememory[i], &allocator);
+    }
+    meshuploadtime = gettime() - start;
+}
+
+/* A scene file has the mesh and its instances, a mesh file only the mesh,
+ * packed offline by scenepack and meshpack. Without either the triangle
+ * goes through the mesh pipeline at load. */
+void
+createmesh(void)
+{
+    const SceneBounds *b;
+    MeshSource *vertices;
+    uint32_t *indices;
+    const void *data = NULL;
+    size_t size;
+
+    if (scenefile[0] != '\0') {
+	/* Pages a driver can import, the upload says which path it took */
+	scenedata = hashostimport ? mapfilecopy(scenefile, &size) :
+	    mapfile(scenefile, &size);
+	scene_read(&scene, scenedata, size);
+	b = (const SceneBounds *) scene.blobs[SCENE_BOUNDS].data;
+	mesh.vertices = (MeshVertex *) scene.blobs[SCENE_VERTICES].data;
+	mesh.indices = (uint32_t *) scene.blobs[SCENE_INDICES].data;
+	mesh.vertexcount = scene.blobs[SCENE_VERTICES].count;
+	mesh.indexcount = scene.blobs[SCENE_INDICES].count;
+	memcpy(mesh.centre, b->centre, sizeof mesh.centre);
+	mesh.scale = b->scale;
+	mesh.radius = b->radius;
+	mesh.base = NULL;
+    } else if (meshfile[0] != '\0') {
+	data = mapfile(meshfile, &size);
+	mesh_read(&mesh, data, size);
+    } else {
+	/* The pipeline reorders its input in place */
+	vertices = (MeshSource *) mem_alloc(&initarena,
+		sizeof trianglevertices);
+	indices = (uint32_t *) mem_alloc(&initarena, sizeof triangleindices);
+	memcpy(vertices, trianglevertices, sizeof trianglevertices);
+	memcpy(indices, triangleindices, sizeof triangleindices);
+	mesh_build(&mesh, vertices, COUNT(trianglevertices), indices,
+		COUNT(triangleindices));
+    }
+
+    uploadmesh();
+    /* The arrays may not outlive this */
+    cs_mesh(mesh.vertices, mesh.vertexcount, mesh.indices, mesh.indexcount);
+
+    if (data != NULL)
+	unmapfile(data);
+    mesh_free(&mesh);
+}
+
+void
+destroymesh(void)
+{
+    fprintf(stderr, "Mesh: %u vertices, %u triangles, uploaded in %.1f ms "
+	    "%s.\n", mesh.vertexcount, mesh.indexcount / 3,
+	    meshuploadtime * 1000.0, meshimported ? "from the mapped file" :
+	    "through staging");
+
+    vkDestroyBuffer(device, meshbuffer, &allocator);
+    vkFreeMemory(device, meshmemory, &allocator);
+    if (scenedata != NULL)
+	unmapfile(scenedata);
+}
+
+void
+updaterenderscale(uint32_t frame)
+{
+    uint64_t ts[2];
+    double ms, ideal;
+
+    /* The frame's fence has signalled so its timestamps are ready */
+    if (!queried[frame])
+	return;
+    queried[frame] = 0;
+    if (vkGetQueryPoolResults(device, querypool, 2 * frame, 2, sizeof ts, ts,
+		sizeof ts[0], VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+	return;
+
+#ifdef TRACE
+    tracegpuframe(ts);
+#endif /* TRACE */
+
+    /* GPU time excludes waiting for vsync, unlike the CPU frame time */
+    ms = (double) ((ts[1] - ts[0]) & timestampmask) * timestampperiod / 1e6;
+    if (postprocess != POST_OFF)
+	post_account(ms, vk_renderextent());
+    gputime = gputime == 0.0 ? ms : gputime + (ms - gputime) * framesmoothing;
+    gputotal += ms;
+    gpuframes++;
+    if (gputime <= 0.0)
+	return;
+
+    /* Cost goes with the pixel count, the square of the scale. Move part
+     * way there and ignore small changes so it doesn't hunt. */
+    ideal = renderscale * sqrt(framebudget / gputime);
+    if (fabs(ideal - renderscale) < 0.02)
+	return;
+    renderscale += (float) ((ideal - renderscale) * 0.25);
+    renderscale = CLAMP(renderscale, minrenderscale, maxrenderscale);
+}
+
+/* Frame timings are only taken for telemetry */
+double
+telclock(void)
+{
+    return telemetry ? gettime() : 0.0;
+}
+
+/* Everything the process has in device local heaps, zero if unknown */
+uint64_t
+querydevicebytes(void)
+{
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+	.sType =
+	    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+	.pNext = NULL
+    };
+    VkPhysicalDeviceMemoryProperties2 pdmp2 = {
+	.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+	.pNext = &budget
+    };
+    VkPhysicalDeviceMemoryProperties *mp = &pdmp2.memoryProperties;
+    uint64_t bytes = 0;
+    uint32_t i;
+
+    if (!hasmemorybudget)
+	return 0;
+    getmemoryproperties2(physicaldevice, &pdmp2);
+    for (i = 0; i < mp->memoryHeapCount; i++)
+	if (mp->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+	    bytes += budget.heapUsage[i];
+
+    return bytes;
+}
+
+#ifdef TRACE
+
+void
+initcalibration(void)
+{
+    PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT getdomains;
+    VkTimeDomainEXT *domains;
+    LARGE_INTEGER frequency;
+    uint32_t count, hasdevice = 0, hasqpc = 0, i;
+
+    if (!calibrated)
+	return;
+    getdomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)
+	vkGetInstanceProcAddr(instance,
+		"vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    if (getdomains == NULL)
+	return;
+
+    /* Need the GPU clock and the clock gettime() uses */
+    getdomains(physicaldevice, &count, NULL);
+    domains = (VkTimeDomainEXT *) mem_alloc(&initarena, count *
+	    sizeof(VkTimeDomainEXT));
+    getdomains(physicaldevice, &count, domains);
+    for (i = 0; i < count; i++) {
+	hasdevice |= domains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+	hasqpc |= domains[i] == VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+    }
+    if (!hasdevice || !hasqpc)
+	return;
+
+    getcalibratedtimestamps = (PFN_vkGetCalibratedTimestampsEXT)
+	vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+    QueryPerformanceFrequency(&frequency);
+    qpcperiod = 1.0 / (double) frequency.QuadPart;
+}
+
+void
+tracegpuframe(const uint64_t *ts)
+{
+    VkCalibratedTimestampInfoEXT ctis[] = {
+	{
+	    .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT,
+	    .pNext = NULL,
+	    .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT
+	},
+	{
+	    .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT,
+	    .pNext = NULL,
+	    .timeDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT
+	}
+    };
+    uint64_t now[2], deviation;
+    double end, duration;
+
+    if (getcalibratedtimestamps == NULL ||
+	    getcalibratedtimestamps(device, COUNT(ctis), ctis, now,
+		&deviation) != VK_SUCCESS)
+	return;
+
+    /* Work back from a sample of both clocks taken at the same time */
+    end = (double) now[1] * qpcperiod - (double) ((now[0] - ts[1]) &
+	    timestampmask) * timestampperiod / 1e9;
+    duration = (double) ((ts[1] - ts[0]) & timestampmask) * timestampperiod /
+	1e9;
+    TRACE_GPU("scene", end - duration, end);
+}
+
+#endif /* TRACE */
+
+VkExtent2D
+vk_renderextent(void)
+{
+    VkExtent2D extent;
+
+    extent.width = (uint32_t) (rendertarget.extent.width * renderscale +
+	    0.5f);
+    extent.height = (uint32_t) (rendertarget.extent.height * renderscale +
+	    0.5f);
+    extent.width = CLAMP(extent.width, 1, rendertarget.extent.width);
+    extent.height = CLAMP(extent.height, 1, rendertarget.extent.height);
+
+    return extent;
+}
+
+void
+drawscene(VkCommandBuffer cb, uint32_t frame)
+{
+    /* Three levels of braces: clearcolour.color.float32 */
+    VkClearValue clearcolour = {{{ 0.0f, 0.0f, 0.0f, 1.0f }}};
+    /* Only the scaled sub-rect of the render target is drawn */
+    VkExtent2D extent = vk_renderextent();
+    VkRenderPassBeginInfo rpbi = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+	.pNext = NULL,
 	.renderPass = renderpass,
-	.subpass = 0,
-	.basePipelineHandle = VK_NULL_HANDLE,
-	.basePipelineIndex = -1
+	.framebuffer = rendertarget.framebuffers[frame],
+	.renderArea.offset = { 0, 0 },
+	.renderArea.extent = extent,
+	.clearValueCount = 1,
+	.pClearValues = &clearcolour
     };
+    VkViewport viewport = {
+	.x = 0.0f,
+	.y = 0.0f,
+	.width = (float) extent.width,
+	.height = (float) extent.height,
+	.minDepth = 0.0f,
+	.maxDepth = 1.0f
+    };
+    VkRect2D scissor = {
+	.offset = { 0, 0 },
+	.extent = extent
+    };
+    uint32_t dynamicoffset = (uint32_t) (frame * uniformstride);
+    VkDescriptorSet sets[] = { descriptorset, bindlessset };
+    DrawConstants dc = {
+	.offset = { 0.0f, 0.0f },
+	.scale = 1.0f,
+	.rotation = 0.0f,
+	.texture = NOHANDLE,
+	.buffer = NOHANDLE,
+	.minlod = 0.0f
+    };
+    PipelineKey key = {
+	.colourmode = colourmode,
+	.textured = texture != NULL
+    };
+    CsPass pass = {
+	.format = postprocess == POST_OFF ? surfaceformat.format :
+	    POST_HDRFORMAT,
+	.target = rendertarget.extent,
+	.extent = extent,
+	.clear = { 0.0f, 0.0f, 0.0f, 0.0f }
+    };
+    CsDraw draw = {
+	.indexcount = mesh.indexcount,
+	.instancecount = 1,
+	.firstindex = 0,
+	.vertexoffset = 0,
+	.firstinstance = 0
+    };
+    VkDeviceSize zero = 0;
+    uint32_t capturing = cs_capturing(), i, o;
+
+    if (texture != NULL) {
+	dc.texture = tex_handle(texture);
+	dc.minlod = tex_minlod(texture);
+    }
+
+    /* Not using secondary command buffers */
+    vkCmdBeginRenderPass(cb, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
+    /* This is for graphics and not compute */
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	    pipe_get(pipe_request(key)));
+    vkCmdSetViewport(cb, 0, 1, &viewport);
+    vkCmdSetScissor(cb, 0, 1, &scissor);
+    /* Bound once per frame, draws only change push constants */
+    vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+	    pipelinelayout, 0, COUNT(sets), sets, 1, &dynamicoffset);
+    vkCmdBindVertexBuffers(cb, 0, 1, &meshbuffer, &zero);
+    vkCmdBindIndexBuffer(cb, meshbuffer, meshindexoffset,
+	    VK_INDEX_TYPE_UINT32);
+    if (capturing) {
+	/* Once something can be sampled, the draws then refer to it */
+	if (dc.texture != NOHANDLE)
+	    tex_capture(texture);
+	memcpy(pass.clear, clearcolour.color.float32, sizeof pass.clear);
+	cs_command(CS_BEGINPASS, &pass, sizeof pass);
+	cs_command(CS_BINDPIPELINE, &key, sizeof key);
+    }
+    /* Resources are picked by bindless handle, every object is the mesh
+     * scaled to its bounds. The mesh's own centre and scale dequantise its
+     * positions, with no rotation they fold into the offset and scale. */
+    for (i = 0; i < objects.visiblecount; i++) {
+	o = objects.visible[i];
+	dc.scale = objects.radius[o] / mesh.radius;
+	dc.offset[0] = objects.x[o] + dc.scale * mesh.centre[0];
+	dc.offset[1] = objects.y[o] + dc.scale * mesh.centre[1];
+	dc.scale *= mesh.scale;
+	vkCmdPushConstants(cb, pipelinelayout,
+		VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+		sizeof dc, &dc);
+	vkCmdDrawIndexed(cb, mesh.indexcount, 1, 0, 0, 0);
+	if (capturing) {
+	    cs_command(CS_PUSHCONSTANTS, &dc, sizeof dc);
+	    cs_command(CS_DRAWINDEXED, &draw, sizeof draw);
+	}
+    }
+    /* The sprites and the post-processing aren't captured */
+    if (capturing)
+	cs_command(CS_ENDPASS, NULL, 0);
+    /* Same layout, the descriptor sets stay bound */
+    spr_record(cb, frame);
+    if (postprocess == POST_SUBPASSES)
+	post_subpasses(cb, frame);
+    vkCmdEndRenderPass(cb);
+}
 
-    if (vkCreatePipelineLayout(device, &plci, NULL, &pipelinelayout) !=
-	    VK_SUCCESS)
-	terminate("Failed to create pipeline layout.");
+void
+scenedone(VkCommandBuffer cb, uint32_t frame)
+{
+    if (querypool == VK_NULL_HANDLE)
+	return;
 
-    gpci.layout = pipelinelayout;
+    vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, querypool,
+	    2 * frame + 1);
+    queried[frame] = 1;
+}
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &gpci, NULL,
-		&graphicspipeline) != VK_SUCCESS)
-	terminate("Failed to create graphics pipeline.");
+/* From the render extent of the source to the whole swap chain image */
+void
+blitscene(VkCommandBuffer cb, VkImage src, VkExtent2D extent, VkImage dst)
+{
+    VkImageBlit blit = {
+	.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.srcSubresource.mipLevel       = 0,
+	.srcSubresource.baseArrayLayer = 0,
+	.srcSubresource.layerCount     = 1,
+	.srcOffsets = {
+	    { 0, 0, 0 },
+	    { (int32_t) extent.width, (int32_t) extent.height, 1 }
+	},
+	.dstSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.dstSubresource.mipLevel       = 0,
+	.dstSubresource.baseArrayLayer = 0,
+	.dstSubresource.layerCount     = 1,
+	.dstOffsets = {
+	    { 0, 0, 0 },
+	    { (int32_t) swapchain.extent.width,
+		(int32_t) swapchain.extent.height, 1 }
+	}
+    };
 
-    vkDestroyShaderModule(device, vertexsm,   NULL);
-    vkDestroyShaderModule(device, fragmentsm, NULL);
-    deleteshadercode(&vertexcode);
-    deleteshadercode(&fragmentcode);
+    vkCmdBlitImage(cb, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst,
+	    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, rendertarget.filter);
 }
 
 void
-destroygraphicspipeline(void)
+upscale(VkCommandBuffer cb, uint32_t frame)
 {
-    vkDestroyPipeline(device, graphicspipeline, NULL);
-    vkDestroyPipelineLayout(device, pipelinelayout, NULL);
+    /* Kept to present again without drawing */
+    lastframe = frame;
+    lastextent = vk_renderextent();
+    blitscene(cb, rg_getimage(scenecolour, frame), lastextent,
+	    rg_getimage(backbuffer, frame));
 }
 
+/* Only the upscale of the last frame drawn, its scene colour is still in
+ * the layout the upscale left it in. Outside the graph as nothing else of
+ * the frame runs, the graph has the next frame drawn in that slot wait for
+ * the blit. */
 void
-createframebuffers(void)
+recordrepeat(VkCommandBuffer cb, uint32_t imageindex)
 {
-    uint32_t i;
-    VkFramebufferCreateInfo fci = {
-	.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+    VkCommandBufferBeginInfo cbbi = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 	.pNext = NULL,
 	.flags = 0,
-	.renderPass = renderpass,
-	.attachmentCount = 1,
-	.pAttachments = NULL,
-	.width = swapchain.extent.width,
-	.height = swapchain.extent.height,
-	.layers = 1
+	.pInheritanceInfo = NULL
+    };
+    VkImageMemoryBarrier imb = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	.pNext = NULL,
+	.srcAccessMask = 0,
+	.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.image = swapchain.images[imageindex],
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
     };
 
-    swapchain.framebuffers = (VkFramebuffer *) malloc(swapchain.imagecount *
-	    sizeof(VkFramebuffer));
+    if (vkBeginCommandBuffer(cb, &cbbi) != VK_SUCCESS)
+	terminate("Failed to begin recording command buffer.");
 
-    for (i = 0; i < swapchain.imagecount; i++) {
-	fci.pAttachments = &swapchain.imageviews[i];
+    /* After the last frame's transfers, which may still be running */
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imb);
+    blitscene(cb, rg_getimage(scenecolour, lastframe), lastextent,
+	    imb.image);
+    imb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imb.dstAccessMask = 0;
+    imb.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imb.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &imb);
+
+    if (vkEndCommandBuffer(cb) != VK_SUCCESS)
+	terminate("Failed to record command buffer.");
+}
 
-	if (vkCreateFramebuffer(device, &fci, NULL,
-		    &swapchain.framebuffers[i]) != VK_SUCCESS)
-	    terminate("Failed to create framebuffer.");
-    }
+void
+captureframe(VkCommandBuffer cb, uint32_t frame)
+{
+    cap_record(cb, frame, rg_getimage(backbuffer, frame), swapchain.extent);
 }
 
+/* Scales the finished frame into each view with an image this frame. The
+ * frame's submission waits for those images at the transfer stage. */
 void
-destroyframebuffers(void)
+blitviews(VkCommandBuffer cb, uint32_t frame)
 {
-    uint32_t i;
+    VkImageMemoryBarrier before[MAXWINDOWS - 1], after[MAXWINDOWS - 1];
+    VkImageMemoryBarrier imb = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	.pNext = NULL,
+	.srcAccessMask = 0,
+	.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+	/* Every pixel is written */
+	.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.image = VK_NULL_HANDLE,
+	.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.subresourceRange.baseMipLevel   = 0,
+	.subresourceRange.levelCount     = 1,
+	.subresourceRange.baseArrayLayer = 0,
+	.subresourceRange.layerCount     = 1
+    };
+    VkImageBlit blit = {
+	.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.srcSubresource.mipLevel       = 0,
+	.srcSubresource.baseArrayLayer = 0,
+	.srcSubresource.layerCount     = 1,
+	.srcOffsets = {
+	    { 0, 0, 0 },
+	    { (int32_t) swapchain.extent.width,
+		(int32_t) swapchain.extent.height, 1 }
+	},
+	.dstSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.dstSubresource.mipLevel       = 0,
+	.dstSubresource.baseArrayLayer = 0,
+	.dstSubresource.layerCount     = 1,
+	.dstOffsets = { { 0, 0, 0 }, { 0, 0, 1 } }
+    };
+    /* The corner both images have */
+    VkImageCopy copy = {
+	.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.srcSubresource.mipLevel       = 0,
+	.srcSubresource.baseArrayLayer = 0,
+	.srcSubresource.layerCount     = 1,
+	.srcOffset = { 0, 0, 0 },
+	.dstSubresource.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT,
+	.dstSubresource.mipLevel       = 0,
+	.dstSubresource.baseArrayLayer = 0,
+	.dstSubresource.layerCount     = 1,
+	.dstOffset = { 0, 0, 0 },
+	.extent = { 0, 0, 1 }
+    };
+    View *acquired[MAXWINDOWS - 1];
+    VkExtent2D extent;
+    uint32_t count = 0, i;
 
-    for (i = 0; i < swapchain.imagecount; i++)
-	vkDestroyFramebuffer(device, swapchain.framebuffers[i], NULL);
+    for (i = 0; i < viewcount; i++) {
+	if (!views[i].acquired)
+	    continue;
+	acquired[count] = &views[i];
+	imb.image = views[i].swapchain.images[views[i].imageindex];
+	before[count] = imb;
+	after[count] = imb;
+	after[count].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	after[count].dstAccessMask = 0;
+	after[count].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	after[count].newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	count++;
+    }
+    if (count == 0)
+	return;
 
-    free(swapchain.framebuffers);
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, count,
+	    before);
+    for (i = 0; i < count; i++) {
+	extent = acquired[i]->swapchain.extent;
+	if (!acquired[i]->blit) {
+	    copy.extent.width = extent.width < swapchain.extent.width ?
+		extent.width : swapchain.extent.width;
+	    copy.extent.height = extent.height < swapchain.extent.height ?
+		extent.height : swapchain.extent.height;
+	    vkCmdCopyImage(cb, rg_getimage(backbuffer, frame),
+		    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, before[i].image,
+		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+	    continue;
+	}
+	blit.dstOffsets[1].x = (int32_t) extent.width;
+	blit.dstOffsets[1].y = (int32_t) extent.height;
+	vkCmdBlitImage(cb, rg_getimage(backbuffer, frame),
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, before[i].image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+		acquired[i]->filter);
+    }
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT,
+	    VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, count,
+	    after);
 }
 
 void
@@ -1122,14 +2859,205 @@ createcommandpool(void)
 	.queueFamilyIndex = qf.graphics
     };
 
-    if (vkCreateCommandPool(device, &cpci, NULL, &commandpool) != VK_SUCCESS)
+    if (vkCreateCommandPool(device, &cpci, &allocator, &commandpool) !=
+	    VK_SUCCESS)
 	terminate("Failed to create command pool.");
 }
 
 void
 destroycommandpool(void)
 {
-    vkDestroyCommandPool(device, commandpool, NULL);
+    vkDestroyCommandPool(device, commandpool, &allocator);
+}
+
+uint32_t
+vk_findmemorytype(uint32_t typefilter, VkMemoryPropertyFlags properties)
+{
+    uint32_t i;
+    VkPhysicalDeviceMemoryProperties pdmp;
+
+    vkGetPhysicalDeviceMemoryProperties(physicaldevice, &pdmp);
+
+    /* First memory type allowed by the resource with all the properties */
+    for (i = 0; i < pdmp.memoryTypeCount; i++)
+	if ((typefilter & (1 << i)) &&
+		(pdmp.memoryTypes[i].propertyFlags & properties) == properties)
+	    return i;
+
+    terminate("Failed to find suitable memory type.");
+    return 0;
+}
+
+void
+vk_createbuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties, VkBuffer *buffer,
+	VkDeviceMemory *memory)
+{
+    VkMemoryRequirements mr;
+    VkBufferCreateInfo bci = {
+	.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.size = size,
+	.usage = usage,
+	/* Only used by the graphics queue */
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.queueFamilyIndexCount = 0,
+	.pQueueFamilyIndices = NULL
+    };
+    VkMemoryAllocateInfo mai = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.pNext = NULL,
+	.allocationSize = 0,
+	.memoryTypeIndex = 0
+    };
+
+    if (vkCreateBuffer(device, &bci, &allocator, buffer) != VK_SUCCESS)
+	terminate("Failed to create buffer.");
+
+    vkGetBufferMemoryRequirements(device, *buffer, &mr);
+    mai.allocationSize = mr.size;
+    mai.memoryTypeIndex = vk_findmemorytype(mr.memoryTypeBits, properties);
+
+    if (vkAllocateMemory(device, &mai, &allocator, memory) != VK_SUCCESS)
+	terminate("Failed to allocate buffer memory.");
+
+    if (vkBindBufferMemory(device, *buffer, *memory, 0) != VK_SUCCESS)
+	terminate("Failed to bind buffer memory.");
+}
+
+void
+createuniformbuffer(void)
+{
+    VkPhysicalDeviceProperties pdp;
+    VkDeviceSize align;
+
+    /* One slot per frame in flight, each aligned for use as a dynamic
+     * offset */
+    vkGetPhysicalDeviceProperties(physicaldevice, &pdp);
+    align = pdp.limits.minUniformBufferOffsetAlignment;
+    uniformstride = (sizeof(FrameUniforms) + align - 1) & ~(align - 1);
+
+    vk_createbuffer(uniformstride * MAXFRAMES,
+	    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+	    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+	    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	    &uniformbuffer, &uniformmemory);
+
+    /* Keep the buffer mapped for the lifetime of the program */
+    if (vkMapMemory(device, uniformmemory, 0, VK_WHOLE_SIZE, 0,
+		(void **) &uniformdata) != VK_SUCCESS)
+	terminate("Failed to map uniform buffer.");
+
+    starttime = lasttime = gettime();
+}
+
+void
+destroyuniformbuffer(void)
+{
+    vkUnmapMemory(device, uniformmemory);
+    vkDestroyBuffer(device, uniformbuffer, &allocator);
+    vkFreeMemory(device, uniformmemory, &allocator);
+}
+
+/* Column major orthographic camera keeping the unit square square */
+void
+viewprojection(float *m)
+{
+    float aspect = (float) swapchain.extent.width /
+	(float) swapchain.extent.height;
+
+    memset(m, 0, 16 * sizeof(float));
+    m[0]  = 1.0f / aspect;
+    m[5]  = 1.0f;
+    m[10] = 1.0f;
+    m[15] = 1.0f;
+}
+
+void
+updateuniformbuffer(uint32_t frame)
+{
+    FrameUniforms fu = { 0 };
+    double now = gettime();
+
+    viewprojection(fu.viewproj);
+    fu.time = (float) (now - starttime);
+    fu.deltatime = (float) (now - lasttime);
+    lasttime = now;
+
+    /* The frame's fence has been waited on so the GPU is done with its slot */
+    memcpy(uniformdata + frame * uniformstride, &fu, sizeof fu);
+}
+
+void
+uniformjob(void *data)
+{
+    updateuniformbuffer(*(const uint32_t *) data);
+}
+
+void
+createdescriptorpool(void)
+{
+    VkDescriptorPoolSize dps = {
+	.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.descriptorCount = 1
+    };
+    VkDescriptorPoolCreateInfo dpci = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	.pNext = NULL,
+	.flags = 0,
+	.maxSets = 1,
+	.poolSizeCount = 1,
+	.pPoolSizes = &dps
+    };
+
+    if (vkCreateDescriptorPool(device, &dpci, &allocator, &descriptorpool) !=
+	    VK_SUCCESS)
+	terminate("Failed to create descriptor pool.");
+}
+
+void
+destroydescriptorpool(void)
+{
+    /* Also frees the descriptor set */
+    vkDestroyDescriptorPool(device, descriptorpool, &allocator);
+}
+
+void
+createdescriptorsets(void)
+{
+    VkDescriptorSetAllocateInfo dsai = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+	.pNext = NULL,
+	.descriptorPool = descriptorpool,
+	.descriptorSetCount = 1,
+	.pSetLayouts = &descriptorsetlayout
+    };
+    /* The whole ring is described once, frames select their slot with a
+     * dynamic offset */
+    VkDescriptorBufferInfo dbi = {
+	.buffer = uniformbuffer,
+	.offset = 0,
+	.range = sizeof(FrameUniforms)
+    };
+    VkWriteDescriptorSet wds = {
+	.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+	.pNext = NULL,
+	.dstSet = VK_NULL_HANDLE,
+	.dstBinding = 0,
+	.dstArrayElement = 0,
+	.descriptorCount = 1,
+	.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+	.pImageInfo = NULL,
+	.pBufferInfo = &dbi,
+	.pTexelBufferView = NULL
+    };
+
+    if (vkAllocateDescriptorSets(device, &dsai, &descriptorset) != VK_SUCCESS)
+	terminate("Failed to allocate descriptor sets.");
+
+    wds.dstSet = descriptorset;
+    vkUpdateDescriptorSets(device, 1, &wds, 0, NULL);
 }
 
 void
@@ -1157,57 +3085,77 @@ recordcommandbuffer(VkCommandBuffer commandbuffers, uint32_t imageindex)
 	.flags = 0,
 	.pInheritanceInfo = NULL
     };
-    /* Three levels of braces: clearcolour.color.float32 */
-    VkClearValue clearcolour = {{{ 0.0f, 0.0f, 0.0f, 1.0f }}};
-    VkRenderPassBeginInfo rpbi = {
-	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-	.pNext = NULL,
-	.renderPass = renderpass,
-	.framebuffer = swapchain.framebuffers[imageindex],
-	.renderArea.offset = { 0, 0 },
-	.renderArea.extent = swapchain.extent,
-	.clearValueCount = 1,
-	.pClearValues = &clearcolour
-    };
-    VkViewport viewport = {
-	.x = 0.0f,
-	.y = 0.0f,
-	.width = (float) swapchain.extent.width,
-	.height = (float) swapchain.extent.height,
-	.minDepth = 0.0f,
-	.maxDepth = 1.0f
-    };
-    VkRect2D scissor = {
-	.offset = { 0, 0 },
-	.extent = swapchain.extent
-    };
 
     if (vkBeginCommandBuffer(commandbuffers, &cbbi) != VK_SUCCESS)
 	terminate("Failed to begin recording command buffer.");
 
-    /* Not using secondary command buffers */
-    vkCmdBeginRenderPass(commandbuffers, &rpbi, VK_SUBPASS_CONTENTS_INLINE);
-    /* This is for graphics and not compute */
-    vkCmdBindPipeline(commandbuffers, VK_PIPELINE_BIND_POINT_GRAPHICS,
-	    graphicspipeline);
-    vkCmdSetViewport(commandbuffers, 0, 1, &viewport);
-    vkCmdSetScissor(commandbuffers, 0, 1, &scissor);
-    vkCmdDraw(commandbuffers, vertexcount, 1, 0, 0);
-    vkCmdEndRenderPass(commandbuffers);
+    /* Stream in texture mips before any draws sample them */
+    tex_update(commandbuffers, currentframe);
+
+    if (querypool != VK_NULL_HANDLE) {
+	vkCmdResetQueryPool(commandbuffers, querypool, 2 * currentframe, 2);
+	vkCmdWriteTimestamp(commandbuffers, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		querypool, 2 * currentframe);
+    }
+
+    rg_bind(backbuffer, swapchain.images[imageindex]);
+    rg_execute(commandbuffers, currentframe);
 
     if (vkEndCommandBuffer(commandbuffers) != VK_SUCCESS)
 	terminate("Failed to record command buffer.");
 }
 
+/* On whichever worker picks it up, only one records at a time so the pool
+ * needs no lock */
+void
+recordjob(void *data)
+{
+    vkResetCommandBuffer(commandbuffers[currentframe], 0);
+    recordcommandbuffer(commandbuffers[currentframe],
+	    *(const uint32_t *) data);
+}
+
+void
+spritejob(void *data)
+{
+    UNUSED(data);
+    spr_build();
+}
+
+/* Visible objects are drawn in index order */
+void
+culljob(void *data)
+{
+    float m[16];
+    Frustum f;
+
+    UNUSED(data);
+    viewprojection(m);
+    cull_planes(&f, m);
+    cull_frustum(&objects, &f, CULL_AUTO);
+}
+
+/* Low latency mode holds the next frame back here */
+void
+vk_waitframe(void)
+{
+    lat_wait(gputime);
+}
+
 void
 vk_drawframe(void)
 {
-    uint32_t imageindex, n = currentframe;
-    VkResult result;
-    /* Don't write colours till image is available */
-    VkSemaphore waitsems[] = { imagesems[n] };
-    VkPipelineStageFlags waitstages[] = {
-	VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    uint32_t imageindices[MAXWINDOWS], n = currentframe, count, repeat, i;
+    TelFrame tf = { 0 };
+    double t;
+    VkResult results[MAXWINDOWS], result;
+    JobCounter prepared = { 0 }, recorded = { 0 };
+    /* Rendering is offscreen, only the image's first use waits for it. The
+     * views' images are first used by transfers. */
+    VkSemaphore waitsems[MAXWINDOWS] = { imagesems[n] };
+    VkPipelineStageFlags waitstages[MAXWINDOWS] = {
+	rg_waitstage(backbuffer)
+    };
     VkSemaphore signalsems[] = { rendersems[n] };
     VkSubmitInfo submitinfo = {
 	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -1220,7 +3168,9 @@ vk_drawframe(void)
 	.signalSemaphoreCount = 1,
 	.pSignalSemaphores = signalsems
     };
-    VkSwapchainKHR swapchains[] = { swapchain.handle };
+    /* Every window in one present, the main one first */
+    VkSwapchainKHR swapchains[MAXWINDOWS] = { swapchain.handle };
+    View *presented[MAXWINDOWS] = { NULL };
     VkPresentInfoKHR presentinfo = {
 	.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
 	.pNext = NULL,
@@ -1228,46 +3178,154 @@ vk_drawframe(void)
 	.pWaitSemaphores = signalsems,
 	.swapchainCount = 1,
 	.pSwapchains = swapchains,
-	.pImageIndices = &imageindex,
-	.pResults = NULL
+	.pImageIndices = imageindices,
+	.pResults = results
     };
 
     /* Wait for the previous frame to finish rendering. The fence is created in
      * the signaled state so the first call won't block. */
+    TRACE_BEGIN("vk_drawframe");
+    /* Only exposed since the last frame drawn, so present that again.
+     * Anything changing from here on is drawn next frame. */
+    repeat = ondemand && repeatexposed && exposed && !dirty && lastdrawn &&
+	!animating();
+    exposed = 0;
+    if (!repeat)
+	InterlockedExchange(&dirty, 0);
+    lat_beginframe();
+    tf.start = telclock();
+    TRACE_BEGIN("wait for frame");
     vkWaitForFences(device, 1, &framefences[n], VK_TRUE, UINT64_MAX);
-
+    TRACE_END();
+    t = telclock();
+    tf.fencewait = (float) ((t - tf.start) * 1000.0);
+    releaseretiredslots();
+    pipe_update(framecount);
+    updaterenderscale(n);
+    cap_collect(n);
+
+    TRACE_BEGIN("acquire");
+    t = telclock();
     result = vkAcquireNextImageKHR(device, swapchain.handle, UINT64_MAX,
-	    imagesems[n], VK_NULL_HANDLE, &imageindex);
+	    imagesems[n], VK_NULL_HANDLE, &imageindices[0]);
+    tf.acquire = (float) ((telclock() - t) * 1000.0);
+    TRACE_END();
     /* Recreate the swap chain if it's out of date but continue if merely
      * suboptimal. */
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-	recreateswapchain();
+	TRACE_CALL(recreateswapchain());
+	TRACE_END();
 	return;
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
 	terminate("Failed to acquire swap chain image.");
     }
+    lat_acquired();
+    /* Views keep showing their last image when only presenting again */
+    if (!repeat)
+	acquireviews(n);
+    for (i = 0; i < viewcount && !repeat; i++) {
+	if (!views[i].acquired)
+	    continue;
+	count = presentinfo.swapchainCount++;
+	waitsems[count] = views[i].imagesems[n];
+	waitstages[count] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	swapchains[count] = views[i].swapchain.handle;
+	imageindices[count] = views[i].imageindex;
+	presented[count] = &views[i];
+    }
+    submitinfo.waitSemaphoreCount = presentinfo.swapchainCount;
 
     /* Don't reset the fence till we know we're submitting work */
     vkResetFences(device, 1, &framefences[n]);
 
-    vkResetCommandBuffer(commandbuffers[n], 0);
-    recordcommandbuffer(commandbuffers[n], imageindex);
+    if (repeat) {
+	/* The blit is the image's only use */
+	waitstages[0] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	vkResetCommandBuffer(commandbuffers[n], 0);
+	recordrepeat(commandbuffers[n], imageindices[0]);
+	repeatcount++;
+    } else {
+	if (demosprites > 0)
+	    adddemosprites();
+	cs_beginframe(framecount);
+	/* Recording needs the visible list and the sprite batches but not
+	 * the sprite vertices, those and the uniforms are written alongside
+	 * it */
+	job_run("spr_build", spritejob, NULL, &prepared);
+	job_run("cullobjects", culljob, NULL, &prepared);
+	job_run("updateuniformbuffer", uniformjob, &n, &recorded);
+	job_wait(&prepared);
+	spr_write(n, &recorded);
+	job_run("recordcommandbuffer", recordjob, &imageindices[0],
+		&recorded);
+	job_wait(&recorded);
+	cs_endframe(uniformdata + n * uniformstride, sizeof(FrameUniforms));
+	lastdrawn = 1;
+	drawncount++;
+    }
 
+    TRACE_BEGIN("submit");
+    t = telclock();
     if (vkQueueSubmit(graphics, 1, &submitinfo, framefences[n]) != VK_SUCCESS)
 	terminate("Failed to submit draw command buffer.");
-
-    result = vkQueuePresentKHR(present, &presentinfo);
+    tf.submit = (float) ((telclock() - t) * 1000.0);
+    framecount++;
+    TRACE_END();
+
+    TRACE_BEGIN("present");
+    lat_present(&presentinfo);
+    t = telclock();
+    vkQueuePresentKHR(present, &presentinfo);
+    tf.present = (float) ((telclock() - t) * 1000.0);
+    result = results[0];
+    lat_presented(swapchain.handle, result);
+    for (i = 1; i < presentinfo.swapchainCount; i++) {
+	if (results[i] == VK_SUCCESS || results[i] == VK_SUBOPTIMAL_KHR)
+	    viewpresents++;
+	else if (results[i] != VK_ERROR_OUT_OF_DATE_KHR)
+	    terminate("Failed to present view swap chain image.");
+	/* Recreated before its next acquire, and drawn to */
+	if (results[i] != VK_SUCCESS) {
+	    presented[i]->resized = 1;
+	    vk_invalidate();
+	}
+    }
+    TRACE_END();
     /* Recreate the swap chain if out of date, suboptimal or resized as we
      * want the best possible image. */
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
 	    framebufferresized) {
 	framebufferresized = 0;
-	recreateswapchain();
+	TRACE_CALL(recreateswapchain());
     } else if (result != VK_SUCCESS) {
 	terminate("Failed to present swap chain image.");
     }
 
+#ifdef DEBUG
+    /* Startup cost, cold on the first run after the driver caches are
+     * cleared and warm after that */
+    if (framecount == 1)
+	fprintf(stderr, "First frame presented %.1f ms after initialising.\n",
+		(gettime() - inittime) * 1000.0);
+#endif /* DEBUG */
+
+    /* Copies a few counters, only the device's bytes call the driver. The
+     * frame just submitted, numbered as it was captured. */
+    if (telemetry) {
+	tf.frame = framecount - 1;
+	if (tf.frame % telemetryperiod == 0)
+	    devicebytes = querydevicebytes();
+	tf.frametime = lastframestart == 0.0 ? 0.0f :
+	    (float) ((tf.start - lastframestart) * 1000.0);
+	tf.recreations = recreations;
+	tf.hostbytes = mem_hostbytes();
+	tf.devicebytes = devicebytes;
+	tel_write(&tf);
+	lastframestart = tf.start;
+    }
+
     currentframe = ++n % MAXFRAMES;
+    TRACE_END();
 }
 
 void
@@ -1286,9 +3344,9 @@ createsyncobjects(void)
     };
 
     for (i = 0; i < MAXFRAMES; i++)
-	if (vkCreateSemaphore(device, &sci, NULL, &imagesems[i]) != VK_SUCCESS
-		|| vkCreateSemaphore(device, &sci, NULL, &rendersems[i]) != VK_SUCCESS
-		|| vkCreateFence(device, &fci, NULL, &framefences[i]) != VK_SUCCESS)
+	if (vkCreateSemaphore(device, &sci, &allocator, &imagesems[i]) != VK_SUCCESS
+		|| vkCreateSemaphore(device, &sci, &allocator, &rendersems[i]) != VK_SUCCESS
+		|| vkCreateFence(device, &fci, &allocator, &framefences[i]) != VK_SUCCESS)
 	    terminate("Failed to create semaphores.");
 }
 
@@ -1298,9 +3356,95 @@ destroysyncobjects(void)
     uint32_t i;
 
     for (i = 0; i < MAXFRAMES; i++) {
-	vkDestroySemaphore(device, imagesems[i], NULL);
-	vkDestroySemaphore(device, rendersems[i], NULL);
-	vkDestroyFence(device, framefences[i], NULL);
+	vkDestroySemaphore(device, imagesems[i], &allocator);
+	vkDestroySemaphore(device, rendersems[i], &allocator);
+	vkDestroyFence(device, framefences[i], &allocator);
+    }
+}
+
+void
+initcapture(void)
+{
+    cap_initialise(swapchain.imageformat, swapchain.extent);
+}
+
+/* Before the mesh task, which writes the mesh to it */
+void
+initcommandstream(void)
+{
+    cs_initialise(streamfile, streamfirst, streamframes);
+    cs_shader(VK_SHADER_STAGE_VERTEX_BIT, vertexshader);
+    cs_shader(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentshader);
+}
+
+void
+inittextures(void)
+{
+    tex_initialise();
+    if (texturefile[0] != '\0')
+	texture = tex_load(texturefile);
+}
+
+void
+initsprites(void)
+{
+    spr_initialise(renderpass, pipelinelayout);
+}
+
+/* The scene's instances or else the mesh at the origin, then the test
+ * objects scattered about them, most of them out of view */
+void
+initobjects(void)
+{
+    const SceneInstance *instances = (const SceneInstance *)
+	scene.blobs[SCENE_INSTANCES].data;
+    uint32_t i, noise = 1;
+    float x, y;
+
+    cull_initialise(&objects, maxobjects);
+    for (i = 0; i < scene.blobs[SCENE_INSTANCES].count; i++)
+	cull_add(&objects, instances[i].x, instances[i].y, instances[i].z,
+		instances[i].radius);
+    if (objects.count == 0)
+	cull_add(&objects, 0.0f, 0.0f, 0.0f, mesh.radius);
+    for (i = 0; i < demoobjects && objects.count < objects.capacity; i++) {
+	noise = noise * 1664525 + 1013904223;
+	x = (float) (noise >> 16) / 65536.0f * 8.0f - 4.0f;
+	y = (float) (noise & 0xffff) / 65536.0f * 8.0f - 4.0f;
+	cull_add(&objects, x, y, 0.0f, 0.02f);
+    }
+}
+
+/* A turning ring over the triangle, spread across layers and blend modes */
+void
+adddemosprites(void)
+{
+    Sprite s = {
+	.x = 0.0f,
+	.y = 0.0f,
+	.width = 0.04f,
+	.height = 0.04f,
+	.u0 = 0.0f,
+	.v0 = 0.0f,
+	.u1 = 1.0f,
+	.v1 = 1.0f,
+	.colour = 0,
+	.texture = NOHANDLE,
+	.layer = 0,
+	.blend = SPRITE_OPAQUE
+    };
+    float t = (float) (gettime() - starttime), a;
+    uint32_t i;
+
+    for (i = 0; i < demosprites; i++) {
+	a = 6.2831853f * (float) i / (float) demosprites + 0.5f * t;
+	s.x = cosf(a) * (0.6f + 0.2f * sinf(7.0f * a));
+	s.y = sinf(a) * (0.6f + 0.2f * sinf(7.0f * a));
+	/* Alpha 0xc0 shows through on the blended ones */
+	s.colour = 0xc0000000 | (i * 2654435761u & 0xffffff);
+	s.layer = (uint8_t) (i & 3);
+	s.blend = (uint8_t) (i >> 2 & 1);
+	spr_draw(&s);
     }
 }
 
@@ -1310,8 +3454,94 @@ devicewait(void)
     vkDeviceWaitIdle(device);
 }
 
+/* 0 is the main window, views count from 1 */
+void
+vk_onresize(uint32_t window)
+{
+    if (window == 0)
+	framebufferresized = 1;
+    else if (window <= viewcount)
+	views[window - 1].resized = 1;
+    vk_invalidate();
+}
+
+/* A view is drawn to again, it has no image of its own to present */
+void
+vk_onexpose(uint32_t window)
+{
+    if (window == 0)
+	exposed = 1;
+    else
+	vk_invalidate();
+}
+
+/* From any thread, wakes the main loop if it's idle */
+void
+vk_invalidate(void)
+{
+    InterlockedExchange(&dirty, 1);
+    SetEvent(wakeevent);
+}
+
+/* Whether on demand rendering has nothing to draw or present */
+uint32_t
+vk_idle(void)
+{
+    return ondemand && !dirty && !exposed && !animating();
+}
+
+/* Between frames, before the view's window goes */
+void
+vk_closewindow(uint32_t window)
+{
+    if (window == 0 || window > viewcount)
+	return;
+
+    devicewait();
+    destroyview(&views[window - 1]);
+}
+
+void
+vk_cyclecolourmode(void)
+{
+    colourmode = (colourmode + 1) % COLOUR_COUNT;
+    vk_invalidate();
+}
+
+/* Demo sprites move and a capture records every frame */
+uint32_t
+animating(void)
+{
+    return demosprites > 0 || capturefile[0] != '\0';
+}
+
+/* Seconds of user and kernel time for the whole process */
+double
+cputime(void)
+{
+    FILETIME creation, exited, kernel, user;
+
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel,
+		&user))
+	return 0.0;
+
+    /* In 100 ns units */
+    return (double) (((uint64_t) kernel.dwHighDateTime << 32 |
+		kernel.dwLowDateTime) + ((uint64_t) user.dwHighDateTime << 32 |
+		user.dwLowDateTime)) * 1e-7;
+}
+
+/* CPU use is the proxy for power here, an idle scene on demand should be
+ * near zero. Package power needs an outside tool. */
 void
-vk_onresize(void)
+reportusage(void)
 {
-    framebufferresized = 1;
+    double seconds = gettime() - runtime;
+
+    if (seconds <= 0.0)
+	return;
+    fprintf(stderr, "Ran %.1f s: %llu frames drawn, %llu presented again, "
+	    "%.1f%% of a core.\n", seconds, (unsigned long long) drawncount,
+	    (unsigned long long) repeatcount,
+	    (cputime() - runcpu) / seconds * 100.0);
 }
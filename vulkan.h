@@ -1,4 +1,45 @@
+#include <vulkan/vulkan.h>
+
+/* Frames in flight */
+#define MAXFRAMES 2
+/* Windows presented together, the main one first */
+#define MAXWINDOWS 4
+
+/* Bindless handle that refers to nothing */
+#define NOHANDLE UINT32_MAX
+
+/* Per-draw parameters, must match the push_constant blocks in vertex.glsl
+ * and sprite.glsl */
+typedef struct {
+    float offset[2];
+    float scale;
+    float rotation;
+    uint32_t texture;
+    uint32_t buffer;
+    float minlod;
+} DrawConstants;
+
+extern VkPhysicalDevice physicaldevice;
+extern VkDevice device;
+
 void vk_initialise(void);
 void vk_terminate(void);
+void vk_waitframe(void);
 void vk_drawframe(void);
-void vk_onresize(void);
+void vk_invalidate(void);
+uint32_t vk_idle(void);
+void vk_onresize(uint32_t window);
+void vk_onexpose(uint32_t window);
+void vk_closewindow(uint32_t window);
+void vk_cyclecolourmode(void);
+VkExtent2D vk_renderextent(void);
+uint32_t vk_findmemorytype(uint32_t typefilter,
+	VkMemoryPropertyFlags properties);
+void vk_createbuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties, VkBuffer *buffer,
+	VkDeviceMemory *memory);
+uint32_t vk_registerimage(VkImageView view);
+uint32_t vk_registerbuffer(VkBuffer buffer, VkDeviceSize offset,
+	VkDeviceSize range);
+void vk_unregisterimage(uint32_t handle);
+void vk_unregisterbuffer(uint32_t handle);
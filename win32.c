@@ -1,6 +1,7 @@
 #include <windows.h>
 
 #include "config.h"
+#include "trace.h"
 #include "util.h"
 #include "vulkan.h"
 #include "win32.h"
@@ -8,29 +9,78 @@
 static const char classname[] = "Main Window";
 
 HWND hwnd;
+HWND viewhwnds[MAXWINDOWS - 1];
+uint32_t viewcount;
+/* Wakes the main loop from an on demand idle */
+HANDLE wakeevent;
 int quitting;
 int minimised;
 
+/* 0 for the main window, views count from 1 */
+static uint32_t
+windowindex(HWND window)
+{
+    uint32_t i;
+
+    for (i = 0; i < viewcount; i++)
+	if (viewhwnds[i] == window)
+	    return i + 1;
+
+    return 0;
+}
+
 static LRESULT CALLBACK
 WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
+    uint32_t window = windowindex(hwnd);
+
     switch (uMsg) {
+    case WM_CLOSE:
+	/* A view goes on its own, its swap chain first */
+	if (window > 0) {
+	    vk_closewindow(window);
+	    DestroyWindow(hwnd);
+	    return 0;
+	}
+	break;
     case WM_DESTROY:
+	if (window > 0) {
+	    viewhwnds[window - 1] = NULL;
+	    return 0;
+	}
 	/* Request to quit */
 	quitting = 1;
 	PostQuitMessage(0);
 	return 0;
+    case WM_PAINT:
+	/* Drawn with Vulkan, so only the image needs presenting again */
+	ValidateRect(hwnd, NULL);
+	vk_onexpose(window);
+	return 0;
     case WM_SIZE:
+	/* A minimised view is skipped until it has an area again */
+	if (window > 0) {
+	    vk_onresize(window);
+	    return 0;
+	}
 	switch(wParam) {
 	case SIZE_MINIMIZED:
 	    minimised = 1;
 	    break;
 	default:
 	    minimised = 0;
-	    vk_onresize();
+	    vk_onresize(0);
 	    break;
 	}
 	return 0;
+    case WM_KEYDOWN:
+	/* Dump the trace so far on demand */
+	if (wParam == VK_F9)
+	    TRACE_DUMP(tracefile);
+	/* Switch pipeline variant */
+	else if (wParam == VK_F2)
+	    vk_cyclecolourmode();
+	return 0;
     }
 
     /* If we don't handle the message, use the default handler */
@@ -52,6 +102,7 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShow
     MSG msg;
     BOOL bRet;
     int running;
+    uint32_t i;
     WNDCLASS wc = {
 	.style         = 0,
 	.lpfnWndProc   = WindowProc,
@@ -65,17 +116,31 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShow
 	.lpszClassName = classname
     };
 
+    TRACE_THREAD("main");
+    if ((wakeevent = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL)
+	terminate("Failed to create wake event.\n");
     RegisterClass(&wc);
     hwnd = CreateWindowEx(0, classname, appname, WS_OVERLAPPEDWINDOW,
 	    CW_USEDEFAULT, CW_USEDEFAULT, appwidth, appheight, NULL, NULL,
 	    hInstance, NULL);
     if (hwnd == NULL)
 	terminate("Failed to create window.\n");
+    /* Owned by the main window, so they stay above it and minimise with it */
+    for (i = 0; i < viewwindows && i < MAXWINDOWS - 1; i++) {
+	viewhwnds[i] = CreateWindowEx(0, classname, appname,
+		WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT,
+		appwidth / 2, appheight / 2, hwnd, NULL, hInstance, NULL);
+	if (viewhwnds[i] == NULL)
+	    terminate("Failed to create view window.\n");
+	viewcount++;
+    }
 
     vk_initialise();
 
     minimised = (nShowCmd == SW_SHOWMINIMIZED);
     ShowWindow(hwnd, nShowCmd);
+    for (i = 0; i < viewcount; i++)
+	ShowWindow(viewhwnds[i], SW_SHOWNOACTIVATE);
 
     /* Main loop */
     quitting = 0;
@@ -102,16 +167,30 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShow
 	    /* WM_QUIT may have already been processed */
 	    if (msg.message == WM_QUIT)
 		running = 0;
+	/* Nothing has changed, sleep until a message or another thread wakes
+	 * us, counting messages already peeked at. WM_QUIT is left for the
+	 * loop above. */
+	} else if (vk_idle()) {
+	    MsgWaitForMultipleObjectsEx(1, &wakeevent, INFINITE, QS_ALLINPUT,
+		    MWMO_INPUTAVAILABLE);
+	    while (!quitting && PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+		onmessage(&msg);
 	} else {
-	    vk_drawframe();
+	    /* Input read after the wait is as fresh as it can be */
+	    vk_waitframe();
 
 	    /* PeekMessage doesn't block */
 	    if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
 		onmessage(&msg);
+
+	    if (!quitting && !minimised)
+		vk_drawframe();
 	}
     } while (running);
 
     vk_terminate();
+    TRACE_DUMP(tracefile);
+    CloseHandle(wakeevent);
 
     /* Return nExitCode value from PostQuitMessage() */
     return msg.wParam;
@@ -1,3 +1,7 @@
 #include <windows.h>
 
 extern HWND hwnd;
+extern HWND viewhwnds[];
+extern uint32_t viewcount;
+extern HANDLE wakeevent;
+